@@ -0,0 +1,927 @@
+/*
+###############################################################################
+#
+#  EGSnrc tetrahedral mesh geometry
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+#
+#  Author:          Max Orok, 2020
+#
+###############################################################################
+*/
+
+#ifndef EGS_MESH_
+#define EGS_MESH_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mesh_bvh.h"
+#include "mesh_io.h"
+#include "mesh_kernels.h"
+#include "mesh_neighbours.h"
+#include "mesh_order.h"
+#include "mesh_tags.h"
+
+namespace mesh_snapshot { namespace internal { class MeshAccess; } }
+namespace mesh_validation { struct Report; }
+
+class EGS_Mesh /* : public EGS_BaseGeometry */ {
+public:
+    /// A single tetrahedral mesh element
+    struct Tetrahedron {
+        Tetrahedron(int medium_tag, int a, int b, int c, int d) :
+            medium_tag(medium_tag), a(a), b(b), c(c), d(d) {}
+        Tetrahedron(int tag, int medium_tag, int a, int b, int c, int d) :
+            tag(tag), medium_tag(medium_tag), a(a), b(b), c(c), d(d) {}
+        // Gmsh element tag, -1 if unknown
+        int tag = -1;
+        int medium_tag = -1;
+        // nodes
+        int a = -1;
+        int b = -1;
+        int c = -1;
+        int d = -1;
+    };
+
+    /// A single 3D point
+    struct Node {
+        Node(int tag, double x, double y, double z) :
+            tag(tag), x(x), y(y), z(z) {}
+        int tag = -1;
+        double x = 0.0;
+        double y = 0.0;
+        double z = 0.0;
+    };
+
+    /// A physical medium
+    struct Medium {
+        Medium(int tag, std::string medium_name) :
+            tag(tag), medium_name(medium_name) {}
+        int tag = -1;
+        std::string medium_name;
+    };
+
+    /// A 3D point or direction
+    struct Vec3 {
+        Vec3() = default;
+        Vec3(double x, double y, double z) : x(x), y(y), z(z) {}
+        double x = 0.0;
+        double y = 0.0;
+        double z = 0.0;
+    };
+
+    /// Where a ray leaves a tetrahedron, see howfar.
+    struct Exit {
+        /// Distance along the ray to the exit face, infinity if there is none.
+        double distance = std::numeric_limits<double>::infinity();
+        /// The face the ray leaves through, or -1 if there is none.
+        int face = -1;
+        /// The element across the exit face, or -1 if the ray leaves the mesh.
+        int next = -1;
+    };
+
+    /// Where a ray from outside the mesh enters it, see entry_distance.
+    struct Entry {
+        /// Distance along the ray to the mesh boundary, infinity if the ray misses the mesh.
+        double distance = std::numeric_limits<double>::infinity();
+        /// The element the ray enters, or -1 if it misses the mesh.
+        int tet = -1;
+        /// The boundary face of `tet` the ray enters through, or -1.
+        int face = -1;
+    };
+
+    /// Counters for locate_from, accumulated over calls.
+    struct LocateStats {
+        /// Number of calls
+        std::size_t walks = 0;
+        /// Total number of elements stepped across, including walks that fell back
+        std::size_t steps = 0;
+        /// Number of calls that fell back to isWhere
+        std::size_t fallbacks = 0;
+
+        double average_steps() const {
+            return walks == 0 ? 0.0 : static_cast<double>(steps) / walks;
+        }
+    };
+
+    /// Element orderings, see Options::reorder.
+    enum class Reorder {
+        /// Keep the input order
+        None,
+        /// Sort elements along the Morton (Z-order) curve of their centroids
+        Morton,
+        /// Sort elements along the Hilbert curve of their centroids
+        Hilbert
+    };
+
+    /// Mesh construction options.
+    struct Options {
+        /// Renumber elements along a space-filling curve, and nodes in order
+        /// of first use by the renumbered elements. Elements that are close
+        /// in space are then close in memory, so walking through the mesh
+        /// misses the cache less often. See original_index to map results
+        /// back to the input order.
+        Reorder reorder = Reorder::None;
+        /// Find element neighbours, and the boundary faces, on first use
+        /// rather than at construction, so that tools that only look at
+        /// nodes, elements or media don't pay for them. The first call to
+        /// neighbours, howfar, locate_from or the boundary face methods
+        /// then builds them, once, even if called from several threads.
+        bool lazy_neighbours = false;
+        /// Check the mesh with mesh_validation::validate once it is built,
+        /// and throw on errors such as degenerate elements, whose face
+        /// planes would make transport silently wrong. Warnings are kept in
+        /// validation(). Non-manifold faces aren't checked with
+        /// lazy_neighbours, since that would find the neighbours.
+        bool validate = true;
+    };
+
+    /// Build a mesh from its elements, nodes and media.
+    ///
+    /// The element node tags and medium tags are resolved into indices and
+    /// the geometry arrays used by the transport routines are built, see
+    /// element_nodes, element_vertices, element_planes, medium_index and
+    /// neighbours. Neighbours are found in parallel unless
+    /// Options::lazy_neighbours is set, and the mesh is then validated unless
+    /// Options::validate is unset.
+    ///
+    /// Throws a std::runtime_error if an element has an unknown node or
+    /// medium tag, or a repeated node, if node, element or medium tags are
+    /// repeated, or if validation finds errors.
+    EGS_Mesh(std::vector<EGS_Mesh::Tetrahedron> elements,
+        std::vector<EGS_Mesh::Node> nodes, std::vector<EGS_Mesh::Medium> materials) :
+        EGS_Mesh(std::move(elements), std::move(nodes), std::move(materials), Options()) {}
+
+    /// Build a mesh with non-default options.
+    EGS_Mesh(std::vector<EGS_Mesh::Tetrahedron> elements,
+        std::vector<EGS_Mesh::Node> nodes, std::vector<EGS_Mesh::Medium> materials,
+        const Options& options) :
+        /* EGS_BaseGeometry("EGS_Mesh"), */ _materials(std::move(materials)), _options(options)
+    {
+        build_geometry(std::move(elements), std::move(nodes));
+        if (_options.validate) {
+            validate_built();
+        }
+    }
+
+    const mesh_io::SharedArray<EGS_Mesh::Tetrahedron>& elements() const {
+        return _elements;
+    }
+    const mesh_io::SharedArray<EGS_Mesh::Node>& nodes() const {
+        return _nodes;
+    }
+    const std::vector<EGS_Mesh::Medium>& materials() const {
+        return _materials;
+    }
+
+    /// The options the mesh was built with.
+    const Options& options() const {
+        return _options;
+    }
+
+    /// The report of the validation of the mesh when it was built, with any
+    /// warnings, or null if it was built without Options::validate.
+    const mesh_validation::Report* validation() const {
+        return _validation.get();
+    }
+
+    /// The number of tetrahedrons. Element indices run from 0 to
+    /// num_elements() - 1 in the order of elements().
+    int num_elements() const {
+        return static_cast<int>(_elements.size());
+    }
+
+    /// The position of element `i` in the element list the mesh was built
+    /// from, which is the msh file order for parsed meshes. This is `i`
+    /// unless the mesh was reordered, see Options::reorder.
+    int original_index(int i) const {
+        return _original_index.empty() ? i : _original_index[i];
+    }
+
+    /// Returns per-element `values` in mesh order rearranged into the
+    /// original element order, e.g. to report results by Gmsh element.
+    ///
+    /// Throws a std::invalid_argument exception if there isn't one value per element.
+    template <typename T>
+    std::vector<T> to_original_order(const std::vector<T>& values) const {
+        if (values.size() != _elements.size()) {
+            throw std::invalid_argument("expected " + std::to_string(_elements.size()) +
+                " values, got " + std::to_string(values.size()));
+        }
+        if (_original_index.empty()) {
+            return values;
+        }
+        std::vector<T> original(values.size());
+        for (std::size_t i = 0; i < values.size(); i++) {
+            original[_original_index[i]] = values[i];
+        }
+        return original;
+    }
+
+    /// A mesh with the elements, media and neighbours of this one and the
+    /// node coordinates of `nodes`, e.g. the next phase of a moving
+    /// phantom. `nodes` must have the tags of nodes(), in any order.
+    ///
+    /// Everything that only depends on the connectivity is shared with this
+    /// mesh instead of being rebuilt: the element and tag tables, the
+    /// element order of a reordered mesh, and the neighbours, which are
+    /// found first if this mesh was built with Options::lazy_neighbours.
+    /// The element and boundary hierarchies keep the trees of this mesh with
+    /// refitted bounds, which stay efficient while the nodes move by less
+    /// than about an element size. The elements are validated again with
+    /// the new coordinates, see Options::validate.
+    ///
+    /// Throws a std::runtime_error if the number of nodes differs, a node
+    /// tag isn't one of nodes() or is repeated, or if validation finds
+    /// errors.
+    EGS_Mesh with_nodes(const std::vector<EGS_Mesh::Node>& nodes) const {
+        if (nodes.size() != _nodes.size()) {
+            throw std::runtime_error("expected " + std::to_string(_nodes.size()) + " nodes, got " +
+                std::to_string(nodes.size()));
+        }
+        // in the node order of this mesh, which differs from the input
+        // order if the mesh was reordered
+        std::vector<EGS_Mesh::Node> mesh_nodes(nodes.size(), EGS_Mesh::Node(-1, 0.0, 0.0, 0.0));
+        for (const auto& node: nodes) {
+            const int n = _node_index.find(node.tag);
+            if (n == -1) {
+                throw std::runtime_error("node tag " + std::to_string(node.tag) + " is not a node of the mesh");
+            }
+            if (mesh_nodes[n].tag != -1) {
+                throw std::runtime_error("node tag " + std::to_string(node.tag) + " is repeated");
+            }
+            mesh_nodes[n] = node;
+        }
+        const Topology& topo = topology();
+        EGS_Mesh mesh(*this);
+        mesh.build_coordinates(mesh_nodes, &_bvh);
+        mesh._nodes = std::move(mesh_nodes);
+        mesh._topology = std::make_shared<Topology>();
+        mesh._topology->neighbours = topo.neighbours;
+        mesh._topology->non_manifold_faces = topo.non_manifold_faces;
+        mesh.build_boundary(*mesh._topology, &topo.boundary_bvh);
+        mesh._topology->built = true;
+        mesh._validation.reset();
+        if (mesh._options.validate) {
+            mesh.validate_built();
+        }
+        return mesh;
+    }
+
+    /// The index in nodes() of the node with tag `tag`, or -1 if there is none.
+    int node_index(int tag) const {
+        return _node_index.find(tag);
+    }
+
+    /// The index of the element with Gmsh tag `tag`, or -1 if there is none.
+    int element_index(int tag) const {
+        return _element_index.find(tag);
+    }
+
+    /// The index in materials() of the medium with tag `medium_tag`, or -1
+    /// if there is none.
+    int material_index(int medium_tag) const {
+        return _material_index.find(medium_tag);
+    }
+
+    /// The indices in nodes() of the vertices of element `i`, in the order
+    /// of element_vertices(i).
+    const std::array<int, 4>& element_nodes(int i) const {
+        return _connectivity[i];
+    }
+
+    /// The vertex coordinates of element `i` as 12 contiguous doubles: x, y
+    /// and z of vertex 0, then vertex 1, 2 and 3.
+    ///
+    /// Vertices are ordered by node index, so vertex f is the vertex opposite
+    /// the face shared with neighbours(i)[f].
+    const double* element_vertices(int i) const {
+        return &_vertices[VERTEX_STRIDE * static_cast<std::size_t>(i)];
+    }
+
+    /// The index of the medium of element `i` in materials().
+    int medium_index(int i) const {
+        return _media[i];
+    }
+
+    /// The indices of the elements across each face of element `i`, or -1 for
+    /// boundary faces. Face f is opposite vertex f of element_vertices(i).
+    const std::array<int, 4>& neighbours(int i) const {
+        return topology().neighbours[i];
+    }
+
+    /// The neighbours of every element, see neighbours(i).
+    const mesh_io::SharedArray<std::array<int, 4>>& neighbour_table() const {
+        return topology().neighbours;
+    }
+
+    /// Whether the neighbours have been found yet, which is always the case
+    /// unless the mesh was built with Options::lazy_neighbours.
+    bool neighbours_built() const {
+        return _topology->built.load(std::memory_order_acquire);
+    }
+
+    /// The faces that are shared by more than two elements, as (element,
+    /// face) pairs sorted by element. Such a face is only paired between the
+    /// first two elements that have it, so these later copies have no
+    /// neighbour and the mesh isn't a valid volume unless this is empty, see
+    /// mesh_validation::validate.
+    const mesh_io::SharedArray<std::array<int, 2>>& non_manifold_faces() const {
+        return topology().non_manifold_faces;
+    }
+
+    /// The outward unit normals and offsets of the faces of element `i` as 16
+    /// contiguous doubles: the x components of the four face normals, then
+    /// the y components, the z components and the offsets. A point p is on
+    /// the inner side of face f if n_f . p <= d_f.
+    const double* element_planes(int i) const {
+        return &_planes[PLANE_STRIDE * static_cast<std::size_t>(i)];
+    }
+
+    /// Returns true if `point` is inside or on the boundary of element `tet`.
+    bool isInside(int tet, const Vec3& point) const {
+        return _kernels->is_inside(element_planes(tet), point.x, point.y, point.z);
+    }
+
+    /// Returns the distance from `point` inside element `tet` to the nearest
+    /// face plane of the element, a lower bound of the distance to the element
+    /// boundary. Negative for points outside the element.
+    double hownear(int tet, const Vec3& point) const {
+        return _kernels->hownear(element_planes(tet), point.x, point.y, point.z);
+    }
+
+    /// Returns the index of an element containing `point`, or -1 if the point
+    /// is outside the mesh. A point on a face shared by two elements may be
+    /// reported in either of them.
+    ///
+    /// Points within round-off of the element faces (see location_tolerance)
+    /// are reported in the element they are closest to being inside, so mesh
+    /// nodes and points on faces are always found.
+    ///
+    /// Candidate elements are found with a bounding volume hierarchy built at
+    /// construction, see element_bvh.
+    int isWhere(const Vec3& point) const {
+        int found = -1;
+        double best = -_location_tolerance;
+        _bvh.visit_point(point.x, point.y, point.z, [&](std::uint32_t tet) {
+            const double near = hownear(static_cast<int>(tet), point);
+            if (near >= best) {
+                best = near;
+                found = static_cast<int>(tet);
+            }
+            return near >= 0.0;
+        });
+        return found;
+    }
+
+    /// Returns the index of an element containing `point`, like isWhere,
+    /// starting the search from element `hint`.
+    ///
+    /// This is a visibility walk: while the point is outside the current
+    /// element, step to the neighbour across the face the point is furthest
+    /// outside of, other than the face just crossed. Nearby points are found
+    /// in a few steps, much faster than a global search. If the walk reaches
+    /// the mesh boundary, can only step back, or takes more than
+    /// MAX_WALK_STEPS steps, or if `hint` is not a valid element, it falls
+    /// back to isWhere.
+    ///
+    /// If `stats` isn't null, the walk is counted in it.
+    int locate_from(int hint, const Vec3& point, LocateStats* stats = nullptr) const {
+        if (stats) {
+            stats->walks++;
+        }
+        int step = 0;
+        if (hint >= 0 && hint < num_elements()) {
+            const auto& neighbours = topology().neighbours;
+            int current = hint;
+            int previous = -1;
+            for (; step <= MAX_WALK_STEPS; step++) {
+                const double* p = element_planes(current);
+                // the face back to the previous element is only taken if no
+                // other face is violated, which is a round-off cycle
+                int worst_face = -1;
+                double worst_gap = 0.0;
+                bool back_violated = false;
+                for (int f = 0; f < 4; f++) {
+                    const double gap = p[12 + f] - (p[f] * point.x + p[4 + f] * point.y + p[8 + f] * point.z);
+                    if (gap >= 0.0) {
+                        continue;
+                    }
+                    if (neighbours[current][f] == previous) {
+                        back_violated = true;
+                    } else if (gap < worst_gap) {
+                        worst_gap = gap;
+                        worst_face = f;
+                    }
+                }
+                if (worst_face == -1 && !back_violated) {
+                    if (stats) {
+                        stats->steps += step;
+                    }
+                    return current;
+                }
+                const int next = worst_face == -1 ? -1 : neighbours[current][worst_face];
+                if (next == -1) {
+                    break;
+                }
+                previous = current;
+                current = next;
+            }
+        }
+        if (stats) {
+            stats->steps += step;
+            stats->fallbacks++;
+        }
+        return isWhere(point);
+    }
+
+    /// The most elements locate_from steps across before falling back to isWhere.
+    static const int MAX_WALK_STEPS = 128;
+
+    /// How far outside the element faces isWhere accepts a point, to allow
+    /// for round-off in the face planes. This is a small multiple of the
+    /// machine epsilon times the largest coordinate magnitude of the mesh.
+    double location_tolerance() const {
+        return _location_tolerance;
+    }
+
+    /// The bounding volume hierarchy over the element bounding boxes, with
+    /// element indices as primitives.
+    const mesh_bvh::BVH& element_bvh() const {
+        return _bvh;
+    }
+
+    /// Find where a ray starting at `pos` inside element `tet` with unit
+    /// direction `dir` leaves the element.
+    ///
+    /// Only faces the ray is heading towards are considered. If `pos` is
+    /// slightly outside a face it is heading through, due to round-off from
+    /// the previous step, the distance is 0.
+    Exit howfar(int tet, const Vec3& pos, const Vec3& dir) const {
+        const double p[3] = {pos.x, pos.y, pos.z};
+        const double d[3] = {dir.x, dir.y, dir.z};
+        Exit exit;
+        exit.face = _kernels->ray_exit(element_planes(tet), p, d, exit.distance);
+        if (exit.face != -1) {
+            exit.next = topology().neighbours[tet][exit.face];
+        }
+        return exit;
+    }
+
+    /// Find where a ray starting at `pos` outside the mesh with direction
+    /// `dir` enters the mesh.
+    ///
+    /// Only boundary faces the ray crosses from outside to inside are
+    /// considered, so for a point inside the mesh the result is where the ray
+    /// re-enters the mesh after leaving it, if it does. Candidate faces are
+    /// found with a bounding volume hierarchy over the boundary faces.
+    Entry entry_distance(const Vec3& pos, const Vec3& dir) const {
+        const double p[3] = {pos.x, pos.y, pos.z};
+        const double d[3] = {dir.x, dir.y, dir.z};
+        Entry entry;
+        const Topology& topo = topology();
+        topo.boundary_bvh.visit_ray(p, d, std::numeric_limits<double>::infinity(),
+            [&](std::uint32_t face, double t_max) {
+                const double t = boundary_face_hit(topo.boundary_faces[face], p, d);
+                if (t < t_max) {
+                    entry.distance = t;
+                    entry.tet = topo.boundary_faces[face].tet;
+                    entry.face = topo.boundary_faces[face].face;
+                }
+                return t;
+            });
+        return entry;
+    }
+
+    /// The number of boundary faces, the faces without a neighbour.
+    std::size_t num_boundary_faces() const {
+        return topology().boundary_faces.size();
+    }
+
+    /// Returns the distance along the ray pos + t * dir at which it enters
+    /// the mesh through boundary face `i` (0 <= i < num_boundary_faces()),
+    /// or infinity if it doesn't. Used by entry_distance.
+    double boundary_face_entry(std::size_t i, const Vec3& pos, const Vec3& dir) const {
+        const double p[3] = {pos.x, pos.y, pos.z};
+        const double d[3] = {dir.x, dir.y, dir.z};
+        return boundary_face_hit(topology().boundary_faces[i], p, d);
+    }
+
+    /// The bounding volume hierarchy over the boundary face bounding boxes.
+    const mesh_bvh::BVH& boundary_bvh() const {
+        return topology().boundary_bvh;
+    }
+
+    /// The kernels used by isInside, hownear and howfar. Defaults to
+    /// mesh_kernels::best_kernels(), the fastest kernels the CPU supports.
+    const mesh_kernels::Kernels& kernels() const {
+        return *_kernels;
+    }
+    /// Use a different set of kernels, e.g. to compare them. All kernels
+    /// give identical results.
+    void set_kernels(const mesh_kernels::Kernels& kernels) {
+        _kernels = &kernels;
+    }
+
+private:
+    // snapshots read and write the arrays directly
+    friend class mesh_snapshot::internal::MeshAccess;
+    EGS_Mesh() = default;
+
+    // Validate the built mesh, keeping the report and throwing on errors.
+    // Defined in mesh_validation.h, which needs the complete class.
+    void validate_built();
+
+    // Number of doubles per element in _vertices
+    static const std::size_t VERTEX_STRIDE = 12;
+    // Number of doubles per element in _planes
+    static const std::size_t PLANE_STRIDE = 16;
+
+    // Resolve element tags into indices and fill the geometry arrays.
+    void build_geometry(std::vector<EGS_Mesh::Tetrahedron> elements, std::vector<EGS_Mesh::Node> nodes) {
+        if (elements.size() >= static_cast<std::size_t>(std::numeric_limits<int>::max()) ||
+            nodes.size() >= static_cast<std::size_t>(std::numeric_limits<int>::max()))
+        {
+            throw std::runtime_error("mesh has too many elements or nodes");
+        }
+        _node_index = mesh_tags::TagIndex::build(nodes.data(), nodes.size(), "node");
+        _material_index = mesh_tags::TagIndex::build(_materials.data(), _materials.size(), "medium");
+
+        // element node indices, in the input node order
+        std::vector<std::array<std::uint32_t, 4>> connectivity(elements.size());
+        std::vector<int> media;
+        media.reserve(elements.size());
+        for (std::size_t i = 0; i < elements.size(); i++) {
+            const auto& elt = elements[i];
+            const int medium = _material_index.find(elt.medium_tag);
+            if (medium == -1) {
+                throw std::runtime_error("element " + std::to_string(i) +
+                    " has unknown medium tag " + std::to_string(elt.medium_tag));
+            }
+            media.push_back(medium);
+            auto& idx = connectivity[i];
+            const int tags[4] = {elt.a, elt.b, elt.c, elt.d};
+            for (int n = 0; n < 4; n++) {
+                const int node = _node_index.find(tags[n]);
+                if (node == -1) {
+                    throw std::runtime_error("element " + std::to_string(i) +
+                        " has unknown node tag " + std::to_string(tags[n]));
+                }
+                idx[n] = static_cast<std::uint32_t>(node);
+            }
+            if (idx[0] == idx[1] || idx[0] == idx[2] || idx[0] == idx[3] ||
+                idx[1] == idx[2] || idx[1] == idx[3] || idx[2] == idx[3])
+            {
+                throw std::runtime_error("element " + std::to_string(i) + " has a repeated node");
+            }
+        }
+
+        if (_options.reorder != Reorder::None) {
+            reorder(elements, nodes, media, connectivity);
+            _node_index = mesh_tags::TagIndex::build(nodes.data(), nodes.size(), "node");
+        }
+        _element_index = mesh_tags::TagIndex::build(elements.data(), elements.size(), "element");
+
+        std::vector<mesh_neighbours::CompactTetrahedron> tets;
+        tets.reserve(connectivity.size());
+        for (const auto& idx: connectivity) {
+            tets.emplace_back(mesh_neighbours::CompactTetrahedron(idx[0], idx[1], idx[2], idx[3]));
+        }
+        std::vector<std::array<std::uint32_t, 4>>().swap(connectivity);
+        // node indices in vertex order, which is sorted
+        std::vector<std::array<int, 4>> element_nodes(tets.size());
+        for (std::size_t i = 0; i < tets.size(); i++) {
+            const auto idx = tets[i].nodes();
+            for (int n = 0; n < 4; n++) {
+                element_nodes[i][n] = static_cast<int>(idx[n]);
+            }
+        }
+        // free the scratch array before the neighbour search
+        std::vector<mesh_neighbours::CompactTetrahedron>().swap(tets);
+
+        _elements = std::move(elements);
+        _media = std::move(media);
+        _connectivity = std::move(element_nodes);
+        build_coordinates(nodes, nullptr);
+        _nodes = std::move(nodes);
+        _topology = std::make_shared<Topology>();
+        if (!_options.lazy_neighbours) {
+            topology();
+        }
+    }
+
+    // Fill the vertex and plane arrays, the element hierarchy and the
+    // location tolerance from the node coordinates and _connectivity. The
+    // hierarchy is built, or refitted from `tree` if given.
+    void build_coordinates(const std::vector<EGS_Mesh::Node>& nodes, const mesh_bvh::BVH* tree) {
+        const std::size_t num_elts = _connectivity.size();
+        std::vector<double> vertices(VERTEX_STRIDE * num_elts);
+        for (std::size_t i = 0; i < num_elts; i++) {
+            double* v = &vertices[VERTEX_STRIDE * i];
+            for (int n: _connectivity[i]) {
+                *v++ = nodes[n].x;
+                *v++ = nodes[n].y;
+                *v++ = nodes[n].z;
+            }
+        }
+
+        std::vector<double> planes(PLANE_STRIDE * num_elts);
+        for (std::size_t i = 0; i < num_elts; i++) {
+            compute_planes(&vertices[VERTEX_STRIDE * i], &planes[PLANE_STRIDE * i]);
+        }
+
+        std::vector<mesh_bvh::Box> boxes(num_elts);
+        for (std::size_t i = 0; i < num_elts; i++) {
+            for (int n = 0; n < 4; n++) {
+                boxes[i].expand(&vertices[VERTEX_STRIDE * i + 3 * n]);
+            }
+        }
+        _bvh = tree ? tree->refitted(boxes) : mesh_bvh::BVH(boxes);
+        double max_coordinate = 0.0;
+        for (double x: vertices) {
+            max_coordinate = std::max(max_coordinate, std::abs(x));
+        }
+        _location_tolerance = 64 * std::numeric_limits<double>::epsilon() * max_coordinate;
+        _vertices = std::move(vertices);
+        _planes = std::move(planes);
+    }
+
+    // Sort the elements along the space-filling curve of their centroids,
+    // then renumber the nodes in order of first use. Nodes no element uses
+    // go last, in their input order.
+    void reorder(std::vector<EGS_Mesh::Tetrahedron>& elements, std::vector<EGS_Mesh::Node>& nodes,
+        std::vector<int>& media, std::vector<std::array<std::uint32_t, 4>>& connectivity)
+    {
+        std::vector<std::array<double, 3>> centroids(connectivity.size());
+        for (std::size_t i = 0; i < connectivity.size(); i++) {
+            std::array<double, 3> c = {{0.0, 0.0, 0.0}};
+            for (auto n: connectivity[i]) {
+                c[0] += 0.25 * nodes[n].x;
+                c[1] += 0.25 * nodes[n].y;
+                c[2] += 0.25 * nodes[n].z;
+            }
+            centroids[i] = c;
+        }
+        const auto elt_order = mesh_order::curve_order(centroids,
+            _options.reorder == Reorder::Morton ? mesh_order::Curve::Morton : mesh_order::Curve::Hilbert);
+        std::vector<std::array<double, 3>>().swap(centroids);
+
+        std::vector<EGS_Mesh::Tetrahedron> sorted_elements;
+        std::vector<std::array<std::uint32_t, 4>> sorted_connectivity;
+        std::vector<int> sorted_media;
+        std::vector<int> original_index;
+        sorted_elements.reserve(elements.size());
+        sorted_connectivity.reserve(elements.size());
+        sorted_media.reserve(elements.size());
+        original_index.reserve(elements.size());
+        for (std::size_t old_index: elt_order) {
+            sorted_elements.push_back(elements[old_index]);
+            sorted_connectivity.push_back(connectivity[old_index]);
+            sorted_media.push_back(media[old_index]);
+            original_index.push_back(static_cast<int>(old_index));
+        }
+        elements.swap(sorted_elements);
+        connectivity.swap(sorted_connectivity);
+        media.swap(sorted_media);
+        _original_index = std::move(original_index);
+
+        const std::uint32_t UNUSED = mesh_neighbours::COMPACT_NONE;
+        std::vector<std::uint32_t> new_node_index(nodes.size(), UNUSED);
+        std::vector<EGS_Mesh::Node> sorted_nodes;
+        sorted_nodes.reserve(nodes.size());
+        for (auto& idx: connectivity) {
+            for (auto& n: idx) {
+                if (new_node_index[n] == UNUSED) {
+                    new_node_index[n] = static_cast<std::uint32_t>(sorted_nodes.size());
+                    sorted_nodes.push_back(nodes[n]);
+                }
+                n = new_node_index[n];
+            }
+        }
+        for (std::size_t n = 0; n < nodes.size(); n++) {
+            if (new_node_index[n] == UNUSED) {
+                sorted_nodes.push_back(nodes[n]);
+            }
+        }
+        nodes.swap(sorted_nodes);
+    }
+
+    // A boundary face stored for Moller-Trumbore ray intersection: one vertex,
+    // the two edges from it, and the outward normal of the owning element.
+    struct BoundaryFace {
+        double origin[3];
+        double edge1[3];
+        double edge2[3];
+        double normal[3];
+        int tet;
+        int face;
+    };
+
+    // Distance along the ray p + t * d to where it enters through `face`, or
+    // infinity if it misses the face or crosses it from inside.
+    static double boundary_face_hit(const BoundaryFace& face, const double* p, const double* d) {
+        const double inf = std::numeric_limits<double>::infinity();
+        if (face.normal[0] * d[0] + face.normal[1] * d[1] + face.normal[2] * d[2] >= 0.0) {
+            return inf;
+        }
+        const double* e1 = face.edge1;
+        const double* e2 = face.edge2;
+        const double pvec[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2],
+            d[0] * e2[1] - d[1] * e2[0] };
+        const double det = e1[0] * pvec[0] + e1[1] * pvec[1] + e1[2] * pvec[2];
+        if (det == 0.0) {
+            return inf;
+        }
+        const double inv_det = 1.0 / det;
+        const double tvec[3] = { p[0] - face.origin[0], p[1] - face.origin[1], p[2] - face.origin[2] };
+        const double u = (tvec[0] * pvec[0] + tvec[1] * pvec[1] + tvec[2] * pvec[2]) * inv_det;
+        if (u < 0.0 || u > 1.0) {
+            return inf;
+        }
+        const double qvec[3] = { tvec[1] * e1[2] - tvec[2] * e1[1], tvec[2] * e1[0] - tvec[0] * e1[2],
+            tvec[0] * e1[1] - tvec[1] * e1[0] };
+        const double v = (d[0] * qvec[0] + d[1] * qvec[1] + d[2] * qvec[2]) * inv_det;
+        if (v < 0.0 || u + v > 1.0) {
+            return inf;
+        }
+        const double t = (e2[0] * qvec[0] + e2[1] * qvec[1] + e2[2] * qvec[2]) * inv_det;
+        return t >= 0.0 ? t : inf;
+    }
+
+    // The neighbour table and the boundary faces found from it, built at
+    // construction or on first use, see Options::lazy_neighbours. Held by
+    // pointer since std::once_flag can't be copied or moved, and shared by
+    // copies of the mesh like the arrays.
+    struct Topology {
+        std::once_flag once;
+        // set after the arrays are built, so built meshes skip call_once
+        std::atomic<bool> built{false};
+        mesh_io::SharedArray<std::array<int, 4>> neighbours;
+        // (element, face) of faces shared by more than two elements
+        mesh_io::SharedArray<std::array<int, 2>> non_manifold_faces;
+        mesh_io::SharedArray<BoundaryFace> boundary_faces;
+        mesh_bvh::BVH boundary_bvh;
+    };
+
+    // The topology, built by the first caller if it isn't yet.
+    const Topology& topology() const {
+        Topology& topo = *_topology;
+        if (!topo.built.load(std::memory_order_acquire)) {
+            std::call_once(topo.once, [&]() {
+                build_topology(topo);
+                topo.built.store(true, std::memory_order_release);
+            });
+        }
+        return topo;
+    }
+
+    // Find the neighbours from the connectivity, in parallel.
+    void build_topology(Topology& topo) const {
+        std::vector<mesh_neighbours::CompactTetrahedron> tets;
+        tets.reserve(_connectivity.size());
+        for (const auto& idx: _connectivity) {
+            tets.emplace_back(mesh_neighbours::CompactTetrahedron(static_cast<std::uint32_t>(idx[0]),
+                static_cast<std::uint32_t>(idx[1]), static_cast<std::uint32_t>(idx[2]),
+                static_cast<std::uint32_t>(idx[3])));
+        }
+        std::vector<std::uint64_t> non_manifold_ids;
+        auto compact_neighbours = mesh_neighbours::tetrahedron_neighbours_parallel(tets, 0, &non_manifold_ids);
+        std::vector<mesh_neighbours::CompactTetrahedron>().swap(tets);
+        std::vector<std::array<int, 2>> non_manifold_faces;
+        for (std::uint64_t id: non_manifold_ids) {
+            non_manifold_faces.push_back({{static_cast<int>(id / 4), static_cast<int>(id % 4)}});
+        }
+        std::vector<std::array<int, 4>> neighbours(compact_neighbours.size());
+        for (std::size_t i = 0; i < compact_neighbours.size(); i++) {
+            for (std::size_t f = 0; f < 4; f++) {
+                const std::uint32_t n = compact_neighbours[i][f];
+                neighbours[i][f] = n == mesh_neighbours::COMPACT_NONE ? -1 : static_cast<int>(n);
+            }
+        }
+        topo.neighbours = std::move(neighbours);
+        topo.non_manifold_faces = std::move(non_manifold_faces);
+        build_boundary(topo);
+    }
+
+    // Collect the faces without a neighbour and build their hierarchy, or
+    // refit `tree` if given.
+    void build_boundary(Topology& topo, const mesh_bvh::BVH* tree = nullptr) const {
+        const auto& neighbours = topo.neighbours;
+        std::vector<BoundaryFace> boundary_faces;
+        std::vector<mesh_bvh::Box> boxes;
+        for (std::size_t i = 0; i < neighbours.size(); i++) {
+            for (int f = 0; f < 4; f++) {
+                if (neighbours[i][f] != -1) {
+                    continue;
+                }
+                const double* v = &_vertices[VERTEX_STRIDE * i];
+                const double* planes = &_planes[PLANE_STRIDE * i];
+                const double* a = v + 3 * ((f + 1) % 4);
+                const double* b = v + 3 * ((f + 2) % 4);
+                const double* c = v + 3 * ((f + 3) % 4);
+                BoundaryFace face;
+                for (int k = 0; k < 3; k++) {
+                    face.origin[k] = a[k];
+                    face.edge1[k] = b[k] - a[k];
+                    face.edge2[k] = c[k] - a[k];
+                    face.normal[k] = planes[4 * k + f];
+                }
+                face.tet = static_cast<int>(i);
+                face.face = f;
+                boundary_faces.push_back(face);
+                mesh_bvh::Box box;
+                box.expand(a);
+                box.expand(b);
+                box.expand(c);
+                boxes.push_back(box);
+            }
+        }
+        topo.boundary_faces = std::move(boundary_faces);
+        topo.boundary_bvh = tree ? tree->refitted(boxes) : mesh_bvh::BVH(boxes);
+    }
+
+    // Compute the face planes of a tetrahedron from its 12 vertex
+    // coordinates, see element_planes. Face f is opposite vertex f.
+    static void compute_planes(const double* v, double* planes) {
+        for (int f = 0; f < 4; f++) {
+            const double* a = v + 3 * ((f + 1) % 4);
+            const double* b = v + 3 * ((f + 2) % 4);
+            const double* c = v + 3 * ((f + 3) % 4);
+            const double* opposite = v + 3 * f;
+            const double ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+            const double ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+            double n[3] = {
+                ab[1] * ac[2] - ab[2] * ac[1],
+                ab[2] * ac[0] - ab[0] * ac[2],
+                ab[0] * ac[1] - ab[1] * ac[0]
+            };
+            const double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            // point the normal away from the opposite vertex
+            const double sign = (n[0] * (opposite[0] - a[0]) + n[1] * (opposite[1] - a[1]) +
+                n[2] * (opposite[2] - a[2])) > 0.0 ? -1.0 : 1.0;
+            for (int k = 0; k < 3; k++) {
+                n[k] *= sign / len;
+            }
+            planes[f] = n[0];
+            planes[4 + f] = n[1];
+            planes[8 + f] = n[2];
+            planes[12 + f] = n[0] * a[0] + n[1] * a[1] + n[2] * a[2];
+        }
+    }
+
+    // Arrays are shared with their owner, which is either a vector built at
+    // construction or a snapshot file, see mesh_snapshot.h.
+    mesh_io::SharedArray<EGS_Mesh::Tetrahedron> _elements;
+    mesh_io::SharedArray<EGS_Mesh::Node> _nodes;
+    std::vector<EGS_Mesh::Medium> _materials;
+    Options _options;
+    // input position of each element if the mesh was reordered, otherwise empty
+    mesh_io::SharedArray<int> _original_index;
+    // tag lookups, see node_index, element_index and material_index
+    mesh_tags::TagIndex _node_index;
+    mesh_tags::TagIndex _element_index;
+    mesh_tags::TagIndex _material_index;
+
+    // Geometry arrays indexed by element, see element_nodes,
+    // element_vertices, element_planes and medium_index.
+    mesh_io::SharedArray<std::array<int, 4>> _connectivity;
+    mesh_io::SharedArray<double> _vertices;
+    mesh_io::SharedArray<double> _planes;
+    mesh_io::SharedArray<int> _media;
+    mesh_bvh::BVH _bvh;
+    std::shared_ptr<Topology> _topology;
+    double _location_tolerance = 0.0;
+    const mesh_kernels::Kernels* _kernels = &mesh_kernels::best_kernels();
+    std::shared_ptr<const mesh_validation::Report> _validation;
+};
+
+// for EGS_Mesh::validate_built
+#include "mesh_validation.h"
+
+#endif // EGS_MESH_
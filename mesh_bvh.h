@@ -0,0 +1,446 @@
+/*
+###############################################################################
+#
+#  EGSnrc mesh bounding volume hierarchy
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+*/
+
+#ifndef MESH_BVH_
+#define MESH_BVH_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mesh_io.h"
+
+namespace mesh_bvh {
+
+/// An axis-aligned bounding box.
+struct Box {
+    double lo[3] = { std::numeric_limits<double>::infinity(),
+        std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() };
+    double hi[3] = { -std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity() };
+
+    /// Grow the box to contain the point `p`.
+    void expand(const double* p) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], p[k]);
+            hi[k] = std::max(hi[k], p[k]);
+        }
+    }
+    /// Grow the box to contain the box `b`.
+    void expand(const Box& b) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], b.lo[k]);
+            hi[k] = std::max(hi[k], b.hi[k]);
+        }
+    }
+    /// Half the surface area, or 0 for an empty box.
+    double half_area() const {
+        if (lo[0] > hi[0]) {
+            return 0.0;
+        }
+        const double dx = hi[0] - lo[0];
+        const double dy = hi[1] - lo[1];
+        const double dz = hi[2] - lo[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+};
+
+/// A bounding volume hierarchy over a list of primitives given by their
+/// bounding boxes.
+///
+/// The tree is built top-down with the binned surface area heuristic (SAH)
+/// and flattened in depth-first order into 32-byte nodes with single
+/// precision bounds. Bounds are rounded outwards, so a query never misses a
+/// primitive because of the conversion.
+class BVH {
+public:
+    /// Maximum number of primitives per leaf, unless the primitives can't be split.
+    static const unsigned MAX_LEAF_SIZE = 4;
+
+    BVH() = default;
+
+    /// Build a hierarchy over `boxes`. Primitive i is the one with bounding
+    /// box boxes[i].
+    ///
+    /// Throws a std::invalid_argument exception if there are 2^32 or more boxes.
+    explicit BVH(const std::vector<Box>& boxes) {
+        if (boxes.size() >= std::numeric_limits<std::uint32_t>::max()) {
+            throw std::invalid_argument("too many primitives for the bounding volume hierarchy");
+        }
+        if (boxes.empty()) {
+            return;
+        }
+        std::vector<BuildPrimitive> prims(boxes.size());
+        for (std::size_t i = 0; i < boxes.size(); i++) {
+            prims[i].box = boxes[i];
+            for (int k = 0; k < 3; k++) {
+                prims[i].centre[k] = 0.5 * (boxes[i].lo[k] + boxes[i].hi[k]);
+            }
+            prims[i].index = static_cast<std::uint32_t>(i);
+        }
+        std::vector<Node> nodes;
+        nodes.reserve(2 * boxes.size() / MAX_LEAF_SIZE + 1);
+        build(nodes, prims, 0, prims.size(), 0);
+        nodes.shrink_to_fit();
+        std::vector<std::uint32_t> primitives;
+        primitives.reserve(prims.size());
+        for (const auto& p: prims) {
+            primitives.push_back(p.index);
+        }
+        _nodes = std::move(nodes);
+        _primitives = std::move(primitives);
+    }
+
+    /// A node of the flattened tree. The left child of an interior node
+    /// immediately follows it.
+    struct Node {
+        float lo[3];
+        float hi[3];
+        // leaves: index of the first primitive, interior nodes: index of the right child
+        std::uint32_t offset;
+        // number of primitives, 0 for interior nodes
+        std::uint32_t count;
+
+        bool contains(double x, double y, double z) const {
+            return lo[0] <= x && x <= hi[0] && lo[1] <= y && y <= hi[1] && lo[2] <= z && z <= hi[2];
+        }
+
+        // Slab test: returns true if the ray enters the box before t_max, and
+        // sets t_entry to the entry distance (0 if the origin is inside). NaN
+        // slab distances, from an origin on a slab plane of a zero direction
+        // component, are ignored so the test errs on the side of a hit.
+        bool ray_entry(const double* origin, const double* inv_dir, double t_max, double& t_entry) const {
+            double t_lo = 0.0;
+            double t_hi = t_max;
+            for (int k = 0; k < 3; k++) {
+                double t0 = (lo[k] - origin[k]) * inv_dir[k];
+                double t1 = (hi[k] - origin[k]) * inv_dir[k];
+                if (t0 > t1) {
+                    std::swap(t0, t1);
+                }
+                if (t0 > t_lo) {
+                    t_lo = t0;
+                }
+                if (t1 < t_hi) {
+                    t_hi = t1;
+                }
+            }
+            t_entry = t_lo;
+            return t_lo <= t_hi;
+        }
+    };
+
+    /// Use the arrays of a hierarchy built earlier, see nodes() and
+    /// primitives(), e.g. views into a mesh snapshot file.
+    BVH(mesh_io::SharedArray<Node> nodes, mesh_io::SharedArray<std::uint32_t> primitives) :
+        _nodes(std::move(nodes)), _primitives(std::move(primitives)) {}
+
+    /// A hierarchy with the tree of this one and bounds recomputed from
+    /// `boxes`, the new bounding boxes of the same primitives, e.g. after
+    /// the mesh nodes moved. The primitive array is shared. Refitting is
+    /// much faster than building, but the tree only stays efficient while
+    /// the primitives keep roughly the same relative positions.
+    ///
+    /// Throws a std::invalid_argument exception if the number of boxes differs.
+    BVH refitted(const std::vector<Box>& boxes) const {
+        if (boxes.size() != num_primitives()) {
+            throw std::invalid_argument("expected " + std::to_string(num_primitives()) +
+                " boxes to refit, got " + std::to_string(boxes.size()));
+        }
+        std::vector<Node> nodes(_nodes.begin(), _nodes.end());
+        std::vector<Box> bounds(nodes.size());
+        // children come after their parent in depth-first order
+        for (std::size_t i = nodes.size(); i-- > 0; ) {
+            const Node& node = nodes[i];
+            if (node.count > 0) {
+                for (std::uint32_t p = node.offset; p < node.offset + node.count; p++) {
+                    bounds[i].expand(boxes[_primitives[p]]);
+                }
+            } else {
+                bounds[i].expand(bounds[i + 1]);
+                bounds[i].expand(bounds[node.offset]);
+            }
+        }
+        for (std::size_t i = 0; i < nodes.size(); i++) {
+            for (int k = 0; k < 3; k++) {
+                nodes[i].lo[k] = round_down(bounds[i].lo[k]);
+                nodes[i].hi[k] = round_up(bounds[i].hi[k]);
+            }
+        }
+        return BVH(std::move(nodes), _primitives);
+    }
+
+    /// Call `f(primitive)` for each primitive whose bounding box contains the
+    /// point (x, y, z), until `f` returns true. Returns true if `f` did.
+    template <typename F>
+    bool visit_point(double x, double y, double z, F f) const {
+        if (_nodes.empty()) {
+            return false;
+        }
+        std::uint32_t stack[MAX_DEPTH];
+        std::size_t top = 0;
+        std::uint32_t current = 0;
+        while (true) {
+            const Node& node = _nodes[current];
+            if (node.contains(x, y, z)) {
+                if (node.count > 0) {
+                    for (std::uint32_t i = 0; i < node.count; i++) {
+                        if (f(_primitives[node.offset + i])) {
+                            return true;
+                        }
+                    }
+                } else {
+                    // left child is next to its parent
+                    stack[top++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+            }
+            if (top == 0) {
+                return false;
+            }
+            current = stack[--top];
+        }
+    }
+
+    /// Visit the primitives whose bounding boxes are crossed by the ray
+    /// origin + t * dir for 0 <= t <= t_max, roughly nearest first.
+    ///
+    /// `hit(primitive, t_max)` returns the distance along the ray to the
+    /// primitive, or infinity if the ray misses it. The traversal keeps the
+    /// smallest distance as the new t_max and skips boxes beyond it, so the
+    /// last primitive for which `hit` returned a distance below its t_max
+    /// argument is the closest hit. Returns the closest distance, or t_max
+    /// if nothing was hit.
+    template <typename F>
+    double visit_ray(const double* origin, const double* dir, double t_max, F hit) const {
+        if (_nodes.empty()) {
+            return t_max;
+        }
+        const double inv_dir[3] = {1.0 / dir[0], 1.0 / dir[1], 1.0 / dir[2]};
+        double t_entry = 0.0;
+        if (!_nodes[0].ray_entry(origin, inv_dir, t_max, t_entry)) {
+            return t_max;
+        }
+        std::uint32_t stack[MAX_DEPTH];
+        double stack_entry[MAX_DEPTH];
+        std::size_t top = 0;
+        std::uint32_t current = 0;
+        while (true) {
+            const Node& node = _nodes[current];
+            if (node.count > 0) {
+                for (std::uint32_t i = 0; i < node.count; i++) {
+                    t_max = std::min(t_max, hit(_primitives[node.offset + i], t_max));
+                }
+            } else {
+                std::uint32_t near = current + 1;
+                std::uint32_t far = node.offset;
+                double t_near = 0.0;
+                double t_far = 0.0;
+                bool hit_near = _nodes[near].ray_entry(origin, inv_dir, t_max, t_near);
+                bool hit_far = _nodes[far].ray_entry(origin, inv_dir, t_max, t_far);
+                if (hit_near && hit_far) {
+                    if (t_far < t_near) {
+                        std::swap(near, far);
+                        std::swap(t_near, t_far);
+                    }
+                    stack[top] = far;
+                    stack_entry[top] = t_far;
+                    top++;
+                    current = near;
+                    continue;
+                }
+                if (hit_near || hit_far) {
+                    current = hit_near ? near : far;
+                    continue;
+                }
+            }
+            // pop the next box that is still closer than the closest hit
+            while (top > 0 && stack_entry[top - 1] > t_max) {
+                top--;
+            }
+            if (top == 0) {
+                return t_max;
+            }
+            current = stack[--top];
+        }
+    }
+
+    std::size_t num_nodes() const {
+        return _nodes.size();
+    }
+    std::size_t num_primitives() const {
+        return _primitives.size();
+    }
+    /// Memory used by the flattened tree.
+    std::size_t memory_bytes() const {
+        return _nodes.size() * sizeof(Node) + _primitives.size() * sizeof(std::uint32_t);
+    }
+
+    /// The flattened tree, root first.
+    const mesh_io::SharedArray<Node>& nodes() const {
+        return _nodes;
+    }
+    /// Primitive indices in leaf order. Leaves refer to ranges of this array.
+    const mesh_io::SharedArray<std::uint32_t>& primitives() const {
+        return _primitives;
+    }
+
+private:
+    // Bounds on the tree depth: after FORCE_MEDIAN_DEPTH levels nodes are
+    // split at the median, which halves the primitive count each level.
+    static const unsigned FORCE_MEDIAN_DEPTH = 64;
+    static const unsigned MAX_DEPTH = FORCE_MEDIAN_DEPTH + 34;
+    static const int NUM_BINS = 16;
+
+    struct BuildPrimitive {
+        Box box;
+        double centre[3];
+        std::uint32_t index;
+    };
+
+    // Round a double bound down or up to the nearest float.
+    static float round_down(double x) {
+        float f = static_cast<float>(x);
+        return static_cast<double>(f) > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+    static float round_up(double x) {
+        float f = static_cast<float>(x);
+        return static_cast<double>(f) < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    // Build the subtree over prims[begin, end) and return its node index.
+    std::uint32_t build(std::vector<Node>& nodes, std::vector<BuildPrimitive>& prims,
+        std::size_t begin, std::size_t end, unsigned depth)
+    {
+        Box bounds;
+        Box centres;
+        for (std::size_t i = begin; i < end; i++) {
+            bounds.expand(prims[i].box);
+            centres.expand(prims[i].centre);
+        }
+        const std::uint32_t index = static_cast<std::uint32_t>(nodes.size());
+        nodes.push_back(Node());
+        Node& node = nodes.back();
+        for (int k = 0; k < 3; k++) {
+            node.lo[k] = round_down(bounds.lo[k]);
+            node.hi[k] = round_up(bounds.hi[k]);
+        }
+        const std::size_t count = end - begin;
+        int axis = 0;
+        for (int k = 1; k < 3; k++) {
+            if (centres.hi[k] - centres.lo[k] > centres.hi[axis] - centres.lo[axis]) {
+                axis = k;
+            }
+        }
+        const double extent = centres.hi[axis] - centres.lo[axis];
+        // all centres coincide, the primitives can't be separated
+        if (count <= MAX_LEAF_SIZE || !(extent > 0.0)) {
+            make_leaf(nodes, index, begin, count);
+            return index;
+        }
+
+        std::size_t mid = begin;
+        if (depth < FORCE_MEDIAN_DEPTH) {
+            mid = sah_split(prims, begin, end, axis, centres.lo[axis], extent);
+        }
+        if (mid == begin || mid == end) {
+            mid = begin + count / 2;
+            std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+                [axis](const BuildPrimitive& a, const BuildPrimitive& b) {
+                    return a.centre[axis] < b.centre[axis];
+                });
+        }
+        build(nodes, prims, begin, mid, depth + 1);
+        const std::uint32_t right = build(nodes, prims, mid, end, depth + 1);
+        nodes[index].offset = right;
+        nodes[index].count = 0;
+        return index;
+    }
+
+    static void make_leaf(std::vector<Node>& nodes, std::uint32_t index, std::size_t begin,
+        std::size_t count)
+    {
+        nodes[index].offset = static_cast<std::uint32_t>(begin);
+        nodes[index].count = static_cast<std::uint32_t>(count);
+    }
+
+    // Partition prims[begin, end) at the cheapest of the NUM_BINS - 1 bin
+    // boundaries along `axis` and return the split point.
+    std::size_t sah_split(std::vector<BuildPrimitive>& prims, std::size_t begin, std::size_t end,
+        int axis, double centre_lo, double extent)
+    {
+        Box bin_bounds[NUM_BINS];
+        std::size_t bin_counts[NUM_BINS] = {};
+        const double scale = NUM_BINS / extent;
+        auto bin_of = [&](const BuildPrimitive& p) {
+            int b = static_cast<int>((p.centre[axis] - centre_lo) * scale);
+            return std::min(b, NUM_BINS - 1);
+        };
+        for (std::size_t i = begin; i < end; i++) {
+            const int b = bin_of(prims[i]);
+            bin_counts[b]++;
+            bin_bounds[b].expand(prims[i].box);
+        }
+        // sweep from the right to get the cost of every right side
+        double right_cost[NUM_BINS];
+        Box right;
+        std::size_t right_count = 0;
+        for (int b = NUM_BINS - 1; b > 0; b--) {
+            right.expand(bin_bounds[b]);
+            right_count += bin_counts[b];
+            right_cost[b] = right_count * right.half_area();
+        }
+        Box left;
+        std::size_t left_count = 0;
+        double best_cost = std::numeric_limits<double>::infinity();
+        int best_bin = -1;
+        for (int b = 1; b < NUM_BINS; b++) {
+            left.expand(bin_bounds[b - 1]);
+            left_count += bin_counts[b - 1];
+            const double cost = left_count * left.half_area() + right_cost[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_bin = b;
+            }
+        }
+        if (best_bin == -1) {
+            return begin;
+        }
+        auto split = std::partition(prims.begin() + begin, prims.begin() + end,
+            [&](const BuildPrimitive& p) { return bin_of(p) < best_bin; });
+        return static_cast<std::size_t>(split - prims.begin());
+    }
+
+    mesh_io::SharedArray<Node> _nodes;
+    mesh_io::SharedArray<std::uint32_t> _primitives;
+};
+
+} // namespace mesh_bvh
+
+#endif // MESH_BVH_
@@ -0,0 +1,250 @@
+/*
+###############################################################################
+#
+#  EGSnrc mesh file input and output helpers
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+*/
+
+#ifndef MESH_IO_
+#define MESH_IO_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MESH_IO_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mesh_io {
+
+/// A read-only view of an entire file.
+///
+/// On POSIX systems the file is memory-mapped, otherwise it is read into a
+/// heap buffer. The contents are not null-terminated.
+class MappedFile {
+public:
+    /// Throws a std::runtime_error if the file can't be opened or read.
+    explicit MappedFile(const std::string& path) {
+#ifdef MESH_IO_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("couldn't open file `" + path + "`");
+        }
+        struct stat file_info;
+        if (::fstat(fd, &file_info) == -1) {
+            ::close(fd);
+            throw std::runtime_error("couldn't read file size of `" + path + "`");
+        }
+        _size = static_cast<std::size_t>(file_info.st_size);
+        // mmap rejects zero-length mappings, leave _data pointing nowhere
+        if (_size > 0) {
+            void* mapped = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("couldn't memory-map file `" + path + "`");
+            }
+            _data = static_cast<const char*>(mapped);
+            _mapped = true;
+        }
+        ::close(fd);
+#else
+        std::ifstream input(path, std::ios::binary);
+        if (!input) {
+            throw std::runtime_error("couldn't open file `" + path + "`");
+        }
+        input.seekg(0, std::ios::end);
+        _buffer.resize(static_cast<std::size_t>(input.tellg()));
+        input.seekg(0, std::ios::beg);
+        input.read(_buffer.data(), _buffer.size());
+        if (!input) {
+            throw std::runtime_error("couldn't read file `" + path + "`");
+        }
+        _data = _buffer.data();
+        _size = _buffer.size();
+#endif
+    }
+
+    ~MappedFile() {
+#ifdef MESH_IO_HAVE_MMAP
+        if (_mapped) {
+            ::munmap(const_cast<char*>(_data), _size);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const {
+        return _data;
+    }
+    std::size_t size() const {
+        return _size;
+    }
+
+private:
+    const char* _data = nullptr;
+    std::size_t _size = 0;
+    bool _mapped = false;
+    std::vector<char> _buffer;
+};
+
+/// A read-only array that shares its storage with an owner: either a vector
+/// it took over, or e.g. a MappedFile it points into. Copies share the same
+/// storage, which lives until the last copy is destroyed.
+template <typename T>
+class SharedArray {
+public:
+    SharedArray() = default;
+
+    /// Take over the storage of `values`.
+    SharedArray(std::vector<T> values) {
+        auto owned = std::make_shared<const std::vector<T>>(std::move(values));
+        _data = owned->data();
+        _size = owned->size();
+        _owner = std::move(owned);
+    }
+
+    /// View `size` values at `data`, which stay valid while `owner` lives.
+    SharedArray(std::shared_ptr<const void> owner, const T* data, std::size_t size) :
+        _owner(std::move(owner)), _data(data), _size(size) {}
+
+    std::size_t size() const {
+        return _size;
+    }
+    bool empty() const {
+        return _size == 0;
+    }
+    const T* data() const {
+        return _data;
+    }
+    const T& operator[](std::size_t i) const {
+        return _data[i];
+    }
+    const T* begin() const {
+        return _data;
+    }
+    const T* end() const {
+        return _data + _size;
+    }
+
+    /// Copy the values into a new vector.
+    operator std::vector<T>() const {
+        return std::vector<T>(begin(), end());
+    }
+
+private:
+    std::shared_ptr<const void> _owner;
+    const T* _data = nullptr;
+    std::size_t _size = 0;
+};
+
+/// The 64-bit xxHash (XXH64) of `size` bytes at `data`, a fast
+/// non-cryptographic hash used to recognize file contents.
+std::uint64_t content_hash(const char* data, std::size_t size, std::uint64_t seed = 0) {
+    const std::uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    const std::uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    const std::uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+    const std::uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+    const std::uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+    auto rotl = [](std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    // little-endian loads, so the hash doesn't depend on the host
+    auto read64 = [](const char* p) {
+        std::uint64_t v = 0;
+        for (int i = 7; i >= 0; i--) {
+            v = (v << 8) | static_cast<unsigned char>(p[i]);
+        }
+        return v;
+    };
+    auto read32 = [](const char* p) {
+        std::uint64_t v = 0;
+        for (int i = 3; i >= 0; i--) {
+            v = (v << 8) | static_cast<unsigned char>(p[i]);
+        }
+        return v;
+    };
+    auto round = [&](std::uint64_t acc, std::uint64_t input) {
+        return rotl(acc + input * PRIME2, 31) * PRIME1;
+    };
+    auto merge = [&](std::uint64_t acc, std::uint64_t val) {
+        return (acc ^ round(0, val)) * PRIME1 + PRIME4;
+    };
+
+    const char* p = data;
+    const char* const end = data + size;
+    std::uint64_t h;
+    if (size >= 32) {
+        std::uint64_t v1 = seed + PRIME1 + PRIME2;
+        std::uint64_t v2 = seed + PRIME2;
+        std::uint64_t v3 = seed;
+        std::uint64_t v4 = seed - PRIME1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    } else {
+        h = seed + PRIME5;
+    }
+    h += static_cast<std::uint64_t>(size);
+    for (; p + 8 <= end; p += 8) {
+        h = rotl(h ^ round(0, read64(p)), 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end) {
+        h = rotl(h ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h = rotl(h ^ (static_cast<unsigned char>(*p) * PRIME5), 11) * PRIME1;
+    }
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/// The content_hash of a file on disk.
+///
+/// Throws a std::runtime_error if the file can't be read.
+std::uint64_t file_hash(const std::string& path) {
+    MappedFile file(path);
+    return content_hash(file.data(), file.size());
+}
+
+} // namespace mesh_io
+
+#endif // MESH_IO_
@@ -0,0 +1,201 @@
+/*
+###############################################################################
+#
+#  EGSnrc tetrahedral mesh geometry kernels
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+*/
+
+#ifndef MESH_KERNELS_
+#define MESH_KERNELS_
+
+#include <limits>
+
+// AVX2 kernels are compiled with per-function target attributes, so the rest
+// of the program doesn't need to be built with -mavx2.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MESH_KERNELS_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+/// Point location and ray exit kernels for a single tetrahedron.
+///
+/// Every kernel takes the 16 face plane values of a tetrahedron, laid out
+/// as in EGS_Mesh::element_planes: the x components of the four outward unit
+/// face normals, then the y components, the z components and the offsets.
+///
+/// All kernel variants do the same floating point operations in the same
+/// order, so they return identical results for tetrahedrons with finite
+/// planes. Only the sign of zero hownear results may differ.
+namespace mesh_kernels {
+
+/// Returns true if the point (x, y, z) is inside or on the tetrahedron.
+using IsInsideFn = bool (*)(const double* planes, double x, double y, double z);
+
+/// Returns the smallest distance from the point (x, y, z) to the planes of
+/// the tetrahedron faces. For points inside the tetrahedron this is a lower
+/// bound of the distance to the tetrahedron boundary. The result is negative
+/// for points outside.
+using HownearFn = double (*)(const double* planes, double x, double y, double z);
+
+/// Returns the face a ray leaves the tetrahedron through and sets `dist` to
+/// the distance along the ray, see EGS_Mesh::howfar. If the ray doesn't
+/// head towards any face, returns -1 and sets `dist` to infinity.
+using RayExitFn = int (*)(const double* planes, const double* pos, const double* dir,
+    double& dist);
+
+/// A set of kernels for one instruction set.
+struct Kernels {
+    const char* name;
+    IsInsideFn is_inside;
+    HownearFn hownear;
+    RayExitFn ray_exit;
+};
+
+namespace scalar {
+
+bool is_inside(const double* p, double x, double y, double z) {
+    bool inside = true;
+    for (int f = 0; f < 4; f++) {
+        inside &= (p[f] * x + p[4 + f] * y + p[8 + f] * z) <= p[12 + f];
+    }
+    return inside;
+}
+
+double hownear(const double* p, double x, double y, double z) {
+    double nearest = std::numeric_limits<double>::infinity();
+    for (int f = 0; f < 4; f++) {
+        const double gap = p[12 + f] - (p[f] * x + p[4 + f] * y + p[8 + f] * z);
+        nearest = gap < nearest ? gap : nearest;
+    }
+    return nearest;
+}
+
+int ray_exit(const double* p, const double* pos, const double* dir, double& dist) {
+    int face = -1;
+    dist = std::numeric_limits<double>::infinity();
+    for (int f = 0; f < 4; f++) {
+        const double dir_normal = p[f] * dir[0] + p[4 + f] * dir[1] + p[8 + f] * dir[2];
+        if (dir_normal <= 0.0) {
+            continue;
+        }
+        const double gap = p[12 + f] - (p[f] * pos[0] + p[4 + f] * pos[1] + p[8 + f] * pos[2]);
+        const double face_dist = gap > 0.0 ? gap / dir_normal : 0.0;
+        if (face_dist < dist) {
+            dist = face_dist;
+            face = f;
+        }
+    }
+    return face;
+}
+
+} // namespace mesh_kernels::scalar
+
+#ifdef MESH_KERNELS_HAVE_AVX2
+namespace avx2 {
+
+// n . (x, y, z) for the four faces at once. Multiplies and adds are kept
+// separate (no FMA) to match the scalar kernels exactly.
+__attribute__((target("avx2")))
+__m256d dot_normals(const double* p, double x, double y, double z) {
+    __m256d dot = _mm256_mul_pd(_mm256_loadu_pd(p), _mm256_set1_pd(x));
+    dot = _mm256_add_pd(dot, _mm256_mul_pd(_mm256_loadu_pd(p + 4), _mm256_set1_pd(y)));
+    return _mm256_add_pd(dot, _mm256_mul_pd(_mm256_loadu_pd(p + 8), _mm256_set1_pd(z)));
+}
+
+__attribute__((target("avx2")))
+bool is_inside(const double* p, double x, double y, double z) {
+    // an ordered compare is false for NaN, like the scalar <=
+    const __m256d inside = _mm256_cmp_pd(dot_normals(p, x, y, z), _mm256_loadu_pd(p + 12), _CMP_LE_OQ);
+    return _mm256_movemask_pd(inside) == 0xF;
+}
+
+// The minimum of the four lanes of v, in every lane.
+__attribute__((target("avx2")))
+__m256d min_lanes(__m256d v) {
+    v = _mm256_min_pd(v, _mm256_permute2f128_pd(v, v, 1));
+    return _mm256_min_pd(v, _mm256_permute_pd(v, 5));
+}
+
+__attribute__((target("avx2")))
+double hownear(const double* p, double x, double y, double z) {
+    const __m256d gap = _mm256_sub_pd(_mm256_loadu_pd(p + 12), dot_normals(p, x, y, z));
+    return _mm256_cvtsd_f64(min_lanes(gap));
+}
+
+__attribute__((target("avx2")))
+int ray_exit(const double* p, const double* pos, const double* dir, double& dist) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d inf = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    const __m256d dir_normal = dot_normals(p, dir[0], dir[1], dir[2]);
+    const __m256d gap = _mm256_sub_pd(_mm256_loadu_pd(p + 12), dot_normals(p, pos[0], pos[1], pos[2]));
+    // gap > 0 ? gap / dir_normal : 0, for the faces the ray heads towards
+    __m256d face_dist = _mm256_div_pd(gap, dir_normal);
+    face_dist = _mm256_blendv_pd(zero, face_dist, _mm256_cmp_pd(gap, zero, _CMP_GT_OQ));
+    face_dist = _mm256_blendv_pd(inf, face_dist, _mm256_cmp_pd(dir_normal, zero, _CMP_GT_OQ));
+    const __m256d nearest = min_lanes(face_dist);
+    dist = _mm256_cvtsd_f64(nearest);
+    // the first face at the smallest distance, like the scalar loop
+    const int at_nearest = _mm256_movemask_pd(_mm256_cmp_pd(face_dist, nearest, _CMP_EQ_OQ))
+        & _mm256_movemask_pd(_mm256_cmp_pd(face_dist, inf, _CMP_LT_OQ));
+    return at_nearest == 0 ? -1 : __builtin_ctz(at_nearest);
+}
+
+} // namespace mesh_kernels::avx2
+#endif // MESH_KERNELS_HAVE_AVX2
+
+/// Portable kernels, always available.
+const Kernels& scalar_kernels() {
+    static const Kernels kernels = {
+        "scalar", scalar::is_inside, scalar::hownear, scalar::ray_exit
+    };
+    return kernels;
+}
+
+/// Returns true if the AVX2 kernels were compiled in and the CPU supports them.
+bool avx2_supported() {
+#ifdef MESH_KERNELS_HAVE_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+/// Returns the AVX2 kernels, or the scalar kernels if avx2_supported() is false.
+const Kernels& avx2_kernels() {
+#ifdef MESH_KERNELS_HAVE_AVX2
+    static const Kernels kernels = {
+        "avx2", avx2::is_inside, avx2::hownear, avx2::ray_exit
+    };
+    if (avx2_supported()) {
+        return kernels;
+    }
+#endif
+    return scalar_kernels();
+}
+
+/// The fastest kernels supported by the CPU, detected on the first call.
+const Kernels& best_kernels() {
+    static const Kernels& kernels = avx2_kernels();
+    return kernels;
+}
+
+} // namespace mesh_kernels
+
+#endif // MESH_KERNELS_
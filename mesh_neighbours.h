@@ -35,23 +35,39 @@
 
 #include <algorithm>
 #include <array>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <stdexcept>
 #include <vector>
 
+#include "mesh_parallel.h"
+
 namespace mesh_neighbours {
 
+// Magic number for no neighbour, for any index type.
+template <typename Index>
+constexpr Index none() {
+    return static_cast<Index>(-1);
+}
+
 // Magic number for no neighbour.
-constexpr std::size_t NONE = -1;
+constexpr std::size_t NONE = none<std::size_t>();
+// Magic number for no neighbour in compact 32-bit neighbour tables.
+constexpr std::uint32_t COMPACT_NONE = none<std::uint32_t>();
 
-class Tetrahedron {
+// A tetrahedron with node indices of type `Index`. The index type is also
+// used for the element indices of the neighbour table, see CompactTetrahedron.
+template <typename Index>
+class BasicTetrahedron {
 public:
-    using Face = std::array<std::size_t, 3>;
+    using index_type = Index;
+    using Face = std::array<Index, 3>;
 
     // Make a tetrahedron from four nodes.
     //
     // Throws a std::invalid_argument exception if duplicate node tags are passed in.
-    Tetrahedron(std::size_t a, std::size_t b, std::size_t c, std::size_t d) {
+    BasicTetrahedron(Index a, Index b, Index c, Index d) {
         if (a == b || a == c || a == d) {
             throw std::invalid_argument("duplicate node " + std::to_string(a));
         }
@@ -61,52 +77,136 @@ public:
         if (c == d) {
             throw std::invalid_argument("duplicate node " + std::to_string(c));
         }
-        std::vector<std::size_t> sorted {a, b, c, d};
+        std::array<Index, 4> sorted {{a, b, c, d}};
         std::sort(sorted.begin(), sorted.end());
         _a = sorted[0];
         _b = sorted[1];
         _c = sorted[2];
         _d = sorted[3];
     }
-    std::array<std::size_t, 4> nodes() const {
-        return std::array<std::size_t, 4> {_a, _b, _c, _d};
+    std::array<Index, 4> nodes() const {
+        return std::array<Index, 4> {{_a, _b, _c, _d}};
     }
-    std::size_t max_node() const {
+    Index max_node() const {
         return _d;
     }
     std::array<Face, 4> faces() const {
-        return {
-            std::array<std::size_t, 3>{_b, _c, _d},
-            std::array<std::size_t, 3>{_a, _c, _d},
-            std::array<std::size_t, 3>{_a, _b, _d},
-            std::array<std::size_t, 3>{_a, _b, _c}
-        };
+        return {{
+            Face{{_b, _c, _d}},
+            Face{{_a, _c, _d}},
+            Face{{_a, _b, _d}},
+            Face{{_a, _b, _c}}
+        }};
+    }
+    // Face `f` is the face opposite the f-th smallest node, the same as faces()[f].
+    Face face(std::size_t f) const {
+        switch (f) {
+            case 0: return Face{{_b, _c, _d}};
+            case 1: return Face{{_a, _c, _d}};
+            case 2: return Face{{_a, _b, _d}};
+            default: return Face{{_a, _b, _c}};
+        }
     }
 
 private:
-    std::size_t _a;
-    std::size_t _b;
-    std::size_t _c;
-    std::size_t _d;
+    Index _a;
+    Index _b;
+    Index _c;
+    Index _d;
 };
 
+using Tetrahedron = BasicTetrahedron<std::size_t>;
+
+// A tetrahedron with 32-bit node indices, half the size of a Tetrahedron.
+//
+// Passing a list of CompactTetrahedrons to the neighbour functions gives a
+// 32-bit neighbour table with COMPACT_NONE for missing neighbours. Meshes
+// must have fewer than 2^32 - 1 elements and nodes, which always holds for
+// msh files since Gmsh tags are ints.
+using CompactTetrahedron = BasicTetrahedron<std::uint32_t>;
+
 /// The mesh_neighbours::internal namespace is for internal API functions and is not
 /// part of the public API. Functions and types may change without warning.
 namespace internal {
 
+// A read-only view of a contiguous list of element indices.
+template <typename Index>
+class ElementRange {
+public:
+    ElementRange(const Index* begin, const Index* end) :
+        _begin(begin), _end(end) {}
+    const Index* begin() const {
+        return _begin;
+    }
+    const Index* end() const {
+        return _end;
+    }
+    std::size_t size() const {
+        return static_cast<std::size_t>(_end - _begin);
+    }
+    bool empty() const {
+        return _begin == _end;
+    }
+    Index operator[](std::size_t i) const {
+        return _begin[i];
+    }
+private:
+    const Index* _begin;
+    const Index* _end;
+};
+
+// The elements around each node in compressed sparse row (CSR) form: the
+// elements around node n are elements[offsets[n]..offsets[n + 1]], in
+// increasing order.
+//
+// Element indices are stored as `Index`, offsets are always std::size_t
+// since there are four times as many entries as elements.
+template <typename Index>
 class SharedNodes {
 public:
-    SharedNodes(std::vector<std::vector<std::size_t>> shared_nodes) :
-        shared_nodes(std::move(shared_nodes)) {}
-    const std::vector<std::size_t>& elements_around_node(std::size_t node) const {
-        return shared_nodes.at(node);
+    SharedNodes(std::vector<std::size_t> offsets, std::vector<Index> elements) :
+        _offsets(std::move(offsets)), _elements(std::move(elements)) {}
+
+    // Throws a std::out_of_range exception if the node is out of range.
+    ElementRange<Index> elements_around_node(std::size_t node) const {
+        if (node + 1 >= _offsets.size()) {
+            throw std::out_of_range("node " + std::to_string(node) + " is out of range");
+        }
+        const Index* data = _elements.data();
+        return ElementRange<Index>(data + _offsets[node], data + _offsets[node + 1]);
+    }
+    std::size_t num_nodes() const {
+        return _offsets.size() - 1;
+    }
+    // Heap memory used by the adjacency arrays.
+    std::size_t memory_bytes() const {
+        return _offsets.capacity() * sizeof(std::size_t) + _elements.capacity() * sizeof(Index);
     }
 private:
-    std::vector<std::vector<std::size_t>> shared_nodes;
+    std::vector<std::size_t> _offsets;
+    std::vector<Index> _elements;
 };
 
+// Throws a std::invalid_argument exception if the element indices of
+// `elements` don't fit in `Index` with room left for the none<Index>() sentinel.
+template <typename Index>
+void check_index_range(const std::vector<BasicTetrahedron<Index>>& elements) {
+    if (static_cast<std::uint64_t>(elements.size()) >=
+        static_cast<std::uint64_t>(none<Index>()))
+    {
+        throw std::invalid_argument("too many elements for the index type: "
+            + std::to_string(elements.size()));
+    }
+}
+
 // Find the elements around each node.
-SharedNodes elements_around_nodes(const std::vector<mesh_neighbours::Tetrahedron>& elements) {
+//
+// This is a counting sort with two passes over the elements: the first
+// counts the elements around each node to size the rows, the second fills
+// them in.
+template <typename Index>
+SharedNodes<Index> elements_around_nodes(const std::vector<BasicTetrahedron<Index>>& elements) {
+    check_index_range(elements);
     std::size_t max_node = 0;
     for (const auto& elt: elements) {
         if (elt.max_node() > max_node) {
@@ -116,37 +216,138 @@ SharedNodes elements_around_nodes(const std::vector<mesh_neighbours::Tetrahedron
 
     // the number of unique nodes is equal to the maximum node number + 1
     // because the nodes are numbered from 0..=max_node
-    std::vector<std::vector<std::size_t>> shared_nodes(max_node + 1);
+    const std::size_t num_nodes = max_node + 1;
+    // count into offsets[node + 1], then a prefix sum gives the row starts
+    std::vector<std::size_t> offsets(num_nodes + 1, 0);
+    for (const auto& elt: elements) {
+        for (auto node: elt.nodes()) {
+            offsets[node + 1]++;
+        }
+    }
+    for (std::size_t n = 0; n < num_nodes; n++) {
+        offsets[n + 1] += offsets[n];
+    }
+    // fill each row, which moves offsets[n] to the start of row n + 1...
+    std::vector<Index> shared_nodes(offsets[num_nodes]);
     for (std::size_t i = 0; i < elements.size(); i++) {
         for (auto node: elements[i].nodes()) {
-            shared_nodes.at(node).push_back(i);
+            shared_nodes[offsets[node]++] = static_cast<Index>(i);
+        }
+    }
+    // ...so shift the offsets back by one row
+    for (std::size_t n = num_nodes; n > 0; n--) {
+        offsets[n] = offsets[n - 1];
+    }
+    offsets[0] = 0;
+    return SharedNodes<Index>(std::move(offsets), std::move(shared_nodes));
+}
+
+// Hash of a sorted face, using the 64-bit finalizer from MurmurHash3.
+template <typename Index>
+std::uint64_t hash_face(const std::array<Index, 3>& face) {
+    std::uint64_t h = face[0];
+    h = h * 0x9e3779b97f4a7c15ULL + face[1];
+    h = h * 0x9e3779b97f4a7c15ULL + face[2];
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Bits of a FaceTable entry used for the face id, the rest hold hash bits.
+constexpr unsigned FACE_ID_BITS = 40;
+constexpr std::uint64_t FACE_ID_MASK = (std::uint64_t(1) << FACE_ID_BITS) - 1;
+// Magic number for an empty FaceTable slot.
+constexpr std::uint64_t NO_FACE = ~std::uint64_t(0);
+
+// A flat open-addressing hash table of faces, used to pair each face with
+// the other face made of the same three nodes.
+//
+// Entries only store a face id (element * 4 + face index) with the top bits
+// of the face hash, the nodes are looked up in the element list when the
+// hash bits match.
+class FaceTable {
+public:
+    // Make a table with room for `num_faces` faces at a load factor of at most one half.
+    explicit FaceTable(std::size_t num_faces) {
+        std::size_t capacity = 16;
+        while (capacity < 2 * num_faces) {
+            capacity *= 2;
+        }
+        _mask = capacity - 1;
+        _slots.assign(capacity, NO_FACE);
+    }
+
+    // Look up the face `f` of element `elt`. If an earlier element has the
+    // same face, its face id is returned. Otherwise the face is inserted and
+    // NO_FACE is returned.
+    template <typename Index>
+    std::uint64_t find_or_insert(const std::vector<BasicTetrahedron<Index>>& elements,
+        std::size_t elt, std::size_t f)
+    {
+        const auto face = elements[elt].face(f);
+        const std::uint64_t hash = hash_face(face);
+        const std::uint64_t tag = hash & ~FACE_ID_MASK;
+        for (std::size_t slot = hash & _mask; ; slot = (slot + 1) & _mask) {
+            const std::uint64_t entry = _slots[slot];
+            if (entry == NO_FACE) {
+                _slots[slot] = tag | (4 * elt + f);
+                return NO_FACE;
+            }
+            if ((entry & ~FACE_ID_MASK) == tag) {
+                const std::uint64_t id = entry & FACE_ID_MASK;
+                if (elements[id / 4].face(id % 4) == face) {
+                    return id;
+                }
+            }
         }
     }
-    return SharedNodes(shared_nodes);
+
+private:
+    std::vector<std::uint64_t> _slots;
+    std::size_t _mask = 0;
+};
+
+// Throws a std::invalid_argument exception if there are too many elements
+// for the index type or for FaceTable face ids.
+template <typename Index>
+void check_face_table_range(const std::vector<BasicTetrahedron<Index>>& elements) {
+    check_index_range(elements);
+    if (elements.size() >= (std::size_t(1) << (FACE_ID_BITS - 2))) {
+        throw std::invalid_argument("too many elements for the face hash table");
+    }
 }
 
 } // namespace internal
 
 // Given a list of tetrahedrons, returns the indices of neighbouring tetrahedrons.
-std::vector<std::array<std::size_t,4>> tetrahedron_neighbours(
-        const std::vector<mesh_neighbours::Tetrahedron>& elements)
+//
+// Missing neighbours are none<Index>(), which is NONE for Tetrahedrons and
+// COMPACT_NONE for CompactTetrahedrons.
+template <typename Index>
+std::vector<std::array<Index,4>> tetrahedron_neighbours(
+        const std::vector<mesh_neighbours::BasicTetrahedron<Index>>& elements)
 {
     const std::size_t NUM_FACES = 4;
+    const Index NO_NEIGHBOUR = none<Index>();
     const auto shared_nodes = mesh_neighbours::internal::elements_around_nodes(elements);
 
     // initialize neighbour element index vector with "no neighbour" constant
-    std::vector<std::array<std::size_t, 4>> neighbours(elements.size(), {NONE, NONE, NONE, NONE});
+    std::vector<std::array<Index, 4>> neighbours(elements.size(),
+        {{NO_NEIGHBOUR, NO_NEIGHBOUR, NO_NEIGHBOUR, NO_NEIGHBOUR}});
 
     for (std::size_t i = 0; i < elements.size(); i++) {
         auto elt_faces = elements[i].faces();
         for (std::size_t f = 0; f < NUM_FACES; f++) {
             // if this face's neighbour was already found, skip it
-            if (neighbours[i][f] != NONE) {
+            if (neighbours[i][f] != NO_NEIGHBOUR) {
                 continue;
             }
             auto face = elt_faces[f];
             // select a face node and loop through the other elements that share it
-            const auto& elts_sharing_node = shared_nodes.elements_around_node(face[0]);
+            const auto elts_sharing_node = shared_nodes.elements_around_node(face[0]);
             for (auto j: elts_sharing_node) {
                 if (j == i) {
                     // elt can't be a neighbour of itself, skip it
@@ -156,7 +357,7 @@ std::vector<std::array<std::size_t,4>> tetrahedron_neighbours(
                 for (std::size_t jf = 0; jf < NUM_FACES; jf++) {
                     if (face == other_elt_faces[jf]) {
                         neighbours[i][f] = j;
-                        neighbours[j][jf] = i;
+                        neighbours[j][jf] = static_cast<Index>(i);
                         break;
                     }
                 }
@@ -166,5 +367,142 @@ std::vector<std::array<std::size_t,4>> tetrahedron_neighbours(
     return neighbours;
 };
 
+// Given a list of tetrahedrons, returns the indices of neighbouring tetrahedrons.
+//
+// Every face is looked up in a hash table keyed on its sorted nodes, so the
+// neighbours are found in a single pass over the faces regardless of how many
+// elements share a node. The result is the same as tetrahedron_neighbours for
+// any mesh where a face is shared by at most two tetrahedrons.
+//
+// A face shared by more than two tetrahedrons is paired between the first two
+// that have it, the later copies get no neighbour. If `non_manifold_faces` is
+// given, the ids (element * 4 + face index) of those later copies are
+// appended to it in increasing order.
+//
+// Throws a std::invalid_argument exception if there are 2^38 or more elements,
+// or too many elements for the index type.
+template <typename Index>
+std::vector<std::array<Index,4>> tetrahedron_neighbours_hashed(
+        const std::vector<mesh_neighbours::BasicTetrahedron<Index>>& elements,
+        std::vector<std::uint64_t>* non_manifold_faces = nullptr)
+{
+    using mesh_neighbours::internal::FaceTable;
+    const std::size_t NUM_FACES = 4;
+    const Index NO_NEIGHBOUR = none<Index>();
+    mesh_neighbours::internal::check_face_table_range(elements);
+    std::vector<std::array<Index, 4>> neighbours(elements.size(),
+        {{NO_NEIGHBOUR, NO_NEIGHBOUR, NO_NEIGHBOUR, NO_NEIGHBOUR}});
+    FaceTable faces(NUM_FACES * elements.size());
+    for (std::size_t i = 0; i < elements.size(); i++) {
+        for (std::size_t f = 0; f < NUM_FACES; f++) {
+            const std::uint64_t match = faces.find_or_insert(elements, i, f);
+            if (match == mesh_neighbours::internal::NO_FACE) {
+                continue;
+            }
+            Index& other = neighbours[match / NUM_FACES][match % NUM_FACES];
+            if (other != NO_NEIGHBOUR) {
+                if (non_manifold_faces) {
+                    non_manifold_faces->push_back(NUM_FACES * i + f);
+                }
+                continue;
+            }
+            neighbours[i][f] = static_cast<Index>(match / NUM_FACES);
+            other = static_cast<Index>(i);
+        }
+    }
+    return neighbours;
+}
+
+// Given a list of tetrahedrons, returns the indices of neighbouring
+// tetrahedrons using `num_threads` threads (0 uses every hardware thread).
+//
+// Faces are partitioned by hash so that both copies of a shared face land in
+// the same partition, and each partition is matched by one thread with its
+// own FaceTable. A partition only writes the neighbour entries of its own
+// faces, and visits them in element order, so the result is bit-identical to
+// tetrahedron_neighbours_hashed for any number of threads, including the
+// non-manifold faces.
+//
+// Throws a std::invalid_argument exception if there are 2^38 or more elements,
+// or too many elements for the index type.
+template <typename Index>
+std::vector<std::array<Index,4>> tetrahedron_neighbours_parallel(
+        const std::vector<mesh_neighbours::BasicTetrahedron<Index>>& elements,
+        unsigned num_threads = 0,
+        std::vector<std::uint64_t>* non_manifold_faces = nullptr)
+{
+    using mesh_neighbours::internal::FaceTable;
+    const std::size_t NUM_FACES = 4;
+    const Index NO_NEIGHBOUR = none<Index>();
+    mesh_neighbours::internal::check_face_table_range(elements);
+    if (num_threads == 0) {
+        num_threads = mesh_parallel::default_num_threads();
+    }
+    const std::size_t num_parts = num_threads;
+    // the partition of a face comes from the high hash bits, FaceTable slots
+    // come from the low bits
+    auto partition = [num_parts](const std::array<Index, 3>& face) {
+        return static_cast<std::size_t>(((mesh_neighbours::internal::hash_face(face) >> 32) * num_parts) >> 32);
+    };
+
+    // buckets[t][p] holds the ids of faces in partition p of the t-th range of
+    // elements, in increasing order
+    std::vector<std::vector<std::vector<std::uint64_t>>> buckets(num_threads,
+        std::vector<std::vector<std::uint64_t>>(num_parts));
+    mesh_parallel::parallel_for(elements.size(), num_threads,
+        [&](std::size_t begin, std::size_t end, unsigned t) {
+            auto& thread_buckets = buckets[t];
+            for (auto& bucket: thread_buckets) {
+                bucket.reserve(NUM_FACES * (end - begin) / num_parts + 64);
+            }
+            for (std::size_t i = begin; i < end; i++) {
+                for (std::size_t f = 0; f < NUM_FACES; f++) {
+                    thread_buckets[partition(elements[i].face(f))].push_back(NUM_FACES * i + f);
+                }
+            }
+        });
+
+    std::vector<std::array<Index, 4>> neighbours(elements.size(),
+        {{NO_NEIGHBOUR, NO_NEIGHBOUR, NO_NEIGHBOUR, NO_NEIGHBOUR}});
+    std::vector<std::vector<std::uint64_t>> part_non_manifold(num_parts);
+    mesh_parallel::parallel_tasks(num_parts, num_threads, [&](std::size_t p) {
+        std::size_t num_part_faces = 0;
+        for (const auto& thread_buckets: buckets) {
+            num_part_faces += thread_buckets[p].size();
+        }
+        FaceTable faces(num_part_faces);
+        for (auto& thread_buckets: buckets) {
+            for (std::uint64_t id: thread_buckets[p]) {
+                const std::size_t i = id / NUM_FACES;
+                const std::size_t f = id % NUM_FACES;
+                const std::uint64_t match = faces.find_or_insert(elements, i, f);
+                if (match == mesh_neighbours::internal::NO_FACE) {
+                    continue;
+                }
+                // both copies are in this partition, so no other thread
+                // writes this entry
+                Index& other = neighbours[match / NUM_FACES][match % NUM_FACES];
+                if (other != NO_NEIGHBOUR) {
+                    part_non_manifold[p].push_back(id);
+                    continue;
+                }
+                neighbours[i][f] = static_cast<Index>(match / NUM_FACES);
+                other = static_cast<Index>(i);
+            }
+            // release the bucket memory as soon as possible
+            std::vector<std::uint64_t>().swap(thread_buckets[p]);
+        }
+    });
+    if (non_manifold_faces) {
+        const std::size_t first = non_manifold_faces->size();
+        for (const auto& part: part_non_manifold) {
+            non_manifold_faces->insert(non_manifold_faces->end(), part.begin(), part.end());
+        }
+        std::sort(non_manifold_faces->begin() + static_cast<std::ptrdiff_t>(first),
+            non_manifold_faces->end());
+    }
+    return neighbours;
+}
+
 } // namespace mesh_neighbours
 #endif // MESH_NEIGHBOURS_
@@ -0,0 +1,143 @@
+/*
+###############################################################################
+#
+#  EGSnrc mesh space-filling curve ordering
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+*/
+
+#ifndef MESH_ORDER_
+#define MESH_ORDER_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// Space-filling curve orderings of points, used to renumber mesh elements
+/// so that elements close in space are close in memory.
+namespace mesh_order {
+
+/// Bits per axis of the curve codes. Three axes fit in a 64-bit code.
+constexpr unsigned CURVE_BITS = 21;
+
+/// A space-filling curve.
+enum class Curve {
+    /// Z-order: interleaved coordinate bits. Cheap, with jumps between octants.
+    Morton,
+    /// Hilbert curve: consecutive codes are always adjacent cells.
+    Hilbert
+};
+
+/// The Morton code of the cell (x, y, z), with coordinates below 2^CURVE_BITS.
+std::uint64_t morton_code(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+    // spread the bits of v so there are two zero bits between each
+    auto spread = [](std::uint64_t v) {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffULL;
+        v = (v | v << 16) & 0x1f0000ff0000ffULL;
+        v = (v | v << 8) & 0x100f00f00f00f00fULL;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+        v = (v | v << 2) & 0x1249249249249249ULL;
+        return v;
+    };
+    return spread(x) << 2 | spread(y) << 1 | spread(z);
+}
+
+/// The Hilbert code of the cell (x, y, z), with coordinates below 2^CURVE_BITS.
+///
+/// This is Skilling's transform of the coordinates into the "transposed"
+/// Hilbert index (J. Skilling, Programming the Hilbert curve, AIP Conf.
+/// Proc. 707, 2004), followed by bit interleaving.
+std::uint64_t hilbert_code(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+    std::uint32_t v[3] = {x, y, z};
+    const std::uint32_t top = std::uint32_t(1) << (CURVE_BITS - 1);
+    // inverse undo of the excess work
+    for (std::uint32_t q = top; q > 1; q >>= 1) {
+        const std::uint32_t p = q - 1;
+        for (int i = 0; i < 3; i++) {
+            if (v[i] & q) {
+                v[0] ^= p;
+            } else {
+                const std::uint32_t t = (v[0] ^ v[i]) & p;
+                v[0] ^= t;
+                v[i] ^= t;
+            }
+        }
+    }
+    // Gray encode
+    v[1] ^= v[0];
+    v[2] ^= v[1];
+    std::uint32_t t = 0;
+    for (std::uint32_t q = top; q > 1; q >>= 1) {
+        if (v[2] & q) {
+            t ^= q - 1;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        v[i] ^= t;
+    }
+    return morton_code(v[0], v[1], v[2]);
+}
+
+/// Returns the order of `points` along `curve`: element i of the result is
+/// the index of the i-th point on the curve. Points are quantized to a
+/// 2^CURVE_BITS grid over their bounding box, and points in the same cell
+/// keep their relative order.
+std::vector<std::size_t> curve_order(const std::vector<std::array<double, 3>>& points, Curve curve) {
+    std::array<double, 3> lo = {{0.0, 0.0, 0.0}};
+    std::array<double, 3> hi = {{0.0, 0.0, 0.0}};
+    if (!points.empty()) {
+        lo = points[0];
+        hi = points[0];
+    }
+    for (const auto& p: points) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], p[k]);
+            hi[k] = std::max(hi[k], p[k]);
+        }
+    }
+    const double max_cell = static_cast<double>((std::uint32_t(1) << CURVE_BITS) - 1);
+    std::array<double, 3> scale;
+    for (int k = 0; k < 3; k++) {
+        scale[k] = hi[k] > lo[k] ? max_cell / (hi[k] - lo[k]) : 0.0;
+    }
+    std::vector<std::pair<std::uint64_t, std::size_t>> codes(points.size());
+    for (std::size_t i = 0; i < points.size(); i++) {
+        std::uint32_t cell[3];
+        for (int k = 0; k < 3; k++) {
+            cell[k] = static_cast<std::uint32_t>((points[i][k] - lo[k]) * scale[k]);
+        }
+        codes[i].first = curve == Curve::Morton ? morton_code(cell[0], cell[1], cell[2])
+            : hilbert_code(cell[0], cell[1], cell[2]);
+        codes[i].second = i;
+    }
+    // ties are broken by the original index, so the order is deterministic
+    std::sort(codes.begin(), codes.end());
+    std::vector<std::size_t> order(points.size());
+    for (std::size_t i = 0; i < codes.size(); i++) {
+        order[i] = codes[i].second;
+    }
+    return order;
+}
+
+} // namespace mesh_order
+
+#endif // MESH_ORDER_
@@ -0,0 +1,103 @@
+/*
+###############################################################################
+#
+#  EGSnrc mesh threading helpers
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+*/
+
+#ifndef MESH_PARALLEL_
+#define MESH_PARALLEL_
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace mesh_parallel {
+
+/// Returns the number of hardware threads, or 1 if it can't be determined.
+unsigned default_num_threads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+/// Run `task(i)` for every i in [0, num_tasks) on up to `num_threads` threads.
+/// Threads pick up tasks in order as they finish earlier ones, so tasks can
+/// have uneven sizes. Passing 0 threads uses every hardware thread.
+///
+/// If tasks throw, the exception of the lowest-numbered failing task is
+/// rethrown on the calling thread once all threads have finished. Errors are
+/// therefore reported the same way as a serial loop over the tasks would.
+template <typename F>
+void parallel_tasks(std::size_t num_tasks, unsigned num_threads, F task) {
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    num_threads = static_cast<unsigned>(std::min<std::size_t>(num_threads, num_tasks));
+    std::vector<std::exception_ptr> errors(num_tasks);
+    std::atomic<std::size_t> next_task(0);
+    auto worker = [&]() {
+        for (std::size_t i = next_task++; i < num_tasks; i = next_task++) {
+            try {
+                task(i);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    // the calling thread is the last worker
+    for (unsigned t = 1; t < num_threads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t: threads) {
+        t.join();
+    }
+    for (const auto& err: errors) {
+        if (err) {
+            std::rethrow_exception(err);
+        }
+    }
+}
+
+/// Split [0, n) into `num_threads` contiguous ranges of nearly equal size and
+/// call `f(begin, end, thread)` for each range in parallel. Passing 0 threads
+/// uses every hardware thread. The range assigned to each thread only depends
+/// on `n` and `num_threads`.
+///
+/// Exceptions are rethrown like in parallel_tasks.
+template <typename F>
+void parallel_for(std::size_t n, unsigned num_threads, F f) {
+    if (num_threads == 0) {
+        num_threads = default_num_threads();
+    }
+    parallel_tasks(num_threads, num_threads, [&](std::size_t t) {
+        std::size_t begin = n * t / num_threads;
+        std::size_t end = n * (t + 1) / num_threads;
+        f(begin, end, static_cast<unsigned>(t));
+    });
+}
+
+} // namespace mesh_parallel
+
+#endif // MESH_PARALLEL_
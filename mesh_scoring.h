@@ -0,0 +1,368 @@
+/*
+###############################################################################
+#
+#  EGSnrc mesh per-element scoring
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+*/
+
+#ifndef MESH_SCORING_
+#define MESH_SCORING_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "mesh_parallel.h"
+
+/// Scoring of quantities such as the energy deposited in each mesh element.
+namespace mesh_scoring {
+
+namespace internal {
+
+/// An array split into pages of PAGE_SIZE values, which are allocated and
+/// value-initialized on first access, or all at construction in one block.
+///
+/// Each page is owned by its own slot of the page table, so different
+/// threads may touch different pages at the same time.
+template <typename T>
+class PagedArray {
+public:
+    static const std::size_t PAGE_BITS = 8;
+    static const std::size_t PAGE_SIZE = std::size_t(1) << PAGE_BITS;
+
+    PagedArray(std::size_t size, bool allocate_all) :
+        _size(size), _num_pages((size + PAGE_SIZE - 1) >> PAGE_BITS)
+    {
+        if (allocate_all) {
+            _block.reset(new T[_num_pages * PAGE_SIZE]());
+        } else {
+            _pages.resize(_num_pages);
+        }
+    }
+
+    std::size_t size() const {
+        return _size;
+    }
+    std::size_t num_pages() const {
+        return _num_pages;
+    }
+
+    /// Value `i`, allocating its page if needed.
+    T& operator[](std::size_t i) {
+        // dense arrays skip the page table
+        if (_block) {
+            return _block[i];
+        }
+        return touch_page(i >> PAGE_BITS)[i & (PAGE_SIZE - 1)];
+    }
+
+    /// Page `p`, allocating it if needed. Only page `p` is modified.
+    T* touch_page(std::size_t p) {
+        if (_block) {
+            return &_block[p * PAGE_SIZE];
+        }
+        if (!_pages[p]) {
+            _pages[p].reset(new T[PAGE_SIZE]());
+        }
+        return _pages[p].get();
+    }
+
+    /// Page `p`, or null if it was never touched.
+    T* page(std::size_t p) {
+        return _block ? &_block[p * PAGE_SIZE] : _pages[p].get();
+    }
+    const T* page(std::size_t p) const {
+        return _block ? &_block[p * PAGE_SIZE] : _pages[p].get();
+    }
+
+    std::size_t num_allocated_pages() const {
+        if (_block) {
+            return _num_pages;
+        }
+        std::size_t n = 0;
+        for (const auto& page: _pages) {
+            n += page ? 1 : 0;
+        }
+        return n;
+    }
+
+    /// Memory used by the allocated pages and the page table, in bytes.
+    std::size_t memory_bytes() const {
+        return num_allocated_pages() * PAGE_SIZE * sizeof(T) +
+            _pages.capacity() * sizeof(_pages[0]);
+    }
+
+private:
+    std::size_t _size;
+    std::size_t _num_pages;
+    // the pages, either in one block or allocated one by one
+    std::unique_ptr<T[]> _block;
+    std::vector<std::unique_ptr<T[]>> _pages;
+};
+
+} // namespace internal
+
+/// The mean of a per-history score and its standard error.
+struct Result {
+    double mean = 0.0;
+    double uncertainty = 0.0;
+};
+
+/// The results of the elements that were scored in, sorted by element.
+struct SparseResults {
+    std::vector<std::size_t> elements;
+    std::vector<Result> results;
+};
+
+/// How ElementScorer stores per-element values.
+enum class Layout {
+    /// Every element, allocated up front: 32 bytes per element per thread.
+    Dense,
+    /// Pages of 256 elements allocated when an element in them is first
+    /// scored, for large meshes with localized deposition. Scoring is as
+    /// fast once the pages are allocated, and the page table only takes 8
+    /// bytes per 256 elements. Elements are best reordered along a
+    /// space-filling curve (see EGS_Mesh::Options::reorder) so that
+    /// deposition regions touch few pages.
+    Paged
+};
+
+/// Energy deposition scoring by element index, with history-by-history
+/// uncertainties, for a fixed number of scoring threads.
+///
+/// Each thread scores into its own Tally, so threads never write to the same
+/// memory while scoring, and reduce() adds the tallies into the totals at the
+/// end of a batch. The uncertainty of a per-history mean needs the sum of
+/// squares of whole histories, not of single deposits, so each element of a
+/// tally keeps the energy of the last history that scored in it. That
+/// energy is moved into the sums when a later history scores in the element,
+/// or by reduce(), which makes starting a history free whatever the number
+/// of elements.
+///
+/// A dense tally takes 32 bytes per element, see Layout for the paged
+/// alternative.
+class ElementScorer {
+public:
+    /// The scores of one thread. Only that thread may use it.
+    class Tally {
+    public:
+        /// Start the next history. Scores belong to the last started history.
+        void start_history() {
+            _history++;
+            _num_histories++;
+        }
+
+        /// Add `energy` to element `element` for the current history.
+        void score(int element, double energy) {
+            Accumulator& a = _elements[static_cast<std::size_t>(element)];
+            if (a.history != _history) {
+                a.sum += a.pending;
+                a.sum_squares += a.pending * a.pending;
+                a.pending = 0.0;
+                a.history = _history;
+            }
+            a.pending += energy;
+        }
+
+        /// The number of histories started since the last reduce().
+        std::uint64_t num_histories() const {
+            return _num_histories;
+        }
+
+    private:
+        friend class ElementScorer;
+
+        struct Accumulator {
+            // energy of the history `history`, not yet in the sums
+            double pending = 0.0;
+            double sum = 0.0;
+            double sum_squares = 0.0;
+            std::uint64_t history = 0;
+        };
+
+        Tally(std::size_t num_elements, Layout layout) :
+            _elements(num_elements, layout == Layout::Dense) {}
+
+        internal::PagedArray<Accumulator> _elements;
+        std::uint64_t _history = 0;
+        std::uint64_t _num_histories = 0;
+        // keeps the counters of different threads off the same cache line
+        char _padding[64];
+    };
+
+    /// A scorer for `num_elements` elements and `num_threads` scoring
+    /// threads. Passing 0 threads makes one tally per hardware thread. The
+    /// tallies and the reduced totals are stored with `layout`.
+    ElementScorer(std::size_t num_elements, unsigned num_threads, Layout layout = Layout::Dense) :
+        _layout(layout), _totals(num_elements, layout == Layout::Dense)
+    {
+        if (num_threads == 0) {
+            num_threads = mesh_parallel::default_num_threads();
+        }
+        for (unsigned t = 0; t < num_threads; t++) {
+            _tallies.emplace_back(new Tally(num_elements, layout));
+        }
+    }
+
+    std::size_t num_elements() const {
+        return _totals.size();
+    }
+    Layout layout() const {
+        return _layout;
+    }
+    unsigned num_threads() const {
+        return static_cast<unsigned>(_tallies.size());
+    }
+
+    /// The tally of scoring thread `t`, 0 <= t < num_threads().
+    Tally& tally(unsigned t) {
+        return *_tallies[t];
+    }
+
+    /// Add every tally into the totals and clear them, with each of
+    /// `num_threads` threads (0 for every hardware thread) reducing a range
+    /// of pages. Call between batches, when no thread is scoring: pending
+    /// history energies are taken as complete. Tally pages stay allocated
+    /// for the next batch.
+    void reduce(unsigned num_threads = 0) {
+        const std::size_t page_size = internal::PagedArray<Total>::PAGE_SIZE;
+        mesh_parallel::parallel_for(_totals.num_pages(), num_threads,
+            [&](std::size_t begin, std::size_t end, unsigned)
+        {
+            for (std::size_t p = begin; p < end; p++) {
+                for (auto& tally: _tallies) {
+                    Tally::Accumulator* elements = tally->_elements.page(p);
+                    if (!elements) {
+                        continue;
+                    }
+                    Total* totals = _totals.touch_page(p);
+                    for (std::size_t k = 0; k < page_size; k++) {
+                        Tally::Accumulator& a = elements[k];
+                        totals[k].sum += a.sum + a.pending;
+                        totals[k].sum_squares += a.sum_squares + a.pending * a.pending;
+                        a = Tally::Accumulator();
+                    }
+                }
+            }
+        });
+        for (auto& tally: _tallies) {
+            _num_histories += tally->_num_histories;
+            tally->_num_histories = 0;
+        }
+    }
+
+    /// The number of histories reduced so far.
+    std::uint64_t num_histories() const {
+        return _num_histories;
+    }
+
+    /// The reduced sum of the scores of element `i`.
+    double sum(std::size_t i) const {
+        return total(i).sum;
+    }
+    /// The reduced sum of the squared per-history scores of element `i`.
+    double sum_squares(std::size_t i) const {
+        return total(i).sum_squares;
+    }
+
+    /// The mean score per history of element `i` and its standard error.
+    /// The uncertainty is infinite with fewer than two histories.
+    Result result(std::size_t i) const {
+        return result(total(i));
+    }
+
+    /// The results of every element, see result(i).
+    std::vector<Result> results() const {
+        std::vector<Result> all(num_elements());
+        for (std::size_t i = 0; i < all.size(); i++) {
+            all[i] = result(i);
+        }
+        return all;
+    }
+
+    /// The results of the elements with a non-zero sum, in a compressed
+    /// form whose size only depends on the number of elements scored in.
+    SparseResults sparse_results() const {
+        const std::size_t page_size = internal::PagedArray<Total>::PAGE_SIZE;
+        SparseResults sparse;
+        for (std::size_t p = 0; p < _totals.num_pages(); p++) {
+            const Total* totals = _totals.page(p);
+            if (!totals) {
+                continue;
+            }
+            for (std::size_t k = 0; k < page_size && p * page_size + k < num_elements(); k++) {
+                if (totals[k].sum != 0.0) {
+                    sparse.elements.push_back(p * page_size + k);
+                    sparse.results.push_back(result(totals[k]));
+                }
+            }
+        }
+        return sparse;
+    }
+
+    /// Memory used by the tallies and the totals, in bytes.
+    std::size_t memory_bytes() const {
+        std::size_t bytes = _totals.memory_bytes();
+        for (const auto& tally: _tallies) {
+            bytes += tally->_elements.memory_bytes();
+        }
+        return bytes;
+    }
+
+private:
+    struct Total {
+        double sum = 0.0;
+        double sum_squares = 0.0;
+    };
+
+    // the total of element `i`, zero if its page was never scored in
+    const Total& total(std::size_t i) const {
+        static const Total zero;
+        const Total* page = _totals.page(i >> internal::PagedArray<Total>::PAGE_BITS);
+        return page ? page[i & (internal::PagedArray<Total>::PAGE_SIZE - 1)] : zero;
+    }
+
+    Result result(const Total& total) const {
+        Result r;
+        const double n = static_cast<double>(_num_histories);
+        if (_num_histories > 0) {
+            r.mean = total.sum / n;
+        }
+        if (_num_histories < 2) {
+            r.uncertainty = std::numeric_limits<double>::infinity();
+            return r;
+        }
+        const double variance = (total.sum_squares / n - r.mean * r.mean) / (n - 1.0);
+        r.uncertainty = variance > 0.0 ? std::sqrt(variance) : 0.0;
+        return r;
+    }
+
+    Layout _layout;
+    std::vector<std::unique_ptr<Tally>> _tallies;
+    internal::PagedArray<Total> _totals;
+    std::uint64_t _num_histories = 0;
+};
+
+} // namespace mesh_scoring
+
+#endif // MESH_SCORING_
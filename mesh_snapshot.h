@@ -0,0 +1,546 @@
+/*
+###############################################################################
+#
+#  EGSnrc mesh binary snapshots
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+*/
+
+#ifndef MESH_SNAPSHOT_
+#define MESH_SNAPSHOT_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "egs_mesh.h"
+#include "mesh_io.h"
+#include "mesh_validation.h"
+
+/// Binary snapshots of a built EGS_Mesh, so a mesh can be loaded again
+/// without parsing the msh file or recomputing any derived array.
+///
+/// A snapshot holds every array of the mesh (elements, nodes, media,
+/// neighbours, face planes, hierarchies, ...) in its in-memory layout, each
+/// aligned to 64 bytes. Loading memory-maps the file and the mesh arrays
+/// point straight into the mapping: nothing is parsed or copied except the
+/// medium names. The mapping stays alive as long as the mesh, or any copy
+/// of it, does.
+///
+/// Snapshots are a cache, not an exchange format. They are only readable by
+/// the same version of this code on the same kind of machine, and record
+/// the content hash of the msh file they were built from so stale snapshots
+/// are detected, and a hash of their own contents so damaged ones are.
+namespace mesh_snapshot {
+
+/// Format version, incremented whenever the layout of any stored array changes.
+const std::uint32_t VERSION = 5;
+
+/// The mesh_snapshot::internal namespace is for internal API functions and is
+/// not part of the public API. Functions and types may change without warning.
+namespace internal {
+
+const char MAGIC[8] = {'E', 'G', 'S', 'M', 'E', 'S', 'H', '\0'};
+// written as a native integer, to detect snapshots from other byte orders
+const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+const std::size_t ALIGNMENT = 64;
+
+enum Section {
+    ELEMENTS,
+    NODES,
+    MATERIALS,
+    ORIGINAL_INDEX,
+    VERTICES,
+    PLANES,
+    MEDIA,
+    NEIGHBOURS,
+    BVH_NODES,
+    BVH_PRIMITIVES,
+    BOUNDARY_FACES,
+    BOUNDARY_BVH_NODES,
+    BOUNDARY_BVH_PRIMITIVES,
+    CONNECTIVITY,
+    NODE_TAG_TABLE,
+    NODE_TAG_SLOTS,
+    ELEMENT_TAG_TABLE,
+    ELEMENT_TAG_SLOTS,
+    NON_MANIFOLD_FACES,
+    VALIDATION_SUMMARY,
+    VALIDATION_DIAGNOSTICS,
+    NUM_SECTIONS
+};
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint64_t source_hash;
+    std::uint64_t file_size;
+    std::uint32_t reorder;
+    std::uint32_t num_sections;
+    double location_tolerance;
+    // first tags of the node and element tag tables
+    std::int32_t node_min_tag;
+    std::int32_t element_min_tag;
+    // see payload_hash
+    std::uint64_t payload_hash;
+};
+
+// The validation report of the saved mesh without its diagnostics, stored
+// once if the mesh was validated, so loading doesn't check every element again.
+struct ValidationSummary {
+    std::uint64_t counts[mesh_validation::NUM_KINDS];
+    double min_quality;
+    double total_volume;
+    std::uint32_t faces_checked;
+    std::uint32_t padding;
+};
+
+// A kept diagnostic without its message, which is rebuilt from the mesh.
+struct PackedDiagnostic {
+    std::int32_t kind;
+    std::int32_t index;
+    std::int32_t face;
+    std::int32_t padding;
+    double quality;
+};
+
+struct SectionEntry {
+    std::uint64_t offset;
+    std::uint64_t count;
+    std::uint64_t value_size;
+};
+
+// The XXH64 of the section table, then of each section in turn, seeded
+// with the hash so far, so that damage to anything loading reads is
+// detected. The padding between sections is never read and isn't covered.
+std::uint64_t payload_hash(const SectionEntry* entries, const char* const* data) {
+    std::uint64_t hash = mesh_io::content_hash(reinterpret_cast<const char*>(entries),
+        NUM_SECTIONS * sizeof(SectionEntry));
+    for (std::size_t s = 0; s < NUM_SECTIONS; s++) {
+        hash = mesh_io::content_hash(data[s], static_cast<std::size_t>(entries[s].count * entries[s].value_size),
+            hash);
+    }
+    return hash;
+}
+
+std::size_t align_up(std::size_t offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// The nodes in the layout of EGS_Mesh::Node, with the padding after the
+// tag zeroed rather than copied, so snapshots of a mesh are the same byte
+// for byte and don't pick up stray memory.
+std::vector<char> pack_nodes(const mesh_io::SharedArray<EGS_Mesh::Node>& nodes) {
+    std::vector<char> bytes(nodes.size() * sizeof(EGS_Mesh::Node), 0);
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+        char* record = &bytes[i * sizeof(EGS_Mesh::Node)];
+        const EGS_Mesh::Node& n = nodes[i];
+        std::memcpy(record + offsetof(EGS_Mesh::Node, tag), &n.tag, sizeof(n.tag));
+        std::memcpy(record + offsetof(EGS_Mesh::Node, x), &n.x, sizeof(n.x));
+        std::memcpy(record + offsetof(EGS_Mesh::Node, y), &n.y, sizeof(n.y));
+        std::memcpy(record + offsetof(EGS_Mesh::Node, z), &n.z, sizeof(n.z));
+    }
+    return bytes;
+}
+
+// Medium tags and names as a byte blob: per medium, a 32-bit tag, a 32-bit
+// name length and the name.
+std::vector<char> pack_materials(const std::vector<EGS_Mesh::Medium>& materials) {
+    std::vector<char> bytes;
+    for (const auto& m: materials) {
+        const std::int32_t tag = m.tag;
+        const std::uint32_t len = static_cast<std::uint32_t>(m.medium_name.size());
+        const char* tag_bytes = reinterpret_cast<const char*>(&tag);
+        const char* len_bytes = reinterpret_cast<const char*>(&len);
+        bytes.insert(bytes.end(), tag_bytes, tag_bytes + sizeof(tag));
+        bytes.insert(bytes.end(), len_bytes, len_bytes + sizeof(len));
+        bytes.insert(bytes.end(), m.medium_name.begin(), m.medium_name.end());
+    }
+    return bytes;
+}
+
+std::vector<EGS_Mesh::Medium> unpack_materials(const char* p, std::size_t size) {
+    std::vector<EGS_Mesh::Medium> materials;
+    const char* end = p + size;
+    while (p != end) {
+        std::int32_t tag = 0;
+        std::uint32_t len = 0;
+        if (end - p < static_cast<std::ptrdiff_t>(sizeof(tag) + sizeof(len))) {
+            throw std::runtime_error("corrupt medium table");
+        }
+        std::memcpy(&tag, p, sizeof(tag));
+        std::memcpy(&len, p + sizeof(tag), sizeof(len));
+        p += sizeof(tag) + sizeof(len);
+        if (static_cast<std::size_t>(end - p) < len) {
+            throw std::runtime_error("corrupt medium table");
+        }
+        materials.push_back(EGS_Mesh::Medium(tag, std::string(p, len)));
+        p += len;
+    }
+    return materials;
+}
+
+// Reads and writes the private arrays of EGS_Mesh.
+class MeshAccess {
+public:
+    static void save(const EGS_Mesh& mesh, std::ostream& out, std::uint64_t source_hash) {
+        const std::vector<char> materials = pack_materials(mesh._materials);
+        const std::vector<char> nodes = pack_nodes(mesh._nodes);
+        std::vector<std::pair<const void*, SectionEntry>> sections(NUM_SECTIONS);
+        auto add = [&](Section s, const void* data, std::size_t count, std::size_t value_size) {
+            sections[s].first = data;
+            sections[s].second.count = count;
+            sections[s].second.value_size = value_size;
+        };
+        add(ELEMENTS, mesh._elements.data(), mesh._elements.size(), sizeof(EGS_Mesh::Tetrahedron));
+        add(NODES, nodes.data(), mesh._nodes.size(), sizeof(EGS_Mesh::Node));
+        add(MATERIALS, materials.data(), materials.size(), 1);
+        add(ORIGINAL_INDEX, mesh._original_index.data(), mesh._original_index.size(), sizeof(int));
+        add(VERTICES, mesh._vertices.data(), mesh._vertices.size(), sizeof(double));
+        add(PLANES, mesh._planes.data(), mesh._planes.size(), sizeof(double));
+        add(MEDIA, mesh._media.data(), mesh._media.size(), sizeof(int));
+        const EGS_Mesh::Topology& topology = mesh.topology();
+        add(NEIGHBOURS, topology.neighbours.data(), topology.neighbours.size(), sizeof(std::array<int, 4>));
+        add(BVH_NODES, mesh._bvh.nodes().data(), mesh._bvh.nodes().size(),
+            sizeof(mesh_bvh::BVH::Node));
+        add(BVH_PRIMITIVES, mesh._bvh.primitives().data(), mesh._bvh.primitives().size(),
+            sizeof(std::uint32_t));
+        add(BOUNDARY_FACES, topology.boundary_faces.data(), topology.boundary_faces.size(),
+            sizeof(EGS_Mesh::BoundaryFace));
+        add(BOUNDARY_BVH_NODES, topology.boundary_bvh.nodes().data(), topology.boundary_bvh.nodes().size(),
+            sizeof(mesh_bvh::BVH::Node));
+        add(BOUNDARY_BVH_PRIMITIVES, topology.boundary_bvh.primitives().data(),
+            topology.boundary_bvh.primitives().size(), sizeof(std::uint32_t));
+        add(CONNECTIVITY, mesh._connectivity.data(), mesh._connectivity.size(), sizeof(std::array<int, 4>));
+        add(NODE_TAG_TABLE, mesh._node_index.table().data(), mesh._node_index.table().size(), sizeof(int));
+        add(NODE_TAG_SLOTS, mesh._node_index.slots().data(), mesh._node_index.slots().size(),
+            sizeof(mesh_tags::TagIndex::Entry));
+        add(ELEMENT_TAG_TABLE, mesh._element_index.table().data(), mesh._element_index.table().size(),
+            sizeof(int));
+        add(ELEMENT_TAG_SLOTS, mesh._element_index.slots().data(), mesh._element_index.slots().size(),
+            sizeof(mesh_tags::TagIndex::Entry));
+        add(NON_MANIFOLD_FACES, topology.non_manifold_faces.data(), topology.non_manifold_faces.size(),
+            sizeof(std::array<int, 2>));
+        std::vector<ValidationSummary> summary;
+        std::vector<PackedDiagnostic> diagnostics;
+        if (mesh._validation) {
+            const mesh_validation::Report& report = *mesh._validation;
+            summary.push_back(ValidationSummary());
+            for (std::size_t k = 0; k < mesh_validation::NUM_KINDS; k++) {
+                summary[0].counts[k] = report.counts[k];
+            }
+            summary[0].min_quality = report.min_quality;
+            summary[0].total_volume = report.total_volume;
+            summary[0].faces_checked = report.faces_checked ? 1 : 0;
+            for (const auto& d: report.diagnostics) {
+                PackedDiagnostic packed = PackedDiagnostic();
+                packed.kind = static_cast<std::int32_t>(d.kind);
+                packed.index = d.index;
+                packed.face = d.face;
+                packed.quality = d.quality;
+                diagnostics.push_back(packed);
+            }
+        }
+        add(VALIDATION_SUMMARY, summary.data(), summary.size(), sizeof(ValidationSummary));
+        add(VALIDATION_DIAGNOSTICS, diagnostics.data(), diagnostics.size(), sizeof(PackedDiagnostic));
+
+        std::size_t offset = align_up(sizeof(Header) + NUM_SECTIONS * sizeof(SectionEntry));
+        for (auto& s: sections) {
+            s.second.offset = offset;
+            offset = align_up(offset + s.second.count * s.second.value_size);
+        }
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.byte_order = BYTE_ORDER_MARK;
+        header.source_hash = source_hash;
+        header.file_size = offset;
+        header.reorder = static_cast<std::uint32_t>(mesh._options.reorder);
+        header.num_sections = NUM_SECTIONS;
+        header.location_tolerance = mesh._location_tolerance;
+        header.node_min_tag = mesh._node_index.min_tag();
+        header.element_min_tag = mesh._element_index.min_tag();
+        SectionEntry entries[NUM_SECTIONS];
+        const char* data[NUM_SECTIONS];
+        for (std::size_t s = 0; s < NUM_SECTIONS; s++) {
+            entries[s] = sections[s].second;
+            data[s] = static_cast<const char*>(sections[s].first);
+        }
+        header.payload_hash = payload_hash(entries, data);
+
+        std::size_t written = 0;
+        auto write = [&](const void* data, std::size_t size) {
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+            written += size;
+        };
+        auto pad = [&](std::size_t to) {
+            static const char zeros[ALIGNMENT] = {};
+            write(zeros, to - written);
+        };
+        write(&header, sizeof(header));
+        for (const auto& s: sections) {
+            write(&s.second, sizeof(SectionEntry));
+        }
+        for (const auto& s: sections) {
+            pad(s.second.offset);
+            write(s.first, s.second.count * s.second.value_size);
+        }
+        pad(offset);
+    }
+
+    static EGS_Mesh load(std::shared_ptr<const mesh_io::MappedFile> file, std::uint64_t source_hash,
+        const EGS_Mesh::Options& options)
+    {
+        const char* base = file->data();
+        const std::size_t size = file->size();
+        if (size < sizeof(Header) + NUM_SECTIONS * sizeof(SectionEntry)) {
+            throw std::runtime_error("file is too small to be a mesh snapshot");
+        }
+        Header header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+            throw std::runtime_error("not a mesh snapshot");
+        }
+        if (header.version != VERSION || header.byte_order != BYTE_ORDER_MARK ||
+            header.num_sections != NUM_SECTIONS)
+        {
+            throw std::runtime_error("snapshot version " + std::to_string(header.version) +
+                " is not readable by version " + std::to_string(VERSION));
+        }
+        if (header.file_size != size) {
+            throw std::runtime_error("snapshot is truncated");
+        }
+        if (header.source_hash != source_hash) {
+            throw std::runtime_error("snapshot was built from a different msh file");
+        }
+        if (header.reorder != static_cast<std::uint32_t>(options.reorder)) {
+            throw std::runtime_error("snapshot was built with different options");
+        }
+        SectionEntry sections[NUM_SECTIONS];
+        std::memcpy(sections, base + sizeof(Header), sizeof(sections));
+        // only the bounds of the sections here, their value sizes are
+        // checked as they are read
+        const char* data[NUM_SECTIONS];
+        for (std::size_t s = 0; s < NUM_SECTIONS; s++) {
+            const SectionEntry& e = sections[s];
+            if (e.offset > size || (e.value_size != 0 && (size - e.offset) / e.value_size < e.count) ||
+                (e.value_size == 0 && e.count != 0))
+            {
+                throw std::runtime_error("corrupt snapshot section " + std::to_string(s));
+            }
+            data[s] = base + e.offset;
+        }
+        if (payload_hash(sections, data) != header.payload_hash) {
+            throw std::runtime_error("snapshot is corrupt");
+        }
+
+        // the data of section `s`, checking its bounds and value size
+        auto view = [&](Section s, std::size_t value_size) {
+            const SectionEntry& e = sections[s];
+            if (e.value_size != value_size || e.offset % ALIGNMENT != 0 || e.offset > size ||
+                (e.count != 0 && (size - e.offset) / e.value_size < e.count))
+            {
+                throw std::runtime_error("corrupt snapshot section " + std::to_string(s));
+            }
+            return base + e.offset;
+        };
+
+        EGS_Mesh mesh;
+        mesh._options = options;
+        mesh._location_tolerance = header.location_tolerance;
+        mesh._materials = unpack_materials(view(MATERIALS, 1), sections[MATERIALS].count);
+        share(file, mesh._elements, view(ELEMENTS, sizeof(EGS_Mesh::Tetrahedron)), sections[ELEMENTS]);
+        share(file, mesh._nodes, view(NODES, sizeof(EGS_Mesh::Node)), sections[NODES]);
+        share(file, mesh._original_index, view(ORIGINAL_INDEX, sizeof(int)), sections[ORIGINAL_INDEX]);
+        share(file, mesh._vertices, view(VERTICES, sizeof(double)), sections[VERTICES]);
+        share(file, mesh._planes, view(PLANES, sizeof(double)), sections[PLANES]);
+        share(file, mesh._media, view(MEDIA, sizeof(int)), sections[MEDIA]);
+        mesh._topology = std::make_shared<EGS_Mesh::Topology>();
+        EGS_Mesh::Topology& topology = *mesh._topology;
+        share(file, topology.neighbours, view(NEIGHBOURS, sizeof(std::array<int, 4>)), sections[NEIGHBOURS]);
+        share(file, topology.boundary_faces, view(BOUNDARY_FACES, sizeof(EGS_Mesh::BoundaryFace)),
+            sections[BOUNDARY_FACES]);
+        share(file, topology.non_manifold_faces, view(NON_MANIFOLD_FACES, sizeof(std::array<int, 2>)),
+            sections[NON_MANIFOLD_FACES]);
+        mesh_io::SharedArray<mesh_bvh::BVH::Node> bvh_nodes, boundary_bvh_nodes;
+        mesh_io::SharedArray<std::uint32_t> bvh_prims, boundary_bvh_prims;
+        share(file, bvh_nodes, view(BVH_NODES, sizeof(mesh_bvh::BVH::Node)), sections[BVH_NODES]);
+        share(file, bvh_prims, view(BVH_PRIMITIVES, sizeof(std::uint32_t)), sections[BVH_PRIMITIVES]);
+        share(file, boundary_bvh_nodes, view(BOUNDARY_BVH_NODES, sizeof(mesh_bvh::BVH::Node)),
+            sections[BOUNDARY_BVH_NODES]);
+        share(file, boundary_bvh_prims, view(BOUNDARY_BVH_PRIMITIVES, sizeof(std::uint32_t)),
+            sections[BOUNDARY_BVH_PRIMITIVES]);
+        mesh._bvh = mesh_bvh::BVH(bvh_nodes, bvh_prims);
+        topology.boundary_bvh = mesh_bvh::BVH(boundary_bvh_nodes, boundary_bvh_prims);
+        topology.built = true;
+        share(file, mesh._connectivity, view(CONNECTIVITY, sizeof(std::array<int, 4>)), sections[CONNECTIVITY]);
+        mesh_io::SharedArray<int> node_table, element_table;
+        mesh_io::SharedArray<mesh_tags::TagIndex::Entry> node_slots, element_slots;
+        share(file, node_table, view(NODE_TAG_TABLE, sizeof(int)), sections[NODE_TAG_TABLE]);
+        share(file, node_slots, view(NODE_TAG_SLOTS, sizeof(mesh_tags::TagIndex::Entry)),
+            sections[NODE_TAG_SLOTS]);
+        share(file, element_table, view(ELEMENT_TAG_TABLE, sizeof(int)), sections[ELEMENT_TAG_TABLE]);
+        share(file, element_slots, view(ELEMENT_TAG_SLOTS, sizeof(mesh_tags::TagIndex::Entry)),
+            sections[ELEMENT_TAG_SLOTS]);
+        mesh._node_index = mesh_tags::TagIndex(header.node_min_tag, node_table, node_slots);
+        mesh._element_index = mesh_tags::TagIndex(header.element_min_tag, element_table, element_slots);
+        // there are only a few media, so their index is rebuilt
+        mesh._material_index = mesh_tags::TagIndex::build(mesh._materials.data(), mesh._materials.size(), "medium");
+
+        // cheap consistency checks, so a damaged file fails here rather than in transport
+        const std::size_t num_elts = mesh._elements.size();
+        if (mesh._vertices.size() != EGS_Mesh::VERTEX_STRIDE * num_elts ||
+            mesh._planes.size() != EGS_Mesh::PLANE_STRIDE * num_elts ||
+            mesh._media.size() != num_elts || topology.neighbours.size() != num_elts ||
+            mesh._connectivity.size() != num_elts ||
+            (!node_table.empty() && !node_slots.empty()) ||
+            (!element_table.empty() && !element_slots.empty()) ||
+            (node_slots.size() & (node_slots.size() - 1)) != 0 ||
+            (element_slots.size() & (element_slots.size() - 1)) != 0 ||
+            (!mesh._original_index.empty() && mesh._original_index.size() != num_elts) ||
+            mesh._bvh.num_primitives() != num_elts ||
+            topology.boundary_bvh.num_primitives() != topology.boundary_faces.size())
+        {
+            throw std::runtime_error("snapshot arrays have inconsistent sizes");
+        }
+        if (options.validate) {
+            // the stored report, unless it lacks checks these options ask for
+            const auto* summary = reinterpret_cast<const ValidationSummary*>(
+                view(VALIDATION_SUMMARY, sizeof(ValidationSummary)));
+            if (sections[VALIDATION_SUMMARY].count == 1 && (summary->faces_checked || options.lazy_neighbours)) {
+                const auto* packed = reinterpret_cast<const PackedDiagnostic*>(
+                    view(VALIDATION_DIAGNOSTICS, sizeof(PackedDiagnostic)));
+                load_validation(mesh, *summary, packed, sections[VALIDATION_DIAGNOSTICS].count);
+            } else {
+                mesh.validate_built();
+            }
+        }
+        return mesh;
+    }
+
+private:
+    static void load_validation(EGS_Mesh& mesh, const ValidationSummary& summary,
+        const PackedDiagnostic* packed, std::size_t num_packed)
+    {
+        auto report = std::make_shared<mesh_validation::Report>();
+        for (std::size_t k = 0; k < mesh_validation::NUM_KINDS; k++) {
+            report->counts[k] = static_cast<std::size_t>(summary.counts[k]);
+        }
+        report->min_quality = summary.min_quality;
+        report->total_volume = summary.total_volume;
+        report->faces_checked = summary.faces_checked != 0;
+        for (std::size_t i = 0; i < num_packed; i++) {
+            mesh_validation::Diagnostic d;
+            d.kind = static_cast<mesh_validation::Kind>(packed[i].kind);
+            d.index = packed[i].index;
+            d.face = packed[i].face;
+            d.quality = packed[i].quality;
+            // the index must be valid to name the tags in the message
+            const std::size_t limit =
+                d.kind == mesh_validation::Kind::UnusedNode ? mesh._nodes.size() :
+                d.kind == mesh_validation::Kind::UnusedMedium ? mesh._materials.size() : mesh._elements.size();
+            if (packed[i].kind < 0 || static_cast<std::size_t>(packed[i].kind) >= mesh_validation::NUM_KINDS ||
+                d.index < 0 || static_cast<std::size_t>(d.index) >= limit || d.face < -1 || d.face > 3)
+            {
+                throw std::runtime_error("corrupt snapshot validation report");
+            }
+            d.message = mesh_validation::internal::message(mesh, d);
+            report->diagnostics.push_back(std::move(d));
+        }
+        report->throw_if_errors();
+        mesh._validation = std::move(report);
+    }
+
+    template <typename T>
+    static void share(const std::shared_ptr<const mesh_io::MappedFile>& file,
+        mesh_io::SharedArray<T>& array, const char* data, const SectionEntry& entry)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot arrays must be trivially copyable");
+        array = mesh_io::SharedArray<T>(file, reinterpret_cast<const T*>(data),
+            static_cast<std::size_t>(entry.count));
+    }
+};
+
+} // namespace mesh_snapshot::internal
+
+/// Write a snapshot of `mesh` to `path`. `source_hash` identifies the msh
+/// file the mesh was built from, see mesh_io::file_hash.
+///
+/// The snapshot is written to a temporary file which is then renamed, so
+/// concurrent jobs writing the same snapshot never see a partial file.
+///
+/// Throws a std::runtime_error if the file can't be written.
+void save_snapshot(const EGS_Mesh& mesh, const std::string& path, std::uint64_t source_hash) {
+    std::string tmp_path = path + ".tmp";
+#ifdef MESH_IO_HAVE_MMAP
+    tmp_path += std::to_string(::getpid());
+#endif
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("couldn't open `" + tmp_path + "` for writing");
+        }
+        internal::MeshAccess::save(mesh, out, source_hash);
+        out.close();
+        if (!out) {
+            std::remove(tmp_path.c_str());
+            throw std::runtime_error("couldn't write snapshot `" + tmp_path + "`");
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("couldn't rename `" + tmp_path + "` to `" + path + "`");
+    }
+}
+
+/// Load a snapshot written by save_snapshot. The snapshot must have been
+/// written from a msh file with content hash `source_hash`, by a mesh built
+/// with `options`.
+///
+/// The mesh arrays are views into the memory-mapped file. The validation
+/// report of a mesh saved with EGS_Mesh::Options::validate is stored with
+/// it, so loading it with the option set doesn't check every element again,
+/// and other snapshots are validated like a built mesh.
+///
+/// Throws a std::runtime_error if the file can't be read, isn't a snapshot
+/// of this version, is damaged, doesn't match `source_hash` and `options`,
+/// or if validation finds errors.
+EGS_Mesh load_snapshot(const std::string& path, std::uint64_t source_hash,
+    const EGS_Mesh::Options& options = EGS_Mesh::Options())
+{
+    std::shared_ptr<const mesh_io::MappedFile> file(new mesh_io::MappedFile(path));
+    try {
+        return internal::MeshAccess::load(file, source_hash, options);
+    } catch (const std::runtime_error& err) {
+        throw std::runtime_error("couldn't load mesh snapshot `" + path + "`: " + err.what());
+    }
+}
+
+} // namespace mesh_snapshot
+
+#endif // MESH_SNAPSHOT_
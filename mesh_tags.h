@@ -0,0 +1,187 @@
+/*
+###############################################################################
+#
+#  EGSnrc mesh tag to index lookup tables
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+*/
+
+#ifndef MESH_TAGS_
+#define MESH_TAGS_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mesh_io.h"
+
+/// Lookup tables from Gmsh tags (node, element and physical group numbers)
+/// to 0-based array indices.
+namespace mesh_tags {
+
+/// Maps tags to the indices of the values they were read from.
+///
+/// Gmsh tags are usually numbered densely from 1, so the index is looked up
+/// in a table over the range of tags, with -1 for unused tags. If the tags
+/// are sparse, i.e. the range is more than four times the number of tags,
+/// the (tag, index) pairs go in an open-addressing hash table with linear
+/// probing instead, so the table never takes much more memory than the
+/// hashed pairs. Both are flat arrays, so they can be mapped from a mesh
+/// snapshot as they are.
+///
+/// Negative tags mean "no tag" and aren't indexed.
+class TagIndex {
+public:
+    /// A (tag, index) slot of a sparse index, {-1, -1} if unused.
+    using Entry = std::array<int, 2>;
+
+    /// An empty index.
+    TagIndex() = default;
+
+    /// An index from its arrays, e.g. loaded from a mesh snapshot: a table
+    /// of indices starting at `min_tag`, or hashed slots, not both. The
+    /// number of slots must be zero or a power of two.
+    TagIndex(int min_tag, mesh_io::SharedArray<int> table, mesh_io::SharedArray<Entry> slots) :
+        _min_tag(min_tag), _table(std::move(table)), _slots(std::move(slots)) {}
+
+    /// Index the `tag` members of `count` values. `name` describes the
+    /// values in error messages, e.g. "node".
+    ///
+    /// Throws a std::runtime_error if a tag is repeated.
+    template <typename T>
+    static TagIndex build(const T* values, std::size_t count, const std::string& name) {
+        std::size_t num_tags = 0;
+        int min_tag = 0;
+        int max_tag = -1;
+        for (std::size_t i = 0; i < count; i++) {
+            const int tag = values[i].tag;
+            if (tag < 0) {
+                continue;
+            }
+            min_tag = num_tags == 0 ? tag : std::min(min_tag, tag);
+            max_tag = num_tags == 0 ? tag : std::max(max_tag, tag);
+            num_tags++;
+        }
+        if (num_tags == 0) {
+            return TagIndex();
+        }
+        const std::size_t range = static_cast<std::size_t>(max_tag) - static_cast<std::size_t>(min_tag) + 1;
+        if (range <= 4 * num_tags) {
+            std::vector<int> table(range, -1);
+            for (std::size_t i = 0; i < count; i++) {
+                const int tag = values[i].tag;
+                if (tag < 0) {
+                    continue;
+                }
+                int& index = table[static_cast<std::size_t>(tag - min_tag)];
+                if (index != -1) {
+                    throw_duplicate(name, tag);
+                }
+                index = static_cast<int>(i);
+            }
+            return TagIndex(min_tag, std::move(table), mesh_io::SharedArray<Entry>());
+        }
+        // at most half full, so probe sequences stay short
+        std::size_t num_slots = 1;
+        while (num_slots < 2 * num_tags) {
+            num_slots *= 2;
+        }
+        std::vector<Entry> slots(num_slots, Entry{{-1, -1}});
+        for (std::size_t i = 0; i < count; i++) {
+            const int tag = values[i].tag;
+            if (tag < 0) {
+                continue;
+            }
+            std::size_t s = slot(tag, num_slots);
+            while (slots[s][0] != -1) {
+                if (slots[s][0] == tag) {
+                    throw_duplicate(name, tag);
+                }
+                s = (s + 1) & (num_slots - 1);
+            }
+            slots[s] = Entry{{tag, static_cast<int>(i)}};
+        }
+        return TagIndex(0, mesh_io::SharedArray<int>(), std::move(slots));
+    }
+
+    /// The index of the value with tag `tag`, or -1 if there is none.
+    int find(int tag) const {
+        if (!_slots.empty()) {
+            if (tag < 0) {
+                return -1;
+            }
+            const std::size_t mask = _slots.size() - 1;
+            for (std::size_t s = slot(tag, _slots.size()); _slots[s][0] != -1; s = (s + 1) & mask) {
+                if (_slots[s][0] == tag) {
+                    return _slots[s][1];
+                }
+            }
+            return -1;
+        }
+        // unsigned, so tags below min_tag wrap around past the end
+        const std::size_t offset = static_cast<std::size_t>(static_cast<long long>(tag) - _min_tag);
+        return offset < _table.size() ? _table[offset] : -1;
+    }
+
+    /// Whether tags are looked up in a table rather than hashed.
+    bool dense() const {
+        return _slots.empty();
+    }
+
+    /// The first tag of the table.
+    int min_tag() const {
+        return _min_tag;
+    }
+    /// The table of a dense index, empty for a sparse one.
+    const mesh_io::SharedArray<int>& table() const {
+        return _table;
+    }
+    /// The hashed slots of a sparse index, empty for a dense one.
+    const mesh_io::SharedArray<Entry>& slots() const {
+        return _slots;
+    }
+
+    /// Heap or mapped memory used by the index, in bytes.
+    std::size_t memory_bytes() const {
+        return _table.size() * sizeof(int) + _slots.size() * sizeof(Entry);
+    }
+
+private:
+    // Fibonacci hashing, since sparse tags are often multiples of a stride
+    static std::size_t slot(int tag, std::size_t num_slots) {
+        return static_cast<std::size_t>((static_cast<std::uint64_t>(static_cast<std::uint32_t>(tag)) *
+            UINT64_C(11400714819323198485)) >> 32) & (num_slots - 1);
+    }
+
+    [[noreturn]] static void throw_duplicate(const std::string& name, int tag) {
+        throw std::runtime_error("duplicate " + name + " tag " + std::to_string(tag));
+    }
+
+    int _min_tag = 0;
+    mesh_io::SharedArray<int> _table;
+    mesh_io::SharedArray<Entry> _slots;
+};
+
+} // namespace mesh_tags
+
+#endif // MESH_TAGS_
@@ -0,0 +1,443 @@
+/*
+###############################################################################
+#
+#  EGSnrc mesh validation
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+*/
+
+#ifndef MESH_VALIDATION_
+#define MESH_VALIDATION_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "egs_mesh.h"
+#include "mesh_parallel.h"
+
+/// Checks of a built mesh for elements and faces that would make transport
+/// go wrong without an error, such as flat elements whose face planes are
+/// meaningless.
+///
+/// Meshes with unknown or repeated node tags can't be built at all, so those
+/// are reported by the EGS_Mesh constructor, see EGS_Mesh::EGS_Mesh.
+namespace mesh_validation {
+
+/// What a Diagnostic is about.
+enum class Kind {
+    /// An element with no volume to speak of, e.g. with four nearly coplanar
+    /// vertices. Its face normals are dominated by rounding errors, or NaN.
+    DegenerateElement,
+    /// An element whose nodes are in the opposite order to the Gmsh
+    /// convention, i.e. with a negative signed volume. Transport doesn't
+    /// depend on the node order, but it usually means the mesh was written
+    /// by a broken exporter.
+    InvertedElement,
+    /// A valid but very flat element, which tracking crosses in tiny steps.
+    SliverElement,
+    /// A face shared by more than two elements, see
+    /// EGS_Mesh::non_manifold_faces.
+    NonManifoldFace,
+    /// A medium (3D physical group) without elements.
+    UnusedMedium,
+    /// A node that isn't a vertex of any element.
+    UnusedNode
+};
+
+const std::size_t NUM_KINDS = 6;
+
+enum class Severity {
+    /// The mesh can be used, but is probably not what was meant.
+    Warning,
+    /// Transport in the mesh would give wrong results.
+    Error
+};
+
+Severity severity(Kind kind) {
+    return kind == Kind::DegenerateElement || kind == Kind::NonManifoldFace ?
+        Severity::Error : Severity::Warning;
+}
+
+/// A short name for `kind`, e.g. "degenerate element".
+const char* kind_name(Kind kind) {
+    switch (kind) {
+        case Kind::DegenerateElement: return "degenerate element";
+        case Kind::InvertedElement: return "inverted element";
+        case Kind::SliverElement: return "sliver element";
+        case Kind::NonManifoldFace: return "non-manifold face";
+        case Kind::UnusedMedium: return "unused medium";
+        case Kind::UnusedNode: return "unused node";
+    }
+    return "unknown";
+}
+
+/// One problem found in a mesh.
+struct Diagnostic {
+    Kind kind;
+    /// The element index for element and face diagnostics, the index in
+    /// EGS_Mesh::nodes for UnusedNode and in EGS_Mesh::materials for
+    /// UnusedMedium.
+    int index = -1;
+    /// The face of element `index` for NonManifoldFace, otherwise -1.
+    int face = -1;
+    /// The quality of element `index` for element diagnostics, see
+    /// element_quality, otherwise 0.
+    double quality = 0.0;
+    /// A description with the Gmsh tags involved.
+    std::string message;
+
+    Severity severity() const {
+        return mesh_validation::severity(kind);
+    }
+};
+
+/// Validation thresholds.
+struct Options {
+    /// Elements with a lower quality are degenerate. Rounding alone gives
+    /// flat elements a quality of about 1e-16.
+    double degenerate_quality = 1e-8;
+    /// Elements with a lower quality are slivers. Gmsh rarely generates
+    /// elements below 0.1.
+    double sliver_quality = 0.01;
+    /// At most this many diagnostics of each kind are kept, the rest are
+    /// only counted.
+    std::size_t max_per_kind = 100;
+    /// Threads for the element checks, 0 for every hardware thread.
+    unsigned num_threads = 0;
+    /// Report non-manifold faces, which finds the neighbours of a mesh
+    /// built with EGS_Mesh::Options::lazy_neighbours.
+    bool check_faces = true;
+};
+
+/// The result of validate.
+struct Report {
+    /// The first Options::max_per_kind diagnostics of each kind, sorted by
+    /// kind, then by index.
+    std::vector<Diagnostic> diagnostics;
+    /// The number of problems of each kind, including those past the
+    /// diagnostics limit, indexed by Kind.
+    std::array<std::size_t, NUM_KINDS> counts {};
+    /// The lowest element quality, 1 for an empty mesh.
+    double min_quality = 1.0;
+    /// The sum of the element volumes.
+    double total_volume = 0.0;
+    /// Whether non-manifold faces were looked for, see Options::check_faces.
+    bool faces_checked = false;
+
+    std::size_t count(Kind kind) const {
+        return counts[static_cast<std::size_t>(kind)];
+    }
+
+    std::size_t num_errors() const {
+        return count_severity(Severity::Error);
+    }
+    std::size_t num_warnings() const {
+        return count_severity(Severity::Warning);
+    }
+
+    /// Whether there are no errors; warnings are allowed.
+    bool ok() const {
+        return num_errors() == 0;
+    }
+
+    /// A line with the count of each kind of problem found, followed by a
+    /// line per kept diagnostic.
+    std::string summary() const {
+        std::string text;
+        for (std::size_t k = 0; k < NUM_KINDS; k++) {
+            if (counts[k] == 0) {
+                continue;
+            }
+            text += (text.empty() ? "" : ", ") + std::to_string(counts[k]) + " " +
+                kind_name(static_cast<Kind>(k)) + (counts[k] == 1 ? "" : "s");
+        }
+        if (text.empty()) {
+            return "no problems found\n";
+        }
+        text += "\n";
+        for (const auto& d: diagnostics) {
+            text += (d.severity() == Severity::Error ? "error: " : "warning: ") + d.message + "\n";
+        }
+        return text;
+    }
+
+    /// Throws a std::runtime_error with the summary if there are errors.
+    void throw_if_errors() const {
+        if (!ok()) {
+            throw std::runtime_error("invalid mesh: " + summary());
+        }
+    }
+
+private:
+    std::size_t count_severity(Severity severity) const {
+        std::size_t n = 0;
+        for (std::size_t k = 0; k < NUM_KINDS; k++) {
+            if (mesh_validation::severity(static_cast<Kind>(k)) == severity) {
+                n += counts[k];
+            }
+        }
+        return n;
+    }
+};
+
+/// The quality of a tetrahedron from its 12 vertex coordinates:
+/// 6 sqrt(2) |V| / l^3, where V is the volume and l the root mean square edge
+/// length. This is 1 for a regular tetrahedron, and goes to 0 as the
+/// element flattens whatever its size. `signed_volume` is set to the volume
+/// of the vertices in the given order, positive if vertex 3 is on the side of
+/// face (0, 1, 2) that its normal (v1 - v0) x (v2 - v0) points to.
+double element_quality(const double* v, double* signed_volume) {
+    double e[3][3];
+    for (int n = 0; n < 3; n++) {
+        for (int k = 0; k < 3; k++) {
+            e[n][k] = v[3 * (n + 1) + k] - v[k];
+        }
+    }
+    const double det = e[0][0] * (e[1][1] * e[2][2] - e[1][2] * e[2][1]) +
+        e[0][1] * (e[1][2] * e[2][0] - e[1][0] * e[2][2]) +
+        e[0][2] * (e[1][0] * e[2][1] - e[1][1] * e[2][0]);
+    *signed_volume = det / 6.0;
+    double sum_squares = 0.0;
+    for (int a = 0; a < 4; a++) {
+        for (int b = a + 1; b < 4; b++) {
+            for (int k = 0; k < 3; k++) {
+                const double d = v[3 * b + k] - v[3 * a + k];
+                sum_squares += d * d;
+            }
+        }
+    }
+    const double rms = std::sqrt(sum_squares / 6.0);
+    // |det| = 6 |V|, so this is 6 sqrt(2) |V| / rms^3
+    return std::sqrt(2.0) * std::abs(det) / (rms * rms * rms);
+}
+
+/// The mesh_validation::internal namespace is for internal API functions and
+/// is not part of the public API. Functions and types may change without
+/// warning.
+namespace internal {
+
+// The findings of one thread over a range of elements.
+struct Partial {
+    std::array<std::size_t, NUM_KINDS> counts {};
+    std::array<std::vector<Diagnostic>, NUM_KINDS> kept;
+    double min_quality = 1.0;
+    double total_volume = 0.0;
+    std::vector<std::size_t> media_counts;
+    // a bit per node, set if an element in the range uses it
+    std::vector<std::uint64_t> used_nodes;
+
+    void add(Kind kind, int index, double quality, std::size_t max_per_kind) {
+        const std::size_t k = static_cast<std::size_t>(kind);
+        if (counts[k]++ < max_per_kind) {
+            Diagnostic d;
+            d.kind = kind;
+            d.index = index;
+            d.quality = quality;
+            kept[k].push_back(d);
+        }
+    }
+};
+
+std::string format_quality(double quality) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.3g", quality);
+    return buf;
+}
+
+// The message of a diagnostic, naming the Gmsh tags.
+std::string message(const EGS_Mesh& mesh, const Diagnostic& d) {
+    const std::string element = d.index >= 0 && d.index < mesh.num_elements() ?
+        "element " + std::to_string(mesh.elements()[d.index].tag) : "";
+    switch (d.kind) {
+        case Kind::DegenerateElement:
+            return element + " is degenerate (quality " + format_quality(d.quality) + ")";
+        case Kind::InvertedElement:
+            return element + " is inverted";
+        case Kind::SliverElement:
+            return element + " is a sliver (quality " + format_quality(d.quality) + ")";
+        case Kind::NonManifoldFace: {
+            // face f is opposite vertex f
+            std::string nodes;
+            for (int n = 0; n < 4; n++) {
+                if (n != d.face) {
+                    nodes += " " + std::to_string(mesh.nodes()[mesh.element_nodes(d.index)[n]].tag);
+                }
+            }
+            return element + " face with nodes" + nodes + " is shared by more than two elements";
+        }
+        case Kind::UnusedMedium:
+            return "medium " + std::to_string(mesh.materials()[d.index].tag) + " \"" +
+                mesh.materials()[d.index].medium_name + "\" has no elements";
+        case Kind::UnusedNode:
+            return "node " + std::to_string(mesh.nodes()[d.index].tag) + " is not used by any element";
+    }
+    return "";
+}
+
+} // namespace internal
+
+/// Check every element of `mesh` for degenerate, inverted and sliver
+/// tetrahedrons, and report faces shared by more than two elements, media
+/// without elements and nodes without elements.
+///
+/// The element checks are a single parallel pass over the packed vertex
+/// arrays, and the non-manifold faces are found by the neighbour search, so
+/// validating takes a fraction of the time to build the mesh. Meshes are
+/// validated when they are built unless EGS_Mesh::Options::validate is
+/// unset, see EGS_Mesh::validation.
+Report validate(const EGS_Mesh& mesh, const Options& options = Options()) {
+    using internal::Partial;
+    const std::size_t num_elts = static_cast<std::size_t>(mesh.num_elements());
+    const std::size_t num_nodes = mesh.nodes().size();
+    const std::size_t num_media = mesh.materials().size();
+    const std::size_t num_words = (num_nodes + 63) / 64;
+    unsigned num_threads = options.num_threads;
+    if (num_threads == 0) {
+        num_threads = mesh_parallel::default_num_threads();
+    }
+
+    std::vector<Partial> partials(num_threads);
+    mesh_parallel::parallel_for(num_elts, num_threads, [&](std::size_t begin, std::size_t end, unsigned t) {
+        Partial& part = partials[t];
+        part.media_counts.assign(num_media, 0);
+        part.used_nodes.assign(num_words, 0);
+        for (std::size_t i = begin; i < end; i++) {
+            const int elt = static_cast<int>(i);
+            const auto& nodes = mesh.element_nodes(elt);
+            for (int n: nodes) {
+                part.used_nodes[static_cast<std::size_t>(n) / 64] |=
+                    std::uint64_t(1) << (static_cast<std::size_t>(n) % 64);
+            }
+            part.media_counts[static_cast<std::size_t>(mesh.medium_index(elt))]++;
+
+            // vertices are sorted by node index, the Gmsh orientation is
+            // that of the element's own node order
+            double volume = 0.0;
+            const double quality = element_quality(mesh.element_vertices(elt), &volume);
+            const auto& tet = mesh.elements()[i];
+            const int order[4] = {mesh.node_index(tet.a), mesh.node_index(tet.b),
+                mesh.node_index(tet.c), mesh.node_index(tet.d)};
+            int inversions = 0;
+            for (int a = 0; a < 4; a++) {
+                for (int b = a + 1; b < 4; b++) {
+                    inversions += order[a] > order[b] ? 1 : 0;
+                }
+            }
+            if (inversions % 2 == 1) {
+                volume = -volume;
+            }
+
+            part.total_volume += std::abs(volume);
+            // also catches NaN qualities from non-finite coordinates
+            if (!(quality >= options.degenerate_quality)) {
+                part.min_quality = std::min(part.min_quality, quality >= 0.0 ? quality : 0.0);
+                part.add(Kind::DegenerateElement, elt, quality, options.max_per_kind);
+                continue;
+            }
+            part.min_quality = std::min(part.min_quality, quality);
+            if (volume < 0.0) {
+                part.add(Kind::InvertedElement, elt, quality, options.max_per_kind);
+            }
+            if (quality < options.sliver_quality) {
+                part.add(Kind::SliverElement, elt, quality, options.max_per_kind);
+            }
+        }
+    });
+
+    // the ranges are in element order, so the kept diagnostics are the first ones
+    Report report;
+    std::vector<std::size_t> media_counts(num_media, 0);
+    std::vector<std::uint64_t> used_nodes(num_words, 0);
+    std::array<std::vector<Diagnostic>, NUM_KINDS> kept;
+    for (auto& part: partials) {
+        for (std::size_t k = 0; k < NUM_KINDS; k++) {
+            report.counts[k] += part.counts[k];
+            for (auto& d: part.kept[k]) {
+                if (kept[k].size() < options.max_per_kind) {
+                    kept[k].push_back(std::move(d));
+                }
+            }
+        }
+        report.min_quality = std::min(report.min_quality, part.min_quality);
+        report.total_volume += part.total_volume;
+        for (std::size_t m = 0; m < part.media_counts.size(); m++) {
+            media_counts[m] += part.media_counts[m];
+        }
+        for (std::size_t w = 0; w < part.used_nodes.size(); w++) {
+            used_nodes[w] |= part.used_nodes[w];
+        }
+    }
+
+    auto add = [&](Kind kind, int index, int face) {
+        const std::size_t k = static_cast<std::size_t>(kind);
+        if (report.counts[k]++ < options.max_per_kind) {
+            Diagnostic d;
+            d.kind = kind;
+            d.index = index;
+            d.face = face;
+            kept[k].push_back(d);
+        }
+    };
+    report.faces_checked = options.check_faces;
+    if (options.check_faces) {
+        for (const auto& face: mesh.non_manifold_faces()) {
+            add(Kind::NonManifoldFace, face[0], face[1]);
+        }
+    }
+    for (std::size_t m = 0; m < num_media; m++) {
+        if (media_counts[m] == 0) {
+            add(Kind::UnusedMedium, static_cast<int>(m), -1);
+        }
+    }
+    for (std::size_t n = 0; n < num_nodes; n++) {
+        if (!(used_nodes[n / 64] & (std::uint64_t(1) << (n % 64)))) {
+            add(Kind::UnusedNode, static_cast<int>(n), -1);
+        }
+    }
+
+    for (auto& diagnostics: kept) {
+        for (auto& d: diagnostics) {
+            d.message = internal::message(mesh, d);
+            report.diagnostics.push_back(std::move(d));
+        }
+    }
+    return report;
+}
+
+} // namespace mesh_validation
+
+inline void EGS_Mesh::validate_built() {
+    mesh_validation::Options options;
+    // finding the neighbours of a lazy mesh here would defeat the point
+    options.check_faces = !_options.lazy_neighbours || neighbours_built();
+    auto report = std::make_shared<mesh_validation::Report>(mesh_validation::validate(*this, options));
+    report->throw_if_errors();
+    _validation = std::move(report);
+}
+
+#endif // MESH_VALIDATION_
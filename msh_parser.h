@@ -30,6 +30,9 @@
 #define MSH_PARSER_
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <limits>
@@ -39,69 +42,130 @@
 #include <unordered_map>
 #include <unordered_set>
 
-class EGS_Mesh /* : public EGS_BaseGeometry */ {
-public:
-    /// A single tetrahedral mesh element
-    struct Tetrahedron {
-        Tetrahedron(int medium_tag, int a, int b, int c, int d) :
-            medium_tag(medium_tag), a(a), b(b), c(c), d(d) {}
-        int medium_tag = -1;
-        // nodes
-        int a = -1;
-        int b = -1;
-        int c = -1;
-        int d = -1;
-    };
+#include "egs_mesh.h"
+#include "mesh_io.h"
+#include "mesh_parallel.h"
+#include "mesh_snapshot.h"
 
-    /// A single 3D point
-    struct Node {
-        Node(int tag, double x, double y, double z) :
-            tag(tag), x(x), y(y), z(z) {}
-        int tag = -1;
-        double x = 0.0;
-        double y = 0.0;
-        double z = 0.0;
-    };
+namespace msh_parser {
 
-    /// A physical medium
-    struct Medium {
-        Medium(int tag, std::string medium_name) :
-            tag(tag), medium_name(medium_name) {}
-        int tag = -1;
-        std::string medium_name;
-    };
+/// Receives the contents of a msh file bloc by bloc as it is parsed, see
+/// parse_msh_stream.
+///
+/// Sections arrive in file order. The arrays passed to node_bloc and
+/// element_bloc are only valid during the call, so a sink that keeps them
+/// must copy them out, e.g. into storage sized by begin_nodes and
+/// begin_elements.
+class MeshSink {
+public:
+    virtual ~MeshSink() {}
 
-    EGS_Mesh(std::vector<EGS_Mesh::Tetrahedron> elements,
-        std::vector<EGS_Mesh::Node> nodes, std::vector<EGS_Mesh::Medium> materials) :
-        /* EGS_BaseGeometry("EGS_Mesh"), */ _elements(std::move(elements)),
-        _nodes(std::move(nodes)), _materials(std::move(materials))
-    {
-        // TODO find neighbours, construct value arrays
+    /// Called once before the first node bloc with the number of nodes in the file.
+    virtual void begin_nodes(std::size_t num_nodes) {
+        (void) num_nodes;
     }
 
-    const std::vector<EGS_Mesh::Tetrahedron>& elements() {
-        return _elements;
-    }
-    const std::vector<EGS_Mesh::Node>& nodes() {
-        return _nodes;
-    }
-    const std::vector<EGS_Mesh::Medium>& materials() {
-        return _materials;
+    /// Called for each bloc of nodes, in file order.
+    virtual void node_bloc(const EGS_Mesh::Node* nodes, std::size_t count) = 0;
+
+    /// Called once before the first element bloc with the media (the 3D
+    /// physical groups) and an upper bound on the number of tetrahedrons:
+    /// the number of elements of any dimension in the file.
+    virtual void begin_elements(const std::vector<EGS_Mesh::Medium>& media, std::size_t max_elements) {
+        (void) media;
+        (void) max_elements;
     }
 
-private:
-    std::vector<EGS_Mesh::Tetrahedron> _elements;
-    std::vector<EGS_Mesh::Node> _nodes;
-    std::vector<EGS_Mesh::Medium> _materials;
+    /// Called for each bloc of tetrahedrons, in file order. Element medium
+    /// tags are resolved from their volume's physical group.
+    virtual void element_bloc(const EGS_Mesh::Tetrahedron* elements, std::size_t count) = 0;
 };
 
-namespace msh_parser {
+/// Parse a msh file, handing its nodes and elements to `sink` bloc by bloc
+/// instead of building an EGS_Mesh. The parser keeps at most one bloc in
+/// memory, so a sink that doesn't keep the data can process meshes of any
+/// size.
+///
+/// The file is checked as it is parsed, except that node tags of elements
+/// aren't resolved. Checking that tags are unique takes a bit per tag of the
+/// tag range in the section header, or an int per tag if the tags are
+/// sparse. Binary msh files must be opened in binary mode.
+///
+/// Throws a std::runtime_error if parsing fails.
+void parse_msh_stream(std::istream& input, MeshSink& sink);
+
+/// Parse a memory-mapped msh file on disk into `sink`, like the
+/// std::istream overload.
+///
+/// Throws a std::runtime_error if parsing fails.
+void parse_msh_stream(const std::string& path, MeshSink& sink);
 
 /// Parse a msh file into an EGS_Mesh
 ///
+/// Binary msh files must be opened in binary mode (std::ios::binary).
+///
 /// Throws a std::runtime_error if parsing fails.
 EGS_Mesh parse_msh_file(std::istream& input);
 
+/// Parse a msh file into an EGS_Mesh built with `options`, e.g. to reorder
+/// the mesh for locality, see EGS_Mesh::Options.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_msh_file(std::istream& input, const EGS_Mesh::Options& options);
+
+/// Parse a msh file on disk into an EGS_Mesh.
+///
+/// The file is memory-mapped and tokenized in place, which is much faster
+/// than the std::istream overload for large meshes. The resulting mesh is
+/// identical to parsing the same file with the std::istream overload.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_msh_file(const std::string& path);
+
+/// Parse a msh file on disk into an EGS_Mesh using `num_threads` threads, or
+/// every hardware thread if `num_threads` is 0.
+///
+/// The nodes and elements of ascii files are parsed in parallel and the
+/// resulting mesh is identical to the serial overloads. Binary files are
+/// bulk read and always parsed serially.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_msh_file(const std::string& path, unsigned num_threads);
+
+/// Parse a msh file on disk into an EGS_Mesh built with `options` using
+/// `num_threads` threads, or every hardware thread if `num_threads` is 0.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_msh_file(const std::string& path, unsigned num_threads,
+    const EGS_Mesh::Options& options);
+
+/// Load the msh file at `path` through the snapshot cache file `cache_path`.
+///
+/// If `cache_path` holds a snapshot of the same msh file contents built with
+/// the same `options`, it is memory-mapped without any parsing, see
+/// mesh_snapshot.h. Otherwise the msh file is parsed with `num_threads`
+/// threads and a new snapshot is written to `cache_path` for the next run.
+/// Either way the msh file is read once to compute its content hash.
+///
+/// Throws a std::runtime_error if parsing fails or the snapshot can't be written.
+EGS_Mesh parse_msh_file_cached(const std::string& path, const std::string& cache_path,
+    unsigned num_threads = 1, const EGS_Mesh::Options& options = EGS_Mesh::Options());
+
+/// Parse every mesh of a msh file on disk that holds several meshes one
+/// after the other, each starting with its own $MeshFormat header, e.g. the
+/// phases of a time-resolved phantom.
+///
+/// A mesh whose $Entities, $PhysicalNames and $Elements sections are the
+/// same text as those of the previous mesh, in the same format, only has
+/// its $Nodes parsed: it shares the elements, neighbours and hierarchy
+/// trees of the previous mesh, see EGS_Mesh::with_nodes. Other meshes are
+/// parsed in full with `num_threads` threads and built with `options`, like
+/// parse_msh_file.
+///
+/// Throws a std::runtime_error if parsing fails.
+std::vector<EGS_Mesh> parse_msh_meshes(const std::string& path, unsigned num_threads = 1,
+    const EGS_Mesh::Options& options = EGS_Mesh::Options());
+
 /// The msh_parser::internal namespace is for internal API functions and is not
 /// part of the public API. Functions and types may change without warning.
 namespace internal {
@@ -114,13 +178,320 @@ static inline void rtrim(std::string &s) {
 }
 
 enum class MshVersion { v41 };
+
+/// The encoding of a msh file, from its $MeshFormat header.
+struct MshFormat {
+    MshVersion version = MshVersion::v41;
+    bool binary = false;
+    // binary files written on a machine with the opposite byte order
+    bool swap_bytes = false;
+};
+
 constexpr std::size_t SIZET_MAX = std::numeric_limits<std::size_t>::max();
 
+/// A forward-only cursor over an in-memory msh file, used by the
+/// memory-mapped parser. Numbers are parsed in place without copying lines.
+///
+/// Token parsing never crosses a newline, so a short line fails to parse
+/// instead of silently reading values from the next line.
+class TextCursor {
+public:
+    TextCursor(const char* begin, const char* end) : _pos(begin), _end(end) {}
+
+    const char* pos() const {
+        return _pos;
+    }
+    const char* end() const {
+        return _end;
+    }
+    bool eof() const {
+        return _pos == _end;
+    }
+    void seek(const char* pos) {
+        _pos = pos;
+    }
+
+    /// Returns the rest of the current line without its newline and moves
+    /// to the start of the next line.
+    std::string read_line() {
+        const char* line_end = find_newline();
+        std::string line(_pos, line_end);
+        _pos = line_end == _end ? _end : line_end + 1;
+        return line;
+    }
+
+    /// Moves to the start of the next line.
+    void skip_line() {
+        const char* line_end = find_newline();
+        _pos = line_end == _end ? _end : line_end + 1;
+    }
+
+    /// Parse a signed decimal integer. Returns false if the next token isn't
+    /// an int, including on overflow.
+    bool parse_int(int& value) {
+        skip_blanks();
+        const char* p = _pos;
+        bool negative = false;
+        if (p != _end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            ++p;
+        }
+        const long long limit = negative ?
+            -static_cast<long long>(std::numeric_limits<int>::min()) : std::numeric_limits<int>::max();
+        long long res = 0;
+        const char* digits_start = p;
+        while (p != _end && is_digit(*p)) {
+            res = res * 10 + (*p - '0');
+            if (res > limit) {
+                return false;
+            }
+            ++p;
+        }
+        if (p == digits_start || !at_delimiter(p)) {
+            return false;
+        }
+        value = static_cast<int>(negative ? -res : res);
+        _pos = p;
+        return true;
+    }
+
+    /// Parse an unsigned decimal integer. Returns false if the next token
+    /// isn't a non-negative integer, including on overflow.
+    bool parse_size(std::size_t& value) {
+        skip_blanks();
+        const char* p = _pos;
+        if (p != _end && *p == '+') {
+            ++p;
+        }
+        std::size_t res = 0;
+        const char* digits_start = p;
+        while (p != _end && is_digit(*p)) {
+            std::size_t digit = static_cast<std::size_t>(*p - '0');
+            if (res > (SIZET_MAX - digit) / 10) {
+                return false;
+            }
+            res = res * 10 + digit;
+            ++p;
+        }
+        if (p == digits_start || !at_delimiter(p)) {
+            return false;
+        }
+        value = res;
+        _pos = p;
+        return true;
+    }
+
+    /// Parse a decimal floating point number, e.g. `-1.5e-07`.
+    ///
+    /// The result is correctly rounded: short mantissas with small exponents
+    /// are converted exactly with a single multiplication or division by a
+    /// power of ten (Clinger's fast path), anything else falls back to strtod.
+    bool parse_double(double& value) {
+        skip_blanks();
+        const char* start = _pos;
+        const char* p = start;
+        bool negative = false;
+        if (p != _end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            ++p;
+        }
+        std::uint64_t mantissa = 0;
+        int num_digits = 0;
+        int exp10 = 0;
+        bool truncated = false;
+        bool any_digits = false;
+        while (p != _end && is_digit(*p)) {
+            any_digits = true;
+            accumulate_digit(*p, mantissa, num_digits, truncated);
+            ++p;
+        }
+        if (p != _end && *p == '.') {
+            ++p;
+            while (p != _end && is_digit(*p)) {
+                any_digits = true;
+                accumulate_digit(*p, mantissa, num_digits, truncated);
+                // the exponent is only used if no digits were truncated
+                --exp10;
+                ++p;
+            }
+        }
+        if (!any_digits) {
+            return false;
+        }
+        if (p != _end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            bool exp_negative = false;
+            if (p != _end && (*p == '-' || *p == '+')) {
+                exp_negative = *p == '-';
+                ++p;
+            }
+            if (p == _end || !is_digit(*p)) {
+                return false;
+            }
+            int exp = 0;
+            while (p != _end && is_digit(*p)) {
+                // saturate, the value is out of range for a double anyway
+                if (exp < 100000) {
+                    exp = exp * 10 + (*p - '0');
+                }
+                ++p;
+            }
+            exp10 += exp_negative ? -exp : exp;
+        }
+        if (!at_delimiter(p)) {
+            return false;
+        }
+        _pos = p;
+
+        const std::uint64_t MAX_EXACT_MANTISSA = std::uint64_t(1) << 53;
+        if (!truncated && mantissa <= MAX_EXACT_MANTISSA && exp10 >= -22 && exp10 <= 22) {
+            static const double POWERS_OF_TEN[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+            };
+            double res = static_cast<double>(mantissa);
+            if (exp10 < 0) {
+                res /= POWERS_OF_TEN[-exp10];
+            } else {
+                res *= POWERS_OF_TEN[exp10];
+            }
+            value = negative ? -res : res;
+            return true;
+        }
+        // slow path, the token is copied because the input isn't null-terminated
+        std::string token(start, p);
+        value = std::strtod(token.c_str(), nullptr);
+        return true;
+    }
+
+private:
+    static bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+    }
+    static bool is_blank(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+    bool at_delimiter(const char* p) const {
+        return p == _end || *p == '\n' || is_blank(*p);
+    }
+    void skip_blanks() {
+        while (_pos != _end && is_blank(*_pos)) {
+            ++_pos;
+        }
+    }
+    const char* find_newline() const {
+        const void* nl = std::memchr(_pos, '\n', static_cast<std::size_t>(_end - _pos));
+        return nl ? static_cast<const char*>(nl) : _end;
+    }
+    // Append a digit to a mantissa, ignoring leading zeros. Digits past what a
+    // uint64 can hold are dropped and flagged as truncated.
+    static void accumulate_digit(char c, std::uint64_t& mantissa, int& num_digits,
+        bool& truncated)
+    {
+        if (mantissa == 0 && c == '0') {
+            return;
+        }
+        if (num_digits < 19) {
+            mantissa = mantissa * 10 + static_cast<std::uint64_t>(c - '0');
+            ++num_digits;
+        } else {
+            truncated = true;
+        }
+    }
+
+    const char* _pos;
+    const char* _end;
+};
+
+/// Returns the text from the cursor up to and including the next line
+/// containing `end_marker`, and moves the cursor past that line. If the marker
+/// isn't found, the rest of the input is returned.
+///
+/// The memory-mapped parser uses this to hand small sections to the
+/// std::istream parsers.
+std::string read_section(TextCursor& input, const std::string& end_marker) {
+    const char* start = input.pos();
+    const char* marker = std::search(start, input.end(), end_marker.begin(), end_marker.end());
+    input.seek(marker);
+    if (marker != input.end()) {
+        input.skip_line();
+    }
+    return std::string(start, input.pos());
+}
+
+/// Reverses the byte order of a value read from a binary msh file.
+template <typename T>
+T swap_bytes(T value) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    std::reverse(bytes, bytes + sizeof(T));
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+// Low-level input primitives, overloaded so the binary section parsers work
+// on both std::istream and memory-mapped input.
+
+/// Reads `size` raw bytes into `dest`. Returns false if the input ended early.
+bool read_bytes(std::istream& input, char* dest, std::size_t size) {
+    input.read(dest, static_cast<std::streamsize>(size));
+    return static_cast<std::size_t>(input.gcount()) == size;
+}
+bool read_bytes(TextCursor& input, char* dest, std::size_t size) {
+    if (static_cast<std::size_t>(input.end() - input.pos()) < size) {
+        return false;
+    }
+    std::memcpy(dest, input.pos(), size);
+    input.seek(input.pos() + size);
+    return true;
+}
+
+/// Skips `size` raw bytes. Returns false if the input ended early.
+bool skip_bytes(std::istream& input, std::size_t size) {
+    input.ignore(static_cast<std::streamsize>(size));
+    return static_cast<std::size_t>(input.gcount()) == size;
+}
+bool skip_bytes(TextCursor& input, std::size_t size) {
+    if (static_cast<std::size_t>(input.end() - input.pos()) < size) {
+        return false;
+    }
+    input.seek(input.pos() + size);
+    return true;
+}
+
+std::string read_line(std::istream& input) {
+    std::string line;
+    std::getline(input, line);
+    return line;
+}
+std::string read_line(TextCursor& input) {
+    return input.read_line();
+}
+
+/// Number of entries binary blocs are read and converted in at a time, so
+/// the scratch space doesn't grow with the bloc.
+constexpr std::size_t BINARY_READ_CHUNK = 1024;
+
+/// Bulk read `count` values of a binary msh file straight into `dest`.
+///
+/// Throws a std::runtime_error with message `err` if the input ended early.
+template <typename T, typename Input>
+void read_binary(Input& input, T* dest, std::size_t count, bool swap, const std::string& err) {
+    if (!read_bytes(input, reinterpret_cast<char*>(dest), count * sizeof(T))) {
+        throw std::runtime_error(err);
+    }
+    if (swap) {
+        for (std::size_t i = 0; i < count; ++i) {
+            dest[i] = swap_bytes(dest[i]);
+        }
+    }
+}
+
 /// Parse a msh file header.
 ///
 /// Throws a std::runtime_error if parsing fails.
-/// Only version 4.1 ascii is supported, any other version will throw.
-MshVersion parse_msh_version(std::istream& input) {
+/// Only version 4.1 (ascii or binary) is supported, any other version will throw.
+MshFormat parse_msh_version(std::istream& input) {
     if (!input) {
         throw std::runtime_error("bad input to parse_msh_version");
     }
@@ -150,10 +521,7 @@ MshVersion parse_msh_version(std::istream& input) {
     if (version != "4.1") {
         throw std::runtime_error("unsupported msh version `" + version + "`, the only supported version is 4.1");
     }
-    if (binary_flag != 0) {
-        if (binary_flag == 1) {
-            throw std::runtime_error("binary msh files are unsupported, please convert this file to ascii and try again");
-        }
+    if (binary_flag != 0 && binary_flag != 1) {
         throw std::runtime_error("failed to parse msh version");
     }
     if (sizet != 8) {
@@ -162,13 +530,32 @@ MshVersion parse_msh_version(std::istream& input) {
     // eat newline
     std::getline(input, format_line);
 
+    MshFormat format;
+    if (binary_flag == 1) {
+        format.binary = true;
+        // binary files store the int 1 to detect the byte order
+        std::int32_t one = 0;
+        input.read(reinterpret_cast<char*>(&one), sizeof(one));
+        if (input.gcount() != sizeof(one)) {
+            throw std::runtime_error("unexpected end of input");
+        }
+        if (one != 1) {
+            if (swap_bytes(one) != 1) {
+                throw std::runtime_error("binary msh file has an invalid byte order marker");
+            }
+            format.swap_bytes = true;
+        }
+        // eat newline
+        std::getline(input, format_line);
+    }
+
     std::getline(input, format_line);
     rtrim(format_line);
     if (format_line != "$EndMeshFormat") {
         throw std::runtime_error("expected $EndMeshFormat, got `" + format_line + "`");
     }
 
-    return MshVersion::v41;
+    return format;
 }
 
 /// Types and functions specific to parsing msh4.1 files. This namespace is part
@@ -182,26 +569,11 @@ struct MeshVolume {
     int group = -1;
 };
 
-// A point in 3D space
-struct Node {
-    Node(int tag, double x, double y, double z) : tag(tag), x(x), y(y), z(z) {}
-    int tag = -1; // TODO size_t?
-    double x = 0.0;
-    double y = 0.0;
-    double z = 0.0;
-};
-
-// A tetrahedron composed of four nodes
-struct Tetrahedron {
-    Tetrahedron(int tag, int volume, int a, int b, int c, int d) :
-            tag(tag), volume(volume), a(a), b(b), c(c), d(d) {}
-    int tag = -1;
-    int volume = -1;
-    int a = -1;
-    int b = -1;
-    int c = -1;
-    int d = -1;
-};
+// Nodes and tetrahedrons are parsed straight into the EGS_Mesh types, so
+// they can be stored without conversion. A parsed tetrahedron's medium_tag
+// holds its volume (entity) tag until VolumeMedia::resolve replaces it.
+using Node = EGS_Mesh::Node;
+using Tetrahedron = EGS_Mesh::Tetrahedron;
 
 // 3D Gmsh physical group
 struct PhysicalGroup {
@@ -226,6 +598,291 @@ std::pair<bool, int> check_unique_tags(const std::vector<T>& values) {
     return std::make_pair(true, 0);
 }
 
+/// Checks the node or element tags of a section as its blocs are parsed:
+/// tags must be unique and within the [min_tag, max_tag] range declared by
+/// the section header.
+///
+/// Gmsh numbers nodes and elements densely, so tags are usually marked in a
+/// bitmap over the declared range, one bit per tag. If the range is sparse,
+/// i.e. the bitmap would be larger than a list of the tags, the tags are
+/// collected and sorted by finish() instead.
+class TagChecker {
+public:
+    /// A checker for a section without tags.
+    TagChecker() = default;
+
+    /// `section` and `name` are used in error messages, e.g. "$Nodes" and
+    /// "node". `count` is the number of tags declared by the header.
+    TagChecker(std::string section, std::string name, std::size_t min_tag,
+        std::size_t max_tag, std::size_t count) : _section(std::move(section)),
+        _name(std::move(name)), _min_tag(min_tag), _max_tag(max_tag)
+    {
+        const std::size_t range = max_tag >= min_tag ? max_tag - min_tag + 1 : 0;
+        // a bit per tag in the range vs an int per tag
+        _dense = count > 0 && range / 32 <= count;
+        if (_dense) {
+            _bitmap.assign((range + 63) / 64, 0);
+        } else {
+            _tags.reserve(count);
+        }
+    }
+
+    /// Whether tags are checked with a bitmap rather than sorted.
+    bool dense() const {
+        return _dense;
+    }
+
+    /// Add `tag` to the section.
+    ///
+    /// Throws a std::runtime_error if the tag is outside the declared range,
+    /// or if the range is dense and the tag was already added.
+    void add(int tag) {
+        if (tag < 0 || static_cast<std::size_t>(tag) < _min_tag || static_cast<std::size_t>(tag) > _max_tag) {
+            throw_out_of_range(tag);
+        }
+        if (!_dense) {
+            _tags.push_back(tag);
+            return;
+        }
+        const std::size_t bit = static_cast<std::size_t>(tag) - _min_tag;
+        const std::uint64_t mask = std::uint64_t(1) << (bit % 64);
+        std::uint64_t& word = _bitmap[bit / 64];
+        if (word & mask) {
+            throw_duplicate(tag);
+        }
+        word |= mask;
+    }
+
+    /// Add the tags of `count` nodes or elements, see add.
+    template <typename T>
+    void add(const T* values, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            add(values[i].tag);
+        }
+    }
+
+    /// Check the collected tags of a sparse section for duplicates and
+    /// release them. Does nothing for dense sections, which are checked by add.
+    ///
+    /// Throws a std::runtime_error if a tag was added twice.
+    void finish() {
+        if (_dense) {
+            return;
+        }
+        std::sort(_tags.begin(), _tags.end());
+        auto duplicate = std::adjacent_find(_tags.begin(), _tags.end());
+        if (duplicate != _tags.end()) {
+            throw_duplicate(*duplicate);
+        }
+        std::vector<int>().swap(_tags);
+    }
+
+private:
+    // kept out of line so add stays small enough to inline
+    [[noreturn]] void throw_out_of_range(int tag) const {
+        throw std::runtime_error(_section + " section parsing failed, " + _name + " tag " + std::to_string(tag)
+            + " is outside the range given in the section header ("
+            + std::to_string(_min_tag) + " to " + std::to_string(_max_tag) + ")");
+    }
+    [[noreturn]] void throw_duplicate(int tag) const {
+        throw std::runtime_error(_section + " section parsing failed, found duplicate " + _name + " tag "
+            + std::to_string(tag));
+    }
+
+    std::string _section;
+    std::string _name;
+    std::size_t _min_tag = 0;
+    std::size_t _max_tag = 0;
+    bool _dense = false;
+    std::vector<std::uint64_t> _bitmap;
+    std::vector<int> _tags;
+};
+
+/// A TagChecker for the $Nodes section.
+TagChecker node_tag_checker(std::size_t min_tag, std::size_t max_tag, std::size_t num_nodes) {
+    return TagChecker("$Nodes", "node", min_tag, max_tag, num_nodes);
+}
+
+/// A TagChecker for the $Elements section. The header range and count
+/// cover elements of every dimension, not only tetrahedrons.
+TagChecker element_tag_checker(std::size_t min_tag, std::size_t max_tag, std::size_t num_elts) {
+    return TagChecker("$Elements", "tetrahedron", min_tag, max_tag, num_elts);
+}
+
+/// The medium of each volume, from the $Entities and $PhysicalNames sections.
+class VolumeMedia {
+public:
+    /// Throws a std::runtime_error if either section is missing or a volume
+    /// has an unknown physical group.
+    VolumeMedia(const std::vector<MeshVolume>& volumes, const std::vector<PhysicalGroup>& groups) {
+        if (volumes.empty()) {
+            throw std::runtime_error("No volumes were parsed");
+        }
+        if (groups.empty()) {
+            throw std::runtime_error("No groups were parsed");
+        }
+        std::unordered_set<int> group_tags;
+        group_tags.reserve(groups.size());
+        _media.reserve(groups.size());
+        for (const auto& g: groups) {
+            group_tags.insert(g.tag);
+            _media.push_back(EGS_Mesh::Medium(g.tag, g.name));
+        }
+        _volume_groups.reserve(volumes.size());
+        for (const auto& v: volumes) {
+            if (group_tags.find(v.group) == group_tags.end()) {
+                throw std::runtime_error("volume " + std::to_string(v.tag) + " had unknown physical group tag " + std::to_string(v.group));
+            }
+            _volume_groups.insert({ v.tag, v.group });
+        }
+    }
+
+    /// The media, one per 3D physical group.
+    const std::vector<EGS_Mesh::Medium>& media() const {
+        return _media;
+    }
+
+    /// Replace the volume tags of parsed tetrahedrons (see Tetrahedron) by
+    /// the tags of their media.
+    ///
+    /// Throws a std::runtime_error if a volume is unknown.
+    void resolve(Tetrahedron* elts, std::size_t count) const {
+        // blocs belong to a single volume, so look each run up once
+        int volume = -1;
+        int medium = -1;
+        for (std::size_t i = 0; i < count; ++i) {
+            if (i == 0 || elts[i].medium_tag != volume) {
+                volume = elts[i].medium_tag;
+                auto group = _volume_groups.find(volume);
+                if (group == _volume_groups.end()) {
+                    throw std::runtime_error("tetrahedron " + std::to_string(elts[i].tag) + " had unknown volume tag " + std::to_string(volume));
+                }
+                medium = group->second;
+            }
+            elts[i].medium_tag = medium;
+        }
+    }
+
+private:
+    std::vector<EGS_Mesh::Medium> _media;
+    std::unordered_map<int, int> _volume_groups;
+};
+
+/// Hands parsed blocs on to a MeshSink, checking node and element tags (see
+/// TagChecker) and resolving element volumes into media.
+class BlocStream {
+public:
+    explicit BlocStream(MeshSink& sink) : _sink(sink) {}
+
+    void set_volumes(std::vector<MeshVolume> volumes) {
+        _volumes = std::move(volumes);
+    }
+    void set_groups(std::vector<PhysicalGroup> groups) {
+        _groups = std::move(groups);
+    }
+
+    /// Start the $Nodes section, with the counts from its header.
+    void begin_nodes(std::size_t num_nodes, std::size_t min_tag, std::size_t max_tag) {
+        _node_tags = node_tag_checker(min_tag, max_tag, num_nodes);
+        _sink.begin_nodes(num_nodes);
+    }
+    /// Throws a std::runtime_error if a node tag is invalid.
+    void node_bloc(const Node* nodes, std::size_t count) {
+        if (count > 0) {
+            _node_tags.add(nodes, count);
+            _sink.node_bloc(nodes, count);
+        }
+    }
+    /// Throws a std::runtime_error if a node tag is duplicated.
+    void end_nodes() {
+        _node_tags.finish();
+    }
+
+    /// Start the $Elements section, with the counts from its header.
+    ///
+    /// Throws a std::runtime_error if the $Entities or $PhysicalNames
+    /// sections are missing or invalid, see VolumeMedia.
+    void begin_elements(std::size_t max_elements, std::size_t min_tag, std::size_t max_tag) {
+        _volume_media.reset(new VolumeMedia(_volumes, _groups));
+        _element_tags = element_tag_checker(min_tag, max_tag, max_elements);
+        _sink.begin_elements(_volume_media->media(), max_elements);
+    }
+    /// Resolves the element media in place, see VolumeMedia::resolve.
+    ///
+    /// Throws a std::runtime_error if an element tag or volume is invalid.
+    void element_bloc(Tetrahedron* elts, std::size_t count) {
+        if (count > 0) {
+            _element_tags.add(elts, count);
+            _volume_media->resolve(elts, count);
+            _sink.element_bloc(elts, count);
+        }
+    }
+    /// Throws a std::runtime_error if an element tag is duplicated.
+    void end_elements() {
+        _element_tags.finish();
+    }
+
+private:
+    MeshSink& _sink;
+    std::vector<MeshVolume> _volumes;
+    std::vector<PhysicalGroup> _groups;
+    std::unique_ptr<VolumeMedia> _volume_media;
+    TagChecker _node_tags;
+    TagChecker _element_tags;
+};
+
+/// Build an EGS_Mesh from the parsed nodes and elements, without copying
+/// them. Their tags must already have been checked.
+///
+/// Throws a std::runtime_error if validation fails.
+EGS_Mesh build_mesh(std::vector<Tetrahedron> elements, std::vector<Node> nodes,
+    std::vector<EGS_Mesh::Medium> media, const EGS_Mesh::Options& options)
+{
+    if (nodes.empty()) {
+        throw std::runtime_error("No nodes were parsed");
+    }
+    if (elements.empty()) {
+        throw std::runtime_error("No tetrahedrons were parsed");
+    }
+    // element node tags, unused 3d physical groups and bad elements are
+    // checked by the EGS_Mesh constructor, see EGS_Mesh::Options::validate
+    return EGS_Mesh(std::move(elements), std::move(nodes), std::move(media), options);
+}
+
+/// A MeshSink that appends the blocs to the vectors an EGS_Mesh is built
+/// from, sized up front from the section headers.
+class MeshBuilder : public MeshSink {
+public:
+    void begin_nodes(std::size_t num_nodes) override {
+        _nodes.reserve(num_nodes);
+    }
+    void node_bloc(const EGS_Mesh::Node* nodes, std::size_t count) override {
+        _nodes.insert(_nodes.end(), nodes, nodes + count);
+    }
+    void begin_elements(const std::vector<EGS_Mesh::Medium>& media, std::size_t max_elements) override {
+        _media = media;
+        _elements.reserve(max_elements);
+    }
+    void element_bloc(const EGS_Mesh::Tetrahedron* elements, std::size_t count) override {
+        _elements.insert(_elements.end(), elements, elements + count);
+    }
+
+    /// Build the mesh, handing over the collected vectors, see build_mesh.
+    EGS_Mesh build(const EGS_Mesh::Options& options) {
+        return build_mesh(std::move(_elements), std::move(_nodes), std::move(_media), options);
+    }
+
+    /// Hand over the collected nodes, for meshes whose elements are known.
+    std::vector<EGS_Mesh::Node> take_nodes() {
+        return std::move(_nodes);
+    }
+
+private:
+    std::vector<EGS_Mesh::Node> _nodes;
+    std::vector<EGS_Mesh::Tetrahedron> _elements;
+    std::vector<EGS_Mesh::Medium> _media;
+};
+
 /// Returns a list of volumes. Volume tags are unique.
 ///
 /// Throws a std::runtime_error if parsing fails.
@@ -302,11 +959,10 @@ std::vector<MeshVolume> parse_entities(std::istream& input) {
     return volumes;
 }
 
-/// Parse a single entity bloc of nodes.
+/// Parse a single entity bloc of nodes, appending them to `nodes`.
 ///
 /// Throws a std::runtime_error if parsing fails.
-std::vector<Node> parse_node_bloc(std::istream& input) {
-    std::vector<Node> nodes;
+void parse_node_bloc(std::istream& input, std::vector<Node>& nodes) {
     std::size_t num_nodes = SIZET_MAX;
     int entity = -1;
     std::string line;
@@ -325,55 +981,43 @@ std::vector<Node> parse_node_bloc(std::istream& input) {
             throw std::runtime_error("Node bloc parsing failed for entity " + std::to_string(entity) + ", got dimension " + std::to_string(dim) + ", expected 0, 1, 2, or 3");
         }
     }
-    nodes.reserve(num_nodes);
+    // the lines are read into one reused string and parsed in place, the
+    // same as the memory-mapped parser
+    const std::size_t first = nodes.size();
+    nodes.resize(first + num_nodes, Node(-1, 0.0, 0.0, 0.0));
     // initialize node tags
     for (std::size_t i = 0; i < num_nodes; ++i) {
         std::getline(input, line);
-        std::istringstream line_stream(line);
+        TextCursor fields(line.data(), line.data() + line.size());
         std::size_t tag = SIZET_MAX;
-        line_stream >> tag;
-        if (line_stream.fail() || tag == SIZET_MAX) {
+        if (!fields.parse_size(tag) || tag == SIZET_MAX) {
             throw std::runtime_error("Node bloc parsing failed during node tag section of entity " + std::to_string(entity));
         }
-        Node n(-1, 0.0, 0.0, 0.0);
-        n.tag = tag;
-        nodes.push_back(n);
+        nodes[first + i].tag = tag;
     }
     // fill in coordinates
     for (std::size_t i = 0; i < num_nodes; ++i) {
         std::getline(input, line);
-        std::istringstream line_stream(line);
-        double x = 0.0;
-        double y = 0.0;
-        double z = 0.0;
-        line_stream >> x >> y >> z;
-        if (line_stream.fail()) {
+        TextCursor fields(line.data(), line.data() + line.size());
+        Node& n = nodes[first + i];
+        if (!(fields.parse_double(n.x) && fields.parse_double(n.y) && fields.parse_double(n.z))) {
             throw std::runtime_error("Node bloc parsing failed during node coordinate section of entity " + std::to_string(entity));
         }
-        nodes.at(i).x = x;
-        nodes.at(i).y = y;
-        nodes.at(i).z = z;
     }
-    if (nodes.size() != num_nodes) {
-        throw std::runtime_error("Node bloc parsing failed, expected " + std::to_string(num_nodes) + " nodes but read "
-            + std::to_string(nodes.size()) + " for entity " + std::to_string(entity));
-    }
-    return nodes;
 }
 
-/// Parse the entire $Nodes section and returns a list of Nodes. Node tags are unique.
+/// Parse the entire $Nodes section, handing each bloc to `stream`.
 ///
 /// Throws a std::runtime_error if parsing fails.
-std::vector<Node> parse_nodes(std::istream& input) {
-    std::vector<Node> nodes;
+void parse_nodes(std::istream& input, BlocStream& stream) {
     std::size_t num_blocs = SIZET_MAX;
     std::size_t num_nodes = SIZET_MAX;
+    std::size_t min_tag = SIZET_MAX;
+    std::size_t max_tag = SIZET_MAX;
     std::string line;
     {
         std::getline(input, line);
         std::istringstream line_stream(line);
-        std::size_t min_tag = SIZET_MAX;
-        std::size_t max_tag = SIZET_MAX;
         line_stream >> num_blocs >> num_nodes >> min_tag >> max_tag;
         if (line_stream.fail() || num_blocs == SIZET_MAX || num_nodes == SIZET_MAX ||
                 min_tag == SIZET_MAX || max_tag == SIZET_MAX)
@@ -385,32 +1029,30 @@ std::vector<Node> parse_nodes(std::istream& input) {
                 + std::to_string(std::numeric_limits<int>::max()));
         }
     }
-    nodes.reserve(num_nodes);
+    stream.begin_nodes(num_nodes, min_tag, max_tag);
+    // one bloc buffer for the whole section
+    std::vector<Node> bloc_nodes;
+    std::size_t num_read = 0;
     for (std::size_t i = 0; i < num_blocs; ++i) {
-        std::vector<Node> bloc_nodes;
+        bloc_nodes.clear();
         try {
-            bloc_nodes = parse_node_bloc(input);
+            parse_node_bloc(input, bloc_nodes);
         } catch (const std::runtime_error& err) {
             throw std::runtime_error("$Nodes section parsing failed\n" + std::string(err.what()));
         }
-        nodes.insert(nodes.end(), bloc_nodes.begin(), bloc_nodes.end());
+        num_read += bloc_nodes.size();
+        stream.node_bloc(bloc_nodes.data(), bloc_nodes.size());
     }
-    if (nodes.size() != num_nodes) {
+    stream.end_nodes();
+    if (num_read != num_nodes) {
         throw std::runtime_error("$Nodes section parsing failed, expected " + std::to_string(num_nodes) + " nodes but read "
-            + std::to_string(nodes.size()));
+            + std::to_string(num_read));
     }
     std::getline(input, line);
     rtrim(line);
     if (line != "$EndNodes") {
         throw std::runtime_error("$Nodes section parsing failed, expected $EndNodes");
     }
-    // ensure node tags are unique
-    auto unique_res = check_unique_tags(nodes);
-    if (!unique_res.first) {
-        throw std::runtime_error("$Nodes section parsing failed, found duplicate node tag "
-            + std::to_string(unique_res.second));
-    }
-    return nodes;
 }
 
 /// Returns a list of PhysicalGroups. PhysicalGroup tags are unique.
@@ -477,11 +1119,10 @@ std::vector<PhysicalGroup> parse_groups(std::istream& input) {
     return groups;
 }
 
-/// Parse a single msh4 element bloc.
+/// Parse a single msh4 element bloc, appending any tetrahedrons to `elts`.
 ///
 /// Throws a std::runtime_error if parsing fails.
-std::vector<Tetrahedron> parse_element_bloc(std::istream& input) {
-    std::vector<Tetrahedron> elts;
+void parse_element_bloc(std::istream& input, std::vector<Tetrahedron>& elts) {
     std::size_t num_elts = SIZET_MAX;
     int entity = -1;
     std::string line;
@@ -505,7 +1146,7 @@ std::vector<Tetrahedron> parse_element_bloc(std::istream& input) {
             for (std::size_t i = 0; i < num_elts; ++i) {
                 std::getline(input, line);
             }
-            return std::vector<Tetrahedron>{};
+            return;
         }
         // If a mesh with 3d non-tetrahedral elements is provided, exit.
         // The mesh may have some volumes that are supposed to be simulated but
@@ -517,40 +1158,37 @@ std::vector<Tetrahedron> parse_element_bloc(std::istream& input) {
                 ", got non-tetrahedral mesh element type " + std::to_string(element_type));
         }
     }
-    elts.reserve(num_elts);
+    elts.reserve(elts.size() + num_elts);
 
     for (std::size_t i = 0; i < num_elts; ++i) {
         std::getline(input, line);
-        std::istringstream line_stream(line);
+        TextCursor fields(line.data(), line.data() + line.size());
         int tag = -1;
         int a = -1;
         int b = -1;
         int c = -1;
         int d = -1;
-        line_stream >> tag >> a >> b >> c >> d;
-        if (line_stream.fail() || tag == -1 || a == -1 || b == -1 ||
-                c == -1 || d == -1)
-        {
+        bool ok = fields.parse_int(tag) && fields.parse_int(a) && fields.parse_int(b) &&
+            fields.parse_int(c) && fields.parse_int(d);
+        if (!ok || tag == -1 || a == -1 || b == -1 || c == -1 || d == -1) {
             throw std::runtime_error("Element bloc parsing failed for entity " + std::to_string(entity));
         }
         elts.push_back(Tetrahedron(tag, entity, a, b, c, d));
     }
-    return elts;
 }
 
-/// Returns a list of tetrahedral elements. Element tags are unique.
+/// Parse the entire $Elements section, handing each bloc of tetrahedrons to `stream`.
 ///
 /// Throws a std::runtime_error if parsing fails.
-std::vector<Tetrahedron> parse_elements(std::istream& input) {
-    std::vector<Tetrahedron> elts;
+void parse_elements(std::istream& input, BlocStream& stream) {
     std::size_t num_blocs = SIZET_MAX;
     std::size_t num_elts = SIZET_MAX;
+    std::size_t min_tag = SIZET_MAX;
+    std::size_t max_tag = SIZET_MAX;
     std::string line;
     {
         std::getline(input, line);
         std::istringstream line_stream(line);
-        std::size_t min_tag = SIZET_MAX;
-        std::size_t max_tag = SIZET_MAX;
         line_stream >> num_blocs >> num_elts >> min_tag >> max_tag;
         if (line_stream.fail() || num_blocs == SIZET_MAX || num_elts == SIZET_MAX ||
                 min_tag == SIZET_MAX || max_tag == SIZET_MAX)
@@ -558,127 +1196,1025 @@ std::vector<Tetrahedron> parse_elements(std::istream& input) {
             throw std::runtime_error("$Elements section parsing failed, missing metadata");
         }
     }
-    elts.reserve(num_elts);
+    stream.begin_elements(num_elts, min_tag, max_tag);
+    // one bloc buffer for the whole section
+    std::vector<Tetrahedron> bloc_elts;
+    std::size_t num_tets = 0;
     for (std::size_t i = 0; i < num_blocs; ++i) {
-        std::vector<Tetrahedron> bloc_elts;
+        bloc_elts.clear();
         try {
-            bloc_elts = parse_element_bloc(input);
+            parse_element_bloc(input, bloc_elts);
         } catch (const std::runtime_error& err) {
             throw std::runtime_error("$Elements section parsing failed\n" + std::string(err.what()));
         }
-        elts.insert(elts.end(), bloc_elts.begin(), bloc_elts.end());
+        num_tets += bloc_elts.size();
+        stream.element_bloc(bloc_elts.data(), bloc_elts.size());
     }
+    stream.end_elements();
     // can't check against num_elts because it counts all elements
     std::getline(input, line);
     rtrim(line);
     if (line != "$EndElements") {
         throw std::runtime_error("$Elements section parsing failed, expected $EndElements");
     }
-    if (elts.size() == 0) {
+    if (num_tets == 0) {
         throw std::runtime_error("$Elements section parsing failed, no tetrahedral elements were read");
     }
-    // ensure element tags are unique
-    auto unique_res = check_unique_tags(elts);
-    if (!unique_res.first) {
-        throw std::runtime_error("$Elements section parsing failed, found duplicate tetrahedron tag "
-            + std::to_string(unique_res.second));
+}
+
+// Binary msh 4.1 sections store tags and counts as int and size_t and
+// coordinates as doubles, in the byte order given by the $MeshFormat marker.
+// $PhysicalNames is always ascii. These parsers are templates so they can read
+// from a std::istream or a memory-mapped file.
+
+/// Returns the number of nodes of a Gmsh element type, which is needed to
+/// skip lower-dimensional binary element blocs. Returns 0 for unknown types.
+std::size_t element_num_nodes(int element_type) {
+    switch (element_type) {
+        case 1: return 2;   // line
+        case 2: return 3;   // triangle
+        case 3: return 4;   // quadrangle
+        case 4: return 4;   // tetrahedron
+        case 5: return 8;   // hexahedron
+        case 6: return 6;   // prism
+        case 7: return 5;   // pyramid
+        case 8: return 3;   // second order line
+        case 9: return 6;   // second order triangle
+        case 10: return 9;  // second order quadrangle
+        case 11: return 10; // second order tetrahedron
+        case 12: return 27; // second order hexahedron
+        case 13: return 18; // second order prism
+        case 14: return 14; // second order pyramid
+        case 15: return 1;  // point
+        case 16: return 8;  // serendipity quadrangle
+        case 17: return 20; // serendipity hexahedron
+        case 18: return 15; // serendipity prism
+        case 19: return 13; // serendipity pyramid
+        default: return 0;
     }
-    // TODO check against min and max tag values
-    return elts;
 }
 
-/// Parse the body of a msh4.1 file.
+/// Skip `count` binary values of type T.
 ///
-/// Throws a std::runtime_error if parsing fails.
-EGS_Mesh parse_body(std::istream& input) {
-    std::vector<Node> nodes;
-    std::vector<MeshVolume> volumes;
-    std::vector<PhysicalGroup> groups;
-    std::vector<Tetrahedron> elements;
-
-    std::string parse_err;
+/// Throws a std::runtime_error with message `err` if the input ended early.
+template <typename T, typename Input>
+void skip_binary(Input& input, std::size_t count, const std::string& err) {
+    if (count > SIZET_MAX / sizeof(T) || !skip_bytes(input, count * sizeof(T))) {
+        throw std::runtime_error(err);
+    }
+}
+
+/// Binary section data is followed by a newline and then the section end
+/// marker. Returns true if the end marker was found.
+template <typename Input>
+bool read_binary_section_end(Input& input, const std::string& end_marker) {
+    std::string line = read_line(input);
+    rtrim(line);
+    if (line.empty()) {
+        line = read_line(input);
+        rtrim(line);
+    }
+    return line == end_marker;
+}
+
+/// Returns a list of volumes from a binary $Entities section. Volume tags are unique.
+///
+/// Throws a std::runtime_error if parsing fails.
+template <typename Input>
+std::vector<MeshVolume> parse_binary_entities(Input& input, bool swap) {
+    const std::string err = "$Entities parsing failed";
+    // number of points, curves, surfaces and volumes
+    std::size_t num_entities[4];
+    read_binary(input, num_entities, 4, swap, err);
+    const std::size_t num_3d = num_entities[3];
+    if (num_3d == 0) {
+        throw std::runtime_error("$Entities parsing failed, no volumes found");
+    }
+    std::vector<MeshVolume> volumes;
+    volumes.reserve(std::min<std::size_t>(num_3d, 1 << 16));
+    for (std::size_t dim = 0; dim < 4; ++dim) {
+        for (std::size_t i = 0; i < num_entities[dim]; ++i) {
+            std::int32_t tag = -1;
+            read_binary(input, &tag, 1, swap, err);
+            // points have a position, everything else has a bounding box
+            skip_binary<double>(input, dim == 0 ? 3 : 6, err);
+            std::size_t num_groups = 0;
+            read_binary(input, &num_groups, 1, swap, err);
+            if (dim != 3) {
+                skip_binary<std::int32_t>(input, num_groups, err);
+            } else {
+                if (num_groups == 0) {
+                    throw std::runtime_error("$Entities parsing failed, volume " + std::to_string(tag) + " was not assigned a physical group");
+                }
+                if (num_groups != 1) {
+                    throw std::runtime_error("$Entities parsing failed, volume " + std::to_string(tag) + " has more than one physical group");
+                }
+                std::int32_t group = -1;
+                read_binary(input, &group, 1, swap, err);
+                volumes.push_back(MeshVolume(tag, group));
+            }
+            if (dim != 0) {
+                std::size_t num_bounding = 0;
+                read_binary(input, &num_bounding, 1, swap, err);
+                skip_binary<std::int32_t>(input, num_bounding, err);
+            }
+        }
+    }
+    if (!read_binary_section_end(input, "$EndEntities")) {
+        throw std::runtime_error("$Entities parsing failed, expected $EndEntities");
+    }
+    // ensure volume tags are unique
+    auto unique_res = check_unique_tags(volumes);
+    if (!unique_res.first) {
+        throw std::runtime_error("$Entities section parsing failed, found duplicate volume tag "
+            + std::to_string(unique_res.second));
+    }
+    return volumes;
+}
+
+/// Parse a single binary entity bloc of nodes, appending them to `nodes`.
+/// Blocs with more than `max_nodes` nodes are rejected.
+///
+/// Throws a std::runtime_error if parsing fails.
+template <typename Input>
+void parse_binary_node_bloc(Input& input, bool swap, std::size_t max_nodes,
+    std::vector<Node>& nodes)
+{
+    // dimension, entity and parametric flag
+    std::int32_t header[3];
+    std::size_t num_nodes = SIZET_MAX;
+    read_binary(input, header, 3, swap, "Node bloc parsing failed");
+    read_binary(input, &num_nodes, 1, swap, "Node bloc parsing failed");
+    const int dim = header[0];
+    const int entity = header[1];
+    const bool parametric = header[2] != 0;
+    if (dim < 0 || dim > 3) {
+        throw std::runtime_error("Node bloc parsing failed for entity " + std::to_string(entity) + ", got dimension " + std::to_string(dim) + ", expected 0, 1, 2, or 3");
+    }
+    if (num_nodes > max_nodes) {
+        throw std::runtime_error("Node bloc parsing failed for entity " + std::to_string(entity) + ", bloc has more nodes than the $Nodes header");
+    }
+    // all the tags come before all the coordinates, so the nodes are
+    // created from the tags and filled in, reading through a small buffer
+    const std::size_t first = nodes.size();
+    nodes.reserve(first + num_nodes);
+    const std::string tag_err = "Node bloc parsing failed during node tag section of entity " + std::to_string(entity);
+    std::size_t tags[BINARY_READ_CHUNK];
+    for (std::size_t done = 0; done < num_nodes; done += BINARY_READ_CHUNK) {
+        const std::size_t n = std::min(BINARY_READ_CHUNK, num_nodes - done);
+        read_binary(input, tags, n, swap, tag_err);
+        for (std::size_t i = 0; i < n; ++i) {
+            if (tags[i] > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+                throw std::runtime_error(tag_err);
+            }
+            nodes.push_back(Node(static_cast<int>(tags[i]), 0.0, 0.0, 0.0));
+        }
+    }
+    // parametric nodes also store one parametric coordinate per dimension
+    const std::size_t stride = 3 + (parametric ? static_cast<std::size_t>(dim) : 0);
+    const std::string coord_err = "Node bloc parsing failed during node coordinate section of entity " + std::to_string(entity);
+    double coords[BINARY_READ_CHUNK * 6];
+    for (std::size_t done = 0; done < num_nodes; done += BINARY_READ_CHUNK) {
+        const std::size_t n = std::min(BINARY_READ_CHUNK, num_nodes - done);
+        read_binary(input, coords, n * stride, swap, coord_err);
+        for (std::size_t i = 0; i < n; ++i) {
+            Node& node = nodes[first + done + i];
+            node.x = coords[i * stride];
+            node.y = coords[i * stride + 1];
+            node.z = coords[i * stride + 2];
+        }
+    }
+}
+
+/// Parse an entire binary $Nodes section, handing each bloc to `stream`.
+///
+/// Throws a std::runtime_error if parsing fails.
+template <typename Input>
+void parse_binary_nodes(Input& input, bool swap, BlocStream& stream) {
+    // number of blocs, number of nodes, min and max tag
+    std::size_t metadata[4];
+    read_binary(input, metadata, 4, swap, "$Nodes section parsing failed, missing metadata");
+    const std::size_t num_blocs = metadata[0];
+    const std::size_t num_nodes = metadata[1];
+    const std::size_t min_tag = metadata[2];
+    const std::size_t max_tag = metadata[3];
+    if (max_tag > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+        throw std::runtime_error("Max node tag is too large (" + std::to_string(max_tag) + "), limit is "
+            + std::to_string(std::numeric_limits<int>::max()));
+    }
+    stream.begin_nodes(num_nodes, min_tag, max_tag);
+    std::vector<Node> bloc_nodes;
+    std::size_t num_read = 0;
+    for (std::size_t i = 0; i < num_blocs; ++i) {
+        bloc_nodes.clear();
+        try {
+            parse_binary_node_bloc(input, swap, num_nodes - num_read, bloc_nodes);
+        } catch (const std::runtime_error& err) {
+            throw std::runtime_error("$Nodes section parsing failed\n" + std::string(err.what()));
+        }
+        num_read += bloc_nodes.size();
+        stream.node_bloc(bloc_nodes.data(), bloc_nodes.size());
+    }
+    stream.end_nodes();
+    if (num_read != num_nodes) {
+        throw std::runtime_error("$Nodes section parsing failed, expected " + std::to_string(num_nodes) + " nodes but read "
+            + std::to_string(num_read));
+    }
+    if (!read_binary_section_end(input, "$EndNodes")) {
+        throw std::runtime_error("$Nodes section parsing failed, expected $EndNodes");
+    }
+}
+
+/// Parse a single binary element bloc, appending any tetrahedrons to `elts`.
+/// Blocs with more than `max_elts` elements are rejected. Returns the number
+/// of elements in the bloc.
+///
+/// Throws a std::runtime_error if parsing fails.
+template <typename Input>
+std::size_t parse_binary_element_bloc(Input& input, bool swap, std::size_t max_elts,
+    std::vector<Tetrahedron>& elts)
+{
+    // dimension, entity and element type
+    std::int32_t header[3];
+    std::size_t num_elts = SIZET_MAX;
+    read_binary(input, header, 3, swap, "Element bloc parsing failed");
+    read_binary(input, &num_elts, 1, swap, "Element bloc parsing failed");
+    const int dim = header[0];
+    const int entity = header[1];
+    const int element_type = header[2];
+    const std::string err = "Element bloc parsing failed for entity " + std::to_string(entity);
+    if (dim < 0 || dim > 3) {
+        throw std::runtime_error(err + ", got dimension " + std::to_string(dim) + ", expected 0, 1, 2, or 3");
+    }
+    if (num_elts > max_elts) {
+        throw std::runtime_error(err + ", bloc has more elements than the $Elements header");
+    }
+    // skip 0, 1, 2d element blocs
+    if (dim != 3) {
+        const std::size_t num_elt_nodes = element_num_nodes(element_type);
+        if (num_elt_nodes == 0) {
+            throw std::runtime_error(err + ", got unknown element type " + std::to_string(element_type));
+        }
+        // each element is its tag followed by its nodes
+        skip_binary<std::size_t>(input, num_elts * (num_elt_nodes + 1), err);
+        return num_elts;
+    }
+    // see parse_element_bloc for why non-tetrahedral 3d elements are an error
+    const int TETRAHEDRON_TYPE = 4;
+    if (element_type != TETRAHEDRON_TYPE) {
+        throw std::runtime_error(err + ", got non-tetrahedral mesh element type " + std::to_string(element_type));
+    }
+    // element tag and four node tags, read through a small buffer
+    elts.reserve(elts.size() + num_elts);
+    std::size_t data[BINARY_READ_CHUNK * 5];
+    const std::size_t INT_MAX_TAG = static_cast<std::size_t>(std::numeric_limits<int>::max());
+    for (std::size_t done = 0; done < num_elts; done += BINARY_READ_CHUNK) {
+        const std::size_t n = std::min(BINARY_READ_CHUNK, num_elts - done);
+        read_binary(input, data, n * 5, swap, err);
+        for (std::size_t i = 0; i < n; ++i) {
+            const std::size_t* elt = data + 5 * i;
+            if (elt[0] > INT_MAX_TAG || elt[1] > INT_MAX_TAG || elt[2] > INT_MAX_TAG ||
+                    elt[3] > INT_MAX_TAG || elt[4] > INT_MAX_TAG)
+            {
+                throw std::runtime_error(err);
+            }
+            elts.push_back(Tetrahedron(static_cast<int>(elt[0]), entity, static_cast<int>(elt[1]),
+                static_cast<int>(elt[2]), static_cast<int>(elt[3]), static_cast<int>(elt[4])));
+        }
+    }
+    return num_elts;
+}
+
+/// Parse an entire binary $Elements section, handing each bloc of
+/// tetrahedrons to `stream`.
+///
+/// Throws a std::runtime_error if parsing fails.
+template <typename Input>
+void parse_binary_elements(Input& input, bool swap, BlocStream& stream) {
+    // number of blocs, number of elements, min and max tag
+    std::size_t metadata[4];
+    read_binary(input, metadata, 4, swap, "$Elements section parsing failed, missing metadata");
+    const std::size_t num_blocs = metadata[0];
+    const std::size_t num_elts = metadata[1];
+    stream.begin_elements(num_elts, metadata[2], metadata[3]);
+    std::vector<Tetrahedron> bloc_elts;
+    // counts every element, not only tetrahedrons, to bound the bloc sizes
+    std::size_t num_read = 0;
+    std::size_t num_tets = 0;
+    for (std::size_t i = 0; i < num_blocs; ++i) {
+        bloc_elts.clear();
+        try {
+            num_read += parse_binary_element_bloc(input, swap, num_elts - num_read, bloc_elts);
+        } catch (const std::runtime_error& err) {
+            throw std::runtime_error("$Elements section parsing failed\n" + std::string(err.what()));
+        }
+        num_tets += bloc_elts.size();
+        stream.element_bloc(bloc_elts.data(), bloc_elts.size());
+    }
+    stream.end_elements();
+    if (!read_binary_section_end(input, "$EndElements")) {
+        throw std::runtime_error("$Elements section parsing failed, expected $EndElements");
+    }
+    if (num_tets == 0) {
+        throw std::runtime_error("$Elements section parsing failed, no tetrahedral elements were read");
+    }
+}
+
+/// Parse the body of a msh4.1 file, handing the nodes and elements to `stream`.
+///
+/// Throws a std::runtime_error if parsing fails.
+void stream_body(std::istream& input, const MshFormat& format, BlocStream& stream) {
     std::string input_line;
+    std::istream::pos_type line_start = input.tellg();
     while (std::getline(input, input_line)) {
         rtrim(input_line);
-        // stop reading if we hit another mesh file
+        // stop before another mesh, so the caller can parse it from a
+        // seekable stream
         if (input_line == "$MeshFormat") {
+            if (line_start != std::istream::pos_type(-1)) {
+                input.seekg(line_start);
+            }
             break;
         }
         if (input_line == "$Entities") {
-           volumes = parse_entities(input);
+            stream.set_volumes(format.binary ? parse_binary_entities(input, format.swap_bytes)
+                : parse_entities(input));
         } else if (input_line == "$PhysicalNames") {
-            groups = parse_groups(input);
+            stream.set_groups(parse_groups(input));
         } else if (input_line == "$Nodes") {
-            nodes = parse_nodes(input);
+            if (format.binary) {
+                parse_binary_nodes(input, format.swap_bytes, stream);
+            } else {
+                parse_nodes(input, stream);
+            }
         } else if (input_line == "$Elements") {
-            elements = parse_elements(input);
+            if (format.binary) {
+                parse_binary_elements(input, format.swap_bytes, stream);
+            } else {
+                parse_elements(input, stream);
+            }
         }
+        line_start = input.tellg();
     }
-    if (volumes.empty()) {
-        throw std::runtime_error("No volumes were parsed");
+}
+
+/// Parse the body of a msh4.1 file.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_body(std::istream& input, const MshFormat& format = MshFormat(),
+    const EGS_Mesh::Options& options = EGS_Mesh::Options())
+{
+    MeshBuilder builder;
+    BlocStream stream(builder);
+    stream_body(input, format, stream);
+    return builder.build(options);
+}
+
+// The following overloads parse the $Nodes and $Elements sections of a
+// memory-mapped file in place. They are drop-in replacements for the
+// std::istream versions above and must report the same errors. Blocs are
+// parsed in pieces (header, then ranges of lines) so the parallel parser can
+// share the same code.
+
+/// The header line of a node or element bloc.
+struct BlocHeader {
+    int dim = -1;
+    int entity = -1;
+    // parametric flag for node blocs, element type for element blocs
+    int type = -1;
+    std::size_t count = SIZET_MAX;
+};
+
+/// Parse the header line of a node bloc.
+///
+/// Throws a std::runtime_error if parsing fails.
+BlocHeader parse_node_bloc_header(TextCursor& input) {
+    BlocHeader header;
+    bool ok = input.parse_int(header.dim) && input.parse_int(header.entity) &&
+        input.parse_int(header.type) && input.parse_size(header.count);
+    if (!ok || header.dim == -1 || header.entity == -1 || header.type == -1
+            || header.count == SIZET_MAX)
+    {
+        throw std::runtime_error("Node bloc parsing failed");
     }
-    if (nodes.empty()) {
-        throw std::runtime_error("No nodes were parsed");
+    if (header.dim < 0 || header.dim > 3) {
+        throw std::runtime_error("Node bloc parsing failed for entity " + std::to_string(header.entity) + ", got dimension " + std::to_string(header.dim) + ", expected 0, 1, 2, or 3");
     }
-    if (groups.empty()) {
-        throw std::runtime_error("No groups were parsed");
+    input.skip_line();
+    return header;
+}
+
+/// Parse `count` node tag lines into the tags of `nodes[0..count)`.
+///
+/// Throws a std::runtime_error if parsing fails.
+void parse_node_tags(TextCursor& input, int entity, Node* nodes, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        std::size_t tag = SIZET_MAX;
+        if (!input.parse_size(tag) || tag == SIZET_MAX) {
+            throw std::runtime_error("Node bloc parsing failed during node tag section of entity " + std::to_string(entity));
+        }
+        input.skip_line();
+        nodes[i].tag = static_cast<int>(tag);
     }
-    if (elements.empty()) {
-        throw std::runtime_error("No tetrahedrons were parsed");
+}
+
+/// Parse `count` node coordinate lines into `nodes[0..count)`.
+///
+/// Throws a std::runtime_error if parsing fails.
+void parse_node_coords(TextCursor& input, int entity, Node* nodes, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        double x = 0.0;
+        double y = 0.0;
+        double z = 0.0;
+        if (!(input.parse_double(x) && input.parse_double(y) && input.parse_double(z))) {
+            throw std::runtime_error("Node bloc parsing failed during node coordinate section of entity " + std::to_string(entity));
+        }
+        input.skip_line();
+        nodes[i].x = x;
+        nodes[i].y = y;
+        nodes[i].z = z;
+    }
+}
+
+/// Parse a single entity bloc of nodes from a memory-mapped file, appending
+/// them to `nodes`.
+///
+/// Throws a std::runtime_error if parsing fails.
+void parse_node_bloc(TextCursor& input, std::vector<Node>& nodes) {
+    BlocHeader header = parse_node_bloc_header(input);
+    const std::size_t first = nodes.size();
+    nodes.resize(first + header.count, Node(-1, 0.0, 0.0, 0.0));
+    parse_node_tags(input, header.entity, nodes.data() + first, header.count);
+    parse_node_coords(input, header.entity, nodes.data() + first, header.count);
+}
+
+/// The metadata line of a $Nodes or $Elements section.
+struct SectionHeader {
+    std::size_t num_blocs = SIZET_MAX;
+    // number of nodes or elements (of any dimension)
+    std::size_t count = SIZET_MAX;
+    std::size_t min_tag = SIZET_MAX;
+    std::size_t max_tag = SIZET_MAX;
+};
+
+/// Parse the metadata line of a $Nodes section.
+///
+/// Throws a std::runtime_error if parsing fails.
+SectionHeader parse_nodes_header(TextCursor& input) {
+    std::size_t num_blocs = SIZET_MAX;
+    std::size_t num_nodes = SIZET_MAX;
+    std::size_t min_tag = SIZET_MAX;
+    std::size_t max_tag = SIZET_MAX;
+    bool ok = input.parse_size(num_blocs) && input.parse_size(num_nodes) &&
+        input.parse_size(min_tag) && input.parse_size(max_tag);
+    if (!ok || num_blocs == SIZET_MAX || num_nodes == SIZET_MAX ||
+            min_tag == SIZET_MAX || max_tag == SIZET_MAX)
+    {
+        throw std::runtime_error("$Nodes section parsing failed, missing metadata");
+    }
+    if (max_tag > static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+        throw std::runtime_error("Max node tag is too large (" + std::to_string(max_tag) + "), limit is "
+            + std::to_string(std::numeric_limits<int>::max()));
     }
+    input.skip_line();
+    SectionHeader header;
+    header.num_blocs = num_blocs;
+    header.count = num_nodes;
+    header.min_tag = min_tag;
+    header.max_tag = max_tag;
+    return header;
+}
 
-    // ensure each entity has a valid group
-    std::unordered_set<int> group_tags;
-    group_tags.reserve(groups.size());
-    for (auto g: groups) {
-        group_tags.insert(g.tag);
+/// Checks the end of a $Nodes section once all blocs have been read.
+///
+/// Throws a std::runtime_error if the node count is wrong or $EndNodes is missing.
+void check_nodes_end(TextCursor& input, std::size_t num_read, std::size_t num_nodes) {
+    if (num_read != num_nodes) {
+        throw std::runtime_error("$Nodes section parsing failed, expected " + std::to_string(num_nodes) + " nodes but read "
+            + std::to_string(num_read));
     }
-    std::unordered_map<int, int> volume_groups;
-    volume_groups.reserve(volumes.size());
-    for (auto v: volumes) {
-        if (group_tags.find(v.group) == group_tags.end()) {
-            throw std::runtime_error("volume " + std::to_string(v.tag) + " had unknown physical group tag " + std::to_string(v.group));
+    std::string line = input.read_line();
+    rtrim(line);
+    if (line != "$EndNodes") {
+        throw std::runtime_error("$Nodes section parsing failed, expected $EndNodes");
+    }
+}
+
+/// Parse the entire $Nodes section of a memory-mapped file, handing each
+/// bloc to `stream`.
+///
+/// Throws a std::runtime_error if parsing fails.
+void parse_nodes(TextCursor& input, BlocStream& stream) {
+    auto counts = parse_nodes_header(input);
+    stream.begin_nodes(counts.count, counts.min_tag, counts.max_tag);
+    // one bloc buffer for the whole section
+    std::vector<Node> bloc_nodes;
+    std::size_t num_read = 0;
+    for (std::size_t i = 0; i < counts.num_blocs; ++i) {
+        bloc_nodes.clear();
+        try {
+            parse_node_bloc(input, bloc_nodes);
+        } catch (const std::runtime_error& err) {
+            throw std::runtime_error("$Nodes section parsing failed\n" + std::string(err.what()));
         }
-        volume_groups.insert({ v.tag, v.group });
+        num_read += bloc_nodes.size();
+        stream.node_bloc(bloc_nodes.data(), bloc_nodes.size());
+    }
+    stream.end_nodes();
+    check_nodes_end(input, num_read, counts.count);
+}
+
+/// Parse the header line of an element bloc. Blocs of 0, 1 and 2d elements
+/// are allowed, 3d blocs must contain tetrahedrons.
+///
+/// Throws a std::runtime_error if parsing fails.
+BlocHeader parse_element_bloc_header(TextCursor& input) {
+    BlocHeader header;
+    bool ok = input.parse_int(header.dim) && input.parse_int(header.entity) &&
+        input.parse_int(header.type) && input.parse_size(header.count);
+    if (!ok || header.dim == -1 || header.entity == -1 || header.type == -1
+            || header.count == SIZET_MAX)
+    {
+        throw std::runtime_error("Element bloc parsing failed");
+    }
+    if (header.dim < 0 || header.dim > 3) {
+        throw std::runtime_error("Element bloc parsing failed for entity " + std::to_string(header.entity)
+                + ", got dimension " + std::to_string(header.dim) + ", expected 0, 1, 2, or 3");
+    }
+    // see the std::istream overload of parse_element_bloc for why
+    // non-tetrahedral 3d elements are an error
+    const int TETRAHEDRON_TYPE = 4;
+    if (header.dim == 3 && header.type != TETRAHEDRON_TYPE) {
+        throw std::runtime_error("Element bloc parsing failed for entity " + std::to_string(header.entity) +
+            ", got non-tetrahedral mesh element type " + std::to_string(header.type));
     }
+    input.skip_line();
+    return header;
+}
 
-    // ensure each element has a valid entity and therefore a valid physical group
-    std::vector<int> element_groups;
-    element_groups.reserve(elements.size());
-    for (auto e: elements) {
-        auto elt_group = volume_groups.find(e.volume);
-        if (elt_group == volume_groups.end()) {
-            throw std::runtime_error("tetrahedron " + std::to_string(e.tag) + " had unknown volume tag " + std::to_string(e.volume));
+/// Parse `count` tetrahedron lines into `elts[0..count)`.
+///
+/// Throws a std::runtime_error if parsing fails.
+void parse_tetrahedrons(TextCursor& input, int entity, Tetrahedron* elts, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        int tag = -1;
+        int a = -1;
+        int b = -1;
+        int c = -1;
+        int d = -1;
+        bool ok = input.parse_int(tag) && input.parse_int(a) && input.parse_int(b) &&
+            input.parse_int(c) && input.parse_int(d);
+        if (!ok || tag == -1 || a == -1 || b == -1 || c == -1 || d == -1) {
+            throw std::runtime_error("Element bloc parsing failed for entity " + std::to_string(entity));
         }
-        element_groups.push_back(elt_group->second);
+        input.skip_line();
+        elts[i] = Tetrahedron(tag, entity, a, b, c, d);
     }
+}
 
-    std::vector<EGS_Mesh::Tetrahedron> mesh_elts;
-    mesh_elts.reserve(elements.size());
-    for (std::size_t i = 0; i < elements.size(); ++i) {
-        const auto& elt = elements[i];
-        mesh_elts.push_back(EGS_Mesh::Tetrahedron(
-            element_groups[i], elt.a, elt.b, elt.c, elt.d
-        ));
+/// Parse a single msh4 element bloc from a memory-mapped file, appending any
+/// tetrahedrons to `elts`.
+///
+/// Throws a std::runtime_error if parsing fails.
+void parse_element_bloc(TextCursor& input, std::vector<Tetrahedron>& elts) {
+    BlocHeader header = parse_element_bloc_header(input);
+    // skip 0, 1, 2d element blocs
+    if (header.dim != 3) {
+        for (std::size_t i = 0; i < header.count; ++i) {
+            input.skip_line();
+        }
+        return;
     }
+    const std::size_t first = elts.size();
+    elts.resize(first + header.count, Tetrahedron(-1, -1, -1, -1, -1, -1));
+    parse_tetrahedrons(input, header.entity, elts.data() + first, header.count);
+}
 
-    std::vector<EGS_Mesh::Node> mesh_nodes;
-    mesh_nodes.reserve(nodes.size());
-    for (const auto& n: nodes) {
-        mesh_nodes.push_back(EGS_Mesh::Node(
-            n.tag, n.x, n.y, n.z
-        ));
+/// Parse the metadata line of an $Elements section.
+///
+/// Throws a std::runtime_error if parsing fails.
+SectionHeader parse_elements_header(TextCursor& input) {
+    std::size_t num_blocs = SIZET_MAX;
+    std::size_t num_elts = SIZET_MAX;
+    std::size_t min_tag = SIZET_MAX;
+    std::size_t max_tag = SIZET_MAX;
+    bool ok = input.parse_size(num_blocs) && input.parse_size(num_elts) &&
+        input.parse_size(min_tag) && input.parse_size(max_tag);
+    if (!ok || num_blocs == SIZET_MAX || num_elts == SIZET_MAX ||
+            min_tag == SIZET_MAX || max_tag == SIZET_MAX)
+    {
+        throw std::runtime_error("$Elements section parsing failed, missing metadata");
     }
+    input.skip_line();
+    SectionHeader header;
+    header.num_blocs = num_blocs;
+    header.count = num_elts;
+    header.min_tag = min_tag;
+    header.max_tag = max_tag;
+    return header;
+}
+
+/// Checks the end of an $Elements section once all blocs have been read.
+///
+/// Throws a std::runtime_error if $EndElements is missing or no tetrahedrons
+/// were found.
+void check_elements_end(TextCursor& input, std::size_t num_tets) {
+    std::string line = input.read_line();
+    rtrim(line);
+    if (line != "$EndElements") {
+        throw std::runtime_error("$Elements section parsing failed, expected $EndElements");
+    }
+    if (num_tets == 0) {
+        throw std::runtime_error("$Elements section parsing failed, no tetrahedral elements were read");
+    }
+}
+
+/// Parse the entire $Elements section of a memory-mapped file, handing each
+/// bloc of tetrahedrons to `stream`.
+///
+/// Throws a std::runtime_error if parsing fails.
+void parse_elements(TextCursor& input, BlocStream& stream) {
+    auto counts = parse_elements_header(input);
+    stream.begin_elements(counts.count, counts.min_tag, counts.max_tag);
+    // one bloc buffer for the whole section
+    std::vector<Tetrahedron> bloc_elts;
+    std::size_t num_tets = 0;
+    for (std::size_t i = 0; i < counts.num_blocs; ++i) {
+        bloc_elts.clear();
+        try {
+            parse_element_bloc(input, bloc_elts);
+        } catch (const std::runtime_error& err) {
+            throw std::runtime_error("$Elements section parsing failed\n" + std::string(err.what()));
+        }
+        num_tets += bloc_elts.size();
+        stream.element_bloc(bloc_elts.data(), bloc_elts.size());
+    }
+    stream.end_elements();
+    check_elements_end(input, num_tets);
+}
+
+/// A section of a memory-mapped file, from its first line to the end of its
+/// end marker line. Null if the section wasn't found.
+struct SectionText {
+    SectionText() = default;
+    SectionText(const char* begin, const char* end) : begin(begin), end(end) {}
+    const char* begin = nullptr;
+    const char* end = nullptr;
+};
+
+/// The sections the connectivity of a mesh is parsed from. Meshes of a
+/// multi-mesh file with the same text in these sections have the same
+/// elements and media, see parse_shared_body.
+struct ConnectivitySections {
+    SectionText entities;
+    SectionText groups;
+    SectionText elements;
+};
+
+/// Parse the body of a memory-mapped msh4.1 file, handing the nodes and
+/// elements to `stream`. The cursor stops at the start of the next mesh, if
+/// any. If `sections` is given, the connectivity sections are recorded in it.
+///
+/// The $Entities and $PhysicalNames sections are small, so they are copied
+/// out and handed to the std::istream parsers.
+///
+/// Throws a std::runtime_error if parsing fails.
+void stream_body(TextCursor& input, const MshFormat& format, BlocStream& stream,
+    ConnectivitySections* sections = nullptr)
+{
+    ConnectivitySections found;
+    while (!input.eof()) {
+        const char* line_start = input.pos();
+        std::string input_line = input.read_line();
+        rtrim(input_line);
+        // stop before another mesh, so the caller can parse it
+        if (input_line == "$MeshFormat") {
+            input.seek(line_start);
+            break;
+        }
+        if (input_line == "$Entities") {
+            if (format.binary) {
+                stream.set_volumes(parse_binary_entities(input, format.swap_bytes));
+            } else {
+                std::istringstream section(read_section(input, "$EndEntities"));
+                stream.set_volumes(parse_entities(section));
+            }
+            found.entities = SectionText(line_start, input.pos());
+        } else if (input_line == "$PhysicalNames") {
+            std::istringstream section(read_section(input, "$EndPhysicalNames"));
+            stream.set_groups(parse_groups(section));
+            found.groups = SectionText(line_start, input.pos());
+        } else if (input_line == "$Nodes") {
+            if (format.binary) {
+                parse_binary_nodes(input, format.swap_bytes, stream);
+            } else {
+                parse_nodes(input, stream);
+            }
+        } else if (input_line == "$Elements") {
+            if (format.binary) {
+                parse_binary_elements(input, format.swap_bytes, stream);
+            } else {
+                parse_elements(input, stream);
+            }
+            found.elements = SectionText(line_start, input.pos());
+        }
+    }
+    if (sections) {
+        *sections = found;
+    }
+}
+
+/// Parse the body of a memory-mapped msh4.1 file, recording its
+/// connectivity sections in `sections` if given.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_body(TextCursor& input, const MshFormat& format = MshFormat(),
+    const EGS_Mesh::Options& options = EGS_Mesh::Options(), ConnectivitySections* sections = nullptr)
+{
+    MeshBuilder builder;
+    BlocStream stream(builder);
+    stream_body(input, format, stream, sections);
+    return builder.build(options);
+}
+
+/// Returns true and moves `input` past the section starting at
+/// `line_start` if its text is the same as `section`.
+bool skip_same_section(TextCursor& input, const char* line_start, const SectionText& section) {
+    const std::size_t size = static_cast<std::size_t>(section.end - section.begin);
+    if (!section.begin || static_cast<std::size_t>(input.end() - line_start) < size ||
+        std::memcmp(line_start, section.begin, size) != 0)
+    {
+        return false;
+    }
+    input.seek(line_start + size);
+    return true;
+}
+
+/// Parse the body of a memory-mapped msh4.1 file whose $Entities,
+/// $PhysicalNames and $Elements sections are the same text as `sections`,
+/// those of the last of `meshes`. Only the $Nodes are parsed, and the mesh
+/// appended to `meshes` shares the connectivity of the last one, see
+/// EGS_Mesh::with_nodes. The cursor stops at the start of the next mesh, if
+/// any.
+///
+/// Returns false, with the cursor where it was, if a connectivity section
+/// differs or is missing, in which case the body must be parsed in full.
+///
+/// Throws a std::runtime_error if parsing fails.
+bool parse_shared_body(TextCursor& input, const MshFormat& format, const ConnectivitySections& sections,
+    std::vector<EGS_Mesh>& meshes)
+{
+    const char* body = input.pos();
+    MeshBuilder builder;
+    BlocStream stream(builder);
+    bool entities = false;
+    bool groups = false;
+    bool elements = false;
+    while (!input.eof()) {
+        const char* line_start = input.pos();
+        std::string input_line = input.read_line();
+        rtrim(input_line);
+        if (input_line == "$MeshFormat") {
+            input.seek(line_start);
+            break;
+        }
+        bool same = true;
+        if (input_line == "$Entities") {
+            same = entities = skip_same_section(input, line_start, sections.entities);
+        } else if (input_line == "$PhysicalNames") {
+            same = groups = skip_same_section(input, line_start, sections.groups);
+        } else if (input_line == "$Elements") {
+            same = elements = skip_same_section(input, line_start, sections.elements);
+        } else if (input_line == "$Nodes") {
+            if (format.binary) {
+                parse_binary_nodes(input, format.swap_bytes, stream);
+            } else {
+                parse_nodes(input, stream);
+            }
+        }
+        if (!same) {
+            input.seek(body);
+            return false;
+        }
+    }
+    if (!entities || !groups || !elements) {
+        input.seek(body);
+        return false;
+    }
+    std::vector<Node> nodes = builder.take_nodes();
+    if (nodes.empty()) {
+        throw std::runtime_error("No nodes were parsed");
+    }
+    meshes.push_back(meshes.back().with_nodes(nodes));
+    return true;
+}
+
+// Parallel parsing of memory-mapped ascii files.
+
+/// A range of lines of a node or element bloc, found by the pre-scan of the
+/// parallel parser. Node chunks also point at the matching coordinate lines.
+struct LineChunk {
+    int entity = -1;
+    const char* lines = nullptr;
+    // node coordinate lines, unused for elements
+    const char* coord_lines = nullptr;
+    // index of the first node or element of the chunk in the section
+    std::size_t first = 0;
+    std::size_t count = 0;
+};
+
+/// Default number of lines per parallel parsing task.
+constexpr std::size_t PARALLEL_CHUNK_LINES = 1 << 16;
+
+/// Skips `count` lines, recording the start of every `chunk_lines`-th line in
+/// `starts`. Returns false if the input ended early.
+bool skip_lines(TextCursor& input, std::size_t count, std::size_t chunk_lines,
+    std::vector<const char*>& starts)
+{
+    starts.clear();
+    for (std::size_t i = 0; i < count; ++i) {
+        if (input.eof()) {
+            return false;
+        }
+        if (i % chunk_lines == 0) {
+            starts.push_back(input.pos());
+        }
+        input.skip_line();
+    }
+    return true;
+}
+
+/// Pre-scan a $Nodes section, appending a chunk for every range of node
+/// lines to `chunks` and setting up `tags` for the section's tag range.
+/// Returns the number of nodes.
+///
+/// Throws a std::runtime_error if a bloc header is invalid or the section is
+/// truncated. Errors inside the node lines are found later, by the chunk parsers.
+std::size_t scan_nodes(TextCursor& input, std::size_t chunk_lines, std::vector<LineChunk>& chunks,
+    TagChecker& tags)
+{
+    auto counts = parse_nodes_header(input);
+    tags = node_tag_checker(counts.min_tag, counts.max_tag, counts.count);
+    std::size_t num_read = 0;
+    std::vector<const char*> tag_starts;
+    std::vector<const char*> coord_starts;
+    for (std::size_t i = 0; i < counts.num_blocs; ++i) {
+        try {
+            BlocHeader header = parse_node_bloc_header(input);
+            if (!skip_lines(input, header.count, chunk_lines, tag_starts)) {
+                throw std::runtime_error("Node bloc parsing failed during node tag section of entity " + std::to_string(header.entity));
+            }
+            if (!skip_lines(input, header.count, chunk_lines, coord_starts)) {
+                throw std::runtime_error("Node bloc parsing failed during node coordinate section of entity " + std::to_string(header.entity));
+            }
+            for (std::size_t c = 0; c < tag_starts.size(); ++c) {
+                LineChunk chunk;
+                chunk.entity = header.entity;
+                chunk.lines = tag_starts[c];
+                chunk.coord_lines = coord_starts[c];
+                chunk.first = num_read + c * chunk_lines;
+                chunk.count = std::min(chunk_lines, header.count - c * chunk_lines);
+                chunks.push_back(chunk);
+            }
+            num_read += header.count;
+        } catch (const std::runtime_error& err) {
+            throw std::runtime_error("$Nodes section parsing failed\n" + std::string(err.what()));
+        }
+    }
+    check_nodes_end(input, num_read, counts.count);
+    return num_read;
+}
+
+/// Pre-scan an $Elements section, appending a chunk for every range of
+/// tetrahedron lines to `chunks` and setting up `tags` for the section's tag
+/// range. Returns the number of tetrahedrons.
+///
+/// Throws a std::runtime_error if a bloc header is invalid or the section is
+/// truncated. Errors inside the element lines are found later, by the chunk parsers.
+std::size_t scan_elements(TextCursor& input, std::size_t chunk_lines, std::vector<LineChunk>& chunks,
+    TagChecker& tags)
+{
+    auto counts = parse_elements_header(input);
+    tags = element_tag_checker(counts.min_tag, counts.max_tag, counts.count);
+    std::size_t num_tets = 0;
+    std::vector<const char*> starts;
+    for (std::size_t i = 0; i < counts.num_blocs; ++i) {
+        try {
+            BlocHeader header = parse_element_bloc_header(input);
+            bool complete = skip_lines(input, header.count, chunk_lines, starts);
+            // 0, 1, 2d element blocs are skipped, a truncated one is reported
+            // by the next bloc header like the serial parser does
+            if (header.dim != 3) {
+                continue;
+            }
+            if (!complete) {
+                throw std::runtime_error("Element bloc parsing failed for entity " + std::to_string(header.entity));
+            }
+            for (std::size_t c = 0; c < starts.size(); ++c) {
+                LineChunk chunk;
+                chunk.entity = header.entity;
+                chunk.lines = starts[c];
+                chunk.first = num_tets + c * chunk_lines;
+                chunk.count = std::min(chunk_lines, header.count - c * chunk_lines);
+                chunks.push_back(chunk);
+            }
+            num_tets += header.count;
+        } catch (const std::runtime_error& err) {
+            throw std::runtime_error("$Elements section parsing failed\n" + std::string(err.what()));
+        }
+    }
+    check_elements_end(input, num_tets);
+    return num_tets;
+}
 
-    std::vector<EGS_Mesh::Medium> media;
-    media.reserve(groups.size());
-    for (const auto& g: groups) {
-        media.push_back(EGS_Mesh::Medium(g.tag, g.name));
+/// Parse the body of a memory-mapped ascii msh4.1 file using `num_threads`
+/// threads (0 uses every hardware thread).
+///
+/// A serial pre-scan reads the bloc headers and records where every chunk of
+/// `chunk_lines` node and element lines starts. The chunks are then parsed in parallel
+/// straight into their place in the node and element lists, so the result is
+/// in file order and identical to parse_body, which `sections` is filled
+/// like.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_body_parallel(TextCursor& input, unsigned num_threads,
+    std::size_t chunk_lines = PARALLEL_CHUNK_LINES,
+    const EGS_Mesh::Options& options = EGS_Mesh::Options(), ConnectivitySections* sections = nullptr)
+{
+    std::vector<MeshVolume> volumes;
+    std::vector<PhysicalGroup> groups;
+    std::vector<LineChunk> node_chunks;
+    std::vector<LineChunk> elt_chunks;
+    std::size_t num_nodes = 0;
+    std::size_t num_elts = 0;
+    TagChecker node_tags;
+    TagChecker element_tags;
+    ConnectivitySections found;
+
+    while (!input.eof()) {
+        const char* line_start = input.pos();
+        std::string input_line = input.read_line();
+        rtrim(input_line);
+        // stop before another mesh, so the caller can parse it
+        if (input_line == "$MeshFormat") {
+            input.seek(line_start);
+            break;
+        }
+        if (input_line == "$Entities") {
+            std::istringstream section(read_section(input, "$EndEntities"));
+            volumes = parse_entities(section);
+            found.entities = SectionText(line_start, input.pos());
+        } else if (input_line == "$PhysicalNames") {
+            std::istringstream section(read_section(input, "$EndPhysicalNames"));
+            groups = parse_groups(section);
+            found.groups = SectionText(line_start, input.pos());
+        } else if (input_line == "$Nodes") {
+            node_chunks.clear();
+            num_nodes = scan_nodes(input, chunk_lines, node_chunks, node_tags);
+        } else if (input_line == "$Elements") {
+            elt_chunks.clear();
+            num_elts = scan_elements(input, chunk_lines, elt_chunks, element_tags);
+            found.elements = SectionText(line_start, input.pos());
+        }
+    }
+    if (sections) {
+        *sections = found;
     }
 
-    // TODO: check all 3d physical groups were used by elements
-    // TODO: ensure all element node tags are valid
-    return EGS_Mesh(mesh_elts, mesh_nodes, media);
+    // nodes and elements are parsed in place into the vectors the mesh takes over
+    const VolumeMedia volume_media(volumes, groups);
+    std::vector<Node> nodes(num_nodes, Node(-1, 0.0, 0.0, 0.0));
+    std::vector<Tetrahedron> elements(num_elts, Tetrahedron(-1, -1, -1, -1, -1, -1));
+    const char* end = input.end();
+    mesh_parallel::parallel_tasks(node_chunks.size() + elt_chunks.size(), num_threads,
+        [&](std::size_t i) {
+            if (i < node_chunks.size()) {
+                const LineChunk& chunk = node_chunks[i];
+                try {
+                    TextCursor tags(chunk.lines, end);
+                    parse_node_tags(tags, chunk.entity, nodes.data() + chunk.first, chunk.count);
+                    TextCursor coords(chunk.coord_lines, end);
+                    parse_node_coords(coords, chunk.entity, nodes.data() + chunk.first, chunk.count);
+                } catch (const std::runtime_error& err) {
+                    throw std::runtime_error("$Nodes section parsing failed\n" + std::string(err.what()));
+                }
+            } else {
+                const LineChunk& chunk = elt_chunks[i - node_chunks.size()];
+                try {
+                    TextCursor lines(chunk.lines, end);
+                    parse_tetrahedrons(lines, chunk.entity, elements.data() + chunk.first, chunk.count);
+                    volume_media.resolve(elements.data() + chunk.first, chunk.count);
+                } catch (const std::runtime_error& err) {
+                    throw std::runtime_error("$Elements section parsing failed\n" + std::string(err.what()));
+                }
+            }
+        });
+    // a serial pass in file order, so errors match the serial parser
+    node_tags.add(nodes.data(), nodes.size());
+    node_tags.finish();
+    element_tags.add(elements.data(), elements.size());
+    element_tags.finish();
+    return build_mesh(std::move(elements), std::move(nodes), volume_media.media(), options);
 }
 
 } // namespace msh_parser::internal::msh41
@@ -689,12 +2225,89 @@ EGS_Mesh parse_body(std::istream& input) {
 ///
 /// Throws a std::runtime_error if parsing fails.
 EGS_Mesh parse_msh_file(std::istream& input) {
-    auto version = msh_parser::internal::parse_msh_version(input);
+    return parse_msh_file(input, EGS_Mesh::Options());
+}
+
+/// Parse a msh file into an EGS_Mesh built with `options`.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_msh_file(std::istream& input, const EGS_Mesh::Options& options) {
+    auto format = msh_parser::internal::parse_msh_version(input);
     // TODO auto mesh_data;
-    switch(version) {
+    switch(format.version) {
+        case msh_parser::internal::MshVersion::v41:
+            try {
+                return msh_parser::internal::msh41::parse_body(input, format, options);
+            } catch (const std::runtime_error& err) {
+                throw std::runtime_error("msh 4.1 parsing failed\n" + std::string(err.what()));
+            }
+            break;
+    }
+    throw std::runtime_error("couldn't parse msh file");
+}
+
+/// Parse a msh file on disk into an EGS_Mesh using `num_threads` threads.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_msh_file(const std::string& path, unsigned num_threads) {
+    return parse_msh_file(path, num_threads, EGS_Mesh::Options());
+}
+
+/// Parse a msh file on disk into an EGS_Mesh built with `options` using
+/// `num_threads` threads.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_msh_file(const std::string& path, unsigned num_threads,
+    const EGS_Mesh::Options& options)
+{
+    mesh_io::MappedFile file(path);
+    msh_parser::internal::TextCursor input(file.data(), file.data() + file.size());
+    // the header is tiny, reuse the std::istream parser
+    std::istringstream header(msh_parser::internal::read_section(input, "$EndMeshFormat"));
+    auto format = msh_parser::internal::parse_msh_version(header);
+    switch(format.version) {
+        case msh_parser::internal::MshVersion::v41:
+            try {
+                if (format.binary || num_threads == 1) {
+                    return msh_parser::internal::msh41::parse_body(input, format, options);
+                }
+                return msh_parser::internal::msh41::parse_body_parallel(input, num_threads,
+                    msh_parser::internal::msh41::PARALLEL_CHUNK_LINES, options);
+            } catch (const std::runtime_error& err) {
+                throw std::runtime_error("msh 4.1 parsing failed\n" + std::string(err.what()));
+            }
+            break;
+    }
+    throw std::runtime_error("couldn't parse msh file");
+}
+
+void parse_msh_stream(std::istream& input, MeshSink& sink) {
+    auto format = msh_parser::internal::parse_msh_version(input);
+    switch(format.version) {
+        case msh_parser::internal::MshVersion::v41:
+            try {
+                msh_parser::internal::msh41::BlocStream stream(sink);
+                msh_parser::internal::msh41::stream_body(input, format, stream);
+                return;
+            } catch (const std::runtime_error& err) {
+                throw std::runtime_error("msh 4.1 parsing failed\n" + std::string(err.what()));
+            }
+            break;
+    }
+    throw std::runtime_error("couldn't parse msh file");
+}
+
+void parse_msh_stream(const std::string& path, MeshSink& sink) {
+    mesh_io::MappedFile file(path);
+    msh_parser::internal::TextCursor input(file.data(), file.data() + file.size());
+    std::istringstream header(msh_parser::internal::read_section(input, "$EndMeshFormat"));
+    auto format = msh_parser::internal::parse_msh_version(header);
+    switch(format.version) {
         case msh_parser::internal::MshVersion::v41:
             try {
-                return msh_parser::internal::msh41::parse_body(input);
+                msh_parser::internal::msh41::BlocStream stream(sink);
+                msh_parser::internal::msh41::stream_body(input, format, stream);
+                return;
             } catch (const std::runtime_error& err) {
                 throw std::runtime_error("msh 4.1 parsing failed\n" + std::string(err.what()));
             }
@@ -703,6 +2316,73 @@ EGS_Mesh parse_msh_file(std::istream& input) {
     throw std::runtime_error("couldn't parse msh file");
 }
 
+/// Parse a msh file on disk into an EGS_Mesh.
+///
+/// Throws a std::runtime_error if parsing fails.
+EGS_Mesh parse_msh_file(const std::string& path) {
+    return parse_msh_file(path, 1);
+}
+
+/// Parse every mesh of a multi-mesh msh file on disk.
+///
+/// Throws a std::runtime_error if parsing fails.
+std::vector<EGS_Mesh> parse_msh_meshes(const std::string& path, unsigned num_threads,
+    const EGS_Mesh::Options& options)
+{
+    mesh_io::MappedFile file(path);
+    msh_parser::internal::TextCursor input(file.data(), file.data() + file.size());
+    std::vector<EGS_Mesh> meshes;
+    msh_parser::internal::MshFormat previous_format;
+    msh_parser::internal::msh41::ConnectivitySections sections;
+    while (!input.eof()) {
+        std::istringstream header(msh_parser::internal::read_section(input, "$EndMeshFormat"));
+        auto format = msh_parser::internal::parse_msh_version(header);
+        switch(format.version) {
+            case msh_parser::internal::MshVersion::v41:
+                try {
+                    const bool shared = !meshes.empty() && format.binary == previous_format.binary &&
+                        format.swap_bytes == previous_format.swap_bytes &&
+                        msh_parser::internal::msh41::parse_shared_body(input, format, sections, meshes);
+                    if (shared) {
+                        break;
+                    }
+                    if (format.binary || num_threads == 1) {
+                        meshes.push_back(msh_parser::internal::msh41::parse_body(input, format, options,
+                            &sections));
+                    } else {
+                        meshes.push_back(msh_parser::internal::msh41::parse_body_parallel(input, num_threads,
+                            msh_parser::internal::msh41::PARALLEL_CHUNK_LINES, options, &sections));
+                    }
+                } catch (const std::runtime_error& err) {
+                    throw std::runtime_error("msh 4.1 parsing failed for mesh " + std::to_string(meshes.size()) +
+                        "\n" + std::string(err.what()));
+                }
+                break;
+        }
+        previous_format = format;
+    }
+    return meshes;
+}
+
+/// Load a msh file on disk through a snapshot cache file.
+///
+/// Throws a std::runtime_error if parsing fails or the snapshot can't be written.
+EGS_Mesh parse_msh_file_cached(const std::string& path, const std::string& cache_path,
+    unsigned num_threads, const EGS_Mesh::Options& options)
+{
+    const std::uint64_t hash = mesh_io::file_hash(path);
+    if (std::ifstream(cache_path)) {
+        try {
+            return mesh_snapshot::load_snapshot(cache_path, hash, options);
+        } catch (const std::runtime_error&) {
+            // stale or unreadable, rebuild it
+        }
+    }
+    EGS_Mesh mesh = parse_msh_file(path, num_threads, options);
+    mesh_snapshot::save_snapshot(mesh, cache_path, hash);
+    return mesh;
+}
+
 } // namespace msh_parser
 
 #endif // MSH_PARSER_
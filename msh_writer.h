@@ -0,0 +1,652 @@
+/*
+###############################################################################
+#
+#  EGSnrc msh file writer
+#  Copyright (C) 2020 National Research Council Canada
+#
+#  This file is part of EGSnrc.
+#
+#  EGSnrc is free software: you can redistribute it and/or modify it under
+#  the terms of the GNU Affero General Public License as published by the
+#  Free Software Foundation, either version 3 of the License, or (at your
+#  option) any later version.
+#
+#  EGSnrc is distributed in the hope that it will be useful, but WITHOUT ANY
+#  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+#  FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License for
+#  more details.
+#
+#  You should have received a copy of the GNU Affero General Public License
+#  along with EGSnrc. If not, see <http://www.gnu.org/licenses/>.
+#
+###############################################################################
+*/
+
+#ifndef MSH_WRITER_
+#define MSH_WRITER_
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "egs_mesh.h"
+#include "mesh_io.h"
+#include "mesh_scoring.h"
+
+/// Writing results as msh 4.1 post-processing data.
+namespace msh_writer {
+
+/// Encodings of written msh files.
+enum class Format {
+    Ascii,
+    /// Binary msh 4.1 in the native byte order, which Gmsh detects.
+    Binary
+};
+
+/// A named set of values, one per mesh element in mesh order, written as
+/// an $ElementData view.
+struct ElementData {
+    std::string name;
+    std::vector<double> values;
+};
+
+namespace internal {
+
+// Shortest round-trip double to text conversion with the Grisu2 algorithm
+// (Loitsch, "Printing floating-point numbers quickly and accurately with
+// integers", PLDI 2010). The output always reads back as the same double,
+// and is the shortest such string for more than 99.9% of doubles.
+namespace grisu {
+
+// A floating point number f * 2^e with a 64-bit significand.
+struct DiyFp {
+    DiyFp(std::uint64_t f, int e) : f(f), e(e) {}
+    std::uint64_t f;
+    int e;
+};
+
+DiyFp sub(const DiyFp& x, const DiyFp& y) {
+    return DiyFp(x.f - y.f, x.e);
+}
+
+// The product, rounded to its upper 64 bits.
+DiyFp mul(const DiyFp& x, const DiyFp& y) {
+    const std::uint64_t x_lo = x.f & 0xFFFFFFFFu;
+    const std::uint64_t x_hi = x.f >> 32;
+    const std::uint64_t y_lo = y.f & 0xFFFFFFFFu;
+    const std::uint64_t y_hi = y.f >> 32;
+    const std::uint64_t p0 = x_lo * y_lo;
+    const std::uint64_t p1 = x_lo * y_hi;
+    const std::uint64_t p2 = x_hi * y_lo;
+    const std::uint64_t p3 = x_hi * y_hi;
+    std::uint64_t mid = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+    mid += std::uint64_t(1) << 31;
+    return DiyFp(p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32), x.e + y.e + 64);
+}
+
+DiyFp normalize(const DiyFp& x) {
+    const int shift = __builtin_clzll(x.f);
+    return DiyFp(x.f << shift, x.e - shift);
+}
+
+// A positive double and the midpoints to its neighbours, normalized to
+// the exponent of the upper one.
+struct Boundaries {
+    DiyFp w;
+    DiyFp minus;
+    DiyFp plus;
+};
+
+Boundaries boundaries(double value) {
+    const std::uint64_t HIDDEN_BIT = std::uint64_t(1) << 52;
+    const int BIAS = 1075;
+    std::uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const std::uint64_t biased_e = bits >> 52;
+    const std::uint64_t fraction = bits & (HIDDEN_BIT - 1);
+    const DiyFp v = biased_e == 0 ? DiyFp(fraction, 1 - BIAS) :
+        DiyFp(fraction + HIDDEN_BIT, static_cast<int>(biased_e) - BIAS);
+    // the gap below powers of two is half the gap above
+    const bool lower_closer = fraction == 0 && biased_e > 1;
+    const DiyFp plus = normalize(DiyFp(2 * v.f + 1, v.e - 1));
+    const DiyFp minus = lower_closer ? DiyFp(4 * v.f - 1, v.e - 2) : DiyFp(2 * v.f - 1, v.e - 1);
+    return Boundaries{normalize(v), DiyFp(minus.f << (minus.e - plus.e), plus.e), plus};
+}
+
+// A normalized 10^k, rounded to 64 bits.
+struct CachedPower {
+    std::uint64_t f;
+    int e;
+    int k;
+};
+
+// The range the scaled upper boundary's exponent is brought into, so the
+// integer part of the scaled value fits in 32 bits.
+const int ALPHA = -60;
+const int GAMMA = -32;
+
+// A power of ten that brings a number with binary exponent `e` into
+// [ALPHA, GAMMA]. The table has every 8th power from 10^-300 to 10^340.
+CachedPower cached_power(int e) {
+    static const CachedPower POWERS[] = {
+        {0xAB70FE17C79AC6CA, -1060, -300},
+        {0xFF77B1FCBEBCDC4F, -1034, -292},
+        {0xBE5691EF416BD60C, -1007, -284},
+        {0x8DD01FAD907FFC3C,  -980, -276},
+        {0xD3515C2831559A83,  -954, -268},
+        {0x9D71AC8FADA6C9B5,  -927, -260},
+        {0xEA9C227723EE8BCB,  -901, -252},
+        {0xAECC49914078536D,  -874, -244},
+        {0x823C12795DB6CE57,  -847, -236},
+        {0xC21094364DFB5637,  -821, -228},
+        {0x9096EA6F3848984F,  -794, -220},
+        {0xD77485CB25823AC7,  -768, -212},
+        {0xA086CFCD97BF97F4,  -741, -204},
+        {0xEF340A98172AACE5,  -715, -196},
+        {0xB23867FB2A35B28E,  -688, -188},
+        {0x84C8D4DFD2C63F3B,  -661, -180},
+        {0xC5DD44271AD3CDBA,  -635, -172},
+        {0x936B9FCEBB25C996,  -608, -164},
+        {0xDBAC6C247D62A584,  -582, -156},
+        {0xA3AB66580D5FDAF6,  -555, -148},
+        {0xF3E2F893DEC3F126,  -529, -140},
+        {0xB5B5ADA8AAFF80B8,  -502, -132},
+        {0x87625F056C7C4A8B,  -475, -124},
+        {0xC9BCFF6034C13053,  -449, -116},
+        {0x964E858C91BA2655,  -422, -108},
+        {0xDFF9772470297EBD,  -396, -100},
+        {0xA6DFBD9FB8E5B88F,  -369,  -92},
+        {0xF8A95FCF88747D94,  -343,  -84},
+        {0xB94470938FA89BCF,  -316,  -76},
+        {0x8A08F0F8BF0F156B,  -289,  -68},
+        {0xCDB02555653131B6,  -263,  -60},
+        {0x993FE2C6D07B7FAC,  -236,  -52},
+        {0xE45C10C42A2B3B06,  -210,  -44},
+        {0xAA242499697392D3,  -183,  -36},
+        {0xFD87B5F28300CA0E,  -157,  -28},
+        {0xBCE5086492111AEB,  -130,  -20},
+        {0x8CBCCC096F5088CC,  -103,  -12},
+        {0xD1B71758E219652C,   -77,   -4},
+        {0x9C40000000000000,   -50,    4},
+        {0xE8D4A51000000000,   -24,   12},
+        {0xAD78EBC5AC620000,     3,   20},
+        {0x813F3978F8940984,    30,   28},
+        {0xC097CE7BC90715B3,    56,   36},
+        {0x8F7E32CE7BEA5C70,    83,   44},
+        {0xD5D238A4ABE98068,   109,   52},
+        {0x9F4F2726179A2245,   136,   60},
+        {0xED63A231D4C4FB27,   162,   68},
+        {0xB0DE65388CC8ADA8,   189,   76},
+        {0x83C7088E1AAB65DB,   216,   84},
+        {0xC45D1DF942711D9A,   242,   92},
+        {0x924D692CA61BE758,   269,  100},
+        {0xDA01EE641A708DEA,   295,  108},
+        {0xA26DA3999AEF774A,   322,  116},
+        {0xF209787BB47D6B85,   348,  124},
+        {0xB454E4A179DD1877,   375,  132},
+        {0x865B86925B9BC5C2,   402,  140},
+        {0xC83553C5C8965D3D,   428,  148},
+        {0x952AB45CFA97A0B3,   455,  156},
+        {0xDE469FBD99A05FE3,   481,  164},
+        {0xA59BC234DB398C25,   508,  172},
+        {0xF6C69A72A3989F5C,   534,  180},
+        {0xB7DCBF5354E9BECE,   561,  188},
+        {0x88FCF317F22241E2,   588,  196},
+        {0xCC20CE9BD35C78A5,   614,  204},
+        {0x98165AF37B2153DF,   641,  212},
+        {0xE2A0B5DC971F303A,   667,  220},
+        {0xA8D9D1535CE3B396,   694,  228},
+        {0xFB9B7CD9A4A7443C,   720,  236},
+        {0xBB764C4CA7A44410,   747,  244},
+        {0x8BAB8EEFB6409C1A,   774,  252},
+        {0xD01FEF10A657842C,   800,  260},
+        {0x9B10A4E5E9913129,   827,  268},
+        {0xE7109BFBA19C0C9D,   853,  276},
+        {0xAC2820D9623BF429,   880,  284},
+        {0x80444B5E7AA7CF85,   907,  292},
+        {0xBF21E44003ACDD2D,   933,  300},
+        {0x8E679C2F5E44FF8F,   960,  308},
+        {0xD433179D9C8CB841,   986,  316},
+        {0x9E19DB92B4E31BA9,  1013,  324},
+        {0xEB96BF6EBADF77D9,  1039,  332},
+        {0xAF87023B9BF0EE6B,  1066,  340}
+    };
+    const int f = ALPHA - e - 1;
+    // ceil(f * log10(2))
+    const int k = (f * 78913) / (1 << 18) + static_cast<int>(f > 0);
+    return POWERS[(300 + k + 7) / 8];
+}
+
+// The number of decimal digits of n, and the largest power of ten <= n.
+int largest_pow10(std::uint32_t n, std::uint32_t& pow10) {
+    static const std::uint32_t POW10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+        100000000, 1000000000};
+    int digits = 10;
+    while (digits > 1 && n < POW10[digits - 1]) {
+        digits--;
+    }
+    pow10 = POW10[digits - 1];
+    return digits;
+}
+
+// Move the last digit down while that brings the number closer to the
+// exact value and keeps it within the rounding interval.
+void round_weed(char* digits, int len, std::uint64_t dist, std::uint64_t delta, std::uint64_t rest,
+    std::uint64_t ten_k)
+{
+    while (rest < dist && delta - rest >= ten_k &&
+        (rest + ten_k < dist || dist - rest > rest + ten_k - dist))
+    {
+        digits[len - 1]--;
+        rest += ten_k;
+    }
+}
+
+// Generate the digits of w, scaled so that M_plus.e is in [ALPHA, GAMMA],
+// stopping as soon as the digits are inside (M_minus, M_plus).
+void digit_gen(char* digits, int& len, int& k, const DiyFp& m_minus, const DiyFp& w, const DiyFp& m_plus) {
+    std::uint64_t delta = sub(m_plus, m_minus).f;
+    std::uint64_t dist = sub(m_plus, w).f;
+    const DiyFp one(std::uint64_t(1) << -m_plus.e, m_plus.e);
+    std::uint32_t p1 = static_cast<std::uint32_t>(m_plus.f >> -one.e);
+    std::uint64_t p2 = m_plus.f & (one.f - 1);
+
+    std::uint32_t pow10 = 1;
+    int n = largest_pow10(p1, pow10);
+    while (n > 0) {
+        digits[len++] = static_cast<char>('0' + p1 / pow10);
+        p1 %= pow10;
+        n--;
+        const std::uint64_t rest = (static_cast<std::uint64_t>(p1) << -one.e) + p2;
+        if (rest <= delta) {
+            k += n;
+            round_weed(digits, len, dist, delta, rest, static_cast<std::uint64_t>(pow10) << -one.e);
+            return;
+        }
+        pow10 /= 10;
+    }
+    int m = 0;
+    for (;;) {
+        p2 *= 10;
+        digits[len++] = static_cast<char>('0' + (p2 >> -one.e));
+        p2 &= one.f - 1;
+        m++;
+        delta *= 10;
+        dist *= 10;
+        if (p2 <= delta) {
+            break;
+        }
+    }
+    k -= m;
+    round_weed(digits, len, dist, delta, p2, one.f);
+}
+
+// The digits of a positive finite `value` = digits * 10^k, at most 17.
+void grisu2(char* digits, int& len, int& k, double value) {
+    const Boundaries b = boundaries(value);
+    const CachedPower cached = cached_power(b.plus.e);
+    const DiyFp c(cached.f, cached.e);
+    const DiyFp w = mul(b.w, c);
+    const DiyFp w_minus = mul(b.minus, c);
+    const DiyFp w_plus = mul(b.plus, c);
+    // shrink the interval by the rounding error of the products
+    len = 0;
+    k = -cached.k;
+    digit_gen(digits, len, k, DiyFp(w_minus.f + 1, w_minus.e), w, DiyFp(w_plus.f - 1, w_plus.e));
+}
+
+} // namespace grisu
+
+/// The most characters format_double writes.
+const std::size_t MAX_DOUBLE_CHARS = 32;
+
+/// Write the shortest text that reads back as `value` to `out`, which has
+/// room for MAX_DOUBLE_CHARS characters, and return the end of the text.
+///
+/// Numbers from 1e-4 to 1e15 are written in fixed notation, others as
+/// d.ddde+XX like printf's %g, and non-finite values as nan, inf or -inf.
+char* format_double(char* out, double value) {
+    if (std::isnan(value)) {
+        std::memcpy(out, "nan", 3);
+        return out + 3;
+    }
+    if (std::signbit(value)) {
+        *out++ = '-';
+        value = -value;
+    }
+    if (std::isinf(value)) {
+        std::memcpy(out, "inf", 3);
+        return out + 3;
+    }
+    if (value == 0.0) {
+        *out++ = '0';
+        return out;
+    }
+    char digits[20];
+    int len = 0;
+    int k = 0;
+    grisu::grisu2(digits, len, k, value);
+    // the decimal point goes after `point` digits
+    const int point = len + k;
+    if (k >= 0 && point <= 15) {
+        std::memcpy(out, digits, len);
+        std::memset(out + len, '0', k);
+        return out + point;
+    }
+    if (point > 0 && point <= 15) {
+        std::memcpy(out, digits, point);
+        out[point] = '.';
+        std::memcpy(out + point + 1, digits + point, len - point);
+        return out + len + 1;
+    }
+    if (point > -4 && point <= 0) {
+        out[0] = '0';
+        out[1] = '.';
+        std::memset(out + 2, '0', -point);
+        std::memcpy(out + 2 - point, digits, len);
+        return out + 2 - point + len;
+    }
+    *out++ = digits[0];
+    if (len > 1) {
+        *out++ = '.';
+        std::memcpy(out, digits + 1, len - 1);
+        out += len - 1;
+    }
+    *out++ = 'e';
+    int exponent = point - 1;
+    *out++ = exponent < 0 ? '-' : '+';
+    exponent = exponent < 0 ? -exponent : exponent;
+    if (exponent >= 100) {
+        *out++ = static_cast<char>('0' + exponent / 100);
+        exponent %= 100;
+    }
+    *out++ = static_cast<char>('0' + exponent / 10);
+    *out++ = static_cast<char>('0' + exponent % 10);
+    return out;
+}
+
+/// Write the decimal digits of `value` to `out` and return their end.
+char* format_uint(char* out, std::uint64_t value) {
+    char digits[20];
+    int len = 0;
+    do {
+        digits[len++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (len > 0) {
+        *out++ = digits[--len];
+    }
+    return out;
+}
+
+/// Collects output in a large buffer and writes it to a stream in blocks,
+/// which is much faster than formatting through the stream.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(std::ostream& out) : _out(out), _buffer(1 << 20) {}
+
+    /// Room for `n` characters at the returned position, to be followed by
+    /// commit() with the end of what was written.
+    char* reserve(std::size_t n) {
+        if (_buffer.size() - _size < n) {
+            flush();
+        }
+        return &_buffer[_size];
+    }
+    void commit(const char* end) {
+        _size = static_cast<std::size_t>(end - _buffer.data());
+    }
+
+    void write(const char* data, std::size_t n) {
+        if (n > _buffer.size()) {
+            flush();
+            put(data, n);
+            return;
+        }
+        std::memcpy(reserve(n), data, n);
+        _size += n;
+    }
+    void write(const std::string& s) {
+        write(s.data(), s.size());
+    }
+
+    void flush() {
+        put(_buffer.data(), _size);
+        _size = 0;
+    }
+
+private:
+    void put(const char* data, std::size_t n) {
+        _out.write(data, static_cast<std::streamsize>(n));
+        if (!_out) {
+            throw std::runtime_error("writing element data failed");
+        }
+    }
+
+    std::ostream& _out;
+    std::vector<char> _buffer;
+    std::size_t _size = 0;
+};
+
+std::string format_double(double value) {
+    char buf[MAX_DOUBLE_CHARS];
+    return std::string(buf, format_double(buf, value));
+}
+
+/// Throws a std::invalid_argument exception if an element has no Gmsh tag,
+/// e.g. one made with the EGS_Mesh::Tetrahedron constructor without a tag,
+/// since Gmsh couldn't match its value to an element, or if a tag doesn't
+/// fit the 32-bit int of data section entries.
+void check_element_tags(const mesh_io::SharedArray<EGS_Mesh::Tetrahedron>& elements) {
+    for (std::size_t i = 0; i < elements.size(); i++) {
+        if (elements[i].tag < 0) {
+            throw std::invalid_argument("element " + std::to_string(i) +
+                " has no Gmsh tag to write element data for");
+        }
+        if (static_cast<long long>(elements[i].tag) > std::numeric_limits<std::int32_t>::max()) {
+            throw std::invalid_argument("element " + std::to_string(i) + " tag " +
+                std::to_string(elements[i].tag) + " doesn't fit in a 32-bit int");
+        }
+    }
+}
+
+/// Throws a std::invalid_argument exception if a view doesn't have
+/// `num_elements` values or its name has a double quote or a newline.
+void check_views(const std::vector<ElementData>& data, std::size_t num_elements) {
+    for (const auto& view: data) {
+        if (view.values.size() != num_elements) {
+            throw std::invalid_argument("expected " + std::to_string(num_elements) + " values for `" +
+                view.name + "`, got " + std::to_string(view.values.size()));
+        }
+        if (view.name.find_first_of("\"\n") != std::string::npos) {
+            throw std::invalid_argument("element data name `" + view.name +
+                "` has a double quote or a newline");
+        }
+    }
+}
+
+} // namespace internal
+
+/// Write `data` as a msh 4.1 file of $ElementData views keyed by the Gmsh
+/// tags of `elements`, e.g. EGS_Mesh::elements(), whose order the values
+/// follow. The file only has the $MeshFormat header and the views, and
+/// Gmsh shows them on the mesh when it is opened after the mesh file.
+/// `step` and `time` label the views, e.g. for successive checkpoints.
+///
+/// Throws a std::invalid_argument exception if an element has no tag (a
+/// negative one), a view doesn't have one value per element or its name has
+/// a double quote or a newline, and a std::runtime_error if writing fails.
+void write_element_data(std::ostream& out, const mesh_io::SharedArray<EGS_Mesh::Tetrahedron>& elements,
+    const std::vector<ElementData>& data, Format format, int step = 0, double time = 0.0)
+{
+    internal::check_element_tags(elements);
+    internal::check_views(data, elements.size());
+    const bool binary = format == Format::Binary;
+    internal::OutputBuffer buf(out);
+    buf.write(binary ? "$MeshFormat\n4.1 1 8\n" : "$MeshFormat\n4.1 0 8\n");
+    if (binary) {
+        // the byte order marker
+        const std::int32_t one = 1;
+        buf.write(reinterpret_cast<const char*>(&one), sizeof(one));
+        buf.write("\n", 1);
+    }
+    buf.write("$EndMeshFormat\n");
+    for (const auto& view: data) {
+        // one string tag (the name), one real tag (the time) and three
+        // integer tags (the step, the number of components and of values)
+        buf.write("$ElementData\n1\n\"" + view.name + "\"\n1\n" + internal::format_double(time) + "\n3\n" +
+            std::to_string(step) + "\n1\n" + std::to_string(elements.size()) + "\n");
+        const std::size_t ENTRY_CHARS = 21 + internal::MAX_DOUBLE_CHARS;
+        for (std::size_t i = 0; i < elements.size(); i++) {
+            char* p = buf.reserve(ENTRY_CHARS);
+            // data section tags are ints whatever the size_t size of the header
+            const std::int32_t tag = static_cast<std::int32_t>(elements[i].tag);
+            if (binary) {
+                std::memcpy(p, &tag, sizeof(tag));
+                std::memcpy(p + sizeof(tag), &view.values[i], sizeof(double));
+                p += sizeof(tag) + sizeof(double);
+            } else {
+                p = internal::format_uint(p, static_cast<std::uint64_t>(tag));
+                *p++ = ' ';
+                p = internal::format_double(p, view.values[i]);
+                *p++ = '\n';
+            }
+            buf.commit(p);
+        }
+        buf.write(binary ? "\n$EndElementData\n" : "$EndElementData\n");
+    }
+    buf.flush();
+}
+
+/// Write `data` for `elements` to the file `path`, see write_element_data
+/// above. The file is written to a temporary file which
+/// is then renamed, so a reader never sees a partly written file.
+void write_element_data(const std::string& path, const mesh_io::SharedArray<EGS_Mesh::Tetrahedron>& elements,
+    const std::vector<ElementData>& data, Format format, int step = 0, double time = 0.0)
+{
+    std::string tmp_path = path + ".tmp";
+#ifdef MESH_IO_HAVE_MMAP
+    tmp_path += std::to_string(::getpid());
+#endif
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("couldn't open `" + tmp_path + "` for writing");
+        }
+        try {
+            write_element_data(out, elements, data, format, step, time);
+        } catch (...) {
+            out.close();
+            std::remove(tmp_path.c_str());
+            throw;
+        }
+        out.close();
+        if (!out) {
+            std::remove(tmp_path.c_str());
+            throw std::runtime_error("couldn't write element data `" + tmp_path + "`");
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("couldn't rename `" + tmp_path + "` to `" + path + "`");
+    }
+}
+
+/// A snapshot of the results of `scorer`: the mean per history of each
+/// element, named `name`, and its uncertainty, named `name` + " uncertainty".
+std::vector<ElementData> scorer_data(const mesh_scoring::ElementScorer& scorer, const std::string& name) {
+    std::vector<ElementData> data(2);
+    data[0].name = name;
+    data[1].name = name + " uncertainty";
+    data[0].values.resize(scorer.num_elements());
+    data[1].values.resize(scorer.num_elements());
+    for (std::size_t i = 0; i < scorer.num_elements(); i++) {
+        const mesh_scoring::Result r = scorer.result(i);
+        data[0].values[i] = r.mean;
+        data[1].values[i] = r.uncertainty;
+    }
+    return data;
+}
+
+/// Writes $ElementData files for a mesh on a background thread, so a
+/// simulation can carry on while a checkpoint is written. The data is
+/// moved into the writer, so it is a snapshot of the results when write()
+/// is called, e.g. from scorer_data.
+///
+/// One file is written at a time: write() first waits for the previous one.
+class BackgroundWriter {
+public:
+    /// A writer for the elements of `mesh`, which it shares so the mesh
+    /// doesn't need to outlive it.
+    ///
+    /// Throws a std::invalid_argument exception if an element has no tag,
+    /// see write_element_data.
+    BackgroundWriter(const EGS_Mesh& mesh, Format format) : _elements(mesh.elements()), _format(format) {
+        internal::check_element_tags(_elements);
+    }
+
+    BackgroundWriter(const BackgroundWriter&) = delete;
+    BackgroundWriter& operator=(const BackgroundWriter&) = delete;
+
+    /// Waits for the file being written. Errors are lost, call wait() to
+    /// see them.
+    ~BackgroundWriter() {
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    /// Start writing `data` to `path` in the background, see
+    /// write_element_data.
+    ///
+    /// Throws the error of the previous write if it failed, and a
+    /// std::invalid_argument exception if a view doesn't have one value per
+    /// element or its name has a double quote or a newline.
+    void write(const std::string& path, std::vector<ElementData> data, int step = 0, double time = 0.0) {
+        wait();
+        internal::check_views(data, _elements.size());
+        _thread = std::thread(&BackgroundWriter::run, this, path, std::move(data), step, time);
+    }
+
+    /// Wait for the file being written, if any.
+    ///
+    /// Throws the error of the write if it failed.
+    void wait() {
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+        if (_error) {
+            std::exception_ptr error = _error;
+            _error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    void run(const std::string& path, const std::vector<ElementData>& data, int step, double time) {
+        try {
+            write_element_data(path, _elements, data, _format, step, time);
+        } catch (...) {
+            _error = std::current_exception();
+        }
+    }
+
+    mesh_io::SharedArray<EGS_Mesh::Tetrahedron> _elements;
+    Format _format;
+    std::thread _thread;
+    // set by the writing thread, read after joining it
+    std::exception_ptr _error;
+};
+
+} // namespace msh_writer
+
+#endif // MSH_WRITER_
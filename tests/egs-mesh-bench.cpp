@@ -0,0 +1,1671 @@
+#include "msh_parser.h"
+#include "mesh_neighbours.h"
+#include "mesh_scoring.h"
+#include "mesh_validation.h"
+#include "msh_writer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define EGS_MESH_BENCH_HAVE_PERF 1
+#endif
+
+// O(n2) neighbour finding function, the reference for the faster algorithms
+std::vector<std::array<std::size_t, 4>> naive_neighbours(const std::vector<mesh_neighbours::Tetrahedron>& elements) {
+    using mesh_neighbours::NONE;
+    std::vector<std::array<std::size_t, 4>> nbrs(elements.size(), {NONE, NONE, NONE, NONE});
+    for (std::size_t i = 0; i < elements.size(); i++) {
+        auto elt_faces = elements[i].faces();
+        for (std::size_t f = 0; f < 4; f++) {
+            if (nbrs[i][f] != NONE) {
+                continue;
+            }
+            for (std::size_t j = 0; j < elements.size(); j++) {
+                if (i == j) {
+                    continue;
+                }
+                auto other_faces = elements[j].faces();
+                for (std::size_t fj = 0; fj < 4; fj++) {
+                    if (elt_faces[f] == other_faces[fj]) {
+                        nbrs[i][f] = j;
+                        nbrs[j][fj] = i;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    return nbrs;
+}
+
+// Returns the best wall time in seconds of `repeats` calls to `f`.
+template <typename F>
+double best_time(int repeats, F f) {
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repeats; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+// Counts last-level cache misses of the calling thread with the Linux perf
+// events interface. The counter is unavailable on other platforms, and on
+// Linux if perf events are disabled (e.g. perf_event_paranoid or containers).
+class CacheMissCounter {
+public:
+    CacheMissCounter() {
+#ifdef EGS_MESH_BENCH_HAVE_PERF
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~CacheMissCounter() {
+#ifdef EGS_MESH_BENCH_HAVE_PERF
+        if (_fd != -1) {
+            close(_fd);
+        }
+#endif
+    }
+    CacheMissCounter(const CacheMissCounter&) = delete;
+    CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+
+    bool available() const {
+        return _fd != -1;
+    }
+    // Returns the cache misses during a call to `f`, or -1 if unavailable.
+    template <typename F>
+    long long count(F f) {
+#ifdef EGS_MESH_BENCH_HAVE_PERF
+        if (_fd != -1) {
+            ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+            f();
+            ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+            long long misses = 0;
+            if (read(_fd, &misses, sizeof(misses)) == sizeof(misses)) {
+                return misses;
+            }
+            return -1;
+        }
+#endif
+        f();
+        return -1;
+    }
+private:
+    int _fd = -1;
+};
+
+std::size_t file_size(const std::string& path) {
+    std::ifstream input(path, std::ios::binary | std::ios::ate);
+    return static_cast<std::size_t>(input.tellg());
+}
+
+// Number of cube cells per side needed for a synthetic mesh of at least
+// `num_elts` tetrahedrons.
+std::size_t cells_per_side(std::size_t num_elts) {
+    return static_cast<std::size_t>(std::ceil(std::cbrt(num_elts / 6.0)));
+}
+
+// Calls f(tag, nodes) for each tetrahedron of a unit cube split into n^3
+// cells of six tetrahedrons each. Node tags start at 1 and run along x, then
+// y, then z. Every cell is split along its main diagonal, so the
+// tetrahedrons of neighbouring cells share faces.
+template <typename F>
+void for_each_cube_tet(std::size_t n, F f) {
+    auto node = [n](std::size_t i, std::size_t j, std::size_t k) {
+        return 1 + i + (n + 1) * (j + (n + 1) * k);
+    };
+    // the six paths from corner (0,0,0) to (1,1,1) along cell edges
+    const int paths[6][3] = { {0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0} };
+    std::size_t tag = 1;
+    for (std::size_t k = 0; k < n; k++) {
+        for (std::size_t j = 0; j < n; j++) {
+            for (std::size_t i = 0; i < n; i++) {
+                for (const auto& path: paths) {
+                    std::size_t corner[3] = {i, j, k};
+                    std::size_t tet[4];
+                    tet[0] = node(corner[0], corner[1], corner[2]);
+                    for (int step = 0; step < 3; step++) {
+                        corner[path[step]]++;
+                        tet[step + 1] = node(corner[0], corner[1], corner[2]);
+                    }
+                    f(tag++, tet);
+                }
+            }
+        }
+    }
+}
+
+// Writes a msh 4.1 unit cube of water split into n^3 cells of six
+// tetrahedrons each, see for_each_cube_tet.
+void write_cube_mesh(const std::string& path, std::size_t n, bool binary) {
+    std::FILE* out = std::fopen(path.c_str(), binary ? "wb" : "w");
+    if (!out) {
+        throw std::runtime_error("couldn't create " + path);
+    }
+    auto write_ints = [out](std::initializer_list<int> values) {
+        for (int v: values) {
+            std::fwrite(&v, sizeof(v), 1, out);
+        }
+    };
+    auto write_sizes = [out](std::initializer_list<std::size_t> values) {
+        for (std::size_t v: values) {
+            std::fwrite(&v, sizeof(v), 1, out);
+        }
+    };
+    const std::size_t num_nodes = (n + 1) * (n + 1) * (n + 1);
+    const std::size_t num_elts = 6 * n * n * n;
+    if (binary) {
+        std::fprintf(out, "$MeshFormat\n4.1 1 8\n");
+        write_ints({1});
+        std::fprintf(out, "\n$EndMeshFormat\n");
+    } else {
+        std::fprintf(out, "$MeshFormat\n4.1 0 8\n$EndMeshFormat\n");
+    }
+    std::fprintf(out, "$PhysicalNames\n1\n3 1 \"Water\"\n$EndPhysicalNames\n");
+    if (binary) {
+        std::fprintf(out, "$Entities\n");
+        write_sizes({0, 0, 0, 1});
+        write_ints({1});
+        double bbox[6] = {0.0, 0.0, 0.0, 1.0, 1.0, 1.0};
+        std::fwrite(bbox, sizeof(double), 6, out);
+        write_sizes({1});
+        write_ints({1});
+        write_sizes({0});
+        std::fprintf(out, "\n$EndEntities\n$Nodes\n");
+        write_sizes({1, num_nodes, 1, num_nodes});
+        write_ints({3, 1, 0});
+        write_sizes({num_nodes});
+    } else {
+        std::fprintf(out, "$Entities\n0 0 0 1\n1 0 0 0 1 1 1 1 1 0\n$EndEntities\n");
+        std::fprintf(out, "$Nodes\n1 %zu 1 %zu\n3 1 0 %zu\n", num_nodes, num_nodes, num_nodes);
+    }
+    for (std::size_t i = 1; i <= num_nodes; i++) {
+        if (binary) {
+            write_sizes({i});
+        } else {
+            std::fprintf(out, "%zu\n", i);
+        }
+    }
+    for (std::size_t k = 0; k <= n; k++) {
+        for (std::size_t j = 0; j <= n; j++) {
+            for (std::size_t i = 0; i <= n; i++) {
+                double xyz[3] = { static_cast<double>(i) / n, static_cast<double>(j) / n,
+                    static_cast<double>(k) / n };
+                if (binary) {
+                    std::fwrite(xyz, sizeof(double), 3, out);
+                } else {
+                    std::fprintf(out, "%.16g %.16g %.16g\n", xyz[0], xyz[1], xyz[2]);
+                }
+            }
+        }
+    }
+    if (binary) {
+        std::fprintf(out, "\n$EndNodes\n$Elements\n");
+        write_sizes({1, num_elts, 1, num_elts});
+        write_ints({3, 1, 4});
+        write_sizes({num_elts});
+    } else {
+        std::fprintf(out, "$EndNodes\n$Elements\n1 %zu 1 %zu\n3 1 4 %zu\n", num_elts, num_elts, num_elts);
+    }
+    for_each_cube_tet(n, [&](std::size_t tag, const std::size_t* tet) {
+        if (binary) {
+            write_sizes({tag, tet[0], tet[1], tet[2], tet[3]});
+        } else {
+            std::fprintf(out, "%zu %zu %zu %zu %zu\n", tag, tet[0], tet[1], tet[2], tet[3]);
+        }
+    });
+    std::fprintf(out, binary ? "\n$EndElements\n" : "$EndElements\n");
+    std::fclose(out);
+}
+
+// Returns the path of a synthetic cube mesh with at least `num_elts`
+// tetrahedrons, writing it if it doesn't exist yet.
+std::string synthetic_mesh(std::size_t num_elts, bool binary = false) {
+    std::size_t n = cells_per_side(num_elts);
+    std::string path = "synthetic-" + std::to_string(n) + (binary ? "-binary" : "") + ".msh";
+    if (!std::ifstream(path)) {
+        std::cout << "writing " << path << " (" << 6 * n * n * n << " elements)\n";
+        write_cube_mesh(path, n, binary);
+    }
+    return path;
+}
+
+void bench_parse_file(const std::string& path, int repeats) {
+    double size_mb = file_size(path) / 1e6;
+    std::size_t num_elts = 0;
+    double stream_s = best_time(repeats, [&]() {
+        std::ifstream input(path, std::ios::binary);
+        num_elts = msh_parser::parse_msh_file(input).elements().size();
+    });
+    double mmap_s = best_time(repeats, [&]() {
+        num_elts = msh_parser::parse_msh_file(path).elements().size();
+    });
+    std::printf("%s: %.1f MB, %zu elements\n", path.c_str(), size_mb, num_elts);
+    std::printf("  std::istream  %8.3f s  %8.1f MB/s\n", stream_s, size_mb / stream_s);
+    std::printf("  mmap          %8.3f s  %8.1f MB/s  (%.1fx)\n", mmap_s, size_mb / mmap_s,
+        stream_s / mmap_s);
+}
+
+void bench_parse(std::size_t synthetic_elts) {
+    bench_parse_file("water10000.msh", 5);
+    bench_parse_file(synthetic_mesh(synthetic_elts), 1);
+}
+
+void bench_binary(std::size_t synthetic_elts) {
+    bench_parse_file("water.msh", 5);
+    bench_parse_file("water_binary.msh", 5);
+    bench_parse_file(synthetic_mesh(synthetic_elts), 1);
+    bench_parse_file(synthetic_mesh(synthetic_elts, true), 1);
+}
+
+// Thread counts to benchmark: powers of two up to the hardware thread count.
+std::vector<unsigned> thread_counts() {
+    unsigned max_threads = mesh_parallel::default_num_threads();
+    std::vector<unsigned> counts;
+    for (unsigned t = 1; t < max_threads; t *= 2) {
+        counts.push_back(t);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+void bench_parallel_parse(std::size_t synthetic_elts) {
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts)}) {
+        int repeats = path == "water10000.msh" ? 5 : 1;
+        double size_mb = file_size(path) / 1e6;
+        double serial_s = best_time(repeats, [&]() { msh_parser::parse_msh_file(path); });
+        std::printf("%s: %.1f MB\n", path.c_str(), size_mb);
+        std::printf("  serial         %8.3f s  %8.1f MB/s\n", serial_s, size_mb / serial_s);
+        for (unsigned num_threads: thread_counts()) {
+            double parallel_s = best_time(repeats, [&]() { msh_parser::parse_msh_file(path, num_threads); });
+            std::printf("  %3u threads    %8.3f s  %8.1f MB/s  (%.2fx)\n", num_threads, parallel_s,
+                size_mb / parallel_s, serial_s / parallel_s);
+        }
+    }
+}
+
+// Returns the tetrahedrons of a synthetic cube mesh for neighbour finding.
+std::vector<mesh_neighbours::Tetrahedron> cube_tetrahedrons(std::size_t n) {
+    std::vector<mesh_neighbours::Tetrahedron> elts;
+    elts.reserve(6 * n * n * n);
+    for_each_cube_tet(n, [&](std::size_t, const std::size_t* tet) {
+        elts.push_back(mesh_neighbours::Tetrahedron(tet[0], tet[1], tet[2], tet[3]));
+    });
+    return elts;
+}
+
+void bench_neighbours(std::size_t max_elts) {
+    std::printf("%10s %14s %14s %14s\n", "elements", "naive (s)", "node walk (s)", "hashed (s)");
+    for (std::size_t target = 1000; target <= max_elts; target *= 10) {
+        auto elts = cube_tetrahedrons(cells_per_side(target));
+        int repeats = elts.size() < 1000000 ? 3 : 1;
+        std::vector<std::array<std::size_t, 4>> walk_nbrs;
+        std::vector<std::array<std::size_t, 4>> hashed_nbrs;
+        double walk_s = best_time(repeats, [&]() {
+            walk_nbrs = mesh_neighbours::tetrahedron_neighbours(elts);
+        });
+        double hashed_s = best_time(repeats, [&]() {
+            hashed_nbrs = mesh_neighbours::tetrahedron_neighbours_hashed(elts);
+        });
+        if (walk_nbrs != hashed_nbrs) {
+            throw std::runtime_error("hashed neighbours differ from tetrahedron_neighbours");
+        }
+        // the naive algorithm is quadratic, only run it on small meshes
+        if (elts.size() <= 20000) {
+            double naive_s = best_time(1, [&]() { naive_neighbours(elts); });
+            std::printf("%10zu %14.4f %14.4f %14.4f\n", elts.size(), naive_s, walk_s, hashed_s);
+        } else {
+            std::printf("%10zu %14s %14.4f %14.4f\n", elts.size(), "-", walk_s, hashed_s);
+        }
+    }
+}
+
+void bench_parallel_neighbours(std::size_t synthetic_elts) {
+    auto elts = cube_tetrahedrons(cells_per_side(synthetic_elts));
+    std::vector<std::array<std::size_t, 4>> serial_nbrs;
+    double serial_s = best_time(1, [&]() {
+        serial_nbrs = mesh_neighbours::tetrahedron_neighbours_hashed(elts);
+    });
+    std::printf("%zu elements\n", elts.size());
+    std::printf("  serial hashed  %8.3f s\n", serial_s);
+    for (unsigned num_threads: thread_counts()) {
+        std::vector<std::array<std::size_t, 4>> nbrs;
+        double parallel_s = best_time(1, [&]() {
+            nbrs = mesh_neighbours::tetrahedron_neighbours_parallel(elts, num_threads);
+        });
+        if (nbrs != serial_nbrs) {
+            throw std::runtime_error("parallel neighbours differ from the serial result");
+        }
+        std::printf("  %3u threads    %8.3f s  (%.2fx)\n", num_threads, parallel_s, serial_s / parallel_s);
+    }
+}
+
+// The previous elements_around_nodes, with one vector per node.
+std::vector<std::vector<std::size_t>> nested_elements_around_nodes(
+    const std::vector<mesh_neighbours::Tetrahedron>& elements)
+{
+    std::size_t max_node = 0;
+    for (const auto& elt: elements) {
+        max_node = std::max(max_node, elt.max_node());
+    }
+    std::vector<std::vector<std::size_t>> shared_nodes(max_node + 1);
+    for (std::size_t i = 0; i < elements.size(); i++) {
+        for (auto node: elements[i].nodes()) {
+            shared_nodes.at(node).push_back(i);
+        }
+    }
+    return shared_nodes;
+}
+
+void bench_shared_nodes(std::size_t synthetic_elts) {
+    // glibc malloc adds 16 bytes of bookkeeping to every allocation
+    const std::size_t MALLOC_OVERHEAD = 16;
+    std::printf("%10s %10s %14s %14s %12s %12s\n", "elements", "nodes", "nested (s)", "CSR (s)",
+        "nested (MB)", "CSR (MB)");
+    for (std::size_t target = 1000; target <= synthetic_elts; target *= 10) {
+        auto elts = cube_tetrahedrons(cells_per_side(target));
+        int repeats = elts.size() < 1000000 ? 5 : 1;
+        std::size_t nested_bytes = 0;
+        double nested_s = best_time(repeats, [&]() {
+            auto shared = nested_elements_around_nodes(elts);
+            nested_bytes = shared.capacity() * sizeof(std::vector<std::size_t>) + MALLOC_OVERHEAD;
+            for (const auto& around: shared) {
+                if (around.capacity() > 0) {
+                    nested_bytes += around.capacity() * sizeof(std::size_t) + MALLOC_OVERHEAD;
+                }
+            }
+        });
+        std::size_t csr_bytes = 0;
+        std::size_t num_nodes = 0;
+        double csr_s = best_time(repeats, [&]() {
+            auto shared = mesh_neighbours::internal::elements_around_nodes(elts);
+            csr_bytes = shared.memory_bytes() + 2 * MALLOC_OVERHEAD;
+            num_nodes = shared.num_nodes();
+        });
+        std::printf("%10zu %10zu %14.4f %14.4f %12.1f %12.1f\n", elts.size(), num_nodes, nested_s, csr_s,
+            nested_bytes / 1e6, csr_bytes / 1e6);
+    }
+}
+
+// Follows neighbours through the mesh for `steps` steps, turning to the next
+// face at each step and restarting from an unrelated element at the boundary,
+// similar to the memory access pattern of particle transport.
+template <typename Index>
+std::size_t neighbour_walk(const std::vector<std::array<Index, 4>>& nbrs, std::size_t steps) {
+    std::size_t elt = 0;
+    std::size_t checksum = 0;
+    for (std::size_t step = 0; step < steps; step++) {
+        Index next = nbrs[elt][(step + elt) % 4];
+        elt = next == mesh_neighbours::none<Index>() ? (elt * 7919 + step) % nbrs.size() : next;
+        checksum += elt;
+    }
+    return checksum;
+}
+
+template <typename Index>
+void bench_index_type(const char* name, const std::vector<mesh_neighbours::BasicTetrahedron<Index>>& elts,
+    int repeats, CacheMissCounter& misses)
+{
+    std::vector<std::array<Index, 4>> nbrs;
+    long long nbr_misses = -1;
+    double nbr_s = best_time(repeats, [&]() {
+        nbr_misses = misses.count([&]() { nbrs = mesh_neighbours::tetrahedron_neighbours_hashed(elts); });
+    });
+    const std::size_t steps = 10 * elts.size();
+    std::size_t checksum = 0;
+    long long walk_misses = -1;
+    double walk_s = best_time(repeats, [&]() {
+        walk_misses = misses.count([&]() { checksum = neighbour_walk(nbrs, steps); });
+    });
+    const std::size_t table_bytes = elts.size() * (sizeof(elts[0]) + sizeof(nbrs[0]));
+    // keep the walk from being optimized away
+    volatile std::size_t sink = checksum;
+    (void) sink;
+    std::printf("  %-8s %8.1f MB %6zu B/elt %10.4f s %12lld %10.4f s %12lld\n", name,
+        table_bytes / 1e6, table_bytes / elts.size(), nbr_s, nbr_misses, walk_s, walk_misses);
+}
+
+void bench_compact_index(std::size_t synthetic_elts) {
+    CacheMissCounter misses;
+    if (!misses.available()) {
+        std::printf("cache miss counter unavailable, misses are reported as -1\n");
+    }
+    auto run = [&](const std::string& name, const std::vector<mesh_neighbours::Tetrahedron>& elts) {
+        std::vector<mesh_neighbours::CompactTetrahedron> compact_elts;
+        compact_elts.reserve(elts.size());
+        for (const auto& elt: elts) {
+            auto n = elt.nodes();
+            compact_elts.emplace_back(mesh_neighbours::CompactTetrahedron(
+                static_cast<std::uint32_t>(n[0]), static_cast<std::uint32_t>(n[1]),
+                static_cast<std::uint32_t>(n[2]), static_cast<std::uint32_t>(n[3])));
+        }
+        int repeats = elts.size() < 1000000 ? 5 : 1;
+        std::printf("%s: %zu elements\n", name.c_str(), elts.size());
+        std::printf("  %-8s %24s %12s %12s %12s %12s\n", "index", "elements + neighbours",
+            "hashed", "misses", "walk", "misses");
+        bench_index_type("size_t", elts, repeats, misses);
+        bench_index_type("uint32_t", compact_elts, repeats, misses);
+    };
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water10000.msh"));
+    std::vector<mesh_neighbours::Tetrahedron> water_elts;
+    for (const auto& elt: mesh.elements()) {
+        water_elts.emplace_back(mesh_neighbours::Tetrahedron(elt.a, elt.b, elt.c, elt.d));
+    }
+    run("water10000.msh", water_elts);
+    auto n = cells_per_side(synthetic_elts);
+    run("synthetic cube", cube_tetrahedrons(n));
+}
+
+// Walks through `mesh` for `steps` steps like neighbour_walk, summing the
+// centroids of the visited elements. The tag-based version looks the nodes
+// up by tag as the transport routines had to before the packed arrays.
+double tag_centroid_walk(EGS_Mesh& mesh, const std::unordered_map<int, std::size_t>& node_indices,
+    std::size_t steps)
+{
+    const auto& elements = mesh.elements();
+    const auto& nodes = mesh.nodes();
+    double sum = 0.0;
+    int elt = 0;
+    for (std::size_t step = 0; step < steps; step++) {
+        const auto& tet = elements[elt];
+        for (int tag: {tet.a, tet.b, tet.c, tet.d}) {
+            const auto& node = nodes[node_indices.at(tag)];
+            sum += node.x + node.y + node.z;
+        }
+        int next = mesh.neighbours(elt)[(step + elt) % 4];
+        elt = next == -1 ? static_cast<int>((elt * 7919 + step) % elements.size()) : next;
+    }
+    return sum / 4;
+}
+
+double packed_centroid_walk(const EGS_Mesh& mesh, std::size_t steps) {
+    double sum = 0.0;
+    int elt = 0;
+    for (std::size_t step = 0; step < steps; step++) {
+        const double* v = mesh.element_vertices(elt);
+        for (int i = 0; i < 12; i++) {
+            sum += v[i];
+        }
+        int next = mesh.neighbours(elt)[(step + elt) % 4];
+        elt = next == -1 ? static_cast<int>((elt * 7919 + step) % mesh.num_elements()) : next;
+    }
+    return sum / 4;
+}
+
+void bench_geometry(std::size_t synthetic_elts) {
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(path);
+        std::unordered_map<int, std::size_t> node_indices;
+        for (std::size_t i = 0; i < mesh.nodes().size(); i++) {
+            node_indices[mesh.nodes()[i].tag] = i;
+        }
+        const std::size_t steps = 10 * mesh.elements().size();
+        double tag_sum = 0.0;
+        double packed_sum = 0.0;
+        double tag_s = best_time(3, [&]() { tag_sum = tag_centroid_walk(mesh, node_indices, steps); });
+        double packed_s = best_time(3, [&]() { packed_sum = packed_centroid_walk(mesh, steps); });
+        if (std::abs(tag_sum - packed_sum) > 1e-6 * std::abs(tag_sum)) {
+            throw std::runtime_error("centroid walks differ");
+        }
+        std::printf("%s: %zu elements, %zu steps\n", path.c_str(), mesh.elements().size(), steps);
+        std::printf("  node tags      %8.4f s  %8.1f Msteps/s\n", tag_s, steps / tag_s / 1e6);
+        std::printf("  packed arrays  %8.4f s  %8.1f Msteps/s  (%.1fx)\n", packed_s, steps / packed_s / 1e6,
+            tag_s / packed_s);
+    }
+}
+
+// howfar computing the face planes from the element vertices on every call,
+// the reference for the precomputed planes of EGS_Mesh::howfar.
+EGS_Mesh::Exit howfar_on_the_fly(const EGS_Mesh& mesh, int tet, const EGS_Mesh::Vec3& pos,
+    const EGS_Mesh::Vec3& dir)
+{
+    const double* v = mesh.element_vertices(tet);
+    EGS_Mesh::Exit exit;
+    for (int f = 0; f < 4; f++) {
+        const double* a = v + 3 * ((f + 1) % 4);
+        const double* b = v + 3 * ((f + 2) % 4);
+        const double* c = v + 3 * ((f + 3) % 4);
+        const double* opposite = v + 3 * f;
+        const double ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        const double ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+        double n[3] = { ab[1] * ac[2] - ab[2] * ac[1], ab[2] * ac[0] - ab[0] * ac[2],
+            ab[0] * ac[1] - ab[1] * ac[0] };
+        if (n[0] * (opposite[0] - a[0]) + n[1] * (opposite[1] - a[1]) + n[2] * (opposite[2] - a[2]) > 0.0) {
+            n[0] = -n[0];
+            n[1] = -n[1];
+            n[2] = -n[2];
+        }
+        const double dir_normal = n[0] * dir.x + n[1] * dir.y + n[2] * dir.z;
+        if (dir_normal <= 0.0) {
+            continue;
+        }
+        const double gap = n[0] * (a[0] - pos.x) + n[1] * (a[1] - pos.y) + n[2] * (a[2] - pos.z);
+        const double dist = gap > 0.0 ? gap / dir_normal : 0.0;
+        if (dist < exit.distance) {
+            exit.distance = dist;
+            exit.face = f;
+        }
+    }
+    if (exit.face != -1) {
+        exit.next = mesh.neighbours(tet)[exit.face];
+    }
+    return exit;
+}
+
+// Tracks straight rays from the centroid of every `stride`-th element until
+// they leave the mesh, returning the number of element crossings.
+template <typename Howfar>
+std::size_t track_rays(const EGS_Mesh& mesh, int stride, Howfar howfar) {
+    // avoid directions along the synthetic mesh's edges and faces
+    const double norm = std::sqrt(0.3 * 0.3 + 0.5 * 0.5 + 0.8 * 0.8);
+    const EGS_Mesh::Vec3 dir(0.3 / norm, -0.5 / norm, 0.8 / norm);
+    std::size_t steps = 0;
+    for (int start = 0; start < mesh.num_elements(); start += stride) {
+        const double* v = mesh.element_vertices(start);
+        EGS_Mesh::Vec3 pos((v[0] + v[3] + v[6] + v[9]) / 4, (v[1] + v[4] + v[7] + v[10]) / 4,
+            (v[2] + v[5] + v[8] + v[11]) / 4);
+        // the step limit guards against rays trapped by round-off
+        for (int tet = start; tet != -1 && steps < 1000000000; steps++) {
+            auto exit = howfar(mesh, tet, pos, dir);
+            pos = EGS_Mesh::Vec3(pos.x + exit.distance * dir.x, pos.y + exit.distance * dir.y,
+                pos.z + exit.distance * dir.z);
+            tet = exit.next;
+        }
+    }
+    return steps;
+}
+
+void bench_howfar(std::size_t synthetic_elts) {
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(path);
+        // about as many ray steps as elements
+        const int stride = std::max(1, static_cast<int>(std::cbrt(mesh.num_elements() / 6.0)));
+        std::size_t planes_steps = 0;
+        std::size_t fly_steps = 0;
+        double planes_s = best_time(3, [&]() {
+            planes_steps = track_rays(mesh, stride,
+                [](const EGS_Mesh& m, int tet, const EGS_Mesh::Vec3& pos, const EGS_Mesh::Vec3& dir) {
+                    return m.howfar(tet, pos, dir);
+                });
+        });
+        double fly_s = best_time(3, [&]() { fly_steps = track_rays(mesh, stride, howfar_on_the_fly); });
+        std::printf("%s: %zu elements, %zu steps\n", path.c_str(), mesh.elements().size(), planes_steps);
+        std::printf("  on the fly     %8.4f s  %8.1f Msteps/s\n", fly_s, fly_steps / fly_s / 1e6);
+        std::printf("  stored planes  %8.4f s  %8.1f Msteps/s  (%.1fx)\n", planes_s,
+            planes_steps / planes_s / 1e6, (planes_steps / planes_s) / (fly_steps / fly_s));
+    }
+}
+
+// Runs the kernels on `points_per_tet` points inside each element of `mesh`
+// and prints the throughput of each kernel.
+void bench_kernel_set(const EGS_Mesh& mesh, const mesh_kernels::Kernels& kernels,
+    const std::vector<double>& points, int points_per_tet, double scalar_rates[3])
+{
+    const double dir[3] = {0.3 / 1.0677078252, -0.5 / 1.0677078252, 0.8 / 1.0677078252};
+    const std::size_t num_points = points.size() / 3;
+    std::size_t inside = 0;
+    double near_sum = 0.0;
+    double exit_sum = 0.0;
+    auto run = [&](int kernel) {
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            const double* planes = mesh.element_planes(i);
+            for (int j = 0; j < points_per_tet; j++) {
+                const double* p = &points[3 * (static_cast<std::size_t>(i) * points_per_tet + j)];
+                if (kernel == 0) {
+                    inside += kernels.is_inside(planes, p[0], p[1], p[2]);
+                } else if (kernel == 1) {
+                    near_sum += kernels.hownear(planes, p[0], p[1], p[2]);
+                } else {
+                    double dist = 0.0;
+                    exit_sum += kernels.ray_exit(planes, p, dir, dist);
+                    exit_sum += dist;
+                }
+            }
+        }
+    };
+    const char* names[3] = {"is_inside", "hownear", "ray_exit"};
+    for (int kernel = 0; kernel < 3; kernel++) {
+        double secs = best_time(3, [&]() { run(kernel); });
+        double rate = num_points / secs / 1e6;
+        if (scalar_rates[kernel] == 0.0) {
+            scalar_rates[kernel] = rate;
+        }
+        std::printf("  %-7s %-10s %8.1f Mpoints/s  (%.2fx)\n", kernels.name, names[kernel], rate,
+            rate / scalar_rates[kernel]);
+    }
+    // keep the kernels from being optimized away
+    volatile double sink = inside + near_sum + exit_sum;
+    (void) sink;
+}
+
+void bench_kernels(std::size_t synthetic_elts) {
+    if (!mesh_kernels::avx2_supported()) {
+        std::printf("AVX2 is not supported, only the scalar kernels are available\n");
+    }
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(path);
+        const int points_per_tet = 8;
+        // fixed pseudo-random barycentric weights, the same for every run
+        std::vector<double> points;
+        points.reserve(3 * points_per_tet * static_cast<std::size_t>(mesh.num_elements()));
+        std::uint64_t state = 12345;
+        auto uniform = [&state]() {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            return static_cast<double>(state >> 11) / 9007199254740992.0;
+        };
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            const double* v = mesh.element_vertices(i);
+            for (int j = 0; j < points_per_tet; j++) {
+                double w[4] = {uniform(), uniform(), uniform(), uniform()};
+                const double total = w[0] + w[1] + w[2] + w[3];
+                for (int k = 0; k < 3; k++) {
+                    points.push_back((w[0] * v[k] + w[1] * v[3 + k] + w[2] * v[6 + k] + w[3] * v[9 + k]) / total);
+                }
+            }
+        }
+        std::printf("%s: %zu elements, %zu points\n", path.c_str(), mesh.elements().size(), points.size() / 3);
+        double scalar_rates[3] = {0.0, 0.0, 0.0};
+        bench_kernel_set(mesh, mesh_kernels::scalar_kernels(), points, points_per_tet, scalar_rates);
+        if (mesh_kernels::avx2_supported()) {
+            bench_kernel_set(mesh, mesh_kernels::avx2_kernels(), points, points_per_tet, scalar_rates);
+        }
+    }
+}
+
+// Returns `count` points inside pseudo-randomly chosen elements of `mesh`.
+std::vector<EGS_Mesh::Vec3> random_mesh_points(const EGS_Mesh& mesh, std::size_t count) {
+    std::uint64_t state = 987654321;
+    auto next = [&state]() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return state >> 11;
+    };
+    std::vector<EGS_Mesh::Vec3> points;
+    points.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        const double* v = mesh.element_vertices(static_cast<int>(next() % mesh.num_elements()));
+        double w[4];
+        double total = 0.0;
+        for (double& x: w) {
+            x = static_cast<double>(next() % 1000 + 1);
+            total += x;
+        }
+        double p[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = (w[0] * v[k] + w[1] * v[3 + k] + w[2] * v[6 + k] + w[3] * v[9 + k]) / total;
+        }
+        points.push_back(EGS_Mesh::Vec3(p[0], p[1], p[2]));
+    }
+    return points;
+}
+
+// Linear scan for the element containing `point`.
+int brute_force_is_where(const EGS_Mesh& mesh, const EGS_Mesh::Vec3& point) {
+    for (int i = 0; i < mesh.num_elements(); i++) {
+        if (mesh.isInside(i, point)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void bench_is_where(std::size_t synthetic_elts) {
+    for (const std::string& path: {std::string("water.msh"), std::string("water10000.msh"),
+        synthetic_mesh(synthetic_elts, true)})
+    {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(path);
+        std::vector<mesh_bvh::Box> boxes(mesh.num_elements());
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            for (int n = 0; n < 4; n++) {
+                boxes[i].expand(mesh.element_vertices(i) + 3 * n);
+            }
+        }
+        double build_s = best_time(mesh.num_elements() < 1000000 ? 5 : 1, [&]() { mesh_bvh::BVH bvh(boxes); });
+        const auto& bvh = mesh.element_bvh();
+        auto points = random_mesh_points(mesh, 1000000);
+        std::size_t found = 0;
+        double bvh_s = best_time(3, [&]() {
+            found = 0;
+            for (const auto& p: points) {
+                found += mesh.isWhere(p) != -1;
+            }
+        });
+        // the linear scan is slow, time a sample of points
+        const std::size_t num_brute = std::max<std::size_t>(10, 1000000000 / mesh.num_elements() / 10);
+        std::size_t brute_found = 0;
+        double brute_s = best_time(1, [&]() {
+            for (std::size_t i = 0; i < std::min(num_brute, points.size()); i++) {
+                brute_found += brute_force_is_where(mesh, points[i]) != -1;
+            }
+        }) / std::min(num_brute, points.size());
+        std::printf("%s: %zu elements, %zu BVH nodes, %.1f MB\n", path.c_str(), mesh.elements().size(),
+            bvh.num_nodes(), bvh.memory_bytes() / 1e6);
+        std::printf("  build          %10.4f s\n", build_s);
+        std::printf("  BVH isWhere    %10.3f us/point  (%zu of %zu found)\n", bvh_s / points.size() * 1e6,
+            found, points.size());
+        std::printf("  linear scan    %10.3f us/point  (%.0fx slower)\n", brute_s * 1e6,
+            brute_s / (bvh_s / points.size()));
+    }
+}
+
+void bench_entry_distance(std::size_t synthetic_elts) {
+    for (const std::string& path: {std::string("water.msh"), std::string("water10000.msh"),
+        synthetic_mesh(synthetic_elts, true)})
+    {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(path);
+        mesh_bvh::Box bounds;
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            for (int n = 0; n < 4; n++) {
+                bounds.expand(mesh.element_vertices(i) + 3 * n);
+            }
+        }
+        double centre[3];
+        double radius = 0.0;
+        for (int k = 0; k < 3; k++) {
+            centre[k] = 0.5 * (bounds.lo[k] + bounds.hi[k]);
+            radius += 0.25 * (bounds.hi[k] - bounds.lo[k]) * (bounds.hi[k] - bounds.lo[k]);
+        }
+        radius = std::sqrt(radius);
+        // rays from a sphere twice the mesh size aimed at random points in its bounding box
+        std::uint64_t state = 42;
+        auto uniform = [&state]() {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            return static_cast<double>(state >> 11) / 9007199254740992.0;
+        };
+        const std::size_t num_rays = 200000;
+        std::vector<std::pair<EGS_Mesh::Vec3, EGS_Mesh::Vec3>> rays;
+        for (std::size_t i = 0; i < num_rays; i++) {
+            double z = 2 * uniform() - 1;
+            double phi = 2 * M_PI * uniform();
+            double r = std::sqrt(1 - z * z);
+            EGS_Mesh::Vec3 pos(centre[0] + 2 * radius * r * std::cos(phi),
+                centre[1] + 2 * radius * r * std::sin(phi), centre[2] + 2 * radius * z);
+            double d[3];
+            double norm = 0.0;
+            for (int k = 0; k < 3; k++) {
+                const double target = bounds.lo[k] + uniform() * (bounds.hi[k] - bounds.lo[k]);
+                d[k] = target - (k == 0 ? pos.x : k == 1 ? pos.y : pos.z);
+                norm += d[k] * d[k];
+            }
+            norm = std::sqrt(norm);
+            rays.push_back({pos, EGS_Mesh::Vec3(d[0] / norm, d[1] / norm, d[2] / norm)});
+        }
+        std::size_t hits = 0;
+        double bvh_s = best_time(3, [&]() {
+            hits = 0;
+            for (const auto& ray: rays) {
+                hits += mesh.entry_distance(ray.first, ray.second).tet != -1;
+            }
+        });
+        // the brute-force scan is slow, time a sample of rays
+        const std::size_t num_brute = std::min(num_rays,
+            std::max<std::size_t>(10, 200000000 / mesh.num_boundary_faces()));
+        double brute_s = best_time(1, [&]() {
+            for (std::size_t i = 0; i < num_brute; i++) {
+                double nearest = std::numeric_limits<double>::infinity();
+                for (std::size_t f = 0; f < mesh.num_boundary_faces(); f++) {
+                    nearest = std::min(nearest, mesh.boundary_face_entry(f, rays[i].first, rays[i].second));
+                }
+                if (nearest != mesh.entry_distance(rays[i].first, rays[i].second).distance) {
+                    throw std::runtime_error("entry_distance differs from the brute-force scan");
+                }
+            }
+        }) / num_brute;
+        std::printf("%s: %zu boundary faces, %zu of %zu rays hit\n", path.c_str(), mesh.num_boundary_faces(),
+            hits, num_rays);
+        std::printf("  boundary BVH   %10.3f us/ray\n", bvh_s / num_rays * 1e6);
+        std::printf("  face scan      %10.3f us/ray  (%.0fx slower)\n", brute_s * 1e6,
+            brute_s / (bvh_s / num_rays));
+    }
+}
+
+// Positions along random-walk particle tracks inside `mesh`, with steps of
+// `step` in isotropic directions. Tracks that leave the mesh restart at a
+// random point inside it.
+std::vector<EGS_Mesh::Vec3> random_walk_points(const EGS_Mesh& mesh, std::size_t count, double step) {
+    auto starts = random_mesh_points(mesh, count / 100 + 1);
+    std::size_t next_start = 0;
+    std::uint64_t state = 2020;
+    auto uniform = [&state]() {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<double>(state >> 11) / 9007199254740992.0;
+    };
+    std::vector<EGS_Mesh::Vec3> points;
+    points.reserve(count);
+    EGS_Mesh::Vec3 pos = starts[next_start++ % starts.size()];
+    while (points.size() < count) {
+        points.push_back(pos);
+        double z = 2 * uniform() - 1;
+        double phi = 2 * M_PI * uniform();
+        double r = std::sqrt(1 - z * z);
+        EGS_Mesh::Vec3 next(pos.x + step * r * std::cos(phi), pos.y + step * r * std::sin(phi), pos.z + step * z);
+        pos = mesh.isWhere(next) == -1 ? starts[next_start++ % starts.size()] : next;
+    }
+    return points;
+}
+
+void bench_locate_from(std::size_t synthetic_elts) {
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(path);
+        mesh_bvh::Box bounds;
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            for (int n = 0; n < 4; n++) {
+                bounds.expand(mesh.element_vertices(i) + 3 * n);
+            }
+        }
+        // edge length of a cube with the average element volume
+        const double volume = (bounds.hi[0] - bounds.lo[0]) * (bounds.hi[1] - bounds.lo[1]) *
+            (bounds.hi[2] - bounds.lo[2]);
+        const double tet_size = std::cbrt(volume / mesh.num_elements());
+        std::printf("%s: %zu elements, element size %.3g\n", path.c_str(), mesh.elements().size(), tet_size);
+        std::printf("  %10s %14s %14s %8s %12s %10s\n", "step", "cold (us)", "walk (us)", "speedup",
+            "steps/walk", "fallbacks");
+        for (double step_tets: {0.5, 2.0, 8.0, 32.0}) {
+            auto points = random_walk_points(mesh, 1000000, step_tets * tet_size);
+            std::vector<int> cold(points.size());
+            double cold_s = best_time(3, [&]() {
+                for (std::size_t i = 0; i < points.size(); i++) {
+                    cold[i] = mesh.isWhere(points[i]);
+                }
+            });
+            EGS_Mesh::LocateStats stats;
+            std::size_t mismatches = 0;
+            double walk_s = best_time(3, [&]() {
+                stats = EGS_Mesh::LocateStats();
+                int tet = -1;
+                for (std::size_t i = 0; i < points.size(); i++) {
+                    tet = mesh.locate_from(tet, points[i], &stats);
+                    // points on shared faces may be found in either element
+                    mismatches += tet != cold[i] && mesh.hownear(tet, points[i]) < -mesh.location_tolerance();
+                }
+            });
+            if (mismatches > 0) {
+                throw std::runtime_error("locate_from found a different element than isWhere");
+            }
+            std::printf("  %6.1f tet %14.3f %14.3f %7.1fx %12.2f %9.2f%%\n", step_tets,
+                cold_s / points.size() * 1e6, walk_s / points.size() * 1e6, cold_s / walk_s,
+                stats.average_steps(), 100.0 * stats.fallbacks / stats.walks);
+        }
+    }
+}
+
+// Tracks rays and locates random-walk points in `mesh`, printing the build
+// time, throughput and cache misses on one line.
+void bench_mesh_order(const char* name, double build_s, const EGS_Mesh& mesh,
+    const std::vector<EGS_Mesh::Vec3>& points, CacheMissCounter& misses)
+{
+    const int stride = std::max(1, static_cast<int>(std::cbrt(mesh.num_elements() / 6.0)));
+    std::size_t steps = 0;
+    long long ray_misses = -1;
+    double ray_s = best_time(3, [&]() {
+        ray_misses = misses.count([&]() {
+            steps = track_rays(mesh, stride,
+                [](const EGS_Mesh& m, int tet, const EGS_Mesh::Vec3& pos, const EGS_Mesh::Vec3& dir) {
+                    return m.howfar(tet, pos, dir);
+                });
+        });
+    });
+    long long walk_misses = -1;
+    double walk_s = best_time(3, [&]() {
+        walk_misses = misses.count([&]() {
+            int tet = -1;
+            for (const auto& p: points) {
+                tet = mesh.locate_from(tet, p);
+            }
+        });
+    });
+    std::printf("  %-10s %8.3f s %10.1f Msteps/s %12lld %10.1f Mpoints/s %12lld\n", name, build_s,
+        steps / ray_s / 1e6, ray_misses, points.size() / walk_s / 1e6, walk_misses);
+}
+
+void bench_reorder(std::size_t synthetic_elts) {
+    CacheMissCounter misses;
+    if (!misses.available()) {
+        std::printf("cache miss counter unavailable, misses are reported as -1\n");
+    }
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        EGS_Mesh input = msh_parser::parse_msh_file(path);
+        mesh_bvh::Box bounds;
+        for (int i = 0; i < input.num_elements(); i++) {
+            for (int n = 0; n < 4; n++) {
+                bounds.expand(input.element_vertices(i) + 3 * n);
+            }
+        }
+        const double tet_size = std::cbrt((bounds.hi[0] - bounds.lo[0]) * (bounds.hi[1] - bounds.lo[1]) *
+            (bounds.hi[2] - bounds.lo[2]) / input.num_elements());
+        auto points = random_walk_points(input, 1000000, 2.0 * tet_size);
+
+        // the synthetic mesh is written in grid order, so also try a shuffled
+        // copy, like the output of a mesher with no locality
+        std::vector<EGS_Mesh::Tetrahedron> elements = input.elements();
+        std::vector<EGS_Mesh::Node> nodes = input.nodes();
+        std::mt19937 rng(2020);
+        std::shuffle(elements.begin(), elements.end(), rng);
+        std::shuffle(nodes.begin(), nodes.end(), rng);
+        std::vector<EGS_Mesh::Medium> media = input.materials();
+
+        std::printf("%s: %zu elements\n", path.c_str(), input.elements().size());
+        std::printf("  %-10s %10s %19s %12s %20s %12s\n", "order", "build", "howfar", "misses",
+            "locate_from", "misses");
+        auto run = [&](const char* name, const std::vector<EGS_Mesh::Tetrahedron>& elts,
+            const std::vector<EGS_Mesh::Node>& mesh_nodes, EGS_Mesh::Reorder reorder)
+        {
+            EGS_Mesh::Options options;
+            options.reorder = reorder;
+            std::unique_ptr<EGS_Mesh> mesh;
+            double build_s = best_time(1, [&]() {
+                mesh.reset(new EGS_Mesh(elts, mesh_nodes, media, options));
+            });
+            bench_mesh_order(name, build_s, *mesh, points, misses);
+        };
+        run("file", input.elements(), input.nodes(), EGS_Mesh::Reorder::None);
+        run("shuffled", elements, nodes, EGS_Mesh::Reorder::None);
+        run("morton", elements, nodes, EGS_Mesh::Reorder::Morton);
+        run("hilbert", elements, nodes, EGS_Mesh::Reorder::Hilbert);
+    }
+}
+
+void bench_startup(std::size_t synthetic_elts) {
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        const std::string cache = path + ".snapshot";
+        const int repeats = file_size(path) < 1e8 ? 5 : 1;
+        std::size_t num_elts = 0;
+        double parse_s = best_time(repeats, [&]() {
+            num_elts = msh_parser::parse_msh_file(path).elements().size();
+        });
+        std::uint64_t hash = 0;
+        double hash_s = best_time(repeats, [&]() { hash = mesh_io::file_hash(path); });
+        double save_s = best_time(1, [&]() {
+            mesh_snapshot::save_snapshot(msh_parser::parse_msh_file(path), cache, hash);
+        });
+        save_s -= parse_s;
+        double load_s = best_time(repeats, [&]() {
+            num_elts = mesh_snapshot::load_snapshot(cache, hash).elements().size();
+        });
+        // the mapping is paged in on first use, so also time touching every plane
+        double checksum = 0.0;
+        double touch_s = best_time(repeats, [&]() {
+            EGS_Mesh mesh = mesh_snapshot::load_snapshot(cache, hash);
+            for (int i = 0; i < mesh.num_elements(); i++) {
+                checksum += mesh.element_planes(i)[15];
+            }
+        });
+        double cached_s = best_time(repeats, [&]() {
+            num_elts = msh_parser::parse_msh_file_cached(path, cache).elements().size();
+        });
+        std::printf("%s: %.1f MB, %zu elements, snapshot %.1f MB\n", path.c_str(), file_size(path) / 1e6,
+            num_elts, file_size(cache) / 1e6);
+        std::printf("  parse and build          %10.3f ms\n", parse_s * 1e3);
+        std::printf("  write snapshot           %10.3f ms\n", save_s * 1e3);
+        std::printf("  hash msh file            %10.3f ms\n", hash_s * 1e3);
+        std::printf("  load snapshot            %10.3f ms  (%.0fx)\n", load_s * 1e3, parse_s / load_s);
+        std::printf("  load and touch planes    %10.3f ms  (%.0fx)\n", touch_s * 1e3, parse_s / touch_s);
+        std::printf("  parse_msh_file_cached    %10.3f ms  (%.0fx)\n", cached_s * 1e3, parse_s / cached_s);
+        volatile double sink = checksum;
+        (void) sink;
+        std::remove(cache.c_str());
+    }
+}
+
+// Times the duplicate check of `nodes` with a hash set and a TagChecker
+// over the declared range [min_tag, max_tag].
+void bench_tag_range(const char* name, const std::vector<EGS_Mesh::Node>& nodes,
+    std::size_t min_tag, std::size_t max_tag)
+{
+    bool unique = false;
+    double set_s = best_time(3, [&]() {
+        unique = msh_parser::internal::msh41::check_unique_tags(nodes).first;
+    });
+    bool dense = false;
+    double checker_s = best_time(3, [&]() {
+        auto checker = msh_parser::internal::msh41::node_tag_checker(min_tag, max_tag, nodes.size());
+        dense = checker.dense();
+        checker.add(nodes.data(), nodes.size());
+        checker.finish();
+    });
+    std::printf("%s tags (%s), %zu tags in [%zu, %zu]\n", name, dense ? "bitmap" : "sorted",
+        nodes.size(), min_tag, max_tag);
+    std::printf("  unordered_set    %8.3f ms  %6.1f ns/tag%s\n", set_s * 1e3, set_s * 1e9 / nodes.size(),
+        unique ? "" : "  (duplicate found)");
+    std::printf("  TagChecker       %8.3f ms  %6.1f ns/tag  (%.1fx)\n", checker_s * 1e3,
+        checker_s * 1e9 / nodes.size(), set_s / checker_s);
+}
+
+// Discards everything a streaming parse hands over.
+class NullSink : public msh_parser::MeshSink {
+public:
+    void node_bloc(const EGS_Mesh::Node*, std::size_t) override {}
+    void element_bloc(const EGS_Mesh::Tetrahedron*, std::size_t) override {}
+};
+
+void bench_tag_check(std::size_t synthetic_elts) {
+    // dense tags in file order, as written by Gmsh, and sparse shuffled tags
+    std::vector<EGS_Mesh::Node> nodes;
+    nodes.reserve(synthetic_elts);
+    for (std::size_t i = 0; i < synthetic_elts; i++) {
+        nodes.push_back(EGS_Mesh::Node(static_cast<int>(i + 1), 0.0, 0.0, 0.0));
+    }
+    bench_tag_range("dense", nodes, 1, synthetic_elts);
+    std::mt19937 rng(12345);
+    std::shuffle(nodes.begin(), nodes.end(), rng);
+    const std::size_t stride = 100;
+    for (auto& n: nodes) {
+        n.tag = static_cast<int>((n.tag - 1) * stride + 1);
+    }
+    bench_tag_range("sparse", nodes, 1, (synthetic_elts - 1) * stride + 1);
+
+    // share of the tag checks in a full load, which now includes them
+    const std::string path = synthetic_mesh(synthetic_elts, true);
+    double stream_s = best_time(1, [&]() {
+        NullSink sink;
+        msh_parser::parse_msh_stream(path, sink);
+    });
+    double parse_s = best_time(1, [&]() { msh_parser::parse_msh_file(path); });
+    std::printf("%s: %.1f MB\n", path.c_str(), file_size(path) / 1e6);
+    std::printf("  parse_msh_stream %8.3f ms\n", stream_s * 1e3);
+    std::printf("  parse_msh_file   %8.3f ms\n", parse_s * 1e3);
+}
+
+// Times resolving the node tags of every element of `elements` to indices
+// in `nodes` with a hash map and with a TagIndex, both built from scratch.
+void bench_tag_lookup(const char* name, const std::vector<EGS_Mesh::Tetrahedron>& elements,
+    const std::vector<EGS_Mesh::Node>& nodes)
+{
+    const std::size_t lookups = 4 * elements.size();
+    std::size_t sum = 0;
+    double map_s = best_time(3, [&]() {
+        std::unordered_map<int, int> map;
+        map.reserve(nodes.size());
+        for (std::size_t i = 0; i < nodes.size(); i++) {
+            map.emplace(nodes[i].tag, static_cast<int>(i));
+        }
+        for (const auto& tet: elements) {
+            for (int tag: {tet.a, tet.b, tet.c, tet.d}) {
+                sum += map.at(tag);
+            }
+        }
+    });
+    mesh_tags::TagIndex index;
+    double index_s = best_time(3, [&]() {
+        index = mesh_tags::TagIndex::build(nodes.data(), nodes.size(), "node");
+        for (const auto& tet: elements) {
+            for (int tag: {tet.a, tet.b, tet.c, tet.d}) {
+                sum += index.find(tag);
+            }
+        }
+    });
+    std::printf("%s tags (%s index, %.1f MB)\n", name, index.dense() ? "dense" : "hashed",
+        index.memory_bytes() / 1e6);
+    std::printf("  unordered_map    %8.3f ms  %6.1f ns/lookup\n", map_s * 1e3, map_s * 1e9 / lookups);
+    std::printf("  TagIndex         %8.3f ms  %6.1f ns/lookup  (%.1fx)\n", index_s * 1e3,
+        index_s * 1e9 / lookups, map_s / index_s);
+    volatile std::size_t result = sum;
+    (void) result;
+}
+
+void bench_tag_index(std::size_t synthetic_elts) {
+    const std::string path = synthetic_mesh(synthetic_elts, true);
+    EGS_Mesh input = msh_parser::parse_msh_file(path);
+    const std::vector<EGS_Mesh::Node>& nodes = input.nodes();
+    const std::vector<EGS_Mesh::Tetrahedron>& elements = input.elements();
+
+    // the same mesh with shuffled, non-contiguous node and element tags
+    auto sparse_tags = [](std::size_t count, std::mt19937& rng) {
+        std::vector<int> tags(count);
+        for (std::size_t i = 0; i < count; i++) {
+            tags[i] = static_cast<int>(i) * 97 + 13;
+        }
+        std::shuffle(tags.begin(), tags.end(), rng);
+        return tags;
+    };
+    std::mt19937 rng(2020);
+    const std::vector<int> node_tags = sparse_tags(nodes.size(), rng);
+    const std::vector<int> elt_tags = sparse_tags(elements.size(), rng);
+    std::unordered_map<int, int> renumber;
+    std::vector<EGS_Mesh::Node> sparse_nodes = nodes;
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+        renumber.emplace(nodes[i].tag, node_tags[i]);
+        sparse_nodes[i].tag = node_tags[i];
+    }
+    std::vector<EGS_Mesh::Tetrahedron> sparse_elements = elements;
+    for (std::size_t i = 0; i < elements.size(); i++) {
+        auto& tet = sparse_elements[i];
+        tet = EGS_Mesh::Tetrahedron(elt_tags[i], tet.medium_tag, renumber.at(tet.a), renumber.at(tet.b),
+            renumber.at(tet.c), renumber.at(tet.d));
+    }
+    renumber.clear();
+
+    std::printf("%s: %zu elements, %zu nodes\n", path.c_str(), elements.size(), nodes.size());
+    bench_tag_lookup("dense", elements, nodes);
+    bench_tag_lookup("sparse", sparse_elements, sparse_nodes);
+
+    std::unique_ptr<EGS_Mesh> sparse_mesh;
+    double dense_build_s = best_time(1, [&]() { EGS_Mesh(elements, nodes, input.materials()); });
+    double sparse_build_s = best_time(1, [&]() {
+        sparse_mesh.reset(new EGS_Mesh(sparse_elements, sparse_nodes, input.materials()));
+    });
+    std::printf("EGS_Mesh build\n");
+    std::printf("  dense tags       %8.3f ms\n", dense_build_s * 1e3);
+    std::printf("  sparse tags      %8.3f ms\n", sparse_build_s * 1e3);
+
+    // a downstream per-element query: the vertex sum of every element, from
+    // the node tags through a hash map as before, or the 0-based connectivity
+    const EGS_Mesh& mesh = *sparse_mesh;
+    const auto& mesh_nodes = mesh.nodes();
+    double map_sum = 0.0;
+    double map_s = best_time(3, [&]() {
+        std::unordered_map<int, int> node_indices;
+        node_indices.reserve(mesh_nodes.size());
+        for (std::size_t i = 0; i < mesh_nodes.size(); i++) {
+            node_indices.emplace(mesh_nodes[i].tag, static_cast<int>(i));
+        }
+        map_sum = 0.0;
+        for (const auto& tet: mesh.elements()) {
+            for (int tag: {tet.a, tet.b, tet.c, tet.d}) {
+                const auto& node = mesh_nodes[node_indices.at(tag)];
+                map_sum += node.x + node.y + node.z;
+            }
+        }
+    });
+    double index_sum = 0.0;
+    double index_s = best_time(3, [&]() {
+        index_sum = 0.0;
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            for (int n: mesh.element_nodes(i)) {
+                const auto& node = mesh_nodes[n];
+                index_sum += node.x + node.y + node.z;
+            }
+        }
+    });
+    std::printf("vertex sum over all elements, sparse tags%s\n", map_sum == index_sum ? "" : " (MISMATCH)");
+    std::printf("  unordered_map    %8.3f ms\n", map_s * 1e3);
+    std::printf("  element_nodes    %8.3f ms  (%.1fx)\n", index_s * 1e3, map_s / index_s);
+}
+
+void bench_lazy_neighbours(std::size_t synthetic_elts) {
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        const int repeats = file_size(path) < 1e8 ? 5 : 1;
+        EGS_Mesh::Options lazy_options;
+        lazy_options.lazy_neighbours = true;
+        // a metadata-only tool: the volume of each medium
+        auto medium_volumes = [](const EGS_Mesh& mesh) {
+            std::vector<double> volumes(mesh.materials().size());
+            const auto& nodes = mesh.nodes();
+            for (int i = 0; i < mesh.num_elements(); i++) {
+                const auto& idx = mesh.element_nodes(i);
+                const auto& a = nodes[idx[0]];
+                double e[3][3];
+                for (int k = 0; k < 3; k++) {
+                    const auto& b = nodes[idx[k + 1]];
+                    e[k][0] = b.x - a.x;
+                    e[k][1] = b.y - a.y;
+                    e[k][2] = b.z - a.z;
+                }
+                volumes[mesh.medium_index(i)] += std::abs(e[0][0] * (e[1][1] * e[2][2] - e[1][2] * e[2][1]) -
+                    e[0][1] * (e[1][0] * e[2][2] - e[1][2] * e[2][0]) +
+                    e[0][2] * (e[1][0] * e[2][1] - e[1][1] * e[2][0])) / 6.0;
+            }
+            return volumes;
+        };
+        double eager_volume = 0.0, lazy_volume = 0.0;
+        double eager_s = best_time(repeats, [&]() {
+            eager_volume = medium_volumes(msh_parser::parse_msh_file(path))[0];
+        });
+        double lazy_s = best_time(repeats, [&]() {
+            lazy_volume = medium_volumes(msh_parser::parse_msh_file(path, 0, lazy_options))[0];
+        });
+        // the deferred cost, paid by the first transport call
+        double first_s = 0.0;
+        double full_s = best_time(repeats, [&]() {
+            EGS_Mesh mesh = msh_parser::parse_msh_file(path, 0, lazy_options);
+            first_s = best_time(1, [&]() { lazy_volume += mesh.neighbour_table().size(); });
+        });
+        EGS_Mesh eager = msh_parser::parse_msh_file(path);
+        EGS_Mesh lazy = msh_parser::parse_msh_file(path, 0, lazy_options);
+        lazy.neighbours(0);
+        const int stride = std::max(1, static_cast<int>(std::cbrt(eager.num_elements() / 6.0)));
+        auto howfar = [](const EGS_Mesh& m, int tet, const EGS_Mesh::Vec3& pos, const EGS_Mesh::Vec3& dir) {
+            return m.howfar(tet, pos, dir);
+        };
+        std::size_t steps = 0;
+        double eager_howfar_s = best_time(3, [&]() { steps = track_rays(eager, stride, howfar); });
+        double lazy_howfar_s = best_time(3, [&]() { steps = track_rays(lazy, stride, howfar); });
+        std::printf("%s: %zu elements\n", path.c_str(), eager.elements().size());
+        std::printf("  load and medium volumes, eager neighbours %10.3f ms\n", eager_s * 1e3);
+        std::printf("  load and medium volumes, lazy neighbours  %10.3f ms  (%.2fx)\n", lazy_s * 1e3,
+            eager_s / lazy_s);
+        std::printf("  first neighbour_table() call              %10.3f ms\n", first_s * 1e3);
+        std::printf("  lazy load and first call                  %10.3f ms\n", full_s * 1e3);
+        std::printf("  howfar, eager %6.1f Msteps/s, lazy %6.1f Msteps/s\n", steps / eager_howfar_s / 1e6,
+            steps / lazy_howfar_s / 1e6);
+        volatile double sink = eager_volume + lazy_volume;
+        (void) sink;
+    }
+}
+
+// Element indices of random walks through the mesh, as visited by particle
+// tracks, to score along.
+std::vector<int> random_walk_elements(const EGS_Mesh& mesh, std::size_t count) {
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> start(0, mesh.num_elements() - 1);
+    std::vector<int> elts;
+    elts.reserve(count);
+    int elt = start(rng);
+    while (elts.size() < count) {
+        elts.push_back(elt);
+        const int next = mesh.neighbours(elt)[rng() % 4];
+        elt = next == -1 ? start(rng) : next;
+    }
+    return elts;
+}
+
+void bench_scoring(std::size_t synthetic_elts) {
+    const std::size_t num_scores = 1 << 24;
+    const std::size_t scores_per_history = 32;
+    // tallies of 64 threads on a large mesh would not fit in memory
+    const double max_tally_bytes = 3e9;
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(path);
+        const std::size_t num_elts = mesh.elements().size();
+        const std::vector<int> track = random_walk_elements(mesh, num_scores);
+        std::printf("%s: %zu elements, %zu scores, %zu per history\n", path.c_str(), num_elts, num_scores,
+            scores_per_history);
+        std::printf("  %7s %22s %22s %12s %12s\n", "threads", "shared atomic", "per-thread tallies",
+            "reduce", "tallies");
+        for (unsigned num_threads: {1u, 8u, 64u}) {
+            // each thread scores its slice of the track
+            auto run_threads = [&](std::function<void(unsigned, std::size_t, std::size_t)> f) {
+                std::vector<std::thread> threads;
+                for (unsigned t = 0; t < num_threads; t++) {
+                    threads.emplace_back(f, t, num_scores * t / num_threads, num_scores * (t + 1) / num_threads);
+                }
+                for (auto& t: threads) {
+                    t.join();
+                }
+            };
+            std::vector<std::atomic<double>> shared(num_elts);
+            double atomic_s = best_time(3, [&]() {
+                run_threads([&](unsigned, std::size_t begin, std::size_t end) {
+                    for (std::size_t i = begin; i < end; i++) {
+                        auto& total = shared[track[i]];
+                        double old = total.load(std::memory_order_relaxed);
+                        while (!total.compare_exchange_weak(old, old + 1e-3 * (i & 7), std::memory_order_relaxed)) {
+                        }
+                    }
+                });
+            });
+            const double tally_bytes = 32.0 * num_elts * num_threads;
+            if (tally_bytes > max_tally_bytes) {
+                std::printf("  %7u %10.3f s %6.1f M/s  skipped, tallies would take %.1f GB\n", num_threads,
+                    atomic_s, num_scores / atomic_s / 1e6, tally_bytes / 1e9);
+                continue;
+            }
+            mesh_scoring::ElementScorer scorer(num_elts, num_threads);
+            double tally_s = best_time(3, [&]() {
+                run_threads([&](unsigned t, std::size_t begin, std::size_t end) {
+                    auto& tally = scorer.tally(t);
+                    for (std::size_t i = begin; i < end; i++) {
+                        if (i % scores_per_history == 0 || i == begin) {
+                            tally.start_history();
+                        }
+                        tally.score(track[i], 1e-3 * (i & 7));
+                    }
+                });
+            });
+            double reduce_s = best_time(1, [&]() { scorer.reduce(num_threads); });
+            std::printf("  %7u %10.3f s %6.1f M/s %10.3f s %6.1f M/s %9.3f ms %9.1f MB\n", num_threads,
+                atomic_s, num_scores / atomic_s / 1e6, tally_s, num_scores / tally_s / 1e6, reduce_s * 1e3,
+                tally_bytes / 1e6);
+        }
+    }
+}
+
+// Element indices of random walks of `steps_per_history` steps, each
+// starting in a narrow beam along z through the middle of the mesh made of
+// the `beam_fraction` of elements closest to its axis.
+std::vector<int> beam_walk_elements(const EGS_Mesh& mesh, std::size_t count, std::size_t steps_per_history,
+    double beam_fraction)
+{
+    mesh_bvh::Box bounds;
+    for (int i = 0; i < mesh.num_elements(); i++) {
+        bounds.expand(mesh.element_vertices(i));
+    }
+    const double cx = 0.5 * (bounds.lo[0] + bounds.hi[0]);
+    const double cy = 0.5 * (bounds.lo[1] + bounds.hi[1]);
+    std::vector<std::pair<double, int>> radii;
+    for (int i = 0; i < mesh.num_elements(); i++) {
+        const double* v = mesh.element_vertices(i);
+        const double x = (v[0] + v[3] + v[6] + v[9]) / 4 - cx;
+        const double y = (v[1] + v[4] + v[7] + v[10]) / 4 - cy;
+        radii.push_back(std::make_pair(x * x + y * y, i));
+    }
+    const std::size_t beam_size = std::max<std::size_t>(1, static_cast<std::size_t>(beam_fraction * radii.size()));
+    std::nth_element(radii.begin(), radii.begin() + (beam_size - 1), radii.end());
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<std::size_t> start(0, beam_size - 1);
+    std::vector<int> elts;
+    elts.reserve(count);
+    while (elts.size() < count) {
+        int elt = radii[start(rng)].second;
+        for (std::size_t step = 0; step < steps_per_history && elts.size() < count && elt != -1; step++) {
+            elts.push_back(elt);
+            elt = mesh.neighbours(elt)[rng() % 4];
+        }
+    }
+    return elts;
+}
+
+void bench_sparse_scoring(std::size_t synthetic_elts) {
+    const std::size_t num_scores = 1 << 24;
+    const std::size_t scores_per_history = 32;
+    const double max_tally_bytes = 3e9;
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        for (auto reorder: {EGS_Mesh::Reorder::None, EGS_Mesh::Reorder::Morton}) {
+            EGS_Mesh::Options options;
+            options.reorder = reorder;
+            EGS_Mesh mesh = msh_parser::parse_msh_file(path, 0, options);
+            const std::size_t num_elts = mesh.elements().size();
+            const std::vector<int> track = beam_walk_elements(mesh, num_scores, scores_per_history, 0.02);
+            std::vector<char> touched(num_elts);
+            for (int e: track) {
+                touched[e] = 1;
+            }
+            const std::size_t num_touched = std::count(touched.begin(), touched.end(), 1);
+            std::printf("%s, %s order: %zu elements, %zu scores in %zu elements (%.1f%%)\n", path.c_str(),
+                reorder == EGS_Mesh::Reorder::None ? "file" : "morton", num_elts, num_scores, num_touched,
+                100.0 * num_touched / num_elts);
+            std::printf("  %-6s %7s %10s %12s %12s %12s %14s\n", "layout", "threads", "memory", "scoring",
+                "reduce", "results", "sparse results");
+            for (auto layout: {mesh_scoring::Layout::Dense, mesh_scoring::Layout::Paged}) {
+                for (unsigned num_threads: {1u, 8u}) {
+                    const char* name = layout == mesh_scoring::Layout::Dense ? "dense" : "paged";
+                    if (layout == mesh_scoring::Layout::Dense && 32.0 * num_elts * num_threads > max_tally_bytes) {
+                        std::printf("  %-6s %7u  skipped, tallies would take %.1f GB\n", name, num_threads,
+                            32.0 * num_elts * num_threads / 1e9);
+                        continue;
+                    }
+                    std::unique_ptr<mesh_scoring::ElementScorer> scorer;
+                    // includes the allocation of the tallies, up front or on first touch
+                    double scoring_s = best_time(1, [&]() {
+                        scorer.reset(new mesh_scoring::ElementScorer(num_elts, num_threads, layout));
+                        std::vector<std::thread> threads;
+                        for (unsigned t = 0; t < num_threads; t++) {
+                            threads.emplace_back([&](unsigned thread) {
+                                auto& tally = scorer->tally(thread);
+                                const std::size_t end = num_scores * (thread + 1) / num_threads;
+                                for (std::size_t i = num_scores * thread / num_threads; i < end; i++) {
+                                    if (i % scores_per_history == 0) {
+                                        tally.start_history();
+                                    }
+                                    tally.score(track[i], 1e-3 * (i & 7));
+                                }
+                            }, t);
+                        }
+                        for (auto& t: threads) {
+                            t.join();
+                        }
+                    });
+                    double reduce_s = best_time(1, [&]() { scorer->reduce(num_threads); });
+                    std::size_t num_results = 0;
+                    double results_s = best_time(1, [&]() { num_results = scorer->results().size(); });
+                    double sparse_s = best_time(1, [&]() { num_results = scorer->sparse_results().elements.size(); });
+                    std::printf("  %-6s %7u %7.1f MB %6.1f M/s %9.3f ms %9.3f ms %11.3f ms\n", name, num_threads,
+                        scorer->memory_bytes() / 1e6, num_scores / scoring_s / 1e6, reduce_s * 1e3,
+                        results_s * 1e3, sparse_s * 1e3);
+                }
+            }
+        }
+    }
+}
+
+void bench_element_data(std::size_t synthetic_elts) {
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        const int repeats = file_size(path) < 1e8 ? 5 : 1;
+        EGS_Mesh mesh = msh_parser::parse_msh_file(path);
+        const std::size_t num_elts = mesh.elements().size();
+        // dose-like values: a mean and its relative uncertainty per element
+        std::mt19937_64 rng(5);
+        std::uniform_real_distribution<double> dist(0.0, 1.0);
+        std::vector<msh_writer::ElementData> data(2);
+        data[0].name = "Dose";
+        data[1].name = "Dose uncertainty";
+        for (std::size_t i = 0; i < num_elts; i++) {
+            data[0].values.push_back(dist(rng) * 1e-12);
+            data[1].values.push_back(dist(rng) * 0.05);
+        }
+        const std::size_t num_values = 2 * num_elts;
+        const std::string out_path = path + ".dose.msh";
+
+        // the values written with iostreams and printf, without the headers
+        double stream_s = best_time(repeats, [&]() {
+            std::ofstream out(out_path);
+            out << std::setprecision(17);
+            for (const auto& view: data) {
+                for (std::size_t i = 0; i < num_elts; i++) {
+                    out << mesh.elements()[i].tag << ' ' << view.values[i] << '\n';
+                }
+            }
+        });
+        double printf_s = best_time(repeats, [&]() {
+            std::FILE* out = std::fopen(out_path.c_str(), "w");
+            for (const auto& view: data) {
+                for (std::size_t i = 0; i < num_elts; i++) {
+                    std::fprintf(out, "%d %.17g\n", mesh.elements()[i].tag, view.values[i]);
+                }
+            }
+            std::fclose(out);
+        });
+        double ascii_s = best_time(repeats, [&]() {
+            msh_writer::write_element_data(out_path, mesh.elements(), data, msh_writer::Format::Ascii);
+        });
+        const std::size_t ascii_bytes = file_size(out_path);
+        double binary_s = best_time(repeats, [&]() {
+            msh_writer::write_element_data(out_path, mesh.elements(), data, msh_writer::Format::Binary);
+        });
+        const std::size_t binary_bytes = file_size(out_path);
+        // a checkpoint: copy the results, start the write, and carry on
+        double blocked_s = 0.0;
+        double background_s = best_time(repeats, [&]() {
+            msh_writer::BackgroundWriter writer(mesh, msh_writer::Format::Ascii);
+            blocked_s = best_time(1, [&]() { writer.write(out_path, data); });
+            writer.wait();
+        });
+        std::remove(out_path.c_str());
+
+        std::printf("%s: %zu elements, %zu values, ascii %.1f MB, binary %.1f MB\n", path.c_str(), num_elts,
+            num_values, ascii_bytes / 1e6, binary_bytes / 1e6);
+        auto report = [&](const char* name, double seconds) {
+            std::printf("  %-28s %9.3f ms %8.1f Mvalues/s\n", name, seconds * 1e3, num_values / seconds / 1e6);
+        };
+        report("ofstream <<, 17 digits", stream_s);
+        report("fprintf %.17g", printf_s);
+        report("ascii, shortest round-trip", ascii_s);
+        report("binary", binary_s);
+        std::printf("  %-28s %9.3f ms blocked, %.3f ms in total\n", "ascii, background", blocked_s * 1e3,
+            background_s * 1e3);
+    }
+}
+
+#define RUN_BENCH(name, bench_fn) \
+    if (filter.empty() || filter == name) { \
+        std::cout << "benchmark " << name << std::endl; \
+        bench_fn; \
+    }
+
+// usage: egs-mesh-bench [benchmark name] [synthetic mesh element count]
+void bench_validation(std::size_t synthetic_elts) {
+    for (const std::string& path: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts, true)}) {
+        const int repeats = file_size(path) < 1e8 ? 5 : 1;
+        EGS_Mesh::Options unchecked;
+        unchecked.validate = false;
+        // alternated, so that drift in the machine's speed affects both alike
+        double load_s = std::numeric_limits<double>::infinity();
+        double checked_s = load_s;
+        for (int r = 0; r < repeats + 1; r++) {
+            load_s = std::min(load_s, best_time(1, [&]() { msh_parser::parse_msh_file(path, 1, unchecked); }));
+            checked_s = std::min(checked_s, best_time(1, [&]() { msh_parser::parse_msh_file(path); }));
+        }
+        EGS_Mesh mesh = msh_parser::parse_msh_file(path);
+        mesh_validation::Report report;
+        std::printf("%s: %zu elements\n", path.c_str(), mesh.elements().size());
+        std::printf("  load, unvalidated    %10.3f ms\n", load_s * 1e3);
+        std::printf("  load, validated      %10.3f ms  (+%.1f%%)\n", checked_s * 1e3,
+            100.0 * (checked_s - load_s) / load_s);
+        for (unsigned num_threads: thread_counts()) {
+            mesh_validation::Options options;
+            options.num_threads = num_threads;
+            double validate_s = best_time(repeats, [&]() { report = mesh_validation::validate(mesh, options); });
+            std::printf("  validate, %3u threads %9.3f ms  (%.1f%% of load)\n", num_threads, validate_s * 1e3,
+                100.0 * validate_s / load_s);
+        }
+        // only the counts, the synthetic meshes don't follow the Gmsh node order
+        const std::string summary = report.summary();
+        std::printf("  min quality %.3f, %s", report.min_quality, summary.substr(0, summary.find('\n') + 1).c_str());
+    }
+}
+
+// The text of the ascii msh file `path` with every node moved by `dx` along
+// x, a phase of a moving phantom.
+std::string shifted_msh(const std::string& path, double dx) {
+    std::ifstream input(path);
+    std::ostringstream output;
+    output.precision(17);
+    std::string line;
+    while (std::getline(input, line)) {
+        msh_parser::internal::rtrim(line);
+        output << line << "\n";
+        if (line != "$Nodes") {
+            continue;
+        }
+        std::size_t num_blocs = 0;
+        std::getline(input, line);
+        std::istringstream(line) >> num_blocs;
+        output << line << "\n";
+        for (std::size_t b = 0; b < num_blocs; b++) {
+            int dim, entity, parametric;
+            std::size_t count = 0;
+            std::getline(input, line);
+            std::istringstream(line) >> dim >> entity >> parametric >> count;
+            output << line << "\n";
+            for (std::size_t i = 0; i < count; i++) {
+                std::getline(input, line);
+                output << line << "\n";
+            }
+            for (std::size_t i = 0; i < count; i++) {
+                double x, y, z;
+                std::getline(input, line);
+                std::istringstream(line) >> x >> y >> z;
+                output << x + dx << " " << y << " " << z << "\n";
+            }
+        }
+    }
+    return output.str();
+}
+
+void bench_multi_mesh(std::size_t synthetic_elts) {
+    const int num_phases = 20;
+    // the phases of the synthetic mesh add up to about synthetic_elts elements
+    for (const std::string& source: {std::string("water10000.msh"), synthetic_mesh(synthetic_elts / num_phases)}) {
+        const std::string multi_path = "phases.msh";
+        std::vector<std::string> phase_paths;
+        {
+            std::ofstream multi(multi_path);
+            for (int p = 0; p < num_phases; p++) {
+                const std::string phase = shifted_msh(source, 1e-3 * p);
+                multi << phase;
+                phase_paths.push_back("phase-" + std::to_string(p) + ".msh");
+                std::ofstream(phase_paths.back()) << phase;
+            }
+        }
+        const int repeats = file_size(multi_path) < 1e8 ? 3 : 1;
+        std::size_t num_elts = 0;
+        double separate_s = best_time(repeats, [&]() {
+            std::vector<EGS_Mesh> meshes;
+            for (const auto& path: phase_paths) {
+                meshes.push_back(msh_parser::parse_msh_file(path));
+            }
+            num_elts = meshes.back().elements().size();
+        });
+        double multi_s = best_time(repeats, [&]() {
+            num_elts = msh_parser::parse_msh_meshes(multi_path).back().elements().size();
+        });
+        auto meshes = msh_parser::parse_msh_meshes(multi_path);
+        // transport speed through a refitted phase compared to a built one
+        const int stride = std::max(1, static_cast<int>(std::cbrt(num_elts / 6.0)));
+        auto howfar = [](const EGS_Mesh& m, int tet, const EGS_Mesh::Vec3& pos, const EGS_Mesh::Vec3& dir) {
+            return m.howfar(tet, pos, dir);
+        };
+        EGS_Mesh last = msh_parser::parse_msh_file(phase_paths.back());
+        std::size_t steps = 0;
+        double shared_s = best_time(5, [&]() { steps = track_rays(meshes.back(), stride, howfar); });
+        double built_s = best_time(5, [&]() { steps = track_rays(last, stride, howfar); });
+        std::printf("%s: %d phases of %zu elements, %.1f MB\n", source.c_str(), num_phases, num_elts,
+            file_size(multi_path) / 1e6);
+        std::printf("  %d separate files     %10.3f ms\n", num_phases, separate_s * 1e3);
+        std::printf("  one multi-mesh file   %10.3f ms  (%.2fx)\n", multi_s * 1e3, separate_s / multi_s);
+        std::printf("  howfar, built phase %6.1f Msteps/s, shared phase %6.1f Msteps/s\n",
+            steps / built_s / 1e6, steps / shared_s / 1e6);
+        std::remove(multi_path.c_str());
+        for (const auto& path: phase_paths) {
+            std::remove(path.c_str());
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string filter = argc > 1 ? argv[1] : "";
+    std::size_t synthetic_elts = argc > 2 ? std::stoull(argv[2]) : 10000000;
+
+    RUN_BENCH("parse", bench_parse(synthetic_elts));
+    RUN_BENCH("binary", bench_binary(synthetic_elts));
+    RUN_BENCH("parallel-parse", bench_parallel_parse(synthetic_elts));
+    RUN_BENCH("neighbours", bench_neighbours(synthetic_elts));
+    RUN_BENCH("parallel-neighbours", bench_parallel_neighbours(synthetic_elts));
+    RUN_BENCH("shared-nodes", bench_shared_nodes(synthetic_elts));
+    RUN_BENCH("compact-index", bench_compact_index(synthetic_elts));
+    RUN_BENCH("geometry", bench_geometry(synthetic_elts));
+    RUN_BENCH("howfar", bench_howfar(synthetic_elts));
+    RUN_BENCH("kernels", bench_kernels(synthetic_elts));
+    RUN_BENCH("is-where", bench_is_where(synthetic_elts));
+    RUN_BENCH("entry-distance", bench_entry_distance(synthetic_elts));
+    RUN_BENCH("locate-from", bench_locate_from(synthetic_elts));
+    RUN_BENCH("reorder", bench_reorder(synthetic_elts));
+    RUN_BENCH("startup", bench_startup(synthetic_elts));
+    RUN_BENCH("tag-check", bench_tag_check(synthetic_elts));
+    RUN_BENCH("tag-index", bench_tag_index(synthetic_elts));
+    RUN_BENCH("lazy-neighbours", bench_lazy_neighbours(synthetic_elts));
+    RUN_BENCH("scoring", bench_scoring(synthetic_elts));
+    RUN_BENCH("sparse-scoring", bench_sparse_scoring(synthetic_elts));
+    RUN_BENCH("element-data", bench_element_data(synthetic_elts));
+    RUN_BENCH("validation", bench_validation(synthetic_elts));
+    RUN_BENCH("multi-mesh", bench_multi_mesh(synthetic_elts));
+    return 0;
+}
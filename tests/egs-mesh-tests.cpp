@@ -1,6 +1,85 @@
 #include "msh_parser.h"
 #include "mesh_neighbours.h"
+#include "mesh_scoring.h"
+#include "mesh_validation.h"
+#include "msh_writer.h"
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <new>
+#include <random>
+#include <thread>
+
+// Heap accounting for the memory tests: every allocation goes through these
+// operators, which keep the number of live bytes and their peak.
+namespace heap {
+std::atomic<std::size_t> live_bytes(0);
+std::atomic<std::size_t> peak_bytes(0);
+std::atomic<std::size_t> num_allocations(0);
+// room for the allocation size, keeping the alignment of malloc
+const std::size_t HEADER = 16;
+
+__attribute__((noinline)) void* allocate(std::size_t size) {
+    void* p = std::malloc(size + HEADER);
+    if (!p) {
+        return nullptr;
+    }
+    *static_cast<std::size_t*>(p) = size;
+    num_allocations++;
+    std::size_t live = live_bytes += size;
+    std::size_t peak = peak_bytes.load();
+    while (live > peak && !peak_bytes.compare_exchange_weak(peak, live)) {
+    }
+    return static_cast<char*>(p) + HEADER;
+}
+
+__attribute__((noinline)) void deallocate(void* ptr) {
+    if (ptr) {
+        void* p = static_cast<char*>(ptr) - HEADER;
+        live_bytes -= *static_cast<std::size_t*>(p);
+        std::free(p);
+    }
+}
+
+// Resets the peak to the current live bytes and returns them.
+std::size_t reset_peak() {
+    peak_bytes = live_bytes.load();
+    return peak_bytes;
+}
+} // namespace heap
+
+void* operator new(std::size_t size) {
+    void* p = heap::allocate(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return heap::allocate(size);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return heap::allocate(size);
+}
+void operator delete(void* p) noexcept {
+    heap::deallocate(p);
+}
+void operator delete[](void* p) noexcept {
+    heap::deallocate(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    heap::deallocate(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    heap::deallocate(p);
+}
 
 // O(n2) neighbour finding function to verify our implementation
 std::vector<std::array<std::size_t, 4>> naive_neighbours(const std::vector<mesh_neighbours::Tetrahedron>& elements) {
@@ -115,6 +194,1543 @@ int test_water10000_block() {
     return 0;
 }
 
+// Returns true if two meshes have exactly the same elements, nodes and media.
+bool same_mesh(EGS_Mesh& a, EGS_Mesh& b) {
+    const auto& a_elts = a.elements();
+    const auto& b_elts = b.elements();
+    if (a_elts.size() != b_elts.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < a_elts.size(); i++) {
+        if (a_elts[i].medium_tag != b_elts[i].medium_tag || a_elts[i].a != b_elts[i].a ||
+            a_elts[i].b != b_elts[i].b || a_elts[i].c != b_elts[i].c || a_elts[i].d != b_elts[i].d) {
+            return false;
+        }
+    }
+    const auto& a_nodes = a.nodes();
+    const auto& b_nodes = b.nodes();
+    if (a_nodes.size() != b_nodes.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < a_nodes.size(); i++) {
+        if (a_nodes[i].tag != b_nodes[i].tag || a_nodes[i].x != b_nodes[i].x ||
+            a_nodes[i].y != b_nodes[i].y || a_nodes[i].z != b_nodes[i].z) {
+            return false;
+        }
+    }
+    const auto& a_media = a.materials();
+    const auto& b_media = b.materials();
+    if (a_media.size() != b_media.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < a_media.size(); i++) {
+        if (a_media[i].tag != b_media[i].tag || a_media[i].medium_name != b_media[i].medium_name) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int test_mmap_parser() {
+    for (std::string file: {"water.msh", "water10000.msh"}) {
+        std::ifstream input(file);
+        EGS_Mesh stream_mesh = msh_parser::parse_msh_file(input);
+        EGS_Mesh mmap_mesh = msh_parser::parse_msh_file(file);
+        assert(same_mesh(stream_mesh, mmap_mesh));
+    }
+
+    // numbers the fast path can't convert exactly must still round correctly
+    const char numbers[] = "0.9999999000000001 -9.999999994736442e-008 1e-400 1.7976931348623157e308 "
+        "123456789012345678901234567890 -0.0 2.5e+3";
+    msh_parser::internal::TextCursor cursor(numbers, numbers + sizeof(numbers) - 1);
+    std::istringstream expected(numbers);
+    for (int i = 0; i < 7; i++) {
+        double fast = -1.0;
+        double slow = -2.0;
+        assert(cursor.parse_double(fast));
+        expected >> slow;
+        assert(fast == slow && std::signbit(fast) == std::signbit(slow));
+    }
+    double unparsed = 0.0;
+    assert(!cursor.parse_double(unparsed));
+
+    bool threw = false;
+    try {
+        msh_parser::parse_msh_file(std::string("does-not-exist.msh"));
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+    return 0;
+}
+
+int test_binary_parser() {
+    std::ifstream ascii_input("water.msh");
+    EGS_Mesh ascii_mesh = msh_parser::parse_msh_file(ascii_input);
+
+    std::ifstream binary_input("water_binary.msh", std::ios::binary);
+    EGS_Mesh binary_mesh = msh_parser::parse_msh_file(binary_input);
+    assert(same_mesh(ascii_mesh, binary_mesh));
+
+    EGS_Mesh mmap_binary_mesh = msh_parser::parse_msh_file(std::string("water_binary.msh"));
+    assert(same_mesh(ascii_mesh, mmap_binary_mesh));
+
+    // a file written with the opposite byte order is detected from its marker
+    using msh_parser::internal::swap_bytes;
+    std::int32_t swapped_one = swap_bytes(std::int32_t(1));
+    assert(swapped_one != 1 && swap_bytes(swapped_one) == 1);
+    std::string header = "$MeshFormat\n4.1 1 8\n" +
+        std::string(reinterpret_cast<const char*>(&swapped_one), sizeof(swapped_one)) +
+        "\n$EndMeshFormat\n";
+    std::istringstream header_input(header);
+    auto format = msh_parser::internal::parse_msh_version(header_input);
+    assert(format.binary && format.swap_bytes);
+
+    // truncated binary data is an error, not a short mesh
+    std::ifstream full_input("water_binary.msh", std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(full_input)), std::istreambuf_iterator<char>());
+    std::istringstream truncated(contents.substr(0, contents.find("$EndNodes") - 100));
+    bool threw = false;
+    try {
+        msh_parser::parse_msh_file(truncated);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+    return 0;
+}
+
+// Returns the error message of parsing a msh file, or an empty string.
+template <typename Parse>
+std::string parse_error(Parse parse) {
+    try {
+        parse();
+    } catch (const std::runtime_error& err) {
+        return err.what();
+    }
+    return "";
+}
+
+// Parse an ascii msh file in parallel, splitting blocs into small chunks.
+EGS_Mesh parse_chunked(const std::string& file, unsigned num_threads, std::size_t chunk_lines) {
+    mesh_io::MappedFile mapped(file);
+    msh_parser::internal::TextCursor input(mapped.data(), mapped.data() + mapped.size());
+    std::istringstream header(msh_parser::internal::read_section(input, "$EndMeshFormat"));
+    msh_parser::internal::parse_msh_version(header);
+    return msh_parser::internal::msh41::parse_body_parallel(input, num_threads, chunk_lines);
+}
+
+int test_parallel_parser() {
+    for (std::string file: {"water.msh", "water10000.msh"}) {
+        EGS_Mesh serial_mesh = msh_parser::parse_msh_file(file);
+        for (unsigned num_threads: {0u, 2u, 3u, 8u}) {
+            EGS_Mesh parallel_mesh = msh_parser::parse_msh_file(file, num_threads);
+            assert(same_mesh(serial_mesh, parallel_mesh));
+            EGS_Mesh chunked_mesh = parse_chunked(file, num_threads, 100);
+            assert(same_mesh(serial_mesh, chunked_mesh));
+        }
+    }
+
+    // the first error in file order is reported, like the serial parser
+    std::ifstream input("water10000.msh");
+    std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    auto first_elt = contents.find("\n", contents.find("3 1 4 9280")) + 1;
+    contents.replace(contents.find("\n", first_elt + 50000) + 1, 1, "x");
+    contents.replace(contents.find("\n", first_elt + 100000) + 1, 1, "-");
+    {
+        std::ofstream bad("bad-parallel.msh");
+        bad << contents;
+    }
+    std::string serial_err = parse_error([]() { msh_parser::parse_msh_file(std::string("bad-parallel.msh")); });
+    std::string parallel_err = parse_error([]() { parse_chunked("bad-parallel.msh", 4, 100); });
+    std::remove("bad-parallel.msh");
+    assert(!serial_err.empty() && serial_err.find(parallel_err) != std::string::npos);
+    return 0;
+}
+
+// Returns the elements of a mesh in the form used for neighbour finding.
+std::vector<mesh_neighbours::Tetrahedron> neighbour_elements(EGS_Mesh& mesh) {
+    std::vector<mesh_neighbours::Tetrahedron> neighbour_elts;
+    neighbour_elts.reserve(mesh.elements().size());
+    for (int i = 0; i < mesh.num_elements(); i++) {
+        const auto& n = mesh.element_nodes(i);
+        neighbour_elts.emplace_back(mesh_neighbours::Tetrahedron(n[0], n[1], n[2], n[3]));
+    }
+    return neighbour_elts;
+}
+
+int test_hashed_neighbours() {
+    for (std::string file: {"water.msh", "water10000.msh"}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(file);
+        auto elts = neighbour_elements(mesh);
+        assert(mesh_neighbours::tetrahedron_neighbours_hashed(elts) ==
+            mesh_neighbours::tetrahedron_neighbours(elts));
+    }
+    // two tetrahedrons sharing face {2, 3, 4}
+    std::vector<mesh_neighbours::Tetrahedron> pair {
+        mesh_neighbours::Tetrahedron(1, 2, 3, 4), mesh_neighbours::Tetrahedron(5, 4, 3, 2)
+    };
+    auto nbrs = mesh_neighbours::tetrahedron_neighbours_hashed(pair);
+    assert(nbrs == naive_neighbours(pair));
+    assert(nbrs[0][0] == 1 && nbrs[1][3] == 0);
+    return 0;
+}
+
+int test_parallel_neighbours() {
+    for (std::string file: {"water.msh", "water10000.msh"}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(file);
+        auto elts = neighbour_elements(mesh);
+        auto serial = mesh_neighbours::tetrahedron_neighbours(elts);
+        for (unsigned num_threads: {0u, 1u, 2u, 3u, 7u}) {
+            assert(mesh_neighbours::tetrahedron_neighbours_parallel(elts, num_threads) == serial);
+        }
+    }
+    // three tetrahedrons sharing face {2, 3, 4} still match the serial hashed result
+    std::vector<mesh_neighbours::Tetrahedron> fan {
+        mesh_neighbours::Tetrahedron(1, 2, 3, 4), mesh_neighbours::Tetrahedron(5, 4, 3, 2),
+        mesh_neighbours::Tetrahedron(2, 3, 4, 6)
+    };
+    std::vector<std::uint64_t> serial_extra;
+    auto serial_fan = mesh_neighbours::tetrahedron_neighbours_hashed(fan, &serial_extra);
+    // the first two keep their pairing, the third copy is reported
+    assert(serial_fan[0][0] == 1 && serial_fan[1][3] == 0 && serial_fan[2][3] == mesh_neighbours::NONE);
+    assert(serial_extra == std::vector<std::uint64_t>{4 * 2 + 3});
+    for (unsigned num_threads: {1u, 2u, 3u}) {
+        std::vector<std::uint64_t> extra;
+        assert(mesh_neighbours::tetrahedron_neighbours_parallel(fan, num_threads, &extra) == serial_fan);
+        assert(extra == serial_extra);
+    }
+    return 0;
+}
+
+int test_shared_nodes() {
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water.msh"));
+    auto elts = neighbour_elements(mesh);
+    auto shared_nodes = mesh_neighbours::internal::elements_around_nodes(elts);
+    // element nodes are 0-based indices into the node list
+    assert(shared_nodes.num_nodes() == mesh.nodes().size());
+    for (std::size_t node = 0; node < shared_nodes.num_nodes(); node++) {
+        std::vector<std::size_t> expected;
+        for (std::size_t i = 0; i < elts.size(); i++) {
+            auto nodes = elts[i].nodes();
+            if (std::find(nodes.begin(), nodes.end(), node) != nodes.end()) {
+                expected.push_back(i);
+            }
+        }
+        auto around = shared_nodes.elements_around_node(node);
+        assert(std::vector<std::size_t>(around.begin(), around.end()) == expected);
+    }
+    bool threw = false;
+    try {
+        shared_nodes.elements_around_node(shared_nodes.num_nodes());
+    } catch (const std::out_of_range&) {
+        threw = true;
+    }
+    assert(threw);
+    return 0;
+}
+
+int test_compact_neighbours() {
+    static_assert(sizeof(mesh_neighbours::CompactTetrahedron) == 16, "compact tetrahedrons are 16 bytes");
+    for (std::string file: {"water.msh", "water10000.msh"}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(file);
+        auto elts = neighbour_elements(mesh);
+        std::vector<mesh_neighbours::CompactTetrahedron> compact_elts;
+        for (const auto& elt: mesh.elements()) {
+            compact_elts.emplace_back(mesh_neighbours::CompactTetrahedron(elt.a, elt.b, elt.c, elt.d));
+        }
+        auto nbrs = mesh_neighbours::tetrahedron_neighbours(elts);
+        // the compact tables hold the same indices with COMPACT_NONE in place of NONE
+        auto widen = [](const std::vector<std::array<std::uint32_t, 4>>& compact) {
+            std::vector<std::array<std::size_t, 4>> wide;
+            for (const auto& n: compact) {
+                std::array<std::size_t, 4> w;
+                for (std::size_t f = 0; f < 4; f++) {
+                    w[f] = n[f] == mesh_neighbours::COMPACT_NONE ? mesh_neighbours::NONE : n[f];
+                }
+                wide.push_back(w);
+            }
+            return wide;
+        };
+        assert(widen(mesh_neighbours::tetrahedron_neighbours(compact_elts)) == nbrs);
+        assert(widen(mesh_neighbours::tetrahedron_neighbours_hashed(compact_elts)) == nbrs);
+        assert(widen(mesh_neighbours::tetrahedron_neighbours_parallel(compact_elts, 3)) == nbrs);
+    }
+    return 0;
+}
+
+int test_mesh_geometry() {
+    for (std::string file: {"water.msh", "water10000.msh"}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(file);
+        assert(mesh.num_elements() == static_cast<int>(mesh.elements().size()));
+        std::unordered_map<int, const EGS_Mesh::Node*> nodes;
+        for (const auto& node: mesh.nodes()) {
+            nodes[node.tag] = &node;
+        }
+        std::size_t num_boundary_faces = 0;
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            const auto& elt = mesh.elements()[i];
+            assert(mesh.materials()[mesh.medium_index(i)].tag == elt.medium_tag);
+            // the packed vertices are the element's nodes in some order
+            const double* v = mesh.element_vertices(i);
+            for (int tag: {elt.a, elt.b, elt.c, elt.d}) {
+                const auto* node = nodes.at(tag);
+                bool found = false;
+                for (int j = 0; j < 4; j++) {
+                    found = found || (v[3*j] == node->x && v[3*j+1] == node->y && v[3*j+2] == node->z);
+                }
+                assert(found);
+            }
+            // neighbours are symmetric and share the face opposite vertex f
+            for (int f = 0; f < 4; f++) {
+                int n = mesh.neighbours(i)[f];
+                if (n == -1) {
+                    num_boundary_faces++;
+                    continue;
+                }
+                const auto& back = mesh.neighbours(n);
+                int g = static_cast<int>(std::find(back.begin(), back.end(), i) - back.begin());
+                assert(g < 4);
+                const double* w = mesh.element_vertices(n);
+                for (int j = 0; j < 4; j++) {
+                    if (j == f) {
+                        continue;
+                    }
+                    bool shared = false;
+                    for (int k = 0; k < 4; k++) {
+                        shared = shared || (k != g && v[3*j] == w[3*k] && v[3*j+1] == w[3*k+1] &&
+                            v[3*j+2] == w[3*k+2]);
+                    }
+                    assert(shared);
+                }
+            }
+        }
+        std::size_t expected_boundary_faces = 0;
+        for (const auto& nbrs: mesh_neighbours::tetrahedron_neighbours(neighbour_elements(mesh))) {
+            expected_boundary_faces += std::count(nbrs.begin(), nbrs.end(), mesh_neighbours::NONE);
+        }
+        assert(num_boundary_faces == expected_boundary_faces);
+    }
+    std::vector<EGS_Mesh::Node> nodes {
+        EGS_Mesh::Node(1, 0, 0, 0), EGS_Mesh::Node(2, 1, 0, 0),
+        EGS_Mesh::Node(3, 0, 1, 0), EGS_Mesh::Node(4, 0, 0, 1)
+    };
+    std::vector<EGS_Mesh::Medium> media { EGS_Mesh::Medium(1, "Water") };
+    auto construct_error = [&](EGS_Mesh::Tetrahedron elt) {
+        try {
+            EGS_Mesh mesh({elt}, nodes, media);
+        } catch (const std::runtime_error& err) {
+            return std::string(err.what());
+        }
+        return std::string();
+    };
+    assert(construct_error(EGS_Mesh::Tetrahedron(1, 1, 2, 3, 4)).empty());
+    assert(construct_error(EGS_Mesh::Tetrahedron(1, 1, 2, 3, 5)) == "element 0 has unknown node tag 5");
+    assert(construct_error(EGS_Mesh::Tetrahedron(2, 1, 2, 3, 4)) == "element 0 has unknown medium tag 2");
+    assert(construct_error(EGS_Mesh::Tetrahedron(1, 1, 2, 3, 3)) == "element 0 has a repeated node");
+    return 0;
+}
+
+// Signed volume of the tetrahedron (a, b, c, d), times six.
+double signed_volume(const double* a, const double* b, const double* c, const double* d) {
+    const double ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    const double ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    const double ad[3] = {d[0] - a[0], d[1] - a[1], d[2] - a[2]};
+    return ab[0] * (ac[1] * ad[2] - ac[2] * ad[1]) - ab[1] * (ac[0] * ad[2] - ac[2] * ad[0]) +
+        ab[2] * (ac[0] * ad[1] - ac[1] * ad[0]);
+}
+
+// Barycentric coordinate of point p for vertex f of the tetrahedron `v`.
+double barycentric(const double* v, int f, const double* p) {
+    double replaced[12];
+    std::copy(v, v + 12, replaced);
+    std::copy(p, p + 3, replaced + 3 * f);
+    return signed_volume(replaced, replaced + 3, replaced + 6, replaced + 9) /
+        signed_volume(v, v + 3, v + 6, v + 9);
+}
+
+int test_howfar() {
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water10000.msh"));
+    const double s = 1.0 / std::sqrt(3.0);
+    const EGS_Mesh::Vec3 dirs[] = {
+        EGS_Mesh::Vec3(1, 0, 0), EGS_Mesh::Vec3(0, -1, 0), EGS_Mesh::Vec3(0, 0, 1),
+        EGS_Mesh::Vec3(s, s, s), EGS_Mesh::Vec3(-s, s, -s)
+    };
+    for (int i = 0; i < mesh.num_elements(); i++) {
+        const double* v = mesh.element_vertices(i);
+        // start off-centre so that exits through every face are exercised
+        EGS_Mesh::Vec3 pos(
+            0.4 * v[0] + 0.3 * v[3] + 0.2 * v[6] + 0.1 * v[9],
+            0.4 * v[1] + 0.3 * v[4] + 0.2 * v[7] + 0.1 * v[10],
+            0.4 * v[2] + 0.3 * v[5] + 0.2 * v[8] + 0.1 * v[11]);
+        for (const auto& dir: dirs) {
+            auto exit = mesh.howfar(i, pos, dir);
+            assert(exit.face >= 0 && exit.face < 4 && exit.distance > 0.0);
+            assert(exit.next == mesh.neighbours(i)[exit.face]);
+            // the exit point is on the exit face and inside the other faces
+            const double p[3] = { pos.x + exit.distance * dir.x, pos.y + exit.distance * dir.y,
+                pos.z + exit.distance * dir.z };
+            for (int f = 0; f < 4; f++) {
+                double b = barycentric(v, f, p);
+                if (f == exit.face) {
+                    assert(std::abs(b) < 1e-9);
+                } else {
+                    assert(b > -1e-9);
+                }
+            }
+        }
+    }
+    // a point just outside the face it is heading through exits immediately
+    const double* v = mesh.element_vertices(0);
+    auto exit = mesh.howfar(0, EGS_Mesh::Vec3(v[0], v[1], v[2]), EGS_Mesh::Vec3(1, 0, 0));
+    auto back = mesh.howfar(0, EGS_Mesh::Vec3(v[0], v[1], v[2]), EGS_Mesh::Vec3(-1, 0, 0));
+    assert(exit.distance == 0.0 || back.distance == 0.0);
+    return 0;
+}
+
+int test_kernels() {
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water10000.msh"));
+    const auto& scalar = mesh_kernels::scalar_kernels();
+    const auto& best = mesh_kernels::best_kernels();
+    std::cerr << "  comparing " << best.name << " kernels to " << scalar.name << "\n";
+    assert(&mesh.kernels() == &best);
+    if (mesh_kernels::avx2_supported()) {
+        assert(&best == &mesh_kernels::avx2_kernels());
+    }
+    const double s = 1.0 / std::sqrt(3.0);
+    const double dirs[][3] = { {1, 0, 0}, {0, -1, 0}, {0, 0, 1}, {s, s, s}, {-s, s, -s} };
+    for (int i = 0; i < mesh.num_elements(); i++) {
+        const double* v = mesh.element_vertices(i);
+        const double* planes = mesh.element_planes(i);
+        // an inside point, the vertices, and points pushed out past each vertex
+        std::vector<std::array<double, 3>> points;
+        std::array<double, 3> centre = {{
+            0.4 * v[0] + 0.3 * v[3] + 0.2 * v[6] + 0.1 * v[9],
+            0.4 * v[1] + 0.3 * v[4] + 0.2 * v[7] + 0.1 * v[10],
+            0.4 * v[2] + 0.3 * v[5] + 0.2 * v[8] + 0.1 * v[11]
+        }};
+        points.push_back(centre);
+        for (int j = 0; j < 4; j++) {
+            points.push_back({{v[3*j], v[3*j+1], v[3*j+2]}});
+            points.push_back({{2 * v[3*j] - centre[0], 2 * v[3*j+1] - centre[1], 2 * v[3*j+2] - centre[2]}});
+        }
+        for (const auto& p: points) {
+            assert(scalar.is_inside(planes, p[0], p[1], p[2]) == best.is_inside(planes, p[0], p[1], p[2]));
+            assert(scalar.hownear(planes, p[0], p[1], p[2]) == best.hownear(planes, p[0], p[1], p[2]));
+            for (const auto& dir: dirs) {
+                double scalar_dist = 0.0;
+                double best_dist = 0.0;
+                assert(scalar.ray_exit(planes, p.data(), dir, scalar_dist) ==
+                    best.ray_exit(planes, p.data(), dir, best_dist));
+                assert(scalar_dist == best_dist);
+            }
+        }
+        EGS_Mesh::Vec3 inside(centre[0], centre[1], centre[2]);
+        assert(mesh.isInside(i, inside));
+        assert(mesh.hownear(i, inside) > 0.0);
+        EGS_Mesh::Vec3 outside(points[2][0], points[2][1], points[2][2]);
+        assert(!mesh.isInside(i, outside));
+        assert(mesh.hownear(i, outside) < 0.0);
+    }
+    // a ray that doesn't move never leaves
+    double dist = 0.0;
+    const double origin[3] = {0, 0, 0};
+    assert(best.ray_exit(mesh.element_planes(0), origin, origin, dist) == -1);
+    assert(std::isinf(dist));
+    return 0;
+}
+
+int test_is_where() {
+    for (std::string file: {"water.msh", "water10000.msh"}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(file);
+        assert(mesh.element_bvh().num_primitives() == mesh.elements().size());
+        double lo[3] = {1e30, 1e30, 1e30};
+        double hi[3] = {-1e30, -1e30, -1e30};
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            const double* v = mesh.element_vertices(i);
+            for (int k = 0; k < 12; k++) {
+                lo[k % 3] = std::min(lo[k % 3], v[k]);
+                hi[k % 3] = std::max(hi[k % 3], v[k]);
+            }
+            // centroids are strictly inside a single element
+            EGS_Mesh::Vec3 centroid((v[0] + v[3] + v[6] + v[9]) / 4, (v[1] + v[4] + v[7] + v[10]) / 4,
+                (v[2] + v[5] + v[8] + v[11]) / 4);
+            assert(mesh.isWhere(centroid) == i);
+            // vertices are found in one of the elements around them, within round-off
+            EGS_Mesh::Vec3 vertex(v[0], v[1], v[2]);
+            int at_vertex = mesh.isWhere(vertex);
+            assert(at_vertex != -1 && mesh.hownear(at_vertex, vertex) >= -mesh.location_tolerance());
+        }
+        assert(mesh.isWhere(EGS_Mesh::Vec3(hi[0] + 1.0, 0.5 * (lo[1] + hi[1]), 0.5 * (lo[2] + hi[2]))) == -1);
+        assert(mesh.isWhere(EGS_Mesh::Vec3(lo[0] - 1e-6, lo[1], lo[2])) == -1);
+        assert(mesh.isWhere(EGS_Mesh::Vec3(std::nan(""), 0.0, 0.0)) == -1);
+    }
+    // hierarchies over no boxes and over coincident boxes
+    assert(!mesh_bvh::BVH().visit_point(0, 0, 0, [](std::uint32_t) { return true; }));
+    mesh_bvh::Box unit;
+    const double corners[2][3] = {{0, 0, 0}, {1, 1, 1}};
+    unit.expand(corners[0]);
+    unit.expand(corners[1]);
+    mesh_bvh::BVH same(std::vector<mesh_bvh::Box>(10, unit));
+    std::size_t visited = 0;
+    same.visit_point(0.5, 0.5, 0.5, [&](std::uint32_t) { visited++; return false; });
+    assert(visited == 10);
+    return 0;
+}
+
+int test_entry_distance() {
+    for (std::string file: {"water.msh", "water10000.msh"}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(file);
+        std::size_t expected_faces = 0;
+        double centre[3] = {0.0, 0.0, 0.0};
+        double radius = 0.0;
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            const auto& nbrs = mesh.neighbours(i);
+            expected_faces += std::count(nbrs.begin(), nbrs.end(), -1);
+            for (int k = 0; k < 12; k++) {
+                centre[k % 3] += mesh.element_vertices(i)[k] / (4.0 * mesh.num_elements());
+            }
+        }
+        assert(mesh.num_boundary_faces() == expected_faces);
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            for (int j = 0; j < 4; j++) {
+                const double* v = mesh.element_vertices(i) + 3 * j;
+                radius = std::max(radius, std::sqrt((v[0] - centre[0]) * (v[0] - centre[0]) +
+                    (v[1] - centre[1]) * (v[1] - centre[1]) + (v[2] - centre[2]) * (v[2] - centre[2])));
+            }
+        }
+        // rays from a sphere around the mesh aimed at element centroids
+        for (int i = 0; i < mesh.num_elements(); i += 7) {
+            const double* v = mesh.element_vertices(i);
+            const double target[3] = { (v[0] + v[3] + v[6] + v[9]) / 4, (v[1] + v[4] + v[7] + v[10]) / 4,
+                (v[2] + v[5] + v[8] + v[11]) / 4 };
+            const double angle = 0.618 * i;
+            EGS_Mesh::Vec3 pos(centre[0] + 2 * radius * std::cos(angle), centre[1] + 2 * radius * std::sin(angle),
+                centre[2] + radius * std::sin(3 * angle));
+            double to_target[3] = {target[0] - pos.x, target[1] - pos.y, target[2] - pos.z};
+            const double dist = std::sqrt(to_target[0] * to_target[0] + to_target[1] * to_target[1] +
+                to_target[2] * to_target[2]);
+            EGS_Mesh::Vec3 dir(to_target[0] / dist, to_target[1] / dist, to_target[2] / dist);
+            auto entry = mesh.entry_distance(pos, dir);
+            assert(entry.tet != -1 && entry.distance <= dist);
+            assert(mesh.neighbours(entry.tet)[entry.face] == -1);
+            double brute = std::numeric_limits<double>::infinity();
+            for (std::size_t f = 0; f < mesh.num_boundary_faces(); f++) {
+                brute = std::min(brute, mesh.boundary_face_entry(f, pos, dir));
+            }
+            assert(entry.distance == brute);
+            // the entry point is on the entered element
+            EGS_Mesh::Vec3 at(pos.x + entry.distance * dir.x, pos.y + entry.distance * dir.y,
+                pos.z + entry.distance * dir.z);
+            assert(std::abs(mesh.hownear(entry.tet, at)) < 1e-9 * radius);
+            // aimed away from the mesh, the ray misses
+            auto miss = mesh.entry_distance(pos, EGS_Mesh::Vec3(-dir.x, -dir.y, -dir.z));
+            assert(miss.tet == -1 && std::isinf(miss.distance));
+        }
+    }
+    return 0;
+}
+
+int test_locate_from() {
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water10000.msh"));
+    EGS_Mesh::LocateStats stats;
+    // walk from element 0 to every centroid, and from each element to its neighbours' centroids
+    for (int i = 0; i < mesh.num_elements(); i++) {
+        const double* v = mesh.element_vertices(i);
+        EGS_Mesh::Vec3 centroid((v[0] + v[3] + v[6] + v[9]) / 4, (v[1] + v[4] + v[7] + v[10]) / 4,
+            (v[2] + v[5] + v[8] + v[11]) / 4);
+        assert(mesh.locate_from(0, centroid, &stats) == i);
+        assert(mesh.locate_from(i, centroid, &stats) == i);
+        for (int n: mesh.neighbours(i)) {
+            if (n != -1) {
+                assert(mesh.locate_from(n, centroid) == i);
+            }
+        }
+    }
+    assert(stats.walks == 2 * mesh.elements().size());
+    assert(stats.average_steps() > 0.0);
+    std::cerr << "  " << stats.average_steps() << " steps per walk, " << stats.fallbacks << " fallbacks\n";
+    // the mesh is convex, so walks only fall back if round-off makes them cycle
+    assert(stats.fallbacks < stats.walks / 100);
+    // invalid hints and points outside the mesh fall back to the global search
+    const double* v = mesh.element_vertices(5);
+    EGS_Mesh::Vec3 centroid((v[0] + v[3] + v[6] + v[9]) / 4, (v[1] + v[4] + v[7] + v[10]) / 4,
+        (v[2] + v[5] + v[8] + v[11]) / 4);
+    EGS_Mesh::LocateStats fallback_stats;
+    assert(mesh.locate_from(-1, centroid, &fallback_stats) == 5);
+    assert(mesh.locate_from(mesh.num_elements(), centroid, &fallback_stats) == 5);
+    assert(mesh.locate_from(5, EGS_Mesh::Vec3(1e6, 1e6, 1e6), &fallback_stats) == -1);
+    assert(fallback_stats.walks == 3 && fallback_stats.fallbacks == 3);
+    return 0;
+}
+
+int test_curve_order() {
+    // the Hilbert curve visits every cell of an 8x8x8 grid once, moving to an adjacent cell each step
+    const unsigned top = 1u << (mesh_order::CURVE_BITS - 3);
+    std::vector<std::array<std::uint32_t, 3>> cells(512);
+    std::vector<bool> seen(512, false);
+    for (std::uint32_t x = 0; x < 8; x++) {
+        for (std::uint32_t y = 0; y < 8; y++) {
+            for (std::uint32_t z = 0; z < 8; z++) {
+                // the code of a coarse grid is the fine code of the cell corners, divided by the finer levels
+                auto code = mesh_order::hilbert_code(x * top, y * top, z * top) / (std::uint64_t(top) * top * top);
+                assert(code < 512 && !seen[code]);
+                seen[code] = true;
+                cells[code] = {{x, y, z}};
+            }
+        }
+    }
+    for (std::size_t i = 1; i < cells.size(); i++) {
+        unsigned dist = 0;
+        for (int k = 0; k < 3; k++) {
+            dist += cells[i][k] > cells[i - 1][k] ? cells[i][k] - cells[i - 1][k] : cells[i - 1][k] - cells[i][k];
+        }
+        assert(dist == 1);
+    }
+    assert(mesh_order::morton_code(1, 0, 0) == 4 && mesh_order::morton_code(0, 1, 0) == 2);
+    assert(mesh_order::morton_code(0, 0, 3) == 9);
+    // ties keep their input order
+    std::vector<std::array<double, 3>> points = {{{1.0, 1.0, 1.0}}, {{0.0, 0.0, 0.0}}, {{0.0, 0.0, 0.0}}};
+    auto order = mesh_order::curve_order(points, mesh_order::Curve::Hilbert);
+    assert((order == std::vector<std::size_t>{1, 2, 0}));
+    return 0;
+}
+
+int test_reorder() {
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water10000.msh"));
+    for (auto curve: {EGS_Mesh::Reorder::Morton, EGS_Mesh::Reorder::Hilbert}) {
+        EGS_Mesh::Options options;
+        options.reorder = curve;
+        EGS_Mesh sorted = msh_parser::parse_msh_file(std::string("water10000.msh"), 1, options);
+        assert(sorted.num_elements() == mesh.num_elements());
+        assert(sorted.nodes().size() == mesh.nodes().size());
+        // the permutation maps every element back to an identical one
+        std::vector<bool> seen(mesh.elements().size(), false);
+        std::vector<int> tags(mesh.elements().size());
+        for (int i = 0; i < sorted.num_elements(); i++) {
+            const int j = sorted.original_index(i);
+            assert(j >= 0 && j < mesh.num_elements() && !seen[j]);
+            seen[j] = true;
+            tags[i] = sorted.elements()[i].tag;
+            assert(tags[i] == mesh.elements()[j].tag);
+            assert(sorted.medium_index(i) == mesh.medium_index(j));
+            // vertices are stored in node index order, which reordering changes
+            std::vector<std::array<double, 3>> vertices, original_vertices;
+            std::vector<int> nbrs, original_nbrs;
+            for (int f = 0; f < 4; f++) {
+                const double* v = sorted.element_vertices(i) + 3 * f;
+                const double* w = mesh.element_vertices(j) + 3 * f;
+                vertices.push_back({{v[0], v[1], v[2]}});
+                original_vertices.push_back({{w[0], w[1], w[2]}});
+                const int n = sorted.neighbours(i)[f];
+                nbrs.push_back(n == -1 ? -1 : sorted.original_index(n));
+                original_nbrs.push_back(mesh.neighbours(j)[f]);
+                // neighbours stay mutual
+                if (n != -1) {
+                    assert(sorted.neighbours(n)[0] == i || sorted.neighbours(n)[1] == i ||
+                        sorted.neighbours(n)[2] == i || sorted.neighbours(n)[3] == i);
+                }
+            }
+            std::sort(vertices.begin(), vertices.end());
+            std::sort(original_vertices.begin(), original_vertices.end());
+            std::sort(nbrs.begin(), nbrs.end());
+            std::sort(original_nbrs.begin(), original_nbrs.end());
+            assert(vertices == original_vertices && nbrs == original_nbrs);
+        }
+        // results are reported back in element tag order
+        auto original_tags = sorted.to_original_order(tags);
+        for (std::size_t j = 0; j < original_tags.size(); j++) {
+            assert(original_tags[j] == mesh.elements()[j].tag);
+        }
+        // nodes are numbered by first use
+        const auto& first = sorted.elements()[0];
+        const int first_nodes[4] = {first.a, first.b, first.c, first.d};
+        for (int k = 0; k < 4; k++) {
+            assert(sorted.nodes()[k].tag == first_nodes[k]);
+        }
+        for (auto pt: {EGS_Mesh::Vec3(0.1, 0.2, 0.3), EGS_Mesh::Vec3(-1.7, 2.3, 4.1)}) {
+            const int i = sorted.isWhere(pt);
+            const int j = mesh.isWhere(pt);
+            assert(i == -1 ? j == -1 : sorted.original_index(i) == j);
+        }
+    }
+    // unordered meshes are the identity
+    assert(mesh.original_index(42) == 42);
+    return 0;
+}
+
+int test_content_hash() {
+    // XXH64 reference values
+    assert(mesh_io::content_hash("", 0) == 0xEF46DB3751D8E999ULL);
+    assert(mesh_io::content_hash("abc", 3) == 0x44BC2CF5AD770999ULL);
+    std::string text("Nobody inspects the spammish repetition");
+    assert(mesh_io::content_hash(text.data(), text.size()) == 0xFBCEA83C8A378BF1ULL);
+    return 0;
+}
+
+int test_snapshot() {
+    const std::string path = "water10000.snapshot";
+    const std::uint64_t hash = mesh_io::file_hash("water10000.msh");
+    EGS_Mesh::Options options;
+    options.reorder = EGS_Mesh::Reorder::Hilbert;
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water10000.msh"), 1, options);
+    mesh_snapshot::save_snapshot(mesh, path, hash);
+    {
+        EGS_Mesh loaded = mesh_snapshot::load_snapshot(path, hash, options);
+        assert(loaded.num_elements() == mesh.num_elements());
+        assert(loaded.nodes().size() == mesh.nodes().size());
+        assert(loaded.location_tolerance() == mesh.location_tolerance());
+        assert(loaded.num_boundary_faces() == mesh.num_boundary_faces());
+        assert(loaded.materials().size() == mesh.materials().size());
+        for (std::size_t m = 0; m < mesh.materials().size(); m++) {
+            assert(loaded.materials()[m].tag == mesh.materials()[m].tag);
+            assert(loaded.materials()[m].medium_name == mesh.materials()[m].medium_name);
+        }
+        for (std::size_t n = 0; n < mesh.nodes().size(); n++) {
+            assert(loaded.nodes()[n].tag == mesh.nodes()[n].tag && loaded.nodes()[n].x == mesh.nodes()[n].x);
+            assert(loaded.node_index(mesh.nodes()[n].tag) == static_cast<int>(n));
+        }
+        assert(loaded.material_index(mesh.materials()[0].tag) == 0);
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            assert(loaded.elements()[i].tag == mesh.elements()[i].tag);
+            assert(loaded.original_index(i) == mesh.original_index(i));
+            assert(loaded.medium_index(i) == mesh.medium_index(i));
+            assert(loaded.neighbours(i) == mesh.neighbours(i));
+            assert(loaded.element_nodes(i) == mesh.element_nodes(i));
+            assert(loaded.element_index(mesh.elements()[i].tag) == i);
+            assert(std::equal(mesh.element_planes(i), mesh.element_planes(i) + 16, loaded.element_planes(i)));
+            assert(std::equal(mesh.element_vertices(i), mesh.element_vertices(i) + 12,
+                loaded.element_vertices(i)));
+            // the hierarchies are loaded too
+            const double* v = mesh.element_vertices(i);
+            EGS_Mesh::Vec3 centroid((v[0] + v[3] + v[6] + v[9]) / 4, (v[1] + v[4] + v[7] + v[10]) / 4,
+                (v[2] + v[5] + v[8] + v[11]) / 4);
+            assert(loaded.isWhere(centroid) == i);
+        }
+        // arrays are views into the file, aligned for vector loads
+        assert(reinterpret_cast<std::uintptr_t>(loaded.element_planes(0)) % 64 == 0);
+        const EGS_Mesh::Vec3 dir(0.0, 0.6, 0.8);
+        for (double x: {-5.0, 0.0, 2.5}) {
+            EGS_Mesh::Vec3 pos(x, -100.0, -100.0);
+            auto a = mesh.entry_distance(pos, dir);
+            auto b = loaded.entry_distance(pos, dir);
+            assert(a.distance == b.distance && a.tet == b.tet && a.face == b.face);
+        }
+    }
+
+    {
+        // the padding of the node records is written as zeros
+        std::ifstream in(path, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        using mesh_snapshot::internal::SectionEntry;
+        SectionEntry nodes;
+        std::memcpy(&nodes, bytes.data() + sizeof(mesh_snapshot::internal::Header) +
+            mesh_snapshot::internal::NODES * sizeof(SectionEntry), sizeof(nodes));
+        assert(nodes.count == mesh.nodes().size() && nodes.value_size == sizeof(EGS_Mesh::Node));
+        const std::size_t pad_begin = offsetof(EGS_Mesh::Node, tag) + sizeof(int);
+        for (std::size_t n = 0; n < nodes.count; n++) {
+            for (std::size_t b = pad_begin; b < offsetof(EGS_Mesh::Node, x); b++) {
+                assert(bytes[nodes.offset + n * sizeof(EGS_Mesh::Node) + b] == 0);
+            }
+        }
+        // whatever the padding in memory, so snapshots of a mesh are identical
+        std::vector<EGS_Mesh::Node> dirty = mesh.nodes();
+        for (auto& node: dirty) {
+            std::memset(reinterpret_cast<char*>(&node) + pad_begin, 0xab, offsetof(EGS_Mesh::Node, x) - pad_begin);
+        }
+        EGS_Mesh::Options unordered;
+        EGS_Mesh plain(mesh.elements(), mesh.nodes(), mesh.materials(), unordered);
+        EGS_Mesh dirty_mesh(mesh.elements(), std::move(dirty), mesh.materials(), unordered);
+        const std::string plain_path = "water10000-plain.snapshot";
+        const std::string dirty_path = "water10000-dirty.snapshot";
+        mesh_snapshot::save_snapshot(plain, plain_path, hash);
+        mesh_snapshot::save_snapshot(dirty_mesh, dirty_path, hash);
+        std::ifstream plain_in(plain_path, std::ios::binary), dirty_in(dirty_path, std::ios::binary);
+        std::string plain_bytes((std::istreambuf_iterator<char>(plain_in)), std::istreambuf_iterator<char>());
+        std::string dirty_bytes((std::istreambuf_iterator<char>(dirty_in)), std::istreambuf_iterator<char>());
+        assert(plain_bytes == dirty_bytes);
+        std::remove(plain_path.c_str());
+        std::remove(dirty_path.c_str());
+    }
+
+    // stale snapshots are rejected
+    auto load_throws = [&](std::uint64_t h, const EGS_Mesh::Options& opts) {
+        try {
+            mesh_snapshot::load_snapshot(path, h, opts);
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    assert(load_throws(hash + 1, options));
+    assert(load_throws(hash, EGS_Mesh::Options()));
+    {
+        // damaged: one flipped bit in the neighbours
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        mesh_snapshot::internal::SectionEntry neighbours;
+        file.seekg(sizeof(mesh_snapshot::internal::Header) +
+            mesh_snapshot::internal::NEIGHBOURS * sizeof(mesh_snapshot::internal::SectionEntry));
+        file.read(reinterpret_cast<char*>(&neighbours), sizeof(neighbours));
+        const std::streamoff at = static_cast<std::streamoff>(neighbours.offset + 1000);
+        char byte = 0;
+        file.seekg(at);
+        file.get(byte);
+        file.seekp(at);
+        file.put(static_cast<char>(byte ^ 4));
+    }
+    assert(parse_error([&]() { mesh_snapshot::load_snapshot(path, hash, options); }) ==
+        "couldn't load mesh snapshot `" + path + "`: snapshot is corrupt");
+    {
+        // truncated
+        std::ifstream in(path, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), bytes.size() / 2);
+    }
+    assert(load_throws(hash, options));
+    std::remove(path.c_str());
+
+    // the cache is written on the first load and used afterwards
+    const std::string cache = "water.snapshot";
+    std::remove(cache.c_str());
+    EGS_Mesh parsed = msh_parser::parse_msh_file_cached("water.msh", cache);
+    assert(std::ifstream(cache).good());
+    EGS_Mesh cached = msh_parser::parse_msh_file_cached("water.msh", cache);
+    assert(cached.num_elements() == parsed.num_elements() && cached.num_elements() == 1160);
+    assert(cached.neighbours(7) == parsed.neighbours(7));
+    {
+        // a damaged cache is rebuilt
+        std::fstream file(cache, std::ios::binary | std::ios::in | std::ios::out);
+        mesh_snapshot::internal::SectionEntry planes;
+        file.seekg(sizeof(mesh_snapshot::internal::Header) +
+            mesh_snapshot::internal::PLANES * sizeof(mesh_snapshot::internal::SectionEntry));
+        file.read(reinterpret_cast<char*>(&planes), sizeof(planes));
+        file.seekp(static_cast<std::streamoff>(planes.offset + 8 * 16 * 7));
+        file.put('x');
+    }
+    const std::uint64_t water_hash = mesh_io::file_hash("water.msh");
+    assert(parse_error([&]() { mesh_snapshot::load_snapshot(cache, water_hash); }).find("corrupt") !=
+        std::string::npos);
+    EGS_Mesh rebuilt = msh_parser::parse_msh_file_cached("water.msh", cache);
+    assert(std::equal(rebuilt.element_planes(7), rebuilt.element_planes(7) + 16, parsed.element_planes(7)));
+    mesh_snapshot::load_snapshot(cache, water_hash);
+    // a cache built from a different file is replaced
+    EGS_Mesh other = msh_parser::parse_msh_file_cached("water10000.msh", cache);
+    assert(other.num_elements() == mesh.num_elements());
+    std::remove(cache.c_str());
+    return 0;
+}
+
+// Counts what a streaming parse hands over, without keeping it.
+class CountingSink : public msh_parser::MeshSink {
+public:
+    void begin_nodes(std::size_t count) override {
+        num_expected_nodes = count;
+    }
+    void node_bloc(const EGS_Mesh::Node* nodes, std::size_t count) override {
+        num_nodes += count;
+        max_bloc_bytes = std::max(max_bloc_bytes, count * sizeof(EGS_Mesh::Node));
+        for (std::size_t i = 0; i < count; i++) {
+            node_tag_sum += nodes[i].tag;
+        }
+    }
+    void begin_elements(const std::vector<EGS_Mesh::Medium>& media, std::size_t max_elements) override {
+        num_media = media.size();
+        max_elements_bound = max_elements;
+    }
+    void element_bloc(const EGS_Mesh::Tetrahedron* elements, std::size_t count) override {
+        num_elements += count;
+        max_bloc_bytes = std::max(max_bloc_bytes, count * sizeof(EGS_Mesh::Tetrahedron));
+        for (std::size_t i = 0; i < count; i++) {
+            medium_tag_sum += elements[i].medium_tag;
+        }
+    }
+
+    std::size_t num_expected_nodes = 0;
+    std::size_t num_nodes = 0;
+    std::size_t num_media = 0;
+    std::size_t max_elements_bound = 0;
+    std::size_t num_elements = 0;
+    std::size_t max_bloc_bytes = 0;
+    long long node_tag_sum = 0;
+    long long medium_tag_sum = 0;
+};
+
+// Checks that a sink saw the same nodes and elements as `mesh`.
+bool same_counts(const CountingSink& sink, const EGS_Mesh& mesh) {
+    long long node_tag_sum = 0;
+    for (const auto& n: mesh.nodes()) {
+        node_tag_sum += n.tag;
+    }
+    long long medium_tag_sum = 0;
+    for (const auto& e: mesh.elements()) {
+        medium_tag_sum += e.medium_tag;
+    }
+    return sink.num_expected_nodes == mesh.nodes().size() && sink.num_nodes == mesh.nodes().size() &&
+        sink.num_elements == mesh.elements().size() && sink.max_elements_bound >= mesh.elements().size() &&
+        sink.num_media == mesh.materials().size() && sink.node_tag_sum == node_tag_sum &&
+        sink.medium_tag_sum == medium_tag_sum;
+}
+
+int test_parse_stream() {
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water.msh"));
+    {
+        std::ifstream input("water.msh");
+        CountingSink sink;
+        msh_parser::parse_msh_stream(input, sink);
+        assert(same_counts(sink, mesh));
+    }
+    {
+        std::ifstream input("water_binary.msh", std::ios::binary);
+        CountingSink sink;
+        msh_parser::parse_msh_stream(input, sink);
+        assert(same_counts(sink, mesh));
+    }
+    for (std::string file: {"water.msh", "water_binary.msh"}) {
+        CountingSink sink;
+        msh_parser::parse_msh_stream(file, sink);
+        assert(same_counts(sink, mesh));
+    }
+    // errors are reported as for parse_msh_file
+    std::istringstream bad_volume(
+        "$MeshFormat\n4.1 0 8\n$EndMeshFormat\n"
+        "$PhysicalNames\n1\n3 1 \"Water\"\n$EndPhysicalNames\n"
+        "$Entities\n0 0 0 1\n1 0 0 0 1 1 1 1 1 0\n$EndEntities\n"
+        "$Elements\n1 1 1 1\n3 2 4 1\n1 1 2 3 4\n$EndElements\n");
+    CountingSink sink;
+    std::string err;
+    try {
+        msh_parser::parse_msh_stream(bad_volume, sink);
+    } catch (const std::runtime_error& e) {
+        err = e.what();
+    }
+    assert(err == "msh 4.1 parsing failed\ntetrahedron 1 had unknown volume tag 2");
+    return 0;
+}
+
+int test_parse_memory() {
+    // streaming keeps at most a bloc in memory, plus the input buffers
+    for (std::string file: {"water10000.msh", "water_binary.msh"}) {
+        const std::size_t before = heap::reset_peak();
+        CountingSink sink;
+        msh_parser::parse_msh_stream(file, sink);
+        const std::size_t peak = heap::peak_bytes - before;
+        std::cerr << "  " << file << ": streaming peak " << peak / 1000 << " kB, largest bloc "
+            << sink.max_bloc_bytes / 1000 << " kB\n";
+        assert(peak < 2 * sink.max_bloc_bytes + 64 * 1024);
+    }
+    // building a mesh peaks at the mesh plus its construction scratch, not
+    // at extra copies of the parsed nodes and elements (both peaked at
+    // 1.64x when the sections were parsed into separate vectors)
+    const std::vector<std::pair<std::string, double>> max_ratios = {
+        {"water10000.msh", 1.55}, {"water_binary.msh", 1.55}
+    };
+    for (const auto& max_ratio: max_ratios) {
+        const std::string& file = max_ratio.first;
+        const std::size_t before = heap::reset_peak();
+        EGS_Mesh mesh = msh_parser::parse_msh_file(file);
+        const std::size_t kept = heap::live_bytes - before;
+        const std::size_t peak = heap::peak_bytes - before;
+        const double ratio = static_cast<double>(peak) / kept;
+        std::cerr << "  " << file << ": mesh " << kept / 1000 << " kB, peak " << peak / 1000 << " kB ("
+            << ratio << "x)\n";
+        assert(ratio < max_ratio.second);
+    }
+    return 0;
+}
+
+int test_parse_allocations() {
+    // heap allocations of parsing water10000.msh, on its own and with the mesh build
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water10000.msh"));
+    const std::size_t num_entries = mesh.nodes().size() + mesh.elements().size();
+    for (bool mapped: {false, true}) {
+        std::size_t before = heap::num_allocations;
+        {
+            CountingSink sink;
+            if (mapped) {
+                msh_parser::parse_msh_stream(std::string("water10000.msh"), sink);
+            } else {
+                std::ifstream input("water10000.msh");
+                msh_parser::parse_msh_stream(input, sink);
+            }
+        }
+        const std::size_t parse_allocations = heap::num_allocations - before;
+        before = heap::num_allocations;
+        const std::size_t heap_before = heap::reset_peak();
+        std::size_t kept = 0;
+        {
+            std::ifstream input("water10000.msh");
+            EGS_Mesh parsed = mapped ? msh_parser::parse_msh_file(std::string("water10000.msh"))
+                : msh_parser::parse_msh_file(input);
+            kept = heap::live_bytes - heap_before;
+        }
+        const std::size_t mesh_allocations = heap::num_allocations - before;
+        std::cerr << "  " << (mapped ? "mmap" : "istream") << ": parse " << parse_allocations
+            << " allocations, parse and build " << mesh_allocations << " allocations, peak "
+            << (heap::peak_bytes - heap_before) / 1000 << " kB for a " << kept / 1000 << " kB mesh\n";
+        // lines and blocs are parsed into reused buffers, so the count
+        // doesn't grow with the number of nodes and elements (the
+        // std::istream parser used to allocate per line, 18132 times)
+        assert(parse_allocations < num_entries / 10);
+    }
+    return 0;
+}
+
+int test_tag_checks() {
+    using msh_parser::internal::msh41::TagChecker;
+    // dense ranges use a bitmap and report duplicates as they are added
+    TagChecker dense("$Nodes", "node", 1, 100, 100);
+    assert(dense.dense());
+    dense.add(1);
+    dense.add(100);
+    std::string err = parse_error([&]() { dense.add(1); });
+    assert(err == "$Nodes section parsing failed, found duplicate node tag 1");
+    err = parse_error([&]() { dense.add(101); });
+    assert(err == "$Nodes section parsing failed, node tag 101 is outside the range given in the section header (1 to 100)");
+    // sparse ranges are sorted when the section ends
+    TagChecker sparse("$Elements", "tetrahedron", 1, 1000000000, 3);
+    assert(!sparse.dense());
+    sparse.add(1000000000);
+    sparse.add(7);
+    sparse.add(1000000000);
+    err = parse_error([&]() { sparse.finish(); });
+    assert(err == "$Elements section parsing failed, found duplicate tetrahedron tag 1000000000");
+
+    // the serial, memory-mapped and parallel parsers report the same errors
+    std::ifstream input("water.msh");
+    const std::string contents((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    const std::vector<std::pair<std::string, std::string>> edits = {
+        // node 2 renumbered as node 1
+        {"0 2 0 1\n2\n", "0 2 0 1\n1\n"},
+        // tetrahedron 1 renumbered past the declared maximum
+        {"3 1 4 1160\n1 ", "3 1 4 1160\n1161 "}
+    };
+    const std::vector<std::string> expected = {
+        "msh 4.1 parsing failed\n$Nodes section parsing failed, found duplicate node tag 1",
+        "msh 4.1 parsing failed\n$Elements section parsing failed, tetrahedron tag 1161 is outside the range given in the section header (1 to 1160)"
+    };
+    for (std::size_t i = 0; i < edits.size(); i++) {
+        std::string bad = contents;
+        bad.replace(bad.find(edits[i].first), edits[i].first.size(), edits[i].second);
+        {
+            std::ofstream out("bad-tags.msh");
+            out << bad;
+        }
+        std::istringstream bad_input(bad);
+        assert(parse_error([&]() { msh_parser::parse_msh_file(bad_input); }) == expected[i]);
+        assert(parse_error([]() { msh_parser::parse_msh_file(std::string("bad-tags.msh")); }) == expected[i]);
+        assert(parse_error([]() { msh_parser::parse_msh_file(std::string("bad-tags.msh"), 2); }) == expected[i]);
+        std::remove("bad-tags.msh");
+    }
+    return 0;
+}
+
+int test_tag_index() {
+    using mesh_tags::TagIndex;
+    // dense tags are looked up in a table, with gaps and out of range tags missing
+    std::vector<EGS_Mesh::Node> nodes;
+    for (int tag: {5, 3, 4, 7, -1}) {
+        nodes.push_back(EGS_Mesh::Node(tag, 0.0, 0.0, 0.0));
+    }
+    TagIndex dense = TagIndex::build(nodes.data(), nodes.size(), "node");
+    assert(dense.dense() && dense.table().size() == 5);
+    assert(dense.find(5) == 0 && dense.find(3) == 1 && dense.find(7) == 3);
+    assert(dense.find(6) == -1 && dense.find(2) == -1 && dense.find(8) == -1 && dense.find(-1) == -1);
+    // sparse tags are hashed, with a power of two number of slots
+    nodes[3].tag = 1000000;
+    TagIndex sparse = TagIndex::build(nodes.data(), nodes.size(), "node");
+    assert(!sparse.dense() && sparse.slots().size() == 8);
+    assert(sparse.find(1000000) == 3 && sparse.find(4) == 2 && sparse.find(6) == -1 && sparse.find(-1) == -1);
+    // colliding strided tags are probed past each other
+    std::vector<EGS_Mesh::Node> strided;
+    for (int i = 0; i < 1000; i++) {
+        strided.push_back(EGS_Mesh::Node(i * 4096, 0.0, 0.0, 0.0));
+    }
+    TagIndex probed = TagIndex::build(strided.data(), strided.size(), "node");
+    assert(!probed.dense());
+    for (int i = 0; i < 1000; i++) {
+        assert(probed.find(i * 4096) == i && probed.find(i * 4096 + 1) == -1);
+    }
+    nodes[1].tag = 5;
+    assert(parse_error([&]() { TagIndex::build(nodes.data(), nodes.size(), "node"); }) == "duplicate node tag 5");
+    assert(TagIndex().find(0) == -1);
+
+    // mesh connectivity is resolved to node indices, for sparse tags too
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water.msh"));
+    std::vector<EGS_Mesh::Tetrahedron> elements = mesh.elements();
+    std::vector<EGS_Mesh::Node> mesh_nodes = mesh.nodes();
+    std::vector<EGS_Mesh::Medium> media = mesh.materials();
+    for (auto& n: mesh_nodes) {
+        n.tag = n.tag * 1000 + 7;
+    }
+    for (auto& e: elements) {
+        e.tag *= 1000;
+        e.a = e.a * 1000 + 7;
+        e.b = e.b * 1000 + 7;
+        e.c = e.c * 1000 + 7;
+        e.d = e.d * 1000 + 7;
+    }
+    EGS_Mesh::Options options;
+    options.reorder = EGS_Mesh::Reorder::Morton;
+    for (const EGS_Mesh& m: {mesh, EGS_Mesh(elements, mesh_nodes, media), EGS_Mesh(elements, mesh_nodes, media, options)}) {
+        for (std::size_t n = 0; n < m.nodes().size(); n++) {
+            assert(m.node_index(m.nodes()[n].tag) == static_cast<int>(n));
+        }
+        for (int i = 0; i < m.num_elements(); i++) {
+            const auto& elt = m.elements()[i];
+            assert(m.element_index(elt.tag) == i);
+            assert(m.materials()[m.medium_index(i)].tag == elt.medium_tag);
+            assert(m.material_index(elt.medium_tag) == m.medium_index(i));
+            const auto& idx = m.element_nodes(i);
+            std::vector<int> tags, expected = {elt.a, elt.b, elt.c, elt.d};
+            for (int v = 0; v < 4; v++) {
+                const auto& node = m.nodes()[idx[v]];
+                tags.push_back(node.tag);
+                assert(node.x == m.element_vertices(i)[3 * v] && node.z == m.element_vertices(i)[3 * v + 2]);
+            }
+            std::sort(tags.begin(), tags.end());
+            std::sort(expected.begin(), expected.end());
+            assert(tags == expected);
+        }
+        assert(m.node_index(0) == -1 && m.element_index(-1) == -1 && m.material_index(12345) == -1);
+    }
+    return 0;
+}
+
+int test_lazy_neighbours() {
+    EGS_Mesh eager = msh_parser::parse_msh_file(std::string("water10000.msh"));
+    assert(eager.neighbours_built());
+    EGS_Mesh::Options options;
+    options.lazy_neighbours = true;
+    EGS_Mesh lazy = msh_parser::parse_msh_file(std::string("water10000.msh"), 1, options);
+    // metadata doesn't need the neighbours
+    assert(!lazy.neighbours_built());
+    assert(lazy.num_elements() == eager.num_elements() && lazy.nodes().size() == eager.nodes().size());
+    for (int i = 0; i < lazy.num_elements(); i++) {
+        assert(lazy.medium_index(i) == eager.medium_index(i) && lazy.element_nodes(i) == eager.element_nodes(i));
+    }
+    assert(!lazy.neighbours_built());
+
+    // copies share the table, which the first of several threads builds
+    EGS_Mesh copy = lazy;
+    std::vector<const std::array<int, 4>*> tables(4);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < tables.size(); t++) {
+        threads.emplace_back([&, t]() {
+            tables[t] = (t % 2 ? copy : lazy).neighbour_table().data();
+        });
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+    assert(lazy.neighbours_built() && copy.neighbours_built());
+    for (auto table: tables) {
+        assert(table == tables[0]);
+    }
+    assert(lazy.neighbour_table().size() == static_cast<std::size_t>(lazy.num_elements()));
+    for (int i = 0; i < lazy.num_elements(); i++) {
+        assert(lazy.neighbours(i) == eager.neighbours(i));
+        assert(&lazy.neighbours(i) == &lazy.neighbour_table()[i]);
+    }
+    assert(lazy.num_boundary_faces() == eager.num_boundary_faces());
+
+    // the first transport call builds them too
+    EGS_Mesh tracked = msh_parser::parse_msh_file(std::string("water10000.msh"), 1, options);
+    EGS_Mesh::Vec3 pos(0.0, 0.0, 0.0), dir(0.0, 0.0, 1.0);
+    const int tet = eager.isWhere(pos);
+    assert(tet != -1 && tracked.isWhere(pos) == tet);
+    assert(!tracked.neighbours_built());
+    assert(tracked.howfar(tet, pos, dir).next == eager.howfar(tet, pos, dir).next);
+    assert(tracked.neighbours_built());
+    return 0;
+}
+
+int test_element_scorer() {
+    // energies within a history are summed before squaring
+    mesh_scoring::ElementScorer scorer(3, 2);
+    assert(scorer.num_elements() == 3 && scorer.num_threads() == 2);
+    auto& t0 = scorer.tally(0);
+    auto& t1 = scorer.tally(1);
+    t0.start_history();
+    t0.score(0, 1.0);
+    t0.score(1, 1.0);
+    t0.score(0, 2.0);
+    t0.start_history();
+    t0.score(0, 1.0);
+    t1.start_history();
+    t1.score(2, 4.0);
+    t1.start_history();
+    assert(t0.num_histories() == 2 && scorer.num_histories() == 0);
+    assert(std::isinf(scorer.result(0).uncertainty) && scorer.result(0).mean == 0.0);
+    scorer.reduce(2);
+    assert(scorer.num_histories() == 4 && t0.num_histories() == 0);
+    assert(scorer.sum(0) == 4.0 && scorer.sum_squares(0) == 10.0);
+    assert(scorer.sum(1) == 1.0 && scorer.sum_squares(1) == 1.0);
+    assert(scorer.sum(2) == 4.0 && scorer.sum_squares(2) == 16.0);
+    auto r = scorer.result(0);
+    assert(r.mean == 1.0 && std::abs(r.uncertainty - std::sqrt(0.5)) < 1e-12);
+    // tallies are cleared, so the next batch adds to the totals
+    t1.start_history();
+    t1.score(1, 2.0);
+    scorer.reduce(1);
+    assert(scorer.num_histories() == 5 && scorer.sum(1) == 3.0 && scorer.sum_squares(1) == 5.0);
+    assert(scorer.sum(0) == 4.0 && scorer.sum(2) == 4.0);
+
+    // threads scoring at once give the same sums as a serial loop
+    const std::size_t num_elements = 1000;
+    const unsigned num_threads = 4;
+    const int histories = 2000;
+    mesh_scoring::ElementScorer parallel(num_elements, num_threads);
+    std::vector<double> sum(num_elements), sum_squares(num_elements);
+    for (unsigned t = 0; t < num_threads; t++) {
+        for (int h = 0; h < histories; h++) {
+            // each history scores 1, 2 and 3 in three elements, the first twice
+            const std::size_t e = (t * 7919 + h * 31) % num_elements;
+            const std::size_t f = (e + 1 + h % 5) % num_elements;
+            sum[e] += 3.0;
+            sum_squares[e] += 9.0;
+            sum[f] += 3.0;
+            sum_squares[f] += 9.0;
+        }
+    }
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            auto& tally = parallel.tally(t);
+            for (int h = 0; h < histories; h++) {
+                const std::size_t e = (t * 7919 + h * 31) % num_elements;
+                const std::size_t f = (e + 1 + h % 5) % num_elements;
+                tally.start_history();
+                tally.score(static_cast<int>(e), 1.0);
+                tally.score(static_cast<int>(f), 3.0);
+                tally.score(static_cast<int>(e), 2.0);
+            }
+        });
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+    parallel.reduce(3);
+    assert(parallel.num_histories() == num_threads * histories);
+    for (std::size_t i = 0; i < num_elements; i++) {
+        assert(parallel.sum(i) == sum[i] && parallel.sum_squares(i) == sum_squares[i]);
+    }
+    return 0;
+}
+
+int test_paged_scorer() {
+    // scores in two distant pages of a large mesh, with paged and dense tallies
+    const std::size_t num_elements = 1000000;
+    mesh_scoring::ElementScorer dense(num_elements, 2, mesh_scoring::Layout::Dense);
+    mesh_scoring::ElementScorer paged(num_elements, 2, mesh_scoring::Layout::Paged);
+    const std::size_t paged_empty = paged.memory_bytes();
+    assert(paged.layout() == mesh_scoring::Layout::Paged && paged_empty < dense.memory_bytes() / 100);
+    for (auto scorer: {&dense, &paged}) {
+        for (unsigned t = 0; t < 2; t++) {
+            auto& tally = scorer->tally(t);
+            for (int h = 0; h < 100; h++) {
+                tally.start_history();
+                tally.score(10 + h % 3, 1.0);
+                tally.score(999999 - h % 2, 0.5 * (t + 1));
+                tally.score(10, 1.0);
+            }
+        }
+        scorer->reduce(2);
+    }
+    // one page per touched region, in each tally and the totals, plus bookkeeping
+    const std::size_t page_bytes = 2 * (2 * 256 * 32) + 2 * 256 * 16;
+    assert(paged.memory_bytes() >= paged_empty + page_bytes && paged.memory_bytes() < paged_empty + page_bytes + 1024);
+    assert(paged.num_histories() == dense.num_histories());
+    for (std::size_t i: {std::size_t(0), std::size_t(10), std::size_t(11), std::size_t(12), std::size_t(500000),
+        std::size_t(999998), std::size_t(999999)})
+    {
+        assert(paged.sum(i) == dense.sum(i) && paged.sum_squares(i) == dense.sum_squares(i));
+        assert(paged.result(i).mean == dense.result(i).mean);
+    }
+    assert(paged.sum(500000) == 0.0 && paged.sum(10) > 0.0);
+
+    // only scored elements are in the sparse results, sorted
+    for (auto scorer: {&dense, &paged}) {
+        auto sparse = scorer->sparse_results();
+        assert((sparse.elements == std::vector<std::size_t>{10, 11, 12, 999998, 999999}));
+        assert(sparse.results.size() == 5);
+        for (std::size_t k = 0; k < sparse.elements.size(); k++) {
+            assert(sparse.results[k].mean == dense.result(sparse.elements[k]).mean);
+            assert(sparse.results[k].uncertainty == dense.result(sparse.elements[k]).uncertainty);
+        }
+    }
+
+    // many threads allocating many total pages at once in reduce
+    const std::size_t spread = 200000;
+    const unsigned num_tallies = 4;
+    mesh_scoring::ElementScorer spread_dense(spread, num_tallies, mesh_scoring::Layout::Dense);
+    mesh_scoring::ElementScorer spread_paged(spread, num_tallies, mesh_scoring::Layout::Paged);
+    for (auto scorer: {&spread_dense, &spread_paged}) {
+        for (int batch = 0; batch < 2; batch++) {
+            for (unsigned t = 0; t < num_tallies; t++) {
+                auto& tally = scorer->tally(t);
+                for (int h = 0; h < 2000; h++) {
+                    tally.start_history();
+                    // every tally touches most pages, some pages only one tally
+                    tally.score(static_cast<int>((h * 97 + t * 13) % spread), 1.0 + t);
+                    tally.score(static_cast<int>((h * 389 + t * 50000 + batch) % spread), 0.25);
+                }
+            }
+            scorer->reduce(8);
+        }
+    }
+    assert(spread_paged.num_histories() == spread_dense.num_histories());
+    for (std::size_t i = 0; i < spread; i++) {
+        assert(spread_paged.sum(i) == spread_dense.sum(i));
+        assert(spread_paged.sum_squares(i) == spread_dense.sum_squares(i));
+    }
+    return 0;
+}
+
+int test_format_double() {
+    using msh_writer::internal::format_double;
+    // shortest forms, in fixed or exponent notation like %g
+    const std::pair<double, const char*> cases[] = {
+        {0.0, "0"}, {-0.0, "-0"}, {1.0, "1"}, {-2.5, "-2.5"}, {0.1, "0.1"}, {100.0, "100"},
+        {123.456, "123.456"}, {1e-4, "0.0001"}, {1e-5, "1e-05"}, {1.5e-300, "1.5e-300"},
+        {123456789012345.0, "123456789012345"}, {1e15, "1e+15"}, {1.7976931348623157e308, "1.7976931348623157e+308"},
+        {5e-324, "5e-324"}, {1.0 / 3.0, "0.3333333333333333"}, {2.0 / 3.0, "0.6666666666666666"},
+        {std::numeric_limits<double>::infinity(), "inf"}, {-std::numeric_limits<double>::infinity(), "-inf"},
+        {std::nan(""), "nan"}
+    };
+    for (const auto& c: cases) {
+        assert(format_double(c.first) == c.second);
+    }
+    // significant digits of the mantissa
+    auto num_digits = [](const std::string& text) {
+        std::string digits;
+        for (char c: text.substr(0, text.find('e'))) {
+            if (c >= '0' && c <= '9') {
+                digits += c;
+            }
+        }
+        digits.erase(0, digits.find_first_not_of('0'));
+        digits.erase(digits.find_last_not_of('0') + 1);
+        return digits.size();
+    };
+    // every finite double reads back exactly, almost always in the fewest digits
+    std::mt19937_64 rng(42);
+    int num_longer = 0;
+    int num_values = 0;
+    for (int i = 0; i < 200000; i++) {
+        const std::uint64_t bits = rng();
+        double value = 0.0;
+        std::memcpy(&value, &bits, sizeof(value));
+        if (!std::isfinite(value)) {
+            continue;
+        }
+        const std::string text = format_double(value);
+        assert(text.size() <= msh_writer::internal::MAX_DOUBLE_CHARS);
+        const double back = std::strtod(text.c_str(), nullptr);
+        assert(std::memcmp(&back, &value, sizeof(value)) == 0);
+        int shortest = 1;
+        char printf_text[64];
+        for (; shortest < 17; shortest++) {
+            std::snprintf(printf_text, sizeof(printf_text), "%.*g", shortest, value);
+            if (std::strtod(printf_text, nullptr) == value) {
+                break;
+            }
+        }
+        assert(num_digits(text) <= 17);
+        num_longer += static_cast<int>(num_digits(text)) > shortest;
+        num_values++;
+    }
+    assert(num_longer * 1000 < num_values);
+    // dose-like values too
+    for (int i = 0; i < 100000; i++) {
+        const double value = std::ldexp(static_cast<double>(rng() >> 11), -53) * 1e-12;
+        assert(std::strtod(format_double(value).c_str(), nullptr) == value);
+    }
+    return 0;
+}
+
+// The entries of the $ElementData view `name` in a file written by
+// msh_writer, keyed by element tag.
+std::map<int, double> read_element_data(const std::string& file, const std::string& name) {
+    std::istringstream in(file);
+    std::string line;
+    std::getline(in, line);
+    assert(line == "$MeshFormat");
+    std::string version;
+    int binary = -1;
+    int size_t_size = 0;
+    in >> version >> binary >> size_t_size;
+    assert(version == "4.1" && size_t_size == 8);
+    std::getline(in, line);
+    if (binary) {
+        std::int32_t one = 0;
+        in.read(reinterpret_cast<char*>(&one), sizeof(one));
+        assert(one == 1);
+        std::getline(in, line);
+    }
+    std::getline(in, line);
+    assert(line == "$EndMeshFormat");
+    std::map<int, double> values;
+    while (std::getline(in, line)) {
+        assert(line == "$ElementData");
+        int num_strings = 0, num_reals = 0, num_ints = 0;
+        std::string view;
+        double time = 0.0;
+        int step = 0, components = 0;
+        std::size_t count = 0;
+        in >> num_strings;
+        std::getline(in, line);
+        std::getline(in, view);
+        in >> num_reals >> time >> num_ints >> step >> components >> count;
+        assert(num_strings == 1 && num_reals == 1 && num_ints == 3 && components == 1);
+        std::getline(in, line);
+        const bool wanted = view == "\"" + name + "\"";
+        for (std::size_t i = 0; i < count; i++) {
+            // data section tags are ints, not size_t
+            std::int32_t tag = 0;
+            double value = 0.0;
+            if (binary) {
+                in.read(reinterpret_cast<char*>(&tag), sizeof(tag));
+                in.read(reinterpret_cast<char*>(&value), sizeof(value));
+            } else {
+                in >> tag >> value;
+            }
+            if (wanted) {
+                assert(values.insert(std::make_pair(tag, value)).second);
+            }
+        }
+        // the end of the last entry, then the end marker
+        std::getline(in, line);
+        std::getline(in, line);
+        assert(line == "$EndElementData");
+    }
+    return values;
+}
+
+int test_element_data_writer() {
+    // values in mesh order are written by original tag, for a reordered mesh too
+    EGS_Mesh::Options options;
+    options.reorder = EGS_Mesh::Reorder::Hilbert;
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water.msh"), 1, options);
+    std::vector<msh_writer::ElementData> data(2);
+    data[0].name = "Dose";
+    data[1].name = "Dose uncertainty";
+    for (int i = 0; i < mesh.num_elements(); i++) {
+        data[0].values.push_back(mesh.elements()[i].tag * 0.1 + 1e-17);
+        data[1].values.push_back(1.0 / (mesh.elements()[i].tag + 3));
+    }
+    for (auto format: {msh_writer::Format::Ascii, msh_writer::Format::Binary}) {
+        std::ostringstream out;
+        msh_writer::write_element_data(out, mesh.elements(), data, format, 3, 1.5);
+        for (const auto& view: data) {
+            auto values = read_element_data(out.str(), view.name);
+            assert(values.size() == mesh.elements().size());
+            for (int i = 0; i < mesh.num_elements(); i++) {
+                assert(values.at(mesh.elements()[i].tag) == view.values[i]);
+            }
+        }
+        if (format == msh_writer::Format::Ascii) {
+            assert(out.str().find("$ElementData\n1\n\"Dose\"\n1\n1.5\n3\n3\n1\n1160\n") != std::string::npos);
+        } else {
+            // the first entry is a 4 byte int tag and an 8 byte double
+            const std::string header = "$ElementData\n1\n\"Dose\"\n1\n1.5\n3\n3\n1\n1160\n";
+            const std::size_t start = out.str().find(header);
+            assert(start != std::string::npos);
+            const std::int32_t tag = mesh.elements()[0].tag;
+            std::string entry(reinterpret_cast<const char*>(&tag), sizeof(tag));
+            entry.append(reinterpret_cast<const char*>(&data[0].values[0]), sizeof(double));
+            assert(entry.size() == 12);
+            assert(out.str().compare(start + header.size(), 12, entry) == 0);
+            const std::size_t end = start + header.size() + 1160 * 12;
+            assert(out.str().compare(end, 17, "\n$EndElementData\n") == 0);
+        }
+    }
+
+    // mismatched views are rejected
+    auto invalid = [&](const std::vector<msh_writer::ElementData>& bad) {
+        try {
+            std::ostringstream out;
+            msh_writer::write_element_data(out, mesh.elements(), bad, msh_writer::Format::Ascii);
+        } catch (const std::invalid_argument& err) {
+            return std::string(err.what());
+        }
+        return std::string();
+    };
+    auto bad = data;
+    bad[1].values.pop_back();
+    assert(invalid(bad) == "expected 1160 values for `Dose uncertainty`, got 1159");
+    bad = data;
+    bad[0].name = "a\"b";
+    assert(invalid(bad) == "element data name `a\"b` has a double quote or a newline");
+
+    // elements without Gmsh tags can't be written
+    std::vector<EGS_Mesh::Node> nodes {
+        EGS_Mesh::Node(1, 0, 0, 0), EGS_Mesh::Node(2, 1, 0, 0),
+        EGS_Mesh::Node(3, 0, 1, 0), EGS_Mesh::Node(4, 0, 0, 1)
+    };
+    EGS_Mesh untagged({EGS_Mesh::Tetrahedron(1, 1, 2, 3, 4)}, nodes, {EGS_Mesh::Medium(1, "Water")});
+    assert(untagged.elements()[0].tag == -1);
+    std::vector<msh_writer::ElementData> untagged_data(1);
+    untagged_data[0].name = "Dose";
+    untagged_data[0].values.push_back(1.0);
+    std::string untagged_error;
+    try {
+        std::ostringstream out;
+        msh_writer::write_element_data(out, untagged.elements(), untagged_data, msh_writer::Format::Binary);
+    } catch (const std::invalid_argument& err) {
+        untagged_error = err.what();
+    }
+    assert(untagged_error == "element 0 has no Gmsh tag to write element data for");
+    untagged_error.clear();
+    try {
+        msh_writer::BackgroundWriter writer(untagged, msh_writer::Format::Ascii);
+    } catch (const std::invalid_argument& err) {
+        untagged_error = err.what();
+    }
+    assert(untagged_error == "element 0 has no Gmsh tag to write element data for");
+
+    // the background writer writes the same file, and reports errors on wait
+    const std::string path = "water-dose.msh";
+    mesh_scoring::ElementScorer scorer(mesh.elements().size(), 1);
+    for (int h = 0; h < 10; h++) {
+        scorer.tally(0).start_history();
+        scorer.tally(0).score(h % 7, 1.0 + h);
+    }
+    scorer.reduce(1);
+    auto snapshot = msh_writer::scorer_data(scorer, "Edep");
+    assert(snapshot.size() == 2 && snapshot[0].name == "Edep" && snapshot[1].name == "Edep uncertainty");
+    assert(snapshot[0].values[0] == scorer.result(0).mean && std::isinf(snapshot[1].values[100]) == false);
+    std::ostringstream expected;
+    msh_writer::write_element_data(expected, mesh.elements(), snapshot, msh_writer::Format::Binary, 1, 2.0);
+    {
+        msh_writer::BackgroundWriter writer(mesh, msh_writer::Format::Binary);
+        writer.write(path, snapshot, 1, 2.0);
+        writer.wait();
+        std::ifstream in(path, std::ios::binary);
+        std::ostringstream written;
+        written << in.rdbuf();
+        assert(written.str() == expected.str());
+        // bad views are rejected before anything is written
+        auto bad_name = snapshot;
+        bad_name[0].name = "a\nb";
+        std::string write_error;
+        try {
+            writer.write("bad-name.msh", bad_name);
+        } catch (const std::invalid_argument& err) {
+            write_error = err.what();
+        }
+        assert(write_error == "element data name `a\nb` has a double quote or a newline");
+        assert(!std::ifstream("bad-name.msh.tmp" + std::to_string(::getpid())));
+        writer.wait();
+        writer.write("no-such-directory/dose.msh", snapshot);
+        assert(parse_error([&]() { writer.wait(); }) == "couldn't open `no-such-directory/dose.msh.tmp" +
+            std::to_string(::getpid()) + "` for writing");
+        writer.wait();
+    }
+    std::remove(path.c_str());
+    return 0;
+}
+
 #define RUN_TEST(test_fn) \
     std::cerr << "starting test " << #test_fn << std::endl; \
     err = test_fn; \
@@ -126,6 +1742,326 @@ int test_water10000_block() {
         std::cerr << "test passed" << std::endl; \
     }
 
+// A small mesh with one problem of each kind, see test_validation.
+EGS_Mesh invalid_mesh(const EGS_Mesh::Options& options) {
+    std::vector<EGS_Mesh::Node> nodes {
+        EGS_Mesh::Node(1, 0, 0, 0), EGS_Mesh::Node(2, 1, 0, 0),
+        EGS_Mesh::Node(3, 0, 1, 0), EGS_Mesh::Node(4, 0, 0, 1),
+        EGS_Mesh::Node(5, 1, 1, 1), EGS_Mesh::Node(6, 0.9, 0.9, 0.9),
+        EGS_Mesh::Node(7, 1, 1, 0),
+        EGS_Mesh::Node(8, 5, 0, 0), EGS_Mesh::Node(9, 6, 0, 0),
+        EGS_Mesh::Node(10, 5, 1, 0), EGS_Mesh::Node(11, 5, 0, 1),
+        EGS_Mesh::Node(12, 10, 0, 0), EGS_Mesh::Node(13, 11, 0, 0),
+        EGS_Mesh::Node(14, 10, 1, 0), EGS_Mesh::Node(15, 10.5, 0.5, 0.001),
+        EGS_Mesh::Node(16, 20, 20, 20)
+    };
+    std::vector<EGS_Mesh::Tetrahedron> elements {
+        EGS_Mesh::Tetrahedron(10, 1, 1, 2, 3, 4),
+        EGS_Mesh::Tetrahedron(11, 1, 5, 2, 4, 3),
+        // a third element on face {2, 3, 4}
+        EGS_Mesh::Tetrahedron(12, 1, 6, 2, 4, 3),
+        // flat
+        EGS_Mesh::Tetrahedron(13, 1, 1, 2, 3, 7),
+        // negative Gmsh volume
+        EGS_Mesh::Tetrahedron(14, 1, 8, 10, 9, 11),
+        // valid but 1 mm high
+        EGS_Mesh::Tetrahedron(15, 1, 12, 13, 14, 15)
+    };
+    std::vector<EGS_Mesh::Medium> media { EGS_Mesh::Medium(1, "Water"), EGS_Mesh::Medium(2, "Air") };
+    return EGS_Mesh(elements, nodes, media, options);
+}
+
+int test_validation() {
+    using mesh_validation::Kind;
+    for (std::string file: {"water.msh", "water10000.msh"}) {
+        EGS_Mesh mesh = msh_parser::parse_msh_file(file);
+        auto report = mesh_validation::validate(mesh);
+        // Gmsh meshes are positively oriented
+        assert(report.ok() && report.num_warnings() == 0 && report.diagnostics.empty());
+        assert(report.summary() == "no problems found\n");
+        assert(report.min_quality > 0.01 && report.min_quality <= 1.0);
+        double volume = 0.0;
+        for (int i = 0; i < mesh.num_elements(); i++) {
+            double v = 0.0;
+            mesh_validation::element_quality(mesh.element_vertices(i), &v);
+            volume += std::abs(v);
+        }
+        assert(std::abs(report.total_volume - volume) <= 1e-9 * volume);
+        assert(mesh.non_manifold_faces().empty());
+        // the same checks ran when the mesh was built
+        assert(mesh.validation() && mesh.validation()->summary() == report.summary());
+    }
+
+    // a regular tetrahedron has quality 1, and this one is negatively oriented
+    const double regular[12] = {1, 1, 1, 1, -1, -1, -1, 1, -1, -1, -1, 1};
+    double volume = 0.0;
+    assert(std::abs(mesh_validation::element_quality(regular, &volume) - 1.0) < 1e-12);
+    assert(std::abs(volume + 8.0 / 3.0) < 1e-12);
+
+    // errors stop the mesh from being built
+    std::string build_error;
+    try {
+        invalid_mesh(EGS_Mesh::Options());
+    } catch (const std::runtime_error& err) {
+        build_error = err.what();
+    }
+    assert(build_error.find("invalid mesh: 1 degenerate element,") == 0);
+    assert(build_error.find("error: element 12 face with nodes 2 3 4 is shared") != std::string::npos);
+
+    EGS_Mesh::Options unchecked;
+    unchecked.validate = false;
+    EGS_Mesh mesh = invalid_mesh(unchecked);
+    assert(!mesh.validation());
+    assert(mesh.non_manifold_faces().size() == 1);
+    assert((mesh.non_manifold_faces()[0] == std::array<int, 2>{{2, 3}}));
+    assert(mesh.neighbours(0)[0] == 1 && mesh.neighbours(1)[3] == 0 && mesh.neighbours(2)[3] == -1);
+    for (unsigned num_threads: {0u, 1u, 2u, 3u, 7u}) {
+        mesh_validation::Options options;
+        options.num_threads = num_threads;
+        auto report = mesh_validation::validate(mesh, options);
+        for (std::size_t k = 0; k < mesh_validation::NUM_KINDS; k++) {
+            assert(report.counts[k] == 1);
+        }
+        assert(!report.ok() && report.num_errors() == 2 && report.num_warnings() == 4);
+        assert(report.min_quality == 0.0);
+        std::vector<std::string> messages;
+        for (const auto& d: report.diagnostics) {
+            messages.push_back(d.message);
+        }
+        assert((messages == std::vector<std::string>{
+            "element 13 is degenerate (quality 0)",
+            "element 14 is inverted",
+            "element 15 is a sliver (quality 0.00161)",
+            "element 12 face with nodes 2 3 4 is shared by more than two elements",
+            "medium 2 \"Air\" has no elements",
+            "node 16 is not used by any element"
+        }));
+        assert(report.diagnostics[0].index == 3 && report.diagnostics[0].severity() == mesh_validation::Severity::Error);
+        assert(report.diagnostics[3].index == 2 && report.diagnostics[3].face == 3);
+        assert(report.diagnostics[5].index == 15);
+        bool threw = false;
+        try {
+            report.throw_if_errors();
+        } catch (const std::runtime_error& err) {
+            threw = std::string(err.what()).find("1 degenerate element, 1 inverted element") != std::string::npos;
+        }
+        assert(threw);
+    }
+    // diagnostics past the limit are only counted
+    mesh_validation::Options options;
+    options.max_per_kind = 0;
+    auto counted = mesh_validation::validate(mesh, options);
+    assert(counted.diagnostics.empty() && counted.num_errors() == 2);
+
+    // reordering changes the indices, not the findings
+    EGS_Mesh::Options reordered;
+    reordered.reorder = EGS_Mesh::Reorder::Hilbert;
+    reordered.lazy_neighbours = true;
+    reordered.validate = false;
+    EGS_Mesh reordered_mesh = invalid_mesh(reordered);
+    auto report = mesh_validation::validate(reordered_mesh);
+    assert(reordered_mesh.neighbours_built());
+    for (std::size_t k = 0; k < mesh_validation::NUM_KINDS; k++) {
+        assert(report.counts[k] == 1);
+    }
+    for (const auto& d: report.diagnostics) {
+        // the copy reported is the last of the three in mesh order
+        if (d.kind == Kind::NonManifoldFace) {
+            const int tag = reordered_mesh.elements()[d.index].tag;
+            assert(tag == 10 || tag == 11 || tag == 12);
+        }
+    }
+
+    // non-manifold faces are saved in snapshots
+    const std::string path = "invalid.snapshot";
+    mesh_snapshot::save_snapshot(mesh, path, 1);
+    {
+        // and loaded snapshots are validated too
+        bool threw = false;
+        try {
+            mesh_snapshot::load_snapshot(path, 1, EGS_Mesh::Options());
+        } catch (const std::runtime_error& err) {
+            threw = std::string(err.what()).find(": invalid mesh: 1 degenerate element,") != std::string::npos;
+        }
+        assert(threw);
+        EGS_Mesh loaded = mesh_snapshot::load_snapshot(path, 1, unchecked);
+        assert(loaded.non_manifold_faces().size() == 1);
+        assert(loaded.non_manifold_faces()[0] == mesh.non_manifold_faces()[0]);
+        assert(mesh_validation::validate(loaded).summary() == mesh_validation::validate(mesh).summary());
+    }
+    std::remove(path.c_str());
+
+    // warnings are kept on the mesh
+    std::vector<EGS_Mesh::Node> nodes {
+        EGS_Mesh::Node(1, 0, 0, 0), EGS_Mesh::Node(2, 1, 0, 0),
+        EGS_Mesh::Node(3, 0, 1, 0), EGS_Mesh::Node(4, 0, 0, 1)
+    };
+    EGS_Mesh inverted({EGS_Mesh::Tetrahedron(7, 1, 1, 3, 2, 4)}, nodes, {EGS_Mesh::Medium(1, "Water")});
+    assert(inverted.validation() && inverted.validation()->ok());
+    assert(inverted.validation()->count(Kind::InvertedElement) == 1 && inverted.validation()->num_warnings() == 1);
+    assert(inverted.validation()->diagnostics[0].message == "element 7 is inverted");
+
+    // snapshots keep the report, and lazy reports are completed on a full load
+    mesh_snapshot::save_snapshot(inverted, path, 2);
+    {
+        EGS_Mesh loaded = mesh_snapshot::load_snapshot(path, 2, EGS_Mesh::Options());
+        assert(loaded.validation() && loaded.validation()->faces_checked);
+        assert(loaded.validation()->summary() == inverted.validation()->summary());
+        assert(loaded.validation()->total_volume == inverted.validation()->total_volume);
+        assert(loaded.validation()->diagnostics[0].index == 0);
+    }
+    EGS_Mesh::Options lazy;
+    lazy.lazy_neighbours = true;
+    EGS_Mesh lazy_inverted({EGS_Mesh::Tetrahedron(7, 1, 1, 3, 2, 4)}, nodes, {EGS_Mesh::Medium(1, "Water")}, lazy);
+    assert(!lazy_inverted.validation()->faces_checked);
+    mesh_snapshot::save_snapshot(lazy_inverted, path, 2);
+    {
+        EGS_Mesh loaded = mesh_snapshot::load_snapshot(path, 2, lazy);
+        assert(!loaded.validation()->faces_checked);
+        loaded = mesh_snapshot::load_snapshot(path, 2, EGS_Mesh::Options());
+        assert(loaded.validation()->faces_checked);
+        assert(loaded.validation()->summary() == inverted.validation()->summary());
+    }
+    std::remove(path.c_str());
+
+    // a later phase that flattens an element is rejected
+    auto flat = nodes;
+    flat[3] = EGS_Mesh::Node(4, 1, 1, 0);
+    bool threw = false;
+    try {
+        inverted.with_nodes(flat);
+    } catch (const std::runtime_error& err) {
+        threw = std::string(err.what()).find("error: element 7 is degenerate") != std::string::npos;
+    }
+    assert(threw);
+
+    // lazy meshes are validated without finding their neighbours
+    EGS_Mesh lazy_mesh = msh_parser::parse_msh_file(std::string("water.msh"), 1, lazy);
+    assert(!lazy_mesh.neighbours_built() && lazy_mesh.validation() && lazy_mesh.validation()->ok());
+    return 0;
+}
+
+// The text of the ascii msh file `path` with every node moved by `dx` along x.
+std::string shifted_msh(const std::string& path, double dx) {
+    std::ifstream input(path);
+    std::ostringstream output;
+    output.precision(17);
+    std::string line;
+    while (std::getline(input, line)) {
+        msh_parser::internal::rtrim(line);
+        output << line << "\n";
+        if (line != "$Nodes") {
+            continue;
+        }
+        std::size_t num_blocs = 0;
+        std::getline(input, line);
+        std::istringstream(line) >> num_blocs;
+        output << line << "\n";
+        for (std::size_t b = 0; b < num_blocs; b++) {
+            int dim, entity, parametric;
+            std::size_t count = 0;
+            std::getline(input, line);
+            std::istringstream(line) >> dim >> entity >> parametric >> count;
+            output << line << "\n";
+            for (std::size_t i = 0; i < count; i++) {
+                std::getline(input, line);
+                output << line << "\n";
+            }
+            for (std::size_t i = 0; i < count; i++) {
+                double x, y, z;
+                std::getline(input, line);
+                std::istringstream(line) >> x >> y >> z;
+                output << x + dx << " " << y << " " << z << "\n";
+            }
+        }
+    }
+    return output.str();
+}
+
+int test_multi_mesh() {
+    const std::string path = "phases.msh";
+    const std::string single_path = "phase.msh";
+    const int num_phases = 4;
+    {
+        std::ofstream output(path);
+        for (int p = 0; p < num_phases; p++) {
+            output << shifted_msh("water.msh", 0.01 * p);
+        }
+        // a different mesh ends the phases
+        output << shifted_msh("water10000.msh", 0.0);
+    }
+    for (unsigned num_threads: {1u, 2u}) {
+        for (auto reorder: {EGS_Mesh::Reorder::None, EGS_Mesh::Reorder::Hilbert}) {
+            EGS_Mesh::Options options;
+            options.reorder = reorder;
+            auto meshes = msh_parser::parse_msh_meshes(path, num_threads, options);
+            assert(meshes.size() == num_phases + 1);
+            const EGS_Mesh& first = meshes[0];
+            for (int p = 0; p < num_phases; p++) {
+                const EGS_Mesh& mesh = meshes[p];
+                // the connectivity is shared, not copied
+                assert(mesh.elements().data() == first.elements().data());
+                assert(mesh.neighbour_table().data() == first.neighbour_table().data());
+                std::ofstream(single_path) << shifted_msh("water.msh", 0.01 * p);
+                EGS_Mesh single = msh_parser::parse_msh_file(single_path, 1, options);
+                assert(mesh.num_elements() == single.num_elements());
+                assert(mesh.num_boundary_faces() == single.num_boundary_faces());
+                assert(mesh.location_tolerance() == single.location_tolerance());
+                for (int i = 0; i < mesh.num_elements(); i++) {
+                    assert(std::equal(mesh.element_vertices(i), mesh.element_vertices(i) + 12,
+                        single.element_vertices(i)));
+                    assert(std::equal(mesh.element_planes(i), mesh.element_planes(i) + 16,
+                        single.element_planes(i)));
+                    assert(mesh.neighbours(i) == single.neighbours(i));
+                    // the refitted hierarchies find the same elements
+                    const double* v = mesh.element_vertices(i);
+                    EGS_Mesh::Vec3 centroid((v[0] + v[3] + v[6] + v[9]) / 4, (v[1] + v[4] + v[7] + v[10]) / 4,
+                        (v[2] + v[5] + v[8] + v[11]) / 4);
+                    assert(mesh.isWhere(centroid) == i);
+                    const EGS_Mesh::Vec3 outside(centroid.x, centroid.y, -1.0);
+                    const EGS_Mesh::Vec3 up(0, 0, 1);
+                    assert(mesh.entry_distance(outside, up).tet == single.entry_distance(outside, up).tet);
+                    assert(mesh.entry_distance(outside, up).distance == single.entry_distance(outside, up).distance);
+                }
+            }
+            // water10000.msh has other elements, so it is parsed in full
+            const EGS_Mesh& other = meshes[num_phases];
+            assert(other.elements().data() != first.elements().data());
+            assert(other.num_elements() == msh_parser::parse_msh_file(std::string("water10000.msh")).num_elements());
+        }
+    }
+    std::remove(single_path.c_str());
+
+    // with_nodes checks the node tags
+    EGS_Mesh mesh = msh_parser::parse_msh_file(std::string("water.msh"));
+    std::vector<EGS_Mesh::Node> nodes(mesh.nodes().begin(), mesh.nodes().end());
+    std::reverse(nodes.begin(), nodes.end());
+    EGS_Mesh same = mesh.with_nodes(nodes);
+    assert(std::equal(mesh.element_vertices(0), mesh.element_vertices(0) + 12, same.element_vertices(0)));
+    auto with_nodes_error = [&](const std::vector<EGS_Mesh::Node>& nodes) {
+        return parse_error([&]() { mesh.with_nodes(nodes); });
+    };
+    nodes.pop_back();
+    assert(with_nodes_error(nodes) == "expected " + std::to_string(mesh.nodes().size()) + " nodes, got " +
+        std::to_string(nodes.size()));
+    nodes.push_back(EGS_Mesh::Node(-5, 0, 0, 0));
+    assert(with_nodes_error(nodes) == "node tag -5 is not a node of the mesh");
+    nodes.back() = nodes.front();
+    assert(with_nodes_error(nodes) == "node tag " + std::to_string(nodes.front().tag) + " is repeated");
+
+    // the std::istream parser stops at the next mesh
+    {
+        std::ifstream input(path);
+        for (int p = 0; p < num_phases; p++) {
+            EGS_Mesh phase = msh_parser::parse_msh_file(input);
+            assert(phase.num_elements() == mesh.num_elements());
+        }
+        assert(msh_parser::parse_msh_file(input).num_elements() != mesh.num_elements());
+    }
+    std::remove(path.c_str());
+    return 0;
+}
+
 int main() {
     int num_failed = 0;
     int num_total = 0;
@@ -133,6 +2069,35 @@ int main() {
 
     RUN_TEST(test_water_block());
     RUN_TEST(test_water10000_block());
+    RUN_TEST(test_mmap_parser());
+    RUN_TEST(test_binary_parser());
+    RUN_TEST(test_parallel_parser());
+    RUN_TEST(test_hashed_neighbours());
+    RUN_TEST(test_parallel_neighbours());
+    RUN_TEST(test_shared_nodes());
+    RUN_TEST(test_compact_neighbours());
+    RUN_TEST(test_mesh_geometry());
+    RUN_TEST(test_howfar());
+    RUN_TEST(test_kernels());
+    RUN_TEST(test_is_where());
+    RUN_TEST(test_entry_distance());
+    RUN_TEST(test_locate_from());
+    RUN_TEST(test_curve_order());
+    RUN_TEST(test_reorder());
+    RUN_TEST(test_content_hash());
+    RUN_TEST(test_snapshot());
+    RUN_TEST(test_parse_stream());
+    RUN_TEST(test_parse_memory());
+    RUN_TEST(test_parse_allocations());
+    RUN_TEST(test_tag_checks());
+    RUN_TEST(test_tag_index());
+    RUN_TEST(test_lazy_neighbours());
+    RUN_TEST(test_element_scorer());
+    RUN_TEST(test_paged_scorer());
+    RUN_TEST(test_format_double());
+    RUN_TEST(test_element_data_writer());
+    RUN_TEST(test_validation());
+    RUN_TEST(test_multi_mesh());
 
     std::cerr << num_total - num_failed << " out of " << num_total << " tests passed\n";
     return num_failed;